@@ -10,355 +10,429 @@
 
 namespace Cn
 {
-/* implementation of left part of paint/unpaint/uncolor function */
-void
-IpMap::Pt_left(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair)
+/* merge function of paint function */
+IpMap::Handle
+IpMap::Pt_merge(const Handle& mine, const Handle& theirs)
 {
-	if( pos == m_map.begin() ) { /* Do nothing in this case. */ }
-	else if( range.HasOverlap((--pos)->first) )
-		LeftSkew(tmpPair, pos, range);
-	else
-		++pos;
+	return theirs;
 }
 
 
-/* implementation of middle part of paint/uncolor function */
-void
-IpMap::Pt_middle(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+/* merge function of unpaint function */
+IpMap::Handle
+IpMap::Upt_merge(const Handle& mine, const Handle& theirs)
 {
-	while( pos != m_map.end() && (pos->first).IsSubset(range) )
-		pos = m_map.erase(pos);
+	if( mine != Handle() && *mine == *theirs )
+		return Handle();
+	else
+		return mine;
+}
 
-	if( range.HasOverlap(pos->first) )
-	{
-		tmpPair = *pos;
-		isLeftSpan = false;
-	}
+
+/* merge function of uncolor function */
+IpMap::Handle
+IpMap::Uc_merge(const Handle& mine, const Handle& theirs)
+{
+	return Handle();
 }
 
 
-/* implementation of right part of paint function */
-void 
-IpMap::Pt_right(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+/* merge function of blend function */
+IpMap::Handle
+IpMap::Bd_merge(const Handle& mine, const Handle& theirs)
 {
-	if( tmpPair != Pair() )
-	{
-		if(!isLeftSpan)   /* in this case, right end of span overlaps with a span in m_spans */
-			pos = m_map.erase(pos);
-			
-		pos = m_map.insert(pos, std::make_pair(range, color));	/* paint the range with color */
-			
-		/* insert the right half span into m_spans */
-		InsertToMap( range.GetUpperBound() + 1, (tmpPair.first).GetUpperBound(), tmpPair.second, m_map, ++pos);
-	}
-	else	/* in this case, span is not overlap with any span in m_spans at both sides */
-		m_map.insert(pos, std::make_pair(range, color));
+	if( mine == Handle() )
+		return theirs;
+	else
+		return mine + theirs;
 }
 
 
-/* implementation of left part of unpaint function */
-void
-IpMap::Upt_left(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair)
+/* merge function of unblend function */
+IpMap::Handle
+IpMap::Ubd_merge(const Handle& mine, const Handle& theirs)
 {
-	if( pos == m_map.begin() ) { /* Do nothing in this case. */ }
-	else if( range.HasOverlap((--pos)->first) && *(pos->second) == *color )
-		LeftSkew(tmpPair, pos, range);
+	if( mine == Handle() )
+		return mine;
 	else
-		++pos;
+		return mine - theirs;
 }
 
 
-/* implementation of middle part of unpaint function */
-void 
-IpMap::Upt_middle(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+void
+IpMap::Apply(const IpRange& range, const Handle& color, merge_func f)
 {
-	while( pos != m_map.end() && (pos->first).IsSubset(range))
+	/* Split at the upper end first, splitting at the lower end cannot move that span. */
+	iterator endPos = m_map.end();
+	if( range.GetUpperBound() != IpAddr::Max() )
+		endPos = Split(range.GetUpperBound() + 1);
+	iterator pos = Split(range.GetLowerBound());
+
+	/* The color of the addresses in range that have no color */
+	Handle gapColor = (*f)(Handle(), color);
+
+	/* Addresses from nextAddr to the upper end of range are not yet done, if isOpen is set. */
+	IpAddr nextAddr = range.GetLowerBound();
+	bool isOpen = true;
+
+	while( pos != endPos )
 	{
-		if( *(pos->second) == *color )
+		if( gapColor != Handle() && nextAddr < (pos->first).GetLowerBound() )
+			m_map.insert(pos, std::make_pair(IpRange(nextAddr, (pos->first).GetLowerBound() - 1), gapColor));
+
+		isOpen = (pos->first).GetUpperBound() < range.GetUpperBound();
+		nextAddr = (pos->first).GetUpperBound() + 1;
+
+		Handle tmpColor = (*f)(pos->second, color);
+		if( tmpColor == Handle() )
 			pos = m_map.erase(pos);
 		else
+		{
+			pos->second = tmpColor;
 			++pos;
+		}
 	}
 
-	if( range.HasOverlap(pos->first) )
-	{
-		tmpPair = *pos;
-		isLeftSpan = false;
-	}
+	if( gapColor != Handle() && isOpen )
+		m_map.insert(endPos, std::make_pair(IpRange(nextAddr, range.GetUpperBound()), gapColor));
+
+	Coalesce(range);
 }
 
 
-/* implementation of right part of unpaint/uncolor function */
-void 
-IpMap::Upt_right(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+template < typename I >
+void
+IpMap::Apply(I first, I last, Container::size_type count, const Handle* color, merge_func f)
 {
-	if( tmpPair != Pair() )
+	/* A few spans are cheaper to apply one at a time than to rebuild the map.
+	 * If the source is this map, count is the size of the map and it is swept. */
+	if( count * SWEEP_RATIO < m_map.size() )
 	{
-		if(!isLeftSpan)   /* in this case, right end of span overlaps with a span in m_spans */
-			pos = m_map.erase(pos);
-			
-		/* insert the right half span into m_spans */
-		InsertToMap( range.GetUpperBound() + 1, tmpPair.first.GetUpperBound(), tmpPair.second, m_map, ++pos);
+		for( ; first != last; ++first )
+			Apply(first->first, color ? *color : first->second, f);
 	}
+	else
+		Sweep(first, last, color, f);
 }
 
 
-/* implementation of left part of blend function */
-void 
-IpMap::Bd_left(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair)
+template < typename I >
+void
+IpMap::Sweep(I first, I last, const Handle* color, merge_func f)
 {
-	if( pos == m_map.begin() ) { }
-	else if( range.HasOverlap( (--pos)->first) )
-	{   
-		LeftSkew(tmpPair, pos, range);
-		
-		InsertToMap(range.GetLowerBound(), std::min(range.GetUpperBound(), (tmpPair.first).GetUpperBound()), (tmpPair.second) + color, m_map, pos);
-		++pos;
-	}
-	else
-		++pos;
-}
+	Container spanMap;
+	Pair lastPair;
+	bool hasLast = false;
 
+	iterator pos = m_map.begin();
 
-/* implementation of middle part of blend function */
-void 
-IpMap::Bd_middle(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
-{
-	Pair lastPair = tmpPair;
+	/* The lower bounds of the parts of *pos and *first that are not yet done */
+	IpAddr lowMine, lowTheirs;
+	if( pos != m_map.end() )
+		lowMine = (pos->first).GetLowerBound();
+	if( first != last )
+		lowTheirs = (first->first).GetLowerBound();
 
-	/* deal with the spans which totally reside in the range */
-	while( pos != m_map.end() && (pos->first).IsSubset(range) )
+	while( pos != m_map.end() || first != last )
 	{
-		bool insert = false;
-		if(lastPair == Pair())
-			insert = InsertToMap( range.GetLowerBound(), (pos->first).GetLowerBound() - 1, color, m_map, pos);
-		else
-			insert = InsertToMap( (lastPair.first).GetUpperBound() + 1, (pos->first).GetLowerBound() - 1, color, m_map, pos);
-			
-		if(insert)
-				++pos;
+		bool hasMine = pos != m_map.end() && (first == last || lowMine <= lowTheirs);
+		bool hasTheirs = first != last && (pos == m_map.end() || lowTheirs <= lowMine);
+		IpAddr lowAddr, highAddr;
 
-		lastPair = *pos;
-		pos = m_map.erase(pos);
+		if( hasMine && hasTheirs )
+		{
+			/* both cover the addresses up to the first upper bound */
+			lowAddr = lowMine;
+			highAddr = std::min((pos->first).GetUpperBound(), (first->first).GetUpperBound());
+			AppendSpan(spanMap, lastPair, hasLast, lowAddr, highAddr, (*f)(pos->second, color ? *color : first->second));
+		}
+		else if( hasMine )
+		{
+			/* only the map covers the addresses up to the next span of the sequence */
+			lowAddr = lowMine;
+			highAddr = (pos->first).GetUpperBound();
+			if( first != last && lowTheirs <= highAddr )
+				highAddr = lowTheirs - 1;
+			AppendSpan(spanMap, lastPair, hasLast, lowAddr, highAddr, pos->second);
+		}
+		else
+		{
+			/* only the sequence covers the addresses up to the next span of the map */
+			lowAddr = lowTheirs;
+			highAddr = (first->first).GetUpperBound();
+			if( pos != m_map.end() && lowMine <= highAddr )
+				highAddr = lowMine - 1;
+			AppendSpan(spanMap, lastPair, hasLast, lowAddr, highAddr, (*f)(Handle(), color ? *color : first->second));
+		}
 
-		InsertToMap( (lastPair.first).GetLowerBound(), (lastPair.first).GetUpperBound(), (lastPair.second) + color, m_map, pos);
-		++pos;
-	}
+		if( hasMine )
+		{
+			if( highAddr == (pos->first).GetUpperBound() )
+			{
+				if( ++pos != m_map.end() )
+					lowMine = (pos->first).GetLowerBound();
+			}
+			else
+				lowMine = highAddr + 1;
+		}
 
-	if( range.HasOverlap(pos->first) )
-	{
-		tmpPair = *pos;
-		isLeftSpan = false;
-		
-		if( pos!= m_map.begin() )
+		if( hasTheirs )
 		{
-			InsertToMap( (lastPair.first).GetUpperBound() + 1, (pos->first).GetLowerBound() - 1, color, m_map, pos);
+			if( highAddr == (first->first).GetUpperBound() )
+			{
+				if( ++first != last )
+				{
+					assert( highAddr < (first->first).GetLowerBound() );
+					lowTheirs = (first->first).GetLowerBound();
+				}
+			}
+			else
+				lowTheirs = highAddr + 1;
 		}
 	}
-	else
-		InsertToMap( (lastPair.first).GetUpperBound() + 1, range.GetUpperBound(), color, m_map, pos);
-}
 
+	if( hasLast )
+		spanMap.insert(spanMap.end(), lastPair);
+
+	m_map.swap(spanMap);
+}
 
 
-/* implementation of right part of blend function */
-void 
-IpMap::Bd_right(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+void
+IpMap::AppendSpan(Container& spanMap, Pair& lastPair, bool& hasLast, IpAddr lowAddr, IpAddr highAddr, const Handle& color)
 {
-	/* deal with the right overlap */
-	if( tmpPair != Pair() )
-	{
-		if(!isLeftSpan)   /* in this case, right end of span overlaps with a span in m_spans */
-		{
-			pos = m_map.erase(pos);
+	if( color == Handle() )
+		return;
 
-			InsertToMap( (tmpPair.first).GetLowerBound(), range.GetUpperBound(), (tmpPair.second) + color, m_map, ++pos);
-		}
+	if( hasLast && (lastPair.first).GetUpperBound() + 1 == lowAddr && *(lastPair.second) == *color )
+		(lastPair.first).SetUpper(highAddr);
+	else
+	{
+		if( hasLast )
+			spanMap.insert(spanMap.end(), lastPair);
 
-		/* insert the right half span into m_spans */
-		if( range.GetUpperBound() < (tmpPair.first).GetUpperBound() )
-			InsertToMap( range.GetUpperBound() + 1, ((tmpPair.first)).GetUpperBound(), tmpPair.second, m_map, ++pos);
+		lastPair = std::make_pair(IpRange(lowAddr, highAddr), color);
+		hasLast = true;
 	}
-	else	/* in this case, span is not partially overlap with any span in m_spans */
-		m_map.insert(pos, std::make_pair(range, color));
 }
-	
-	
-/* implementation of the left part of unblend function */
-void 
-IpMap::Ubd_left(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair)
+
+
+void
+IpMap::Paint(const IpMap& src)
 {
-	if( pos == m_map.begin() ) { }
-	else if( range.HasOverlap( (--pos)->first) )
-	{   
-		bool insert = false;
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), 0, Pt_merge);
+}
 
-		LeftSkew(tmpPair, pos, range);
 
-		insert = InsertToMap(range.GetLowerBound(), std::min(range.GetUpperBound(), (tmpPair.first).GetUpperBound()), tmpPair.second - color, m_map, pos);
-			
-		if(insert)
-			++pos;
-	}
-	else
-		++pos;
+void
+IpMap::Paint(const IpMap& src, const Handle& color)
+{
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), &color, Pt_merge);
 }
 
 
-/* implementation of middle part of blend function */
-void 
-IpMap::Ubd_middle(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+void
+IpMap::Paint(const SpanVector& spans)
 {
-	//Pair lastPair = * pos;
+	Apply(spans.begin(), spans.end(), spans.size(), 0, Pt_merge);
+}
 
-	/* deal with the spans which totally reside in the range */
-	while( pos != m_map.end() && (pos->first).IsSubset(range) )
-	{
-		Pair lastPair = * pos;
-		pos = m_map.erase(pos);
 
-		InsertToMap( (lastPair.first).GetLowerBound(), (lastPair.first).GetUpperBound(), lastPair.second - color, m_map, pos);
-		++ pos;
-		//lastPair = * pos++;
-	}
 
-	if( range.HasOverlap(pos->first) )
-	{
-		tmpPair = *pos;
-		isLeftSpan = false;
-	}
+void
+IpMap::Unpaint(const IpMap& src)
+{
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), 0, Upt_merge);
 }
 
 
-/* implementation of right part of blend function */
-void 
-IpMap::Ubd_right(const IpRange& range, const Handle& color, iterator& pos, Pair& tmpPair, bool& isLeftSpan)
+
+void
+IpMap::Unpaint(const IpMap& src, const Handle& color)
 {
-	/* deal with the right overlap */
-	if( tmpPair != Pair() )
-	{
-		if(!isLeftSpan)   /* in this case, right end of span overlaps with a span in m_spans */
-		{
-			pos = m_map.erase(pos);
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), &color, Upt_merge);
+}
 
-			InsertToMap( (tmpPair.first).GetLowerBound(), range.GetUpperBound(), (tmpPair.second) - color, m_map, ++pos);
-		}
 
-		/* insert the right half span into m_spans */
-		if( range.GetUpperBound() < (tmpPair.first).GetUpperBound() )
-			InsertToMap( range.GetUpperBound() + 1, (tmpPair.first).GetUpperBound(), tmpPair.second, m_map, ++pos);
-	}
+void
+IpMap::Unpaint(const SpanVector& spans)
+{
+	Apply(spans.begin(), spans.end(), spans.size(), 0, Upt_merge);
 }
 
 
-void 
-IpMap::Paint(IpMap src)
+void
+IpMap::UnColor(const IpMap& src)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); iter++)
-		Paint( iter->first, iter->second );
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), 0, Uc_merge);
 }
 
 
-void 
-IpMap::Paint(IpMap src, const Handle& color)
+void
+IpMap::UnColor(const SpanVector& spans)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); iter++)
-		Paint( iter->first, color );
+	Apply(spans.begin(), spans.end(), spans.size(), 0, Uc_merge);
 }
 
 
 
-void 
-IpMap::Unpaint(IpMap src)
+void
+IpMap::Blend(const IpMap& src)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); iter++)
-		Unpaint( iter->first, iter->second );
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), 0, Bd_merge);
 }
 
 
-
-void 
-IpMap::Unpaint(IpMap src, const Handle& color)
+void
+IpMap::Blend(const IpMap& src, const Handle& color)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); iter++)
-		Unpaint( iter->first, color );
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), &color, Bd_merge);
 }
 
 
 void
-IpMap::UnColor(IpMap src)
+IpMap::Blend(const SpanVector& spans)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); ++iter)
-		UnColor( iter->first );
+	Apply(spans.begin(), spans.end(), spans.size(), 0, Bd_merge);
 }
 
 
 
-void 
-IpMap::Blend(IpMap src)
+void
+IpMap::Unblend(const IpMap& src)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); ++iter)
-		Blend( iter->first, iter->second );
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), 0, Ubd_merge);
 }
 
 
-void 
-IpMap::Blend(IpMap src, const Handle& color)
+void
+IpMap::Unblend(const IpMap& src, const Handle& color)
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); ++iter)
-		Blend( iter->first, color );
+	Apply(src.m_map.begin(), src.m_map.end(), src.m_map.size(), &color, Ubd_merge);
 }
 
 
+void
+IpMap::Unblend(const SpanVector& spans)
+{
+	Apply(spans.begin(), spans.end(), spans.size(), 0, Ubd_merge);
+}
+
 
-void 
-IpMap::Unblend(IpMap src)
+
+IpMap::Handle
+IpMap::Lookup(IpAddr addr) const
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); ++iter)
-		Unblend( iter->first, iter->second );
+	const_iterator pos = Seek(addr, m_map.end());
+
+	if( pos != m_map.end() && (pos->first).IsCompatible(addr) )
+		return pos->second;
+	else
+		return Handle();
 }
 
 
-void 
-IpMap::Unblend(IpMap src, const Handle& color)
+void
+IpMap::Lookup(const std::vector<IpAddr>& addrs, std::vector<Handle>& colors) const
 {
-	for(iterator iter=src.m_map.begin(); iter != src.m_map.end(); ++iter)
-		Unblend( iter->first, color );
+	const_iterator pos = m_map.end();
+
+	colors.clear();
+	colors.reserve(addrs.size());
+
+	for(std::vector<IpAddr>::const_iterator iter = addrs.begin(); iter != addrs.end(); ++iter)
+	{
+		pos = Seek(*iter, pos);
+
+		if( pos != m_map.end() && (pos->first).IsCompatible(*iter) )
+			colors.push_back(pos->second);
+		else
+			colors.push_back(Handle());
+	}
 }
 
 
+IpMap::const_iterator
+IpMap::Seek(IpAddr addr, const_iterator hint) const
+{
+	/* addresses in order are usually in the same or one of the next few spans */
+	if( hint != m_map.end() && (hint->first).GetLowerBound() <= addr )
+	{
+		for( int i = 0; i < SEEK_STEPS; ++i )
+		{
+			const_iterator next = hint;
+			if( ++next == m_map.end() || addr < (next->first).GetLowerBound() )
+				return hint;
+			hint = next;
+		}
+	}
 
-void
-IpMap::Coalesce()
+	const_iterator pos = m_map.upper_bound(IpRange(addr, IpAddr::Max()));
+
+	if( pos == m_map.begin() )
+		return m_map.end();
+	else
+		return --pos;
+}
+
+
+
+IpMap::iterator
+IpMap::Split(IpAddr addr)
 {
-	iterator pos, next_pos, tmp_pos, begin_pos;
-	next_pos = begin();
-	pos = next_pos++;
-	IpAddr low, high;
+	iterator pos = m_map.upper_bound(IpRange(addr, IpAddr::Max()));
 
-	while( pos != end() )
+	if( pos != m_map.begin() )
 	{
-		begin_pos = pos;
-		low = pos->first.GetLowerBound();
-		while ( pos->first.GetUpperBound() == (next_pos->first).GetLowerBound() - 1  
-	  	     && *(pos->second) == *(next_pos->second) )
-		{ 	
-			high = (next_pos->first).GetUpperBound();
-			pos = next_pos ++;
+		iterator prev = pos;
+		--prev;
+
+		if( (prev->first).GetLowerBound() == addr )
+			pos = prev;
+		else if( (prev->first).IsCompatible(addr) )
+		{
+			Pair tmpPair = *prev;
+			m_map.erase(prev);
+
+			InsertToMap(addr, (tmpPair.first).GetUpperBound(), tmpPair.second, m_map, pos);
+
+			iterator lowPos = pos;
+			InsertToMap((tmpPair.first).GetLowerBound(), addr - 1, tmpPair.second, m_map, lowPos);
 		}
+	}
+
+	return pos;
+}
+
+
+
+void
+IpMap::Coalesce(const IpRange& range)
+{
+	/* start with the last span before the range, which may be adjacent to it */
+	iterator pos = m_map.lower_bound(IpRange(range.GetLowerBound()));
+	if( pos != m_map.begin() )
+		--pos;
+
+	if( pos == m_map.end() )
+		return;
 
-		if(begin_pos != pos)
+	/* stop after the first span after the range */
+	iterator next_pos = pos;
+	while( ++next_pos != m_map.end() && (next_pos->first).GetLowerBound() - 1 <= range.GetUpperBound() )
+	{
+		if( (pos->first).GetUpperBound() + 1 == (next_pos->first).GetLowerBound()
+		 && *(pos->second) == *(next_pos->second) )
 		{
+			IpRange tmpRange((pos->first).GetLowerBound(), (next_pos->first).GetUpperBound());
 			Handle tmpColor = pos->second;
-			++pos;
-			tmp_pos = m_map.erase(begin_pos, next_pos);
 
-			IpRange tmpRange(low, high);
-				
-			m_map.insert(tmp_pos, std::make_pair(tmpRange, tmpColor) );
+			m_map.erase(pos);
+			next_pos = m_map.erase(next_pos);
+			next_pos = m_map.insert(next_pos, std::make_pair(tmpRange, tmpColor));
 		}
 
-		pos = next_pos++;
+		pos = next_pos;
 	}
 }
 
@@ -371,7 +445,7 @@ IpMap::InsertToMap(IpAddr lowAddr, IpAddr highAddr, const Handle& color, Contain
 	{
 		IpRange tmpRange(lowAddr, highAddr);
 		Handle tmpColor(color);
-		
+
 		pos = spanMap.insert( pos, std::make_pair(tmpRange, tmpColor) );
 		return true;
 	}
@@ -380,24 +454,6 @@ IpMap::InsertToMap(IpAddr lowAddr, IpAddr highAddr, const Handle& color, Contain
 }
 
 
-void 
-IpMap::LeftSkew(Pair& tmpPair, iterator& pos, const IpRange& range)
-{   
-	tmpPair = *pos;
-	pos = m_map.erase(pos);
-
-	/* This boolean varible test if the insertion succeed or not.
-	 * If the lower bound of the range larger than the upper bound, 
-	 * InsertToMap method return false.
-	 */
-	bool insert = false;  
-	insert = InsertToMap((tmpPair.first).GetLowerBound(), range.GetLowerBound() - 1, tmpPair.second, m_map, pos);
-	
-	if(insert)
-		++pos;
-}
-
-
 /* --------------------------------------------------------------------------- */
 }  // end of namespace Cn.
 /* --------------------------------------------------------------------------- */
@@ -7,6 +7,7 @@
 /* ------------------------------------------------------------------------ */
 # include <cn-ip-base.h>
 # include <stl/map>
+# include <stl/vector>
 # include <assert.h>
 # include <core/cn-sharedhandle.hpp>
 /* ------------------------------------------------------------------------- */
@@ -84,7 +85,11 @@ inline Color::Handle operator- (const Color::Handle& handle1, const Color::Handl
 }
 
 
-/* Colorhe key of IpMap is IpRange, and the element of the IpMap is template class Color. */
+/* Colorhe key of IpMap is IpRange, and the element of the IpMap is template class Color. 
+ * The ranges are disjoint and a range is never adjacent to a range with an equal color. 
+ * Operations on a single range touch only the spans in and next to that range, 
+ * operations on a sequence of spans are done in a single pass over both. 
+ */
 class EXPORT IpMap
 {
 protected:
@@ -96,43 +101,38 @@ protected:
 
 private:
 	typedef Container::iterator iterator;
+	typedef Container::const_iterator const_iterator;
 
+	/* Compute the color of an address from its current color and the color applied to it. 
+	 * A null handle means the address has no color. */
+	typedef Handle (*merge_func)(const Handle& mine, const Handle& theirs);
 
-public:
-	IpMap() { }
+	enum
+	{
+		SWEEP_RATIO = 4,	/* Use a sweep if a sequence has more than 1/SWEEP_RATIO of the spans of the map. */
+		SEEK_STEPS = 4		/* Spans to step over from the previous result in a batch lookup. */
+	};
 
-	typedef void (IpMap::*left_func)(const IpRange& range, const Handle& color, iterator& iter, std::pair<IpRange, Handle>& tmpPair);
-	typedef void (IpMap::*midd_func)(const IpRange& range, const Handle& color, iterator& iter, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
-	typedef void (IpMap::*right_func)(const IpRange& range, const Handle& color, iterator& iter, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
 
+public:
+	/* A sequence of spans, sorted by range with no two ranges overlapping. */
+	typedef std::vector<std::pair<IpRange, Handle> > SpanVector;
+
+	IpMap() { }
 	
 	/* Paint a certain range with color, no matter what the original color is. */
 	void Paint(const IpRange& range, const Handle& color)
-	{ 
-		//MapOperator mapopt(Pt_left, Pt_middle, Pt_right);
-		//Do(range, color, mapopt);
-
-		iterator pos = m_map.lower_bound(range);
-		bool isLeftSpan = true;
-		Pair mapUnit;
-
-		left_func l = Pt_left;
-		midd_func m = Pt_middle;
-		right_func r= Pt_right;
-
-		(this->* l)(range, color, pos, mapUnit); 
-		(this->* m)(range, color, pos, mapUnit, isLeftSpan); 
-		(this->* r)(range, color, pos, mapUnit, isLeftSpan); 
-
-		Coalesce();
-	}
+	{ Apply(range, color, Pt_merge); }
 
 	
 	/* Paint ranges of spans in the Container of src with corresponding colors */
-	void Paint(IpMap src);	
+	void Paint(const IpMap& src);	
 	
 	/* Paint ranges of spans in the Container of src with the given color */
-	void Paint(IpMap src, const Handle& color);
+	void Paint(const IpMap& src, const Handle& color);
+
+	/* Paint the ranges of spans with corresponding colors */
+	void Paint(const SpanVector& spans);
 
 
 	/* In the specified range, if there exists an IpRange 
@@ -141,182 +141,124 @@ public:
 	 * of the IpRange within the specified range will be deleted.
 	 */
 	void Unpaint(const IpRange& range, const Handle& color)
-	{
-		//MapOperator mapopt(Pt_left, Upt_middle, Upt_right);
-		//Do(range, color, mapopt);
-		iterator pos = m_map.lower_bound(range);
-		bool isLeftSpan = true;
-		Pair mapUnit;
-
-		left_func l = Upt_left;
-		midd_func m = Upt_middle;
-		right_func r= Upt_right;
-
-		(this->* l)(range, color, pos, mapUnit); 
-		(this->* m)(range, color, pos, mapUnit, isLeftSpan); 
-		(this->* r)(range, color, pos, mapUnit, isLeftSpan); 
-	}
+	{ Apply(range, color, Upt_merge); }
 	
 
 
 	/* Colorry all ranges of spans in the Container of src and corresponding colors as specified range and color, 
 	 * then repeat the procedure of Unpaint(IpRange range, Color color) */
-	void Unpaint(IpMap src);
+	void Unpaint(const IpMap& src);
 	
 
 	/* Colorry all ranges of span in the Container of src and the specified color as specified range and color, 
 	 * then repeat the procedure of Unpaint(IpRange range, Color color)*/
-	void Unpaint(IpMap src, const Handle& color);
+	void Unpaint(const IpMap& src, const Handle& color);
+
+	/* Unpaint the ranges of spans with corresponding colors */
+	void Unpaint(const SpanVector& spans);
 
 
 	/* Make the color zero for parts of ranges which are inside the specified range*/
 	void UnColor(const IpRange& range)
-	{ 
-		//MapOperator mapopt(Pt_left, Pt_middle, Upt_right);
-		Handle color;
-		//Do(range, color, mapopt);
-		iterator pos = m_map.lower_bound(range);
-		bool isLeftSpan = true;
-		Pair mapUnit;
-
-		left_func l = Pt_left;
-		midd_func m = Pt_middle;
-		right_func r= Upt_right;
-
-		(this->* l)(range, color, pos, mapUnit); 
-		(this->* m)(range, color, pos, mapUnit, isLeftSpan); 
-		(this->* r)(range, color, pos, mapUnit, isLeftSpan); 
-	}
+	{ Apply(range, Handle(), Uc_merge); }
 	
 	
 	/* Use each range of a span in the Container of src as specified range, 
 	 * and repeat the procedure of UnColor(IpRange range) */
-	void UnColor(IpMap src);
+	void UnColor(const IpMap& src);
+	
+	/* UnColor the ranges of spans, the colors of the spans are ignored */
+	void UnColor(const SpanVector& spans);
 	
 	
 	/* add the color to the original colors in the given range.*/
 	void Blend(const IpRange& range, const Handle& color)
-	{ 
-		//MapOperator mapopt(Bd_left, Bd_middle, Bd_right);
-		//Do(range, color, mapopt);
-
-		iterator pos = m_map.lower_bound(range);
-		bool isLeftSpan = true;
-		Pair mapUnit;
-
-		left_func l = Bd_left;
-		midd_func m = Bd_middle;
-		right_func r= Bd_right;
-
-		(this->* l)(range, color, pos, mapUnit); 
-		(this->* m)(range, color, pos, mapUnit, isLeftSpan); 
-		(this->* r)(range, color, pos, mapUnit, isLeftSpan); 
-
-		Coalesce();
-	}
+	{ Apply(range, color, Bd_merge); }
 	
 	
 	/* use each span which contains a pair of range and color in the Container of src 
 	 * as the argument for Blend(IpRange range, Color color) */
-	void Blend(IpMap src);
+	void Blend(const IpMap& src);
 	
 	
 	/* use a range of each span in the Container of src and the specified color, 
 	 * repeat the prodedure of Blend(IpRange range, Color color) */
-	void Blend(IpMap src, const Handle& color);
+	void Blend(const IpMap& src, const Handle& color);
+
+	/* Blend the ranges of spans with corresponding colors */
+	void Blend(const SpanVector& spans);
 
 
 	/* subtract the given color from the original colors in the given range.*/
 	void Unblend(const IpRange& range, const Handle& color)
-	{ 
-		//MapOperator mapopt(Ubd_left, Ubd_middle, Ubd_right);
-		//Do(range, color, mapopt);
-
-		iterator pos = m_map.lower_bound(range);
-		bool isLeftSpan = true;
-		Pair mapUnit;
-
-		left_func l = Ubd_left;
-		midd_func m = Ubd_middle;
-		right_func r= Ubd_right;
-
-		(this->* l)(range, color, pos, mapUnit); 
-		(this->* m)(range, color, pos, mapUnit, isLeftSpan); 
-		(this->* r)(range, color, pos, mapUnit, isLeftSpan); 
-
-		Coalesce();
-	}
+	{ Apply(range, color, Ubd_merge); }
 	
 	/* use each span which contains a pair of range and color in the Container of src 
 	 * as the argument for Unblend(IpRange range, Color color) */
-	void Unblend(IpMap src);
+	void Unblend(const IpMap& src);
 	
 	/* use a range of each span in the Container of src and the specified color, 
 	 * repeat the prodedure of Unblend(IpRange range, Color color) */
-	void Unblend(IpMap src, const Handle& color);
-
-	iterator begin() { return m_map.begin(); }
-	iterator end()	 { return m_map.end(); }
-
-
-private:
-	/* If two ranges are adjacent and have the same color, combine them as a single range with the color */
-	void Coalesce();
-
+	void Unblend(const IpMap& src, const Handle& color);
 
-	bool InsertToMap(IpAddr lowAddr, IpAddr highAddr, const Handle& color, Container& spanMap, iterator& pos);
+	/* Unblend the ranges of spans with corresponding colors */
+	void Unblend(const SpanVector& spans);
 
 
-	/* left part of paint/unpaint/uncolor function */
-	void Pt_left(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair);
+	/* Return the color of an address, or a null handle if the address has no color. */
+	Handle Lookup(IpAddr addr) const;
 
+	/* Place the color of each address in addrs, or a null handle if it has no color, 
+	 * at the same position in colors. This is fastest if addrs is sorted. */
+	void Lookup(const std::vector<IpAddr>& addrs, std::vector<Handle>& colors) const;
 
-	/* middle part of paint/uncolor function */
-	void Pt_middle(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
+	iterator begin() { return m_map.begin(); }
+	iterator end()	 { return m_map.end(); }
 
 
-	/* right part of paint function */
-	void Pt_right(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
-	
+private:
+	/* Combine adjacent spans with the same color in and next to range */
+	void Coalesce(const IpRange& range);
 
-	/*left part of unpaint function */
-	void Upt_left(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair);
 
+	bool InsertToMap(IpAddr lowAddr, IpAddr highAddr, const Handle& color, Container& spanMap, iterator& pos);
 
-	/* middle part of unpaint function */
-	void Upt_middle(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
 
+	/* Split the span that contains addr so that a span starts at addr. 
+	 * Return the first span that starts at or after addr. */
+	iterator Split(IpAddr addr);
 
-	/* right part of unpaint/uncolor function */
-	void Upt_right(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
 
-	
-	/* left part of blend function */
-	void Bd_left(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair);
+	/* Return the last span that starts at or before addr, or end() if there is none. 
+	 * The search starts at hint, if it is not past addr. */
+	const_iterator Seek(IpAddr addr, const_iterator hint) const;
 
 
-	/* middle part of blend function */
-	void Bd_middle(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
+	/* Apply color to range, using f to compute the new colors. */
+	void Apply(const IpRange& range, const Handle& color, merge_func f);
 
 
-	/* right part of blend function */
-	void Bd_right(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
-	
-	
-	/* the left part of unblend function */
-	void Ubd_left(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair);
+	/* Apply a sorted sequence of count spans, using the given color if not null 
+	 * or else the colors of the spans. */
+	template < typename I >
+	void Apply(I first, I last, Container::size_type count, const Handle* color, merge_func f);
 
 
-	/* middle part of blend function */
-	void Ubd_middle(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
+	/* Apply a sorted sequence of spans by merging it with the map in a single pass. */
+	template < typename I >
+	void Sweep(I first, I last, const Handle* color, merge_func f);
 
 
-	/* right part of blend function */
-	void Ubd_right(const IpRange& range, const Handle& color, iterator& pos, std::pair<IpRange, Handle>& tmpPair, bool& isLeftSpan);
-	
+	/* Append a span to a map being built in order, combining it with the previous span if possible. */
+	static void AppendSpan(Container& spanMap, Pair& lastPair, bool& hasLast, IpAddr lowAddr, IpAddr highAddr, const Handle& color);
 
-	void LeftSkew(std::pair<IpRange, Handle>& tmpPair, iterator& pos, const IpRange& range);
 
+	/* merge functions for paint, unpaint, uncolor, blend and unblend */
+	static Handle Pt_merge(const Handle& mine, const Handle& theirs);
+	static Handle Upt_merge(const Handle& mine, const Handle& theirs);
+	static Handle Uc_merge(const Handle& mine, const Handle& theirs);
+	static Handle Bd_merge(const Handle& mine, const Handle& theirs);
+	static Handle Ubd_merge(const Handle& mine, const Handle& theirs);
 };
 
 /* --------------------------------------------------------------------------- */
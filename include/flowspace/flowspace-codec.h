@@ -0,0 +1,328 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <cstddef>
+# include <cstring>
+# include <string>
+# include <boost/cstdint.hpp>
+# include <boost/tuple/tuple.hpp>
+# include <boost/utility/enable_if.hpp>
+# include <boost/type_traits/is_integral.hpp>
+# include <boost/type_traits/is_signed.hpp>
+
+# include <ngeo/ip_base.hpp>
+# include <ngeo/ip6_base.hpp>
+# include <ngeo/ip_service.hpp>
+
+/** @file
+    Binary encoding of flowspace metrics, regions and payloads.
+ */
+
+namespace ngeo { namespace flowspace {
+
+/** Binary encoding of a value of type @a T.
+
+    Specializations provide
+    - @c size(T const&), the number of bytes in the encoding of a value.
+    - @c encode(unsigned char*, T const&), write the encoding of a value and
+      return a pointer past it.
+    - @c decode(unsigned char const* first, unsigned char const* last, T&),
+      read a value from the encoding at @a first and return a pointer past it,
+      or null if [@a first, @a last) does not start with a complete encoding.
+
+    Fixed size encodings also provide @c SIZE, the size of every encoding.
+    These are big endian, with the sign bit of signed types inverted, so that
+    encodings compare with @c memcmp in the same order as the values.
+
+    Encodings are provided for the integral types, the IP metric types and
+    @c std::string. Other payload types need a specialization.
+ */
+template < typename T, typename ENABLE = void > struct binary_codec;
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    // Store the low @a n bytes of @a v at @a out, big endian.
+    inline unsigned char* store_be(unsigned char* out, boost::uint64_t v, std::size_t n)
+    {
+        for ( std::size_t i = n ; i > 0 ; --i, v >>= 8 ) out[i-1] = static_cast<unsigned char>(v);
+        return out + n;
+    }
+
+    // Load @a n bytes at @a in, big endian.
+    inline boost::uint64_t load_be(unsigned char const* in, std::size_t n)
+    {
+        boost::uint64_t zret = 0;
+        for ( std::size_t i = 0 ; i < n ; ++i ) zret = (zret << 8) | in[i];
+        return zret;
+    }
+
+    // Base for encodings that are a fixed size unsigned integer.
+    template < typename T, std::size_t N > struct fixed_codec
+    {
+        static std::size_t const SIZE = N; //!< Encoded size.
+        //! Encoded size of a value.
+        static std::size_t size(T const&) { return SIZE; }
+    };
+
+    // Varint (7 bits per byte, low order first) for lengths.
+    inline unsigned char* store_varint(unsigned char* out, boost::uint64_t v)
+    {
+        for ( ; v >= 0x80 ; v >>= 7 ) *out++ = static_cast<unsigned char>(v | 0x80);
+        *out++ = static_cast<unsigned char>(v);
+        return out;
+    }
+
+    inline std::size_t varint_size(boost::uint64_t v)
+    {
+        std::size_t zret = 1;
+        for ( ; v >= 0x80 ; v >>= 7 ) ++zret;
+        return zret;
+    }
+
+    inline unsigned char const* load_varint(unsigned char const* in, unsigned char const* last, boost::uint64_t& v)
+    {
+        v = 0;
+        for ( int shift = 0 ; in < last && shift < 64 ; shift += 7 ) {
+            unsigned char c = *in++;
+            v |= static_cast<boost::uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80)) return in;
+        }
+        return 0;
+    }
+    //! @endcond
+} // namespace imp
+
+/// Encoding for integral types.
+template < typename T >
+struct binary_codec<T, typename boost::enable_if<boost::is_integral<T> >::type>
+    : public imp::fixed_codec<T, sizeof(T)>
+{
+    /// Bit flipped so that signed values are ordered as unsigned.
+    static boost::uint64_t const SIGN = boost::is_signed<T>::value ? boost::uint64_t(1) << (sizeof(T) * 8 - 1) : 0;
+    //! Write @a v to @a out.
+    static unsigned char* encode(unsigned char* out, T const& v) {
+        return imp::store_be(out, static_cast<boost::uint64_t>(v) ^ SIGN, sizeof(T));
+    }
+    //! Read @a v from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, T& v) {
+        if (static_cast<std::size_t>(last - in) < sizeof(T)) return 0;
+        v = static_cast<T>(imp::load_be(in, sizeof(T)) ^ SIGN);
+        return in + sizeof(T);
+    }
+};
+
+/// Encoding for an IPv4 address.
+template <> struct binary_codec<ip4_addr> : public imp::fixed_codec<ip4_addr, 4>
+{
+    //! Write @a a to @a out.
+    static unsigned char* encode(unsigned char* out, ip4_addr const& a) {
+        return imp::store_be(out, a.host_order(), SIZE);
+    }
+    //! Read @a a from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, ip4_addr& a) {
+        if (static_cast<std::size_t>(last - in) < SIZE) return 0;
+        a = ip4_addr(static_cast<ip4_addr::host_type>(imp::load_be(in, SIZE)));
+        return in + SIZE;
+    }
+};
+
+/// Encoding for an IPv6 address.
+template <> struct binary_codec<ip6_addr> : public imp::fixed_codec<ip6_addr, 16>
+{
+    //! Write @a a to @a out.
+    static unsigned char* encode(unsigned char* out, ip6_addr const& a) {
+        return imp::store_be(imp::store_be(out, a.high(), 8), a.low(), 8);
+    }
+    //! Read @a a from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, ip6_addr& a) {
+        if (static_cast<std::size_t>(last - in) < SIZE) return 0;
+        a.set(imp::load_be(in, 8), imp::load_be(in + 8, 8));
+        return in + SIZE;
+    }
+};
+
+/// Encoding for a port.
+template <> struct binary_codec<ip_port> : public imp::fixed_codec<ip_port, 2>
+{
+    //! Write @a p to @a out.
+    static unsigned char* encode(unsigned char* out, ip_port const& p) {
+        return imp::store_be(out, p.host_order(), SIZE);
+    }
+    //! Read @a p from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, ip_port& p) {
+        if (static_cast<std::size_t>(last - in) < SIZE) return 0;
+        p = ip_port(static_cast<ip_port::host_type>(imp::load_be(in, SIZE)));
+        return in + SIZE;
+    }
+};
+
+/// Encoding for a protocol.
+template <> struct binary_codec<ip_protocol> : public imp::fixed_codec<ip_protocol, binary_codec<ip_protocol::host_type>::SIZE>
+{
+    typedef binary_codec<ip_protocol::host_type> host_codec; //!< Encoding of the value.
+    //! Write @a p to @a out.
+    static unsigned char* encode(unsigned char* out, ip_protocol const& p) {
+        return host_codec::encode(out, p.host_order());
+    }
+    //! Read @a p from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, ip_protocol& p) {
+        ip_protocol::host_type v;
+        if (0 != (in = host_codec::decode(in, last, v))) p = ip_protocol(v);
+        return in;
+    }
+};
+
+/// Encoding for an ICMP type.
+template <> struct binary_codec<icmp_type> : public imp::fixed_codec<icmp_type, binary_codec<icmp_type::host_type>::SIZE>
+{
+    typedef binary_codec<icmp_type::host_type> host_codec; //!< Encoding of the value.
+    //! Write @a t to @a out.
+    static unsigned char* encode(unsigned char* out, icmp_type const& t) {
+        return host_codec::encode(out, t.host_order());
+    }
+    //! Read @a t from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, icmp_type& t) {
+        icmp_type::host_type v;
+        if (0 != (in = host_codec::decode(in, last, v))) t = icmp_type(v);
+        return in;
+    }
+};
+
+/// Encoding for a packed service.
+template <> struct binary_codec<packed_service> : public imp::fixed_codec<packed_service, sizeof(packed_service::raw_type)>
+{
+    //! Write @a s to @a out.
+    static unsigned char* encode(unsigned char* out, packed_service const& s) {
+        return imp::store_be(out, s.raw(), SIZE);
+    }
+    //! Read @a s from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, packed_service& s) {
+        if (static_cast<std::size_t>(last - in) < SIZE) return 0;
+        s = packed_service::from_raw(static_cast<packed_service::raw_type>(imp::load_be(in, SIZE)));
+        return in + SIZE;
+    }
+};
+
+/** Encoding for a string.
+    This is the length as a varint followed by the characters.
+ */
+template <> struct binary_codec<std::string>
+{
+    //! Encoded size of @a s.
+    static std::size_t size(std::string const& s) { return imp::varint_size(s.size()) + s.size(); }
+    //! Write @a s to @a out.
+    static unsigned char* encode(unsigned char* out, std::string const& s) {
+        out = imp::store_varint(out, s.size());
+        if (!s.empty()) std::memcpy(out, s.data(), s.size());
+        return out + s.size();
+    }
+    //! Read @a s from @a in.
+    static unsigned char const* decode(unsigned char const* in, unsigned char const* last, std::string& s) {
+        boost::uint64_t n;
+        if (0 == (in = imp::load_varint(in, last, n)) || static_cast<boost::uint64_t>(last - in) < n) return 0;
+        s.assign(reinterpret_cast<char const*>(in), static_cast<std::size_t>(n));
+        return in + n;
+    }
+};
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    /*  Regions are encoded one interval at a time. Each interval is a tag
+        byte and then the end points that are needed, which is none for an
+        entire dimension and only the minimum for a singleton.
+     */
+    enum { REGION_ALL = 0, REGION_SINGLETON = 1, REGION_RANGE = 2 };
+
+    // Encoded size of an interval.
+    template < typename H > std::size_t interval_size(H const& intv)
+    {
+        typedef binary_codec<typename H::metric_type> codec;
+        return 1 + (intv.is_maximal() ? 0
+            : intv.is_singleton() ? codec::size(intv.min())
+            : codec::size(intv.min()) + codec::size(intv.max()));
+    }
+
+    // Write an interval.
+    template < typename H > unsigned char* encode_interval(unsigned char* out, H const& intv)
+    {
+        typedef binary_codec<typename H::metric_type> codec;
+        if (intv.is_maximal()) {
+            *out++ = REGION_ALL;
+        } else if (intv.is_singleton()) {
+            *out++ = REGION_SINGLETON;
+            out = codec::encode(out, intv.min());
+        } else {
+            *out++ = REGION_RANGE;
+            out = codec::encode(codec::encode(out, intv.min()), intv.max());
+        }
+        return out;
+    }
+
+    // Read an interval.
+    template < typename H > unsigned char const* decode_interval(unsigned char const* in, unsigned char const* last, H& intv)
+    {
+        typedef binary_codec<typename H::metric_type> codec;
+        typename H::metric_type min, max;
+        if (in == last) return 0;
+        switch (*in++) {
+            case REGION_ALL:
+                intv = H::all();
+                break;
+            case REGION_SINGLETON:
+                if (0 != (in = codec::decode(in, last, min))) intv.set(min, min);
+                break;
+            case REGION_RANGE:
+                if (0 != (in = codec::decode(in, last, min)) && 0 != (in = codec::decode(in, last, max)))
+                    intv.set(min, max);
+                break;
+            default:
+                in = 0;
+        }
+        return in;
+    }
+
+    // Encoded size of a region, bottom case.
+    template < typename H > std::size_t region_size(boost::tuples::cons<H, boost::tuples::null_type> const& r)
+    {
+        return interval_size(r.head);
+    }
+
+    // Encoded size of a region, upper case.
+    template < typename H, typename T > std::size_t region_size(boost::tuples::cons<H,T> const& r)
+    {
+        return interval_size(r.head) + region_size(r.tail);
+    }
+
+    // Write a region, bottom case.
+    template < typename H > unsigned char* encode_region(unsigned char* out, boost::tuples::cons<H, boost::tuples::null_type> const& r)
+    {
+        return encode_interval(out, r.head);
+    }
+
+    // Write a region, upper case.
+    template < typename H, typename T > unsigned char* encode_region(unsigned char* out, boost::tuples::cons<H,T> const& r)
+    {
+        return encode_region(encode_interval(out, r.head), r.tail);
+    }
+
+    // Read a region, bottom case.
+    template < typename H > unsigned char const* decode_region(unsigned char const* in, unsigned char const* last, boost::tuples::cons<H, boost::tuples::null_type>& r)
+    {
+        return decode_interval(in, last, r.head);
+    }
+
+    // Read a region, upper case.
+    template < typename H, typename T > unsigned char const* decode_region(unsigned char const* in, unsigned char const* last, boost::tuples::cons<H,T>& r)
+    {
+        in = decode_interval(in, last, r.head);
+        return in ? decode_region(in, last, r.tail) : in;
+    }
+    //! @endcond
+} // namespace imp
+
+}} // namespace flowspace, ngeo
@@ -0,0 +1,281 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <cstring>
+# include <ostream>
+# include <string>
+# include <vector>
+# include <boost/cstdint.hpp>
+# include <boost/tuple/tuple.hpp>
+
+# include <ngeo/text_writer.hpp>
+# include <flowspace/flowspace-layer.h>
+# include <flowspace/flowspace-codec.h>
+
+/** @file
+    Bulk export of the contents of a flowspace.
+
+    The elements of a flowspace, or of a query region, are written to a stream
+    in lexicographic order as either CSV text or a binary columnar format. Both
+    are formatted in to large buffers that are written to the stream in
+    blocks, so the rate is not bounded by stream formatting. An export of the
+    entire flowspace walks the trees directly with @c layer::for_each rather
+    than using a query iterator.
+ */
+
+namespace ngeo { namespace flowspace {
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    // Number of dimensions of a region.
+    template < typename H > int region_rank(boost::tuples::cons<H, boost::tuples::null_type> const&) { return 1; }
+    template < typename H, typename T > int region_rank(boost::tuples::cons<H,T> const& r) { return 1 + region_rank(r.tail); }
+
+    // Write the CSV fields for a region, bottom case.
+    template < typename H > void csv_region(text_writer& w, boost::tuples::cons<H, boost::tuples::null_type> const& r)
+    {
+        w << r.head.min() << ',' << r.head.max();
+    }
+
+    // Write the CSV fields for a region, upper case.
+    template < typename H, typename T > void csv_region(text_writer& w, boost::tuples::cons<H,T> const& r)
+    {
+        w << r.head.min() << ',' << r.head.max() << ',';
+        csv_region(w, r.tail);
+    }
+
+    // Write a CSV payload field, which can't need quoting.
+    template < typename T > void csv_field(text_writer& w, T const& v) { w << v; }
+
+    // Write a CSV text payload field, quoted if needed.
+    inline void csv_field(text_writer& w, std::string const& s)
+    {
+        if (std::string::npos == s.find_first_of(",\"\r\n")) {
+            w << s;
+        } else {
+            w << '"';
+            for ( std::string::size_type spot = 0, next ; spot < s.size() ; spot = next + 1 ) {
+                next = s.find('"', spot);
+                if (std::string::npos == next) {
+                    w.write(s.data() + spot, s.size() - spot);
+                    break;
+                }
+                w.write(s.data() + spot, next - spot + 1) << '"';
+            }
+            w << '"';
+        }
+    }
+
+    // Append the end points of an interval to the columns @a col[0] and @a col[1].
+    template < typename H > void column_interval(std::vector<unsigned char>* col, H const& intv)
+    {
+        typedef binary_codec<typename H::metric_type> codec;
+        std::size_t n = col[0].size();
+        col[0].resize(n + codec::SIZE);
+        col[1].resize(n + codec::SIZE);
+        codec::encode(&col[0][n], intv.min());
+        codec::encode(&col[1][n], intv.max());
+    }
+
+    // Append the end points of a region to the columns starting at @a col, bottom case.
+    template < typename H > void column_region(std::vector<unsigned char>* col, boost::tuples::cons<H, boost::tuples::null_type> const& r)
+    {
+        column_interval(col, r.head);
+    }
+
+    // Append the end points of a region to the columns starting at @a col, upper case.
+    template < typename H, typename T > void column_region(std::vector<unsigned char>* col, boost::tuples::cons<H,T> const& r)
+    {
+        column_interval(col, r.head);
+        column_region(col + 2, r.tail);
+    }
+
+    // Write the metric size of each dimension, bottom case.
+    template < typename H > unsigned char* column_sizes(unsigned char* out, boost::tuples::cons<H, boost::tuples::null_type> const&)
+    {
+        return store_be(out, binary_codec<typename H::metric_type>::SIZE, 4);
+    }
+
+    // Write the metric size of each dimension, upper case.
+    template < typename H, typename T > unsigned char* column_sizes(unsigned char* out, boost::tuples::cons<H,T> const& r)
+    {
+        return column_sizes(store_be(out, binary_codec<typename H::metric_type>::SIZE, 4), r.tail);
+    }
+
+    // Pass each element of @a space in @a r to @a f, walking the trees directly if @a r is everything.
+    template < typename LAYER, typename F > void export_each(LAYER const& space, typename LAYER::key_type const& r, F& f)
+    {
+        if (r == LAYER::all()) {
+            space.for_each(f);
+        } else {
+            for ( typename LAYER::const_iterator spot = space.begin(r), limit = space.end() ; spot != limit ; ++spot )
+                f(spot->first, spot->second);
+        }
+    }
+
+    // Write each element as a CSV line.
+    struct csv_sink
+    {
+        text_writer m_writer;
+        std::size_t m_count;
+
+        explicit csv_sink(std::ostream& s) : m_writer(s), m_count(0) { }
+
+        template < typename R, typename P > void operator () (R const& r, P const& p)
+        {
+            csv_region(m_writer, r);
+            m_writer << ',';
+            csv_field(m_writer, p);
+            m_writer << '\n';
+            ++m_count;
+        }
+    };
+
+    // Collect elements in to columns and write them in blocks.
+    template < typename LAYER > struct column_sink
+    {
+        typedef binary_codec<typename LAYER::mapped_type> payload_codec;
+
+        std::ostream& m_stream;
+        std::size_t m_block; // Maximum elements per block.
+        std::vector<std::vector<unsigned char> > m_cols; // Minima and maxima for each dimension, then payloads.
+        std::size_t m_n; // Elements in the current block.
+        std::size_t m_count; // Elements written.
+
+        column_sink(std::ostream& s, int dims, std::size_t block)
+            : m_stream(s), m_block(block ? block : 1), m_cols(2 * dims + 1), m_n(0), m_count(0) { }
+
+        template < typename R > void operator () (R const& r, typename LAYER::mapped_type const& p)
+        {
+            std::vector<unsigned char>& payloads = m_cols.back();
+            std::size_t k = payloads.size();
+            column_region(&m_cols[0], r);
+            payloads.resize(k + payload_codec::size(p));
+            payload_codec::encode(&payloads[k], p);
+            if (++m_n == m_block) this->flush();
+        }
+
+        // Write the current block, if it is not empty.
+        void flush()
+        {
+            unsigned char frame[4];
+            if (0 == m_n) return;
+            store_be(frame, m_n, 4);
+            m_stream.write(reinterpret_cast<char const*>(frame), 4);
+            for ( std::size_t i = 0 ; i + 1 < m_cols.size() ; ++i ) {
+                m_stream.write(reinterpret_cast<char const*>(&m_cols[i][0]), m_cols[i].size());
+                m_cols[i].clear();
+            }
+            std::vector<unsigned char>& payloads = m_cols.back();
+            store_be(frame, payloads.size(), 4);
+            m_stream.write(reinterpret_cast<char const*>(frame), 4);
+            if (!payloads.empty()) m_stream.write(reinterpret_cast<char const*>(&payloads[0]), payloads.size());
+            payloads.clear();
+            m_count += m_n;
+            m_n = 0;
+        }
+    };
+    //! @endcond
+} // namespace imp
+
+/** Write the elements of @a space in @a r to @a s as CSV.
+
+    There is one line per element, in lexicographic order. Each line is the
+    minimum and maximum of each dimension and then the payload, all separated
+    by commas, in the same text as @c to_chars. A text payload is quoted if it
+    contains a comma, quote or line break. If @a header is set the first line
+    has the column names, "min0,max0,min1,max1,...,payload".
+
+    @return The number of elements written.
+ */
+template < typename LAYER > std::size_t
+export_csv(
+    LAYER const& space, //!< Flowspace to export.
+    typename LAYER::key_type const& r, //!< Query region.
+    std::ostream& s, //!< Output stream.
+    bool header = true //!< Write a header line.
+    )
+{
+    imp::csv_sink sink(s);
+
+    if (header) {
+        for ( int i = 0, n = imp::region_rank(r) ; i < n ; ++i )
+            sink.m_writer << "min" << i << ",max" << i << ',';
+        sink.m_writer << "payload\n";
+    }
+    imp::export_each(space, r, sink);
+    return sink.m_count;
+}
+
+/** Write all elements of @a space to @a s as CSV.
+    @see export_csv(LAYER const&, typename LAYER::key_type const&, std::ostream&, bool)
+ */
+template < typename LAYER > std::size_t
+export_csv(
+    LAYER const& space, //!< Flowspace to export.
+    std::ostream& s, //!< Output stream.
+    bool header = true //!< Write a header line.
+    )
+{
+    return export_csv(space, LAYER::all(), s, header);
+}
+
+/** Write the elements of @a space in @a r to @a s in binary columnar form.
+
+    The output is a header and then blocks of up to @a block elements in
+    lexicographic order, ending with an empty block. All integers are big
+    endian.
+    - The header is the magic "NGFSCOL1", the number of dimensions D as 4
+      bytes, and the encoded size of the metric of each dimension as 4 bytes.
+    - A block is the element count N as 4 bytes. Then for each dimension in
+      order there is a column of N minima and a column of N maxima. Then the
+      payload column, which is its length in bytes as 4 bytes and the N
+      payloads.
+
+    Metrics and payloads are encoded with @c binary_codec, so a metric column
+    is a packed array of fixed size values that compare with @c memcmp in
+    metric order.
+
+    @return The number of elements written.
+ */
+template < typename LAYER > std::size_t
+export_columns(
+    LAYER const& space, //!< Flowspace to export.
+    typename LAYER::key_type const& r, //!< Query region.
+    std::ostream& s, //!< Output stream.
+    std::size_t block = 4096 //!< Maximum elements per block.
+    )
+{
+    int const dims = imp::region_rank(r);
+    std::vector<unsigned char> header(12 + 4 * dims);
+    imp::column_sink<LAYER> sink(s, dims, block);
+    unsigned char frame[4];
+
+    std::memcpy(&header[0], "NGFSCOL1", 8);
+    imp::column_sizes(imp::store_be(&header[8], dims, 4), r);
+    s.write(reinterpret_cast<char const*>(&header[0]), header.size());
+    imp::export_each(space, r, sink);
+    sink.flush();
+    imp::store_be(frame, 0, 4);
+    s.write(reinterpret_cast<char const*>(frame), 4);
+    return sink.m_count;
+}
+
+/** Write all elements of @a space to @a s in binary columnar form.
+    @see export_columns(LAYER const&, typename LAYER::key_type const&, std::ostream&, std::size_t)
+ */
+template < typename LAYER > std::size_t
+export_columns(
+    LAYER const& space, //!< Flowspace to export.
+    std::ostream& s, //!< Output stream.
+    std::size_t block = 4096 //!< Maximum elements per block.
+    )
+{
+    return export_columns(space, LAYER::all(), s, block);
+}
+
+}} // namespace flowspace, ngeo
@@ -0,0 +1,290 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <map>
+# include <vector>
+# include <algorithm>
+# include <ostream>
+# include <stdexcept>
+# include <boost/cstdint.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/functional/hash.hpp>
+# include <boost/detail/atomic_count.hpp>
+# include <boost/integer/integer_log2.hpp>
+# include <boost/type_traits/alignment_of.hpp>
+# include <boost/type_traits/aligned_storage.hpp>
+# include <boost/thread/mutex.hpp>
+
+# include <flowspace/flowspace-layer.h>
+
+/** @file
+    Payload interning for flowspace layers.
+
+    There is one pool of values for each payload type in the process, shared by
+    all layers and guarded by a Boost.Thread mutex. The layer header only has
+    the @c payload_traits hook that this plugs in to.
+ */
+
+namespace ngeo { namespace flowspace {
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    /*  Process wide pool of distinct payloads of type @a T.
+        Each distinct value is stored once and identified by a 32 bit id.
+        Values are reference counted and the id is reused once the last
+        reference is released.
+
+        Values are kept in segments that double in size and are never moved,
+        so a value can be read by id without a lock. Reference counts are
+        atomic, the lock is taken only to add a value or to find one by
+        content, and to reclaim a value whose count has dropped to zero.
+     */
+    template < typename T, typename HASH >
+    class payload_pool : boost::noncopyable
+    {
+    public:
+        typedef payload_pool self;
+        typedef boost::uint32_t id_type;
+
+        /*  The pool for this payload type.
+            It is never destroyed, so that layers with static storage
+            duration can release their payloads at exit.
+         */
+        static self& instance()
+        {
+            static self* pool = new self;
+            return *pool;
+        }
+
+        // Get the id of @a v, adding it if needed, and add a reference to it.
+        id_type acquire(T const& v)
+        {
+            std::size_t h = HASH()(v);
+            boost::mutex::scoped_lock lock(m_mutex);
+            id_type zret;
+            if (!this->lookup(v, h, zret)) {
+                if (m_free.empty()) {
+                    if (m_next == CAPACITY) throw std::length_error("flowspace: too many distinct interned payloads");
+                    zret = m_next++;
+                    std::size_t s, k;
+                    locate(zret, s, k);
+                    if (!m_segments[s]) m_segments[s] = static_cast<slot*>(::operator new((SEGMENT_BASE << s) * sizeof(slot)));
+                    new (m_segments[s] + k) slot();
+                } else {
+                    zret = m_free.back();
+                    m_free.pop_back();
+                }
+                slot& x = this->at(zret);
+                new (x.value()) T(v);
+                x.m_hash = h;
+                x.m_live = true;
+                m_index.insert(typename index::value_type(h, zret));
+            }
+            ++this->at(zret).m_refs;
+            return zret;
+        }
+
+        // Add a reference to the value @a id.
+        void add_ref(id_type id) { ++this->at(id).m_refs; }
+
+        // Release a reference to the value @a id, reclaiming it if that was the last.
+        void release(id_type id)
+        {
+            slot& x = this->at(id);
+            if (0 == --x.m_refs) {
+                // Another thread may have found and released the value in
+                // the meantime, in which case it may already be reclaimed.
+                boost::mutex::scoped_lock lock(m_mutex);
+                if (x.m_live && 0 == static_cast<long>(x.m_refs)) {
+                    for ( typename index::iterator spot = m_index.lower_bound(x.m_hash) ; spot != m_index.end() && spot->first == x.m_hash ; ++spot ) {
+                        if (spot->second == id) {
+                            m_index.erase(spot);
+                            break;
+                        }
+                    }
+                    x.value()->~T();
+                    x.m_live = false;
+                    m_free.push_back(id);
+                }
+            }
+        }
+
+        // Find the id of @a v without adding it.
+        bool find(T const& v, id_type& id)
+        {
+            std::size_t h = HASH()(v);
+            boost::mutex::scoped_lock lock(m_mutex);
+            return this->lookup(v, h, id);
+        }
+
+        // Get the value @a id, which must be referenced.
+        T const& get(id_type id) const { return *const_cast<self*>(this)->at(id).value(); }
+
+        // Number of distinct values in the pool.
+        std::size_t size()
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            return m_index.size();
+        }
+
+    private:
+        typedef std::multimap<std::size_t, id_type> index;
+
+        // Slots in the first segment, each later segment is twice as large.
+        static std::size_t const SEGMENT_BASE = 32;
+        static std::size_t const MAX_SEGMENTS = 27;
+        // Number of ids the segments hold, 2^32 - 32 ids.
+        static id_type const CAPACITY = SEGMENT_BASE * ((std::size_t(1) << MAX_SEGMENTS) - 1);
+
+        struct slot
+        {
+            typename boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value>::type m_data;
+            boost::detail::atomic_count m_refs; // references to the value
+            std::size_t m_hash; // hash of the value
+            bool m_live; // set if the slot holds a value
+            slot() : m_refs(0), m_hash(0), m_live(false) { }
+            T* value() { return static_cast<T*>(static_cast<void*>(&m_data)); }
+        };
+
+        payload_pool() : m_next(0)
+        {
+            std::fill(m_segments, m_segments + MAX_SEGMENTS, static_cast<slot*>(0));
+        }
+
+        // Compute the segment @a s and index @a k in that segment of @a id.
+        static void locate(id_type id, std::size_t& s, std::size_t& k)
+        {
+            s = boost::integer_log2((id / SEGMENT_BASE) + 1);
+            k = id + SEGMENT_BASE - (SEGMENT_BASE << s);
+        }
+
+        slot& at(id_type id)
+        {
+            std::size_t s, k;
+            locate(id, s, k);
+            return m_segments[s][k];
+        }
+
+        // Find @a v with hash @a h, the lock must be held.
+        bool lookup(T const& v, std::size_t h, id_type& id)
+        {
+            for ( typename index::iterator spot = m_index.lower_bound(h) ; spot != m_index.end() && spot->first == h ; ++spot ) {
+                if (*this->at(spot->second).value() == v) {
+                    id = spot->second;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        boost::mutex m_mutex; // Protects everything except reference counts and values.
+        slot* m_segments[MAX_SEGMENTS]; // Value storage.
+        id_type m_next; // First id that has never been used.
+        std::vector<id_type> m_free; // Reclaimed ids.
+        index m_index; // Ids by value hash.
+    };
+
+    //! @endcond
+} // namespace imp
+
+/** Payload policy that interns payloads.
+    Use this as the payload of a bottom layer to store each distinct payload
+    once, for instance <tt>layer<ip_port, interned<action> ></tt>. Each element
+    then holds only a 32 bit id for its payload. This is worthwhile when many
+    regions carry one of a few distinct payloads, because it reduces memory
+    use and makes payload comparisons integer compares.
+
+    The @c mapped_type of the layer, and every layer above it, is @a T and
+    iterators yield a @c T @c const&. Payloads are shared, so they cannot be
+    modified through an iterator; use @c erase and @c insert instead.
+
+    Payloads are held in a process wide pool for @a T and @a HASH, which is
+    safe to use from multiple threads. A payload is removed from the pool
+    when the last element that refers to it is erased.
+
+    @a T must be copy constructible and have equality. @a HASH is the hash
+    function for @a T.
+ */
+template < typename T, typename HASH = boost::hash<T> >
+class interned
+{
+public:
+    typedef interned self; //!< Self reference type.
+    typedef T value_type; //!< Payload type.
+    typedef imp::payload_pool<T, HASH> pool; //!< Pool of distinct payloads.
+    typedef typename pool::id_type id_type; //!< Payload id.
+
+    //! Intern @a v.
+    explicit interned(T const& v) : m_id(pool::instance().acquire(v)) { }
+    //! Copy constructor.
+    interned(self const& that) : m_id(that.m_id) { pool::instance().add_ref(m_id); }
+    //! Destructor.
+    ~interned() { pool::instance().release(m_id); }
+    //! Assignment.
+    self& operator = (self const& that)
+    {
+        if (m_id != that.m_id) {
+            pool::instance().add_ref(that.m_id);
+            pool::instance().release(m_id);
+            m_id = that.m_id;
+        }
+        return *this;
+    }
+
+    //! Get the payload.
+    T const& get() const { return pool::instance().get(m_id); }
+    //! Get the payload id.
+    id_type id() const { return m_id; }
+
+    /** Find the id of the payload @a v.
+        @return @c true if @a v is interned, in which case @a id is set.
+     */
+    static bool find(T const& v, id_type& id) { return pool::instance().find(v, id); }
+
+    //! Number of distinct payloads currently interned.
+    static std::size_t count() { return pool::instance().size(); }
+
+    //! Equality, the same payload has the same id.
+    friend bool operator == (self const& lhs, self const& rhs) { return lhs.m_id == rhs.m_id; }
+    //! Inequality.
+    friend bool operator != (self const& lhs, self const& rhs) { return lhs.m_id != rhs.m_id; }
+    //! Hash, this is consistent only within a process.
+    friend std::size_t hash_value(self const& p) { return p.m_id; }
+    //! Print the payload.
+    friend std::ostream& operator << (std::ostream& s, self const& p) { return s << p.get(); }
+
+private:
+    id_type m_id; //!< Id of the payload in the pool.
+};
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    // Interned payloads are stored as an id and read only for clients.
+    template < typename T, typename HASH > struct payload_traits< interned<T, HASH> >
+    {
+        typedef interned<T, HASH> stored;
+        typedef T value_type;
+        typedef T const& reference;
+        static bool const IS_INTERNED = true;
+        static stored store(T const& v) { return stored(v); }
+        static T const& get(stored const& p) { return p.get(); }
+        // Look up the target once, so that each compare is of ids. A
+        // payload that is not interned matches nothing.
+        struct matcher
+        {
+            typename stored::id_type m_id;
+            bool m_found;
+            matcher(T const& v) : m_found(stored::find(v, m_id)) { }
+            bool operator () (stored const& p) const { return m_found && p.id() == m_id; }
+        };
+    };
+
+    //! @endcond
+} // namespace imp
+
+}} // namespace ngeo::flowspace
@@ -0,0 +1,499 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <cerrno>
+# include <cstring>
+# include <vector>
+# include <fstream>
+# include <algorithm>
+# include <stdexcept>
+# include <boost/crc.hpp>
+# include <boost/cstdint.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/system/system_error.hpp>
+# if defined(_WIN32)
+#   include <io.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+# else
+#   include <unistd.h>
+#   include <fcntl.h>
+# endif
+
+# include <flowspace/flowspace-layer.h>
+# include <flowspace/flowspace-codec.h>
+
+/** @file
+    Write ahead journal of flowspace updates.
+
+    Appends from several threads share one buffer and wait for a group commit
+    on a Boost.Thread condition variable.
+ */
+
+namespace ngeo { namespace flowspace {
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    /*  A journal is a header and then a sequence of records. The header is
+        the 8 byte magic. A record is the body length and the CRC-32 of the
+        body, each 4 bytes big endian, then the body. The body is the
+        operation byte, the encoded region and the encoded payload.
+     */
+    static std::size_t const JOURNAL_HEADER_SIZE = 8;
+    static std::size_t const JOURNAL_FRAME_SIZE = 8;
+    // Upper bound on a record body, anything larger is corrupt.
+    static std::size_t const JOURNAL_MAX_RECORD = 1 << 24;
+    enum { JOURNAL_INSERT = 1, JOURNAL_ERASE = 2 };
+
+    inline unsigned char const* journal_magic() { return reinterpret_cast<unsigned char const*>("NGFSJNL\x01"); }
+
+    inline boost::uint32_t journal_crc(unsigned char const* data, std::size_t n)
+    {
+        boost::crc_32_type crc;
+        crc.process_bytes(data, n);
+        return crc.checksum();
+    }
+
+    /*  Check the record at @a in.
+        @return The record body length, or -1 if there is not a complete,
+        valid record in [@a in, @a last).
+     */
+    inline long journal_record(unsigned char const* in, unsigned char const* last)
+    {
+        if (static_cast<std::size_t>(last - in) < JOURNAL_FRAME_SIZE) return -1;
+        std::size_t n = static_cast<std::size_t>(load_be(in, 4));
+        if (n > JOURNAL_MAX_RECORD || static_cast<std::size_t>(last - in) - JOURNAL_FRAME_SIZE < n) return -1;
+        if (journal_crc(in + JOURNAL_FRAME_SIZE, n) != load_be(in + 4, 4)) return -1;
+        return static_cast<long>(n);
+    }
+
+    /*  Length of the valid prefix of journal data, which is the header and
+        every record up to the first that is truncated or corrupt.
+        @return The length, or 0 if the header is not valid.
+     */
+    inline std::size_t journal_valid_length(unsigned char const* data, std::size_t n)
+    {
+        if (n < JOURNAL_HEADER_SIZE || 0 != std::memcmp(data, journal_magic(), JOURNAL_HEADER_SIZE)) return 0;
+        unsigned char const* spot = data + JOURNAL_HEADER_SIZE;
+        long len;
+        while ((len = journal_record(spot, data + n)) >= 0) spot += JOURNAL_FRAME_SIZE + len;
+        return spot - data;
+    }
+
+    // Throw for a failed file operation.
+    inline void journal_fail(char const* what)
+    {
+        throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), what);
+    }
+
+    // Minimal file access, so that writes and syncs are explicit.
+# if defined(_WIN32)
+    inline int journal_open(char const* path) { return _open(path, _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE); }
+    inline int journal_close(int fd) { return _close(fd); }
+    inline long journal_read(int fd, void* buf, std::size_t n) { return _read(fd, buf, static_cast<unsigned>(n)); }
+    inline long journal_write(int fd, void const* buf, std::size_t n) { return _write(fd, buf, static_cast<unsigned>(n)); }
+    inline int journal_truncate(int fd, std::size_t n) { return 0 == _chsize_s(fd, n) && n == static_cast<std::size_t>(_lseeki64(fd, n, SEEK_SET)) ? 0 : -1; }
+    inline int journal_sync(int fd) { return _commit(fd); }
+# else
+    inline int journal_open(char const* path) { return ::open(path, O_RDWR | O_CREAT, 0644); }
+    inline int journal_close(int fd) { return ::close(fd); }
+    inline long journal_read(int fd, void* buf, std::size_t n) { return ::read(fd, buf, n); }
+    inline long journal_write(int fd, void const* buf, std::size_t n) { return ::write(fd, buf, n); }
+    inline int journal_truncate(int fd, std::size_t n) { return 0 == ::ftruncate(fd, n) && static_cast<off_t>(n) == ::lseek(fd, n, SEEK_SET) ? 0 : -1; }
+#   if defined(__linux__)
+    inline int journal_sync(int fd) { return ::fdatasync(fd); }
+#   else
+    inline int journal_sync(int fd) { return ::fsync(fd); }
+#   endif
+# endif
+
+    // Write all of @a n bytes at @a data.
+    inline void journal_write_all(int fd, unsigned char const* data, std::size_t n)
+    {
+        while (n) {
+            long k = journal_write(fd, data, n);
+            if (k < 0) {
+                if (EINTR == errno) continue;
+                journal_fail("journal write");
+            }
+            data += k;
+            n -= k;
+        }
+    }
+    //! @endcond
+} // namespace imp
+
+/** Write ahead journal of updates to a flowspace.
+
+    Each @c insert and @c erase appends a record to an in memory buffer and
+    returns the sequence number of the record. The buffer is written to the
+    file and synced to disk by @c sync, which does a group commit. If several
+    threads call @c sync at the same time, one of them writes and syncs every
+    record appended so far while the others wait, so the number of syncs is
+    bounded by the number of concurrent callers, not the number of records.
+
+    The journal does not apply the updates, the client does that, normally
+    after the record is durable. After a crash the flowspace is recovered by
+    loading the last checkpoint and then calling @c replay on the journal.
+    Once a new checkpoint is durable the journal should be emptied with
+    @c clear.
+
+    Records are framed with their length and a CRC-32 so that a record that
+    was only partially written at a crash is detected. When an existing
+    journal is opened, anything after the last valid record is discarded.
+
+    If a commit fails the file is truncated back to the last durable record
+    and the records of that commit are kept to be written by the next one. If
+    the file cannot be truncated, every later @c sync and @c commit fails.
+
+    Regions and payloads are stored with @c binary_codec, which must be
+    available for the metric types and the payload type of @a LAYER.
+ */
+template < typename LAYER >
+class journal
+{
+public:
+    typedef journal self; //!< Self reference type.
+    typedef LAYER layer_type; //!< Type of the flowspace.
+    typedef typename LAYER::value_type value_type; //!< Type of the flowspace elements.
+    typedef typename LAYER::mapped_type mapped_type; //!< Type of the payload.
+    typedef boost::uint64_t sequence_type; //!< Record sequence number.
+
+    /** Open the journal at @a path, creating it if it does not exist.
+        @throws boost::system::system_error if the file cannot be opened or repaired.
+        @throws std::runtime_error if the file exists and is not a journal.
+     */
+    explicit journal(
+        char const* path //!< Path to the journal file.
+        )
+        : m_fd(imp::journal_open(path))
+        , m_appended(0)
+        , m_durable(0)
+        , m_length(imp::JOURNAL_HEADER_SIZE)
+        , m_syncing(false)
+        , m_clearing(false)
+    {
+        if (m_fd < 0) imp::journal_fail("journal open");
+        try {
+            std::vector<unsigned char> data;
+            unsigned char buf[1 << 16];
+            long k;
+            while (0 != (k = imp::journal_read(m_fd, buf, sizeof(buf)))) {
+                if (k < 0) {
+                    if (EINTR == errno) continue;
+                    imp::journal_fail("journal read");
+                }
+                data.insert(data.end(), buf, buf + k);
+            }
+            std::size_t valid = data.empty() ? 0 : imp::journal_valid_length(&data[0], data.size());
+            if (0 == valid && !data.empty()) throw std::runtime_error("flowspace journal has an invalid header");
+            if (0 == valid) {
+                imp::journal_write_all(m_fd, imp::journal_magic(), imp::JOURNAL_HEADER_SIZE);
+            } else if (valid < data.size()) {
+                if (imp::journal_truncate(m_fd, valid) < 0) imp::journal_fail("journal truncate");
+            }
+            if (valid) m_length = valid;
+            if (imp::journal_sync(m_fd) < 0) imp::journal_fail("journal sync");
+        } catch (...) {
+            imp::journal_close(m_fd);
+            throw;
+        }
+    }
+
+    /** Destructor.
+        Records not yet synced are written and synced, if possible.
+     */
+    ~journal()
+    {
+        try {
+            this->commit();
+        } catch (...) {
+        }
+        imp::journal_close(m_fd);
+    }
+
+    /** Append an insert of @a v.
+        @return The sequence number of the record.
+        @throws std::length_error if the record would be too large to replay.
+     */
+    sequence_type insert(value_type const& v)
+    {
+        return this->append(imp::JOURNAL_INSERT, v);
+    }
+
+    /** Append an erase of @a v.
+        This is replayed as an erase of an element identical to @a v.
+        @return The sequence number of the record.
+        @throws std::length_error if the record would be too large to replay.
+     */
+    sequence_type erase(value_type const& v)
+    {
+        return this->append(imp::JOURNAL_ERASE, v);
+    }
+
+    /** Make record @a seq durable.
+        This blocks until that record and all before it are synced to disk.
+        @throws boost::system::system_error if the write or sync fails, or
+        an earlier failure could not be undone.
+     */
+    void sync(sequence_type seq)
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (m_durable < seq) {
+            if (m_error) throw boost::system::system_error(m_error, "journal failed");
+            if (m_syncing || m_clearing) {
+                m_synced.wait(lock);
+                continue;
+            }
+            // Lead this commit, it takes everything appended so far.
+            std::vector<unsigned char> data;
+            sequence_type target = m_appended;
+            data.swap(m_pending);
+            m_syncing = true;
+            lock.unlock();
+            try {
+                if (!data.empty()) imp::journal_write_all(m_fd, &data[0], data.size());
+                if (imp::journal_sync(m_fd) < 0) imp::journal_fail("journal sync");
+            } catch (...) {
+                // Drop a partial write, so that the next commit does not follow
+                // a torn record, and write these records again then.
+                bool restored = 0 == imp::journal_truncate(m_fd, m_length);
+                boost::system::error_code error(errno, boost::system::system_category());
+                lock.lock();
+                try {
+                    if (restored) m_pending.insert(m_pending.begin(), data.begin(), data.end());
+                } catch (...) {
+                    restored = false;
+                    error = boost::system::errc::make_error_code(boost::system::errc::not_enough_memory);
+                }
+                if (!restored) m_error = error;
+                m_syncing = false;
+                m_synced.notify_all();
+                throw;
+            }
+            lock.lock();
+            m_syncing = false;
+            m_durable = target;
+            m_length += data.size();
+            // Keep the larger buffer for appends.
+            if (m_pending.empty() && data.capacity() > m_pending.capacity()) {
+                data.clear();
+                m_pending.swap(data);
+            }
+            m_synced.notify_all();
+        }
+    }
+
+    //! Make every record appended so far durable.
+    void commit()
+    {
+        sequence_type seq;
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            seq = m_appended;
+        }
+        this->sync(seq);
+    }
+
+    /** Discard every record appended before this call.
+        This should be called only after a checkpoint that includes all of
+        those records is durable. Records appended by other threads while
+        this runs are kept, and commits wait until it is done so that none of
+        them are written before the file is truncated.
+        @return The sequence number of the last record discarded.
+        @throws boost::system::system_error if the truncate or sync fails,
+        after which every later @c sync and @c commit fails.
+     */
+    sequence_type clear()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (m_clearing) m_synced.wait(lock);
+        if (m_error) throw boost::system::system_error(m_error, "journal failed");
+        sequence_type checkpoint = m_appended;
+        m_clearing = true;
+        while (m_syncing) m_synced.wait(lock);
+        // The file has only records in the checkpoint, drop the pending ones that are too.
+        std::size_t skip = 0;
+        for ( sequence_type seq = m_durable ; seq < checkpoint ; ++seq )
+            skip += imp::JOURNAL_FRAME_SIZE + static_cast<std::size_t>(imp::load_be(&m_pending[skip], 4));
+        m_pending.erase(m_pending.begin(), m_pending.begin() + skip);
+        m_syncing = true;
+        lock.unlock();
+        boost::system::error_code error;
+        if (imp::journal_truncate(m_fd, imp::JOURNAL_HEADER_SIZE) < 0 || imp::journal_sync(m_fd) < 0)
+            error.assign(errno, boost::system::system_category());
+        lock.lock();
+        if (error) {
+            m_error = error;
+        } else {
+            m_durable = checkpoint;
+            m_length = imp::JOURNAL_HEADER_SIZE;
+        }
+        m_syncing = false;
+        m_clearing = false;
+        m_synced.notify_all();
+        if (error) throw boost::system::system_error(error, "journal clear");
+        return checkpoint;
+    }
+
+protected:
+    typedef binary_codec<mapped_type> payload_codec; //!< Payload encoding.
+
+    /// Append a record for @a v.
+    sequence_type append(unsigned char op, value_type const& v)
+    {
+        std::size_t n = 1 + imp::region_size(v.first) + payload_codec::size(v.second);
+        if (n > imp::JOURNAL_MAX_RECORD) throw std::length_error("flowspace journal record is too large");
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        std::size_t offset = m_pending.size();
+        m_pending.resize(offset + imp::JOURNAL_FRAME_SIZE + n);
+        unsigned char* body = &m_pending[offset] + imp::JOURNAL_FRAME_SIZE;
+        *body = op;
+        payload_codec::encode(imp::encode_region(body + 1, v.first), v.second);
+        imp::store_be(imp::store_be(&m_pending[offset], n, 4), imp::journal_crc(body, n), 4);
+        return ++m_appended;
+    }
+
+    int m_fd; //!< Journal file.
+    std::vector<unsigned char> m_pending; //!< Records not yet written.
+    sequence_type m_appended; //!< Last record appended.
+    sequence_type m_durable; //!< Last record synced.
+    std::size_t m_length; //!< Length of the file up to the last record synced.
+    bool m_syncing; //!< Set while a commit is in progress.
+    bool m_clearing; //!< Set while a clear is waiting or in progress.
+    boost::system::error_code m_error; //!< Failure that could not be undone.
+    boost::mutex m_mutex; //!< Protects the buffer and counters.
+    boost::condition_variable m_synced; //!< Signal the end of a commit.
+
+private:
+    // Not copyable.
+    journal(self const&);
+    self& operator = (self const&);
+};
+
+/// Result of replaying a journal.
+struct replay_result
+{
+    std::size_t inserted; //!< Number of inserts applied.
+    std::size_t erased; //!< Number of erases applied.
+    std::size_t missing; //!< Number of erases with no matching element.
+    std::size_t length; //!< Length of the valid journal data, 0 if the header is not valid.
+    bool complete; //!< Set if all of the journal data was valid.
+
+    replay_result() : inserted(0), erased(0), missing(0), length(0), complete(false) { }
+};
+
+/** Apply the journal in [@a data, @a data + @a n) to @a space.
+
+    Records are applied in order up to the first record that is truncated or
+    corrupt, with the same result as applying them to @a space one at a time,
+    where an erase is @c erase(find(v)). That includes the order of identical
+    elements. Records are applied in batches, and the inserts defer their
+    fixups as with @c layer::batch_update. Within a batch an erase of an
+    element that is not in @a space before the batch cancels the earliest
+    matching insert in the batch, which is the element @c find would return.
+ */
+template < typename LAYER > replay_result
+replay(
+    unsigned char const* data, //!< Journal data.
+    std::size_t n, //!< Length of @a data.
+    LAYER& space //!< [in,out] Flowspace to update.
+    )
+{
+    typedef typename LAYER::value_type value_type;
+    typedef typename LAYER::value_copy value_copy;
+    typedef binary_codec<typename LAYER::mapped_type> payload_codec;
+    // Records per batch.
+    static std::size_t const BATCH = 4096;
+    // Operation and cancelled flag for each value in a batch.
+    std::vector<std::pair<unsigned char, bool> > ops;
+    std::vector<value_copy> values;
+    replay_result zret;
+
+    zret.length = imp::journal_valid_length(data, n);
+    zret.complete = 0 != zret.length && zret.length == n;
+    if (0 == zret.length) return zret;
+
+    unsigned char const* spot = data + imp::JOURNAL_HEADER_SIZE;
+    unsigned char const* limit = data + zret.length;
+    while (spot < limit) {
+        ops.clear();
+        values.clear();
+        for ( ; spot < limit && ops.size() < BATCH ; ) {
+            std::size_t len = static_cast<std::size_t>(imp::load_be(spot, 4));
+            unsigned char const* body = spot + imp::JOURNAL_FRAME_SIZE;
+            unsigned char const* end = body + len;
+            value_copy v;
+            spot = end;
+            if (len < 1 || (imp::JOURNAL_INSERT != *body && imp::JOURNAL_ERASE != *body)) continue;
+            unsigned char const* p = imp::decode_region(body + 1, end, v.first);
+            if (0 == p || end != payload_codec::decode(p, end, v.second) || !imp::is_valid(v.first)) continue;
+            if (imp::JOURNAL_ERASE == *body && space.find(value_type(v.first, v.second)) == space.end()) {
+                // Cancel the earliest matching insert in this batch.
+                std::size_t i = 0;
+                for ( ; i < ops.size() ; ++i ) {
+                    if (imp::JOURNAL_INSERT == ops[i].first && !ops[i].second
+                        && values[i].first == v.first && values[i].second == v.second
+                    ) break;
+                }
+                if (i < ops.size()) {
+                    ops[i].second = true;
+                    ++zret.erased;
+                    continue;
+                }
+            }
+            ops.push_back(std::make_pair(*body, false));
+            values.push_back(v);
+        }
+
+        typename LAYER::batch_update batch(space);
+        for ( std::size_t i = 0 ; i < ops.size() ; ++i ) {
+            if (ops[i].second) continue;
+            value_type v(values[i].first, values[i].second);
+            if (imp::JOURNAL_INSERT == ops[i].first) {
+                space.insert(v);
+                ++zret.inserted;
+            } else {
+                typename LAYER::iterator target = space.find(v);
+                if (target == space.end()) {
+                    ++zret.missing;
+                } else {
+                    space.erase(target);
+                    ++zret.erased;
+                }
+            }
+        }
+    }
+    return zret;
+}
+
+/** Apply the journal file at @a path to @a space.
+    A journal that does not exist or is empty has nothing to apply, and the
+    result is all zero.
+    @see replay(unsigned char const*, std::size_t, LAYER&)
+    @throws boost::system::system_error if the file exists but cannot be read.
+ */
+template < typename LAYER > replay_result
+replay(
+    char const* path, //!< Path to the journal file.
+    LAYER& space //!< [in,out] Flowspace to update.
+    )
+{
+    std::vector<unsigned char> data;
+    std::ifstream file(path, std::ios::binary);
+    replay_result zret;
+
+    if (!file) return zret;
+    file.seekg(0, std::ios::end);
+    data.resize(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (!data.empty() && !file.read(reinterpret_cast<char*>(&data[0]), data.size())) imp::journal_fail("journal read");
+    return data.empty() ? zret : replay(&data[0], data.size(), space);
+}
+
+}} // namespace flowspace, ngeo
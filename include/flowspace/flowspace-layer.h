@@ -9,16 +9,23 @@
 # include <iostream>
 # include <string>
 # include <vector>
+# include <algorithm>
 # include <fstream>
 # include <sstream>
 # include <boost/tuple/tuple.hpp>
+# include <boost/tuple/tuple_comparison.hpp>
 # include <local/boost_intrusive_ptr.hpp>
 # include <boost/bind.hpp>
+# include <boost/detail/atomic_count.hpp>
+# include <boost/functional/hash.hpp>
 # include <boost/mpl/if.hpp>
 # include <boost/mpl/eval_if.hpp>
 # include <boost/mpl/apply.hpp>
 # include <boost/mpl/identity.hpp>
+# include <boost/mpl/bool.hpp>
+# include <boost/type_traits/alignment_of.hpp>
 # include <ngeo/tuple_ostream_operator.hpp>
+# include <ngeo/to_chars.hpp>
 
 # include <flowspace/flowspace-tuple.h>
 # include <ngeo/interval.hpp>
@@ -45,6 +52,19 @@
     Top level flowspace header file.
  */
 
+/** Maximum number of elements in a layer kept in the small form.
+    A layer with at most this many elements keeps them in a single sorted
+    array rather than a tree, which is much smaller and faster to scan for
+    the sparse nested layers that are typical of upper layers. A layer
+    changes to a tree when it grows past this and back when it shrinks to
+    half of it. Set to 0 to always use a tree.
+    @note Elements in the small form are moved when the layer is changed, so
+    an update invalidates iterators in to the changed layers.
+ */
+# if !defined(NG_FLOWSPACE_SMALL_LAYER)
+#   define NG_FLOWSPACE_SMALL_LAYER 4
+# endif
+
 namespace ngeo { namespace flowspace {
 
 namespace mpl = boost::mpl;
@@ -86,6 +106,54 @@ namespace imp
         return !r.head.is_empty() && is_valid(r.tail);
     }
 
+    /** Combine the hash of a metric value in to @a seed.
+        Metrics are plain value types, so the object representation is hashed.
+     */
+    template < typename T > void hash_metric (
+        std::size_t& seed,
+        T const& v
+        )
+    {
+        unsigned char const* bytes = reinterpret_cast<unsigned char const*>(&v);
+        boost::hash_combine(seed, boost::hash_range(bytes, bytes + sizeof(T)));
+    }
+
+    // Read a single parenthesized interval of a region.
+    template < typename H > bool read_region_element (
+        std::istream& s,
+        H& intv
+        )
+    {
+        char c;
+        return (s >> std::ws >> c) && '(' == c
+            && (s >> intv >> std::ws >> c) && ')' == c
+            ;
+    }
+
+    // Read a region, bottom case. This is the inverse of detail::print.
+    template < typename H > std::istream& read_region (
+        std::istream& s,
+        boost::tuples::cons<H, boost::tuples::null_type> & r
+        )
+    {
+        if (!read_region_element(s, r.head)) s.setstate(std::ios::failbit);
+        return s;
+    }
+
+    // Read a region, upper case. Read our interval, the separator, and ripple down.
+    template < typename H, typename T > std::istream& read_region (
+        std::istream& s,
+        boost::tuples::cons<H,T> & r
+        )
+    {
+        char c;
+        if (read_region_element(s, r.head) && (s >> std::ws >> c) && ',' == c)
+            read_region(s, r.tail);
+        else
+            s.setstate(std::ios::failbit);
+        return s;
+    }
+
     //! Create the "has_flowspace_tag" metafunction.
     BOOST_MPL_HAS_XXX_TRAIT_DEF(flowspace_tag);
     //! Create the "has_metric_type" metafunction.
@@ -111,7 +179,35 @@ namespace imp
     struct member_cursor_mf { template < typename T > struct apply { typedef typename T::cursor type; }; };
     //! Metafunction class to extract the @c metric_type member of a type.
     struct member_metric_type_mf { template < typename T > struct apply { typedef typename T::metric_type type; }; };
+    //! Metafunction class to extract the @c IS_INTERNED member of a type.
+    struct member_is_interned_mf { template < typename T > struct apply { typedef mpl::bool_<T::IS_INTERNED> type; }; };
     //@}
+
+    /** How a bottom layer stores its payloads.
+        By default a payload is stored directly in each element. A payload
+        policy, such as @c interned, specializes this to store something
+        else in the elements and to map it back to the client payload.
+     */
+    template < typename P > struct payload_traits
+    {
+        typedef P value_type; //!< The client payload type, the layer @c mapped_type.
+        typedef P& reference; //!< Client access to a stored payload.
+        //! Set if stored payloads are shared and so are read only for clients.
+        static bool const IS_INTERNED = false;
+        //! Convert a client payload to the stored form.
+        static P const& store(P const& v) { return v; }
+        //! Get the client payload for a stored payload.
+        static reference get(P& p) { return p; }
+        //! Get the client payload for a stored payload.
+        static P const& get(P const& p) { return p; }
+        //! Compare stored payloads to a client payload.
+        struct matcher
+        {
+            P const& m_value; //!< Target payload.
+            matcher(P const& v) : m_value(v) { }
+            bool operator () (P const& p) const { return p == m_value; }
+        };
+    };
     //! @endcond
 
 
@@ -125,7 +221,8 @@ namespace imp
     The @a PAYLOAD is the data associated with each interval. If the @a PAYLOAD
     is an flowspace type, then that flowspace is used as a nested dimension
     of intervals. This allows a flowspace of an arbitrary number of dimensions
-    to be constructed.
+    to be constructed. The @a PAYLOAD of the bottom layer may be a payload
+    policy such as @c interned, in flowspace-intern.h.
  */
 template <typename METRIC, typename PAYLOAD >
 class layer
@@ -143,6 +240,20 @@ public:
      */
     static bool const IS_UPPER = imp::has_flowspace_tag<PAYLOAD>::value;
 
+    /** Maximum number of elements in the small form of a layer.
+        @see NG_FLOWSPACE_SMALL_LAYER
+     */
+    static std::size_t const SMALL_SIZE = NG_FLOWSPACE_SMALL_LAYER;
+
+    /** Compile time constant that indicates whether the bottom layer interns
+        its payloads, in which case payloads are read only through iterators.
+        @see interned
+     */
+    static bool const IS_INTERNED = mpl::eval_if_c<IS_UPPER,
+        mpl::apply<imp::member_is_interned_mf, PAYLOAD>,
+        mpl::bool_<imp::payload_traits<PAYLOAD>::IS_INTERNED>
+    >::type::value;
+
     /** Metric and interval types. We compute these because we want to support using an
         existing interval as the METRIC template argument.
 
@@ -194,14 +305,15 @@ public:
 
     /** The type used to hold the data associated with a key.
         @internal If the payload isn't a flowspace, we just use it directly
-        as our payload. If it's a flowspace, then to get the nesting correct
-        we want to use the mapped_type of that nested flowspace (rather than
-        the flowspace itself) as our mapped_type.
+        as our payload, unless it is a payload policy such as @c interned in
+        which case it is the payload type of the policy. If it's a flowspace,
+        then to get the nesting correct we want to use the mapped_type of that
+        nested flowspace (rather than the flowspace itself) as our mapped_type.
         @note STL compliance
     */
     typedef typename mpl::eval_if_c<IS_UPPER,
         typename mpl::apply<imp::member_mapped_type_mf, PAYLOAD>,
-        typename mpl::identity<PAYLOAD>
+        typename mpl::identity<typename imp::payload_traits<PAYLOAD>::value_type>
     >::type mapped_type;
 
     /** The effective type of values stored in this container.
@@ -228,14 +340,20 @@ protected:
      */
     typedef typename region::inherited interval_cons;
 
+    /** Storage of bottom layer payloads.
+        @note Only meaningful in the bottom layer.
+     */
+    typedef imp::payload_traits<PAYLOAD> payload_traits;
+
     /** Forwarding mapped typed.
-        This is used in @c value_type_ref.
+        This is used in @c value_type_ref. Interned payloads are shared and
+        therefore are not writable.
      */
-    typedef mapped_type& mapped_type_ref;
+    typedef typename mpl::if_c<IS_INTERNED, mapped_type const&, mapped_type&>::type mapped_type_ref;
 
     /** Used by cursor classes to update the iterator mapped_type data.
      */
-    typedef mapped_type* payload_ptr;
+    typedef typename mpl::if_c<IS_INTERNED, mapped_type const*, mapped_type*>::type payload_ptr;
 
     /** Forwarding iteration value type.
         This is used as something that functions as a value type but keeps the
@@ -274,6 +392,8 @@ protected:
         }
     };
 
+    struct small_set; // forward declare for node construction.
+
     /** The nodes used for this instantiation of a layer.
      */
     struct node : public imp::node_base
@@ -300,7 +420,7 @@ protected:
          */
         struct upper_inner_tree_inserter {
             //! Functor operator.
-            static void func (value_type const& v, inner_set & c) {
+            static void const* func (value_type const& v, inner_set & c, bool deferred) {
                 metric_type i_max(v.first.head.max());
                 typename inner_set::iterator spot(c.find(i_max));
                     if (spot == c.end()) {
@@ -308,7 +428,7 @@ protected:
                         spot = c.insert(typename inner_set::value_type(i_max, PAYLOAD())).first;
                     }
                     // ripple insert down
-                spot->second.insert(typename PAYLOAD::value_type(v.first.tail, v.second));
+                return util::insert_lower(spot->second, typename PAYLOAD::value_type(v.first.tail, v.second), deferred);
             }
         };
     	
@@ -316,19 +436,227 @@ protected:
         /** Bottom layer insert.
         */
         struct bottom_inner_tree_inserter {
-            static void func (value_type const& v, inner_set& c) {
-                c.insert(typename inner_set::value_type(v.first.head.max(), v.second));
+            static void const* func (value_type const& v, inner_set& c, bool) {
+                return &c.insert(typename inner_set::value_type(v.first.head.max(), payload_traits::store(v.second)))->second;
+            }
+        };
+
+        /** Upper layer flush.
+            Flush the lower layers of this node.
+         */
+        struct upper_inner_tree_flusher {
+            static void func (inner_set& c) {
+                for ( typename inner_set::iterator spot = c.begin() ; spot != c.end() ; ++spot )
+                    util::flush_lower(spot->second);
             }
         };
+
+        /** Bottom layer flush.
+            There are no lower layers.
+         */
+        struct bottom_inner_tree_flusher {
+            static void func (inner_set&) { }
+        };
+
+        typedef mpl::if_c< IS_UPPER
+                         , upper_inner_tree_flusher
+                         , bottom_inner_tree_flusher
+                         > inner_flusher;
     	
         typedef mpl::if_c< IS_UPPER
                          , upper_inner_tree_inserter
                          , bottom_inner_tree_inserter
                          > inner_inserter;
+
+        /** Upper layer build.
+            Values with the same maximum share an inner element, their lower
+            layer is built from the remainder of each value.
+         */
+        struct upper_inner_tree_builder {
+            //! Functor operator.
+            static void func (value_copy const* first, value_copy const* last, inner_set& c) {
+                typename PAYLOAD::value_group lower;
+                while (first != last) {
+                    metric_type i_max(first->first.head.max());
+                    lower.clear();
+                    for ( ; first != last && !(i_max < first->first.head.max()) ; ++first )
+                        lower.push_back(typename PAYLOAD::value_copy(first->first.tail, first->second));
+                    c.insert(c.end(), typename inner_set::value_type(i_max, PAYLOAD()))->second.build(lower);
+                }
+            }
+        };
+
+        /** Bottom layer build.
+            The values are in order, so each goes at the end.
+         */
+        struct bottom_inner_tree_builder {
+            static void func (value_copy const* first, value_copy const* last, inner_set& c) {
+                for ( ; first != last ; ++first )
+                    c.insert(c.end(), typename inner_set::value_type(first->first.head.max(), payload_traits::store(first->second)));
+            }
+        };
+
+        typedef mpl::if_c< IS_UPPER
+                         , upper_inner_tree_builder
+                         , bottom_inner_tree_builder
+                         > inner_builder;
+
+        /** Upper layer walk.
+            Walk the lower layer with the rest of the location.
+         */
+        struct upper_inner_tree_walker {
+            //! Functor operator.
+            template < typename R, typename F >
+            static void func (PAYLOAD const& p, interval_cons& location, R const& r, F& f) {
+                util::walk_lower(p, location, r, f);
+            }
+        };
+
+        /** Bottom layer walk.
+            The location is complete, pass the element to the client.
+         */
+        struct bottom_inner_tree_walker {
+            template < typename R, typename F >
+            static void func (PAYLOAD const& p, interval_cons&, R const& r, F& f) {
+                f(r, payload_traits::get(p));
+            }
+        };
+
+        typedef mpl::if_c< IS_UPPER
+                         , upper_inner_tree_walker
+                         , bottom_inner_tree_walker
+                         > inner_walker;
+
+        /** Upper layer copy.
+            If @a share is set the lower layers are shared, otherwise they are copied.
+         */
+        struct upper_inner_tree_copier {
+            //! Functor operator.
+            static void func (inner_set const& src, inner_set& dst, bool share) {
+                if (!share) {
+                    dst = src;
+                } else {
+                    for ( typename inner_set::const_iterator spot = src.begin() ; spot != src.end() ; ++spot )
+                        util::share_lower(dst.insert(dst.end(), typename inner_set::value_type(spot->first, PAYLOAD()))->second, spot->second);
+                }
+            }
+        };
+
+        /** Bottom layer copy.
+            Payloads are always copied.
+         */
+        struct bottom_inner_tree_copier {
+            static void func (inner_set const& src, inner_set& dst, bool) {
+                dst = src;
+            }
+        };
+
+        typedef mpl::if_c< IS_UPPER
+                         , upper_inner_tree_copier
+                         , bottom_inner_tree_copier
+                         > inner_copier;
+
+        /** Upper layer content.
+            Lower layers are already interned, so they are identified by their tree.
+            Lower layers are moved with @c swap rather than copied.
+         */
+        struct upper_inner_tree_content {
+            //! Intern a lower layer, return the number replaced.
+            template < typename P >
+            static std::size_t intern (PAYLOAD& p, P& pool) {
+                return util::intern_lower(p, pool);
+            }
+            //! Combine the hash of a lower layer in to @a seed.
+            static void hash (std::size_t& seed, PAYLOAD const& p) {
+                boost::hash_combine(seed, util::identity_of(p));
+            }
+            //! Compare lower layers.
+            static bool equal (PAYLOAD const& lhs, PAYLOAD const& rhs) {
+                return util::identity_of(lhs) == util::identity_of(rhs);
+            }
+            //! Copy the lower layers on the path to @a r if they are shared.
+            static bool unshare (PAYLOAD& p, interval_cons const& r) {
+                return util::unshare_lower(p, r);
+            }
+            /** Construct a lower layer at @a dst that holds the remainder of @a v.
+                @return The stored payload of @a v.
+             */
+            static void const* construct (void* dst, value_type const& v, bool deferred) {
+                return util::insert_lower(*new (dst) PAYLOAD(), typename PAYLOAD::value_type(v.first.tail, v.second), deferred);
+            }
+            /** Add the remainder of @a v to the lower layer @a p. Always done.
+                @return The stored payload of @a v.
+             */
+            static void const* merge (PAYLOAD& p, value_type const& v, bool deferred) {
+                return util::insert_lower(p, typename PAYLOAD::value_type(v.first.tail, v.second), deferred);
+            }
+            //! Move the lower layer @a src to @a dst, leaving @a src empty.
+            static void relocate (void* dst, PAYLOAD& src) {
+                static_cast<PAYLOAD*>(new (dst) PAYLOAD())->swap(src);
+            }
+            //! Copy the lower layer @a src to @a dst, sharing it if @a share is set.
+            static void copy (void* dst, PAYLOAD const& src, bool share) {
+                if (share) util::share_lower(*new (dst) PAYLOAD(), src);
+                else new (dst) PAYLOAD(src);
+            }
+            //! Move the lower layer @a src to the end of @a c as the element for @a max.
+            static void adopt (inner_set& c, metric_type const& max, PAYLOAD& src) {
+                c.insert(c.end(), typename inner_set::value_type(max, PAYLOAD()))->second.swap(src);
+            }
+            //! Flush a lower layer.
+            static void flush (PAYLOAD& p) {
+                util::flush_lower(p);
+            }
+        };
+
+        /** Bottom layer content.
+            The payloads are compared and copied directly.
+         */
+        struct bottom_inner_tree_content {
+            template < typename P >
+            static std::size_t intern (PAYLOAD&, P&) { return 0; }
+            static void hash (std::size_t& seed, PAYLOAD const& p) {
+                boost::hash_combine(seed, p);
+            }
+            static bool equal (PAYLOAD const& lhs, PAYLOAD const& rhs) {
+                return lhs == rhs;
+            }
+            static bool unshare (PAYLOAD&, interval_cons const&) { return false; }
+            static void const* construct (void* dst, value_type const& v, bool) {
+                return new (dst) PAYLOAD(payload_traits::store(v.second));
+            }
+            //! Elements with the same interval are distinct, never merge.
+            static void const* merge (PAYLOAD&, value_type const&, bool) { return 0; }
+            static void relocate (void* dst, PAYLOAD& src) {
+                new (dst) PAYLOAD(src);
+            }
+            static void copy (void* dst, PAYLOAD const& src, bool) {
+                new (dst) PAYLOAD(src);
+            }
+            static void adopt (inner_set& c, metric_type const& max, PAYLOAD& src) {
+                c.insert(c.end(), typename inner_set::value_type(max, src));
+            }
+            static void flush (PAYLOAD&) { }
+        };
+
+        typedef mpl::if_c< IS_UPPER
+                         , upper_inner_tree_content
+                         , bottom_inner_tree_content
+                         > inner_content;
     	
         metric_type m_metric;    //!< The minima for all intervals in this node.
         inner_set m_maxima;  //!< PAYLOAD keyed by interval maximums
         interval_type m_sti;     //!< Interval hull of the tree rooted here.
+        /** Set if @a m_sti or a lower layer may be out of date.
+            If a node is dirty, all of its ancestors are dirty.
+         */
+        bool m_dirty;
+        /** The number of layers that share the tree rooted here.
+            This is used only for the root of a tree, see @c layer::intern.
+            It is separate from the reference count because handles to the
+            node are also held by iterators.
+         */
+        boost::detail::atomic_count m_owners;
 
         //! Get the left child node, if present.
         self* get_left() { return static_cast<self*>(m_left.get()); }
@@ -338,22 +666,164 @@ protected:
         self* get_parent() { return static_cast<self*>(m_parent); }
         //! Get the node next for in order traversal.
         self* get_next() { return static_cast<self*>(m_next); }
+        //! Get the node previous for in order traversal.
+        self* get_prev() { return static_cast<self*>(super::get_prev().get()); }
         
         self *get_leftmost_descendant() { return static_cast<self*>(node_base::get_leftmost_descendant().get()); }
 
-        /*! Construct a node from a value */
-        node(value_type const& v)
+        /** Get an iterator for the last element.
+            @note The inner set is never empty for a node in the tree.
+         */
+        typename inner_set::iterator last() { return --m_maxima.end(); }
+
+        /*! Construct a node from a value, setting @a spot to its stored payload. */
+        node(value_type const& v, void const*& spot)
             : m_metric(v.first.head.min())
             , m_sti(v.first.head)
+            , m_dirty(false)
+            , m_owners(1)
+        {
+            spot = this->inner_insert(v, false);
+        }
+
+        /** Construct a node from values with the same minimum.
+            [@a first, @a last) must not be empty and must be in @c build_order.
+         */
+        node(value_copy const* first, value_copy const* last)
+            : m_metric(first->first.head.min())
+            , m_sti(first->first.head.min(), (last - 1)->first.head.max())
+            , m_dirty(false)
+            , m_owners(1)
+        {
+            inner_builder::type::func(first, last, m_maxima);
+        }
+
+        /** Construct a node from the elements [@a first, @a last) of @a s.
+            The elements must have the same minimum. Their payloads are moved
+            to this node.
+         */
+        node(small_set& s, std::size_t first, std::size_t last)
+            : m_metric(s.interval(first).min())
+            , m_sti(m_metric, s.interval(last - 1).max())
+            , m_dirty(false)
+            , m_owners(1)
+        {
+            for ( ; first < last ; ++first )
+                inner_content::type::adopt(m_maxima, s.interval(first).max(), s.payload(first));
+        }
+
+        /** Copy the local data of a node.
+            The tree structure is not copied, see @c clone. If @a share is set
+            the lower layers are shared with @a that rather than copied.
+         */
+        node(self const& that, bool share)
+            : super()
+            , m_metric(that.m_metric)
+            , m_sti(that.m_sti)
+            , m_dirty(that.m_dirty)
+            , m_owners(1)
+        {
+            inner_copier::type::func(that.m_maxima, m_maxima, share);
+            this->set_color(that.get_color());
+        }
+
+        /** Copy the subtree rooted at this node.
+            The copy has the same shape and colors, so no rebalancing is done.
+            @a last is the in order predecessor of the copied subtree in the copy
+            and is updated to the last node of the copied subtree. If @a share
+            is set the lower layers are shared, otherwise it is a deep copy.
+            @return The root of the copied subtree.
+         */
+        handle clone(
+            self*& last, //!< [in,out] Last node copied
+            bool share //!< Share lower layers
+            )
+        {
+            handle zret(new self(*this, share));
+            if (m_left) zret->set_child(this->get_left()->clone(last, share), LEFT);
+            // Thread the copy in order.
+            if (last) last->m_next = zret.get();
+# if NG_FLOWSPACE_PREV_THREAD
+            zret->m_prev = last;
+# endif
+            last = zret.get();
+            if (m_right) zret->set_child(this->get_right()->clone(last, share), RIGHT);
+            return zret;
+        }
+
+        /** Link nodes in to a balanced tree.
+            @a nodes is @a n nodes in order, not yet in a tree. Nodes at depth
+            @a red are colored red and the rest black, which is valid because
+            every level above @a red is full. The nodes are threaded in order and
+            the subtree hulls computed, as for @c clone.
+            @return The root of the subtree.
+         */
+        static handle link(
+            handle const* nodes, //!< Nodes to link
+            size_t n, //!< Number of nodes
+            int depth, //!< Depth of the subtree root
+            int red, //!< Depth of the red nodes
+            self*& last //!< [in,out] Last node linked
+            )
         {
-            this->inner_insert(v);
+            size_t mid = n / 2;
+            handle zret(nodes[mid]);
+            if (mid) zret->set_child(link(nodes, mid, depth + 1, red, last), LEFT);
+            if (last) last->m_next = zret.get();
+# if NG_FLOWSPACE_PREV_THREAD
+            zret->m_prev = last;
+# endif
+            last = zret.get();
+            if (n - mid - 1) zret->set_child(link(nodes + mid + 1, n - mid - 1, depth + 1, red, last), RIGHT);
+            zret->set_color(depth == red ? RED : BLACK);
+            zret->structure_fixup();
+            return zret;
         }
 
-        //! Add a region/payload to the node
-        void insert (
-            value_type const& v //!< The region
+        /** Add a region/payload to the node
+            @return The stored payload of @a v.
+         */
+        void const* insert (
+            value_type const& v, //!< The region
+            bool deferred        //!< Defer structure fixups in lower layers.
 	    ) {
-            this->inner_insert(v);
+            return this->inner_insert(v, deferred);
+        }
+
+        /** Mark this node as dirty.
+            Ancestors are marked as well, stopping at the first that is already
+            dirty because all of its ancestors must also be dirty.
+         */
+        void mark_dirty() {
+            for ( self* n = this ; n && !n->m_dirty ; n = n->get_parent() )
+                n->m_dirty = true;
+        }
+
+        /** Restore the dirty invariant after a node is inserted in to the tree.
+            A rotation can make a clean node the parent of a dirty one, but only
+            the node that rises in the rotation. That node is always on the path
+            from this node to the root, and after a double rotation it is this
+            node itself, so the path is marked starting at this node.
+         */
+        void propagate_dirty() {
+            for ( self* n = this ; n ; n = n->get_parent() ) {
+                self* lc = n->get_left();
+                self* rc = n->get_right();
+                if ((lc && lc->m_dirty) || (rc && rc->m_dirty)) n->m_dirty = true;
+            }
+        }
+
+        /** Recompute all dirty nodes in the subtree rooted at this node.
+            Children are done first so that the fixups are done bottom up.
+         */
+        void flush() {
+            self* lc = this->get_left();
+            self* rc = this->get_right();
+            if (lc && lc->m_dirty) lc->flush();
+            if (rc && rc->m_dirty) rc->flush();
+            inner_flusher::type::func(m_maxima);
+            this->structure_fixup();
+            m_dirty = false;
         }
 
         //! Erase an interval.
@@ -392,12 +862,15 @@ protected:
             to the inner set, keyed by the right endpoint.
             Otherwise we need to insert the PAYLOAD in to the sub-flowspace
             in the inner set, creating it if necessary.
+            @return The stored payload of @a v.
          */
-        void inner_insert (
-            value_type const& v	//!< The data to insert
+        void const* inner_insert (
+            value_type const& v,	//!< The data to insert
+            bool deferred       //!< Defer structure fixups in lower layers.
         ) {
-            inner_inserter::type::func(v, m_maxima);
+            void const* zret = inner_inserter::type::func(v, m_maxima, deferred);
             m_sti = interval_type(std::min(m_sti.min(), v.first.head.min()), std::max(m_sti.max(), v.first.head.max()));
+            return zret;
         }
 
         /** Co-variant method */
@@ -631,6 +1104,194 @@ protected:
         }
     }; // struct node
 
+    /** Elements of a layer in the small form.
+        This is a single allocation with a header, an array of intervals and an
+        array of payloads. The elements are sorted by the minimum and then the
+        maximum of the interval, elements with the same interval (only in the
+        bottom layer) are in insertion order. A run of elements with the same
+        minimum corresponds to a node in the tree form.
+
+        The capacity is exact so that a set is no larger than needed, and the
+        set is reallocated to add an element if it is full. Because of that,
+        and because elements are shifted by inserts and erases, iterators in
+        to a layer in the small form are invalidated when the layer is changed.
+     */
+    struct small_set
+    {
+        typedef small_set self; //!< Self reference type.
+        typedef typename node::inner_content::type content; //!< Payload operations.
+
+        /** The number of layers that share this set, see @c layer::intern.
+            Unlike a tree this is also the reference count, iterators do not
+            keep the set alive.
+         */
+        boost::detail::atomic_count m_owners;
+        std::size_t m_size; //!< Number of elements.
+        std::size_t m_capacity; //!< Maximum number of elements.
+        bool m_dirty; //!< Set if a lower layer may be out of date.
+
+        //! Create an empty set with room for @a n elements.
+        static self* create(std::size_t n) {
+            return new (::operator new(footprint(n))) self(n);
+        }
+
+        //! Destroy the elements of @a s and free it.
+        static void destroy(self* s) {
+            while (s->m_size) s->destroy_element(--s->m_size);
+            s->~self();
+            ::operator delete(s);
+        }
+
+        interval_type* intervals() { return reinterpret_cast<interval_type*>(reinterpret_cast<char*>(this) + interval_offset()); }
+        interval_type const* intervals() const { return const_cast<self*>(this)->intervals(); }
+        PAYLOAD* payloads() { return reinterpret_cast<PAYLOAD*>(reinterpret_cast<char*>(this) + payload_offset(m_capacity)); }
+        PAYLOAD const* payloads() const { return const_cast<self*>(this)->payloads(); }
+
+        //! Interval of element @a k.
+        interval_type& interval(std::size_t k) { return this->intervals()[k]; }
+        //! Interval of element @a k.
+        interval_type const& interval(std::size_t k) const { return this->intervals()[k]; }
+        //! Payload of element @a k.
+        PAYLOAD& payload(std::size_t k) { return this->payloads()[k]; }
+        //! Payload of element @a k.
+        PAYLOAD const& payload(std::size_t k) const { return this->payloads()[k]; }
+
+        //! First element of the run that contains element @a k.
+        std::size_t run_begin(std::size_t k) const {
+            while (k && this->interval(k - 1).min() == this->interval(k).min()) --k;
+            return k;
+        }
+
+        //! One past the last element of the run that starts at element @a k.
+        std::size_t run_end(std::size_t k) const {
+            std::size_t zret = k + 1;
+            while (zret < m_size && this->interval(zret).min() == this->interval(k).min()) ++zret;
+            return zret;
+        }
+
+        //! The first element that is after @a intv in element order.
+        std::size_t upper_bound(interval_type const& intv) const {
+            std::size_t k = 0;
+            for ( ; k < m_size ; ++k ) {
+                interval_type const& i = this->interval(k);
+                if (intv.min() < i.min() || (intv.min() == i.min() && intv.max() < i.max())) break;
+            }
+            return k;
+        }
+
+        /** Insert @a v as element @a k.
+            There must be room for the element.
+            @return The stored payload of @a v.
+         */
+        void const* insert(std::size_t k, value_type const& v, bool deferred) {
+            assert(m_size < m_capacity);
+            for ( std::size_t j = m_size ; j > k ; --j ) this->relocate(j - 1, this, j);
+            new (this->intervals() + k) interval_type(v.first.head);
+            void const* zret = content::construct(this->payloads() + k, v, deferred);
+            ++m_size;
+            return zret;
+        }
+
+        //! Move the payload @a src to a new element at the end with the interval @a intv.
+        void append(interval_type const& intv, PAYLOAD& src) {
+            assert(m_size < m_capacity);
+            new (this->intervals() + m_size) interval_type(intv);
+            content::relocate(this->payloads() + m_size, src);
+            ++m_size;
+        }
+
+        //! Remove element @a k.
+        void erase(std::size_t k) {
+            this->destroy_element(k);
+            for ( --m_size ; k < m_size ; ++k ) this->relocate(k + 1, this, k);
+        }
+
+        /** Make a set with room for one more element.
+            The elements are moved to the new set and this set is destroyed.
+         */
+        self* grow() {
+            self* zret = create(m_size + 1);
+            for ( std::size_t k = 0 ; k < m_size ; ++k ) this->relocate(k, zret, k);
+            zret->m_size = m_size;
+            zret->m_dirty = m_dirty;
+            m_size = 0;
+            destroy(this);
+            return zret;
+        }
+
+        //! Copy the set. If @a share is set the lower layers are shared.
+        self* copy(bool share) const {
+            self* zret = create(m_size);
+            for ( ; zret->m_size < m_size ; ++zret->m_size ) {
+                new (zret->intervals() + zret->m_size) interval_type(this->interval(zret->m_size));
+                content::copy(zret->payloads() + zret->m_size, this->payload(zret->m_size), share);
+            }
+            zret->m_dirty = m_dirty;
+            return zret;
+        }
+
+        //! Recompute the lower layers.
+        void flush() {
+            for ( std::size_t k = 0 ; k < m_size ; ++k ) content::flush(this->payload(k));
+            m_dirty = false;
+        }
+
+        //! Check the element order.
+        bool validate() const {
+            bool valid = 0 < m_size && m_size <= m_capacity;
+            for ( std::size_t k = 1 ; valid && k < m_size ; ++k ) {
+                interval_type const& a = this->interval(k - 1);
+                interval_type const& b = this->interval(k);
+                valid = a.min() < b.min() || (a.min() == b.min() && (a.max() < b.max() || (!IS_UPPER && a.max() == b.max())));
+                if (!valid) std::cout << "Small set out of order at " << k << " " << a << " " << b << "\n";
+            }
+            return valid;
+        }
+
+    private:
+        explicit small_set(std::size_t n) : m_owners(1), m_size(0), m_capacity(n), m_dirty(false) { }
+
+        static std::size_t align(std::size_t n, std::size_t a) { return (n + a - 1) / a * a; }
+        static std::size_t interval_offset() { return align(sizeof(self), boost::alignment_of<interval_type>::value); }
+        static std::size_t payload_offset(std::size_t n) { return align(interval_offset() + n * sizeof(interval_type), boost::alignment_of<PAYLOAD>::value); }
+        static std::size_t footprint(std::size_t n) { return payload_offset(n) + n * sizeof(PAYLOAD); }
+
+        //! Destroy element @a k in place.
+        void destroy_element(std::size_t k) {
+            this->payloads()[k].~PAYLOAD();
+            this->intervals()[k].~interval_type();
+        }
+
+        //! Move element @a from to the unconstructed element @a to of @a dst.
+        void relocate(std::size_t from, self* dst, std::size_t to) {
+            new (dst->intervals() + to) interval_type(this->interval(from));
+            content::relocate(dst->payloads() + to, this->payload(from));
+            this->destroy_element(from);
+        }
+
+        // Not copyable, use @c copy.
+        small_set(self const&);
+        self& operator = (self const&);
+    };
+
+    /** Starting position for a cursor.
+        This is a node in the tree form, or the first element of a run in the
+        small form.
+     */
+    struct position
+    {
+        typename node::handle m_node; //!< Node, if in the tree form.
+        small_set* m_set; //!< Set, if in the small form.
+        std::size_t m_pos; //!< First element of the run in @a m_set.
+
+        //! Default constructor, no position.
+        position() : m_set(0), m_pos(0) { }
+        //! Position at a node.
+        position(typename node::handle const& n) : m_node(n), m_set(0), m_pos(0) { }
+        //! Position at the run starting at element @a k of @a s.
+        position(small_set* s, std::size_t k) : m_set(s), m_pos(k) { }
+    };
+
     struct cursor; // must forward declare to get friendship right with gcc.
 
     /** Interval iteration.
@@ -641,7 +1302,7 @@ protected:
         typedef local_iterator self; //!< Self reference type
 
         //! Default constructor
-        local_iterator()
+        local_iterator() : m_set(0), m_pos(0)
         {
         }
 
@@ -653,7 +1314,8 @@ protected:
         //! Equality
         bool operator == ( self const& that )
         {
-            return m_node == that.m_node && (!m_node || m_spot == that.m_spot);
+            return m_node == that.m_node && m_set == that.m_set
+                && (m_set ? m_pos == that.m_pos : (!m_node || m_spot == that.m_spot));
         }
 
         //! Inequality
@@ -665,6 +1327,8 @@ protected:
     protected:
         typename node::handle m_node; //!< Current node
         typename node::inner_set::iterator m_spot; //!< Inner tree location
+        small_set* m_set; //!< Current set, in the small form.
+        std::size_t m_pos; //!< Element in @a m_set.
         interval_type m_value; //!< Dereference data
 
         /** Construct for a specific location.
@@ -673,8 +1337,30 @@ protected:
             typename node::handle const& n, //!< Iteration node
             typename node::inner_set::iterator spot //!< Inner tree location
             )
-            : m_node(n), m_spot(spot), m_value(n->get_metric(), spot->first)
+            : m_node(n), m_spot(spot), m_set(0), m_pos(0), m_value(n->get_metric(), spot->first)
+        {
+        }
+
+        /** Construct for an element in the small form.
+         */
+        local_iterator(
+            small_set* s, //!< Set
+            std::size_t k //!< Element in @a s
+            )
+            : m_set(s), m_pos(k), m_value(s->interval(k))
+        {
+        }
+
+        //! Test if this refers to an interval.
+        bool is_valid() const { return m_node || m_set; }
+
+        //! Payload of the interval.
+        PAYLOAD& payload() const { return m_set ? m_set->payload(m_pos) : m_spot->second; }
+
+        //! Starting position for a cursor at this interval.
+        position get_position() const
         {
+            return m_set ? position(m_set, m_set->run_begin(m_pos)) : position(m_node);
         }
 
         friend class layer;
@@ -689,7 +1375,14 @@ protected:
         )
     {
         local_iterator spot;
-        if (m_root) {
+        if (m_small) {
+            for ( std::size_t k = 0 ; k < m_small->m_size && !(intv.min() < m_small->interval(k).min()) ; ++k ) {
+                if (m_small->interval(k) == intv) {
+                    spot = local_iterator(m_small, k);
+                    break;
+                }
+            }
+        } else if (m_root) {
             // Search for the node with the identical minimum as the interval.
             typename node::handle n;
             typename node::direction d;
@@ -709,10 +1402,17 @@ protected:
         @return The first node for the interval or @c nil if there is
         no node that intersects @a intv.
      */
-    typename node::handle find_intersecting(
+    position find_intersecting(
         interval_type const& intv    //!< interval to match
         )
     {
+        if (m_small) {
+            // The first run that intersects contains the first element that intersects.
+            for ( std::size_t k = 0 ; k < m_small->m_size && !(intv.max() < m_small->interval(k).min()) ; ++k ) {
+                if (intv ^ m_small->interval(k)) return position(m_small, m_small->run_begin(k));
+            }
+            return position();
+        }
         typename node::handle candidate; // The best, if any, we've seen so far
         typename node::handle n(m_root); // current working node
         while (n) {
@@ -756,6 +1456,56 @@ protected:
         return candidate;
     }
 
+    /** Find the first node in the tree with a metric not less than @a m.
+        @return The node or @c nil if every node has a smaller metric.
+     */
+    position find_not_less(
+        metric_type const& m //!< Lower bound for the node metric.
+        )
+    {
+        typename node::handle n;
+        if (m_small) {
+            std::size_t k = 0;
+            while (k < m_small->m_size && m_small->interval(k).min() < m) ++k;
+            return k < m_small->m_size ? position(m_small, k) : position();
+        } else if (m_root) {
+            typename node::direction d;
+            boost::tie(n,d) = m_root->search(boost::bind(&node::compare_metric, _1, m));
+            // If the search ended going right, @a m would have been the right child
+            // of @a n, therefore the in order successor of @a n is the first larger node.
+            if (node::RIGHT == d) n = n->get_next();
+        }
+        return n;
+    }
+
+    /** Find the last node in the tree that overlaps an interval.
+        @return The last node for the interval or @c nil if there is
+        no node that intersects @a intv.
+     */
+    position find_last_intersecting(
+        interval_type const& intv    //!< interval to match
+        )
+    {
+        typename node::handle n;
+        if (m_small) {
+            for ( std::size_t k = m_small->m_size ; k-- > 0 ; ) {
+                if (intv ^ m_small->interval(k)) return position(m_small, m_small->run_begin(k));
+            }
+        } else if (m_root) {
+            typename node::direction d;
+            // Find the last node with a metric not greater than the interval maximum,
+            // no node after it can intersect.
+            boost::tie(n,d) = m_root->search(boost::bind(&node::compare_metric, _1, intv.max()));
+            if (node::LEFT == d) n = n->get_prev();
+            if (n && !n->intersects_local(intv)) {
+                cursor_base c(n);
+                c.rscan(intv);
+                n = c.m_node;
+            }
+        }
+        return n;
+    }
+
     /*  We have paired classes for iteration. There is the standard
         @c iterator class, which presents an STL compliant iterator
         API. Internally, because of the nesting that goes on with the
@@ -782,21 +1532,31 @@ protected:
     struct cursor_base {
         typename node::handle m_node;    //!< the current outer node
         typename node::inner_set::iterator m_inner;    //!< the current inner set node
+        /** The set, if the layer is in the small form.
+            In that case the current run of elements with the same minimum,
+            [@a m_first, @a m_end), takes the place of the current node and
+            @a m_pos the place of the inner iterator.
+         */
+        small_set* m_set;
+        std::size_t m_first; //!< First element of the current run.
+        std::size_t m_end; //!< One past the last element of the current run.
+        std::size_t m_pos; //!< The current element.
 
         /** Default constructor.
             Constructs an invalid cursor.
          */
-        cursor_base() { }
+        cursor_base() : m_set(0), m_first(0), m_end(0), m_pos(0) { }
 
         /** Standard constructor.
             Sub classes will handle setting the cursor to a valid region.
          */
         cursor_base(
-            typename node::handle const& n      //!< initial node for the iteration
+            position const& n      //!< initial node for the iteration
             )
-            : m_node(n)
+            : m_node(n.m_node), m_set(n.m_set), m_first(0), m_end(0), m_pos(0)
         {
-            if (n) m_inner = n->end();
+            if (m_set) this->enter_run(n.m_pos);
+            else if (m_node) m_inner = m_node->end();
         }
 
         //! Return if this cursor is valid.
@@ -805,7 +1565,13 @@ protected:
             /*  Validity is tracked by whether the inner tree iterator is valid.
                 That in turn is true if the iterator isn't at the end of the inner tree.
              */
-            return m_node && m_inner != m_node->end();
+            return m_set ? m_pos < m_end : m_node && m_inner != m_node->end();
+        }
+
+        //! Return if this cursor is at a node, even if not at an interval in it.
+        bool has_node() const
+        {
+            return m_node || m_set;
         }
 
         //! Mark cursor as invalid
@@ -813,24 +1579,103 @@ protected:
         {
             m_node = 0;
             m_inner = typename node::inner_set::iterator();
+            m_set = 0;
         }
 
-        /** Move forward to the next interval that intersects the query region.
-            If an interval is found, @c m_node and @c m_inner are set appropriately.
-            Otherwise, @c m_node is set to @c NIL.
-            @note This always changes the value of @c m_node.
-            @return @c true if an interval was found, @c false otherwise.
-        */
-        bool scan(
-            interval_cons const& region //!< [in] Query region
+        //! Get the minimum of the intervals in the current node.
+        metric_type const& node_metric() const
+        {
+            return m_set ? m_set->interval(m_first).min() : m_node->get_metric();
+        }
+
+        //! Get the maximum of the current interval.
+        metric_type const& inner_max() const
+        {
+            return m_set ? m_set->interval(m_pos).max() : m_inner->first;
+        }
+
+        //! Get the payload of the current interval.
+        PAYLOAD& inner_payload() const
+        {
+            return m_set ? m_set->payload(m_pos) : m_inner->second;
+        }
+
+        //! Test the intersection of an interval and the current node.
+        bool intersects_local(
+            interval_type const& intv    //!< interval to check
+            ) const
+        {
+            return m_set
+                ? intv ^ interval_type(this->node_metric(), m_set->interval(m_end - 1).max())
+                : m_node->intersects_local(intv)
+                ;
+        }
+
+        //! Set the inner cursor to the first interval with a maximum not less than @a m.
+        void seek_inner(
+            metric_type const& m    //!< interval maxima
             )
         {
-            // We should only call this method if the current node is valid.
-            assert(m_node);
-            /*  Scan forward in the outer tree. We have to be careful
-                because we may hit non-intersecting nodes with
-                valid nodes further down the chain.
-             */
+            if (m_set) {
+                for ( m_pos = m_first ; m_pos < m_end && m_set->interval(m_pos).max() < m ; ++m_pos )
+                    ;
+            } else {
+                m_inner = m_node->begin(m);
+            }
+        }
+
+        //! Set the inner cursor to the last interval of the current node.
+        void seek_last_inner()
+        {
+            if (m_set) m_pos = m_end - 1;
+            else m_inner = m_node->last();
+        }
+
+        //! Move the inner cursor forward one element.
+        void advance_inner()
+        {
+            if (m_set) ++m_pos;
+            else ++m_inner;
+        }
+
+        //! Make the run starting at element @a k of the set the current node, with no current interval.
+        void enter_run(
+            std::size_t k   //!< First element of the run
+            )
+        {
+            m_first = k;
+            m_pos = m_end = m_set->run_end(k);
+        }
+
+        /** Move forward to the next interval that intersects the query region.
+            If an interval is found, @c m_node and @c m_inner are set appropriately.
+            Otherwise, @c m_node is set to @c NIL.
+            @note This always changes the value of @c m_node.
+            @return @c true if an interval was found, @c false otherwise.
+        */
+        bool scan(
+            interval_cons const& region //!< [in] Query region
+            )
+        {
+            // We should only call this method if the current node is valid.
+            assert(this->has_node());
+            if (m_set) {
+                // There is no tree to skip, just check each run.
+                while (m_end < m_set->m_size) {
+                    this->enter_run(m_end);
+                    if (this->intersects_local(region.head)) {
+                        this->seek_inner(region.head.min());
+                        return true;
+                    }
+                    if (this->node_metric() > region.head.max()) break;
+                }
+                m_set = 0;
+                return false;
+            }
+            /*  Scan forward in the outer tree. We have to be careful
+                because we may hit non-intersecting nodes with
+                valid nodes further down the chain.
+             */
             m_node = m_node->get_next();
             // loop until we run out of nodes or find an intersecting one
             while (m_node && !m_node->intersects_local(region.head)) {
@@ -868,6 +1713,63 @@ protected:
             return m_node;
         }
 
+        /** Move backward to the previous node that intersects the query interval.
+            This is the reverse of @c scan. If a node is found, @c m_node and
+            @c m_inner are set to the last interval in that node.
+            Otherwise, @c m_node is set to @c NIL.
+            @return @c true if an interval was found, @c false otherwise.
+         */
+        bool rscan(
+            interval_type const& intv //!< [in] Query interval for this layer
+            )
+        {
+            assert(this->has_node());
+            if (m_set) {
+                while (m_first) {
+                    m_end = m_first;
+                    m_first = m_set->run_begin(m_first - 1);
+                    if (this->intersects_local(intv)) {
+                        m_pos = m_end - 1;
+                        return true;
+                    }
+                }
+                m_set = 0;
+                return false;
+            }
+            m_node = m_node->get_prev();
+            while (m_node && !m_node->intersects_local(intv)) {
+                if (!m_node->intersects_tree(intv)) {
+                    // Nothing in this subtree intersects the query. Because of the reverse
+                    // in order traversal the right subtree has already been searched,
+                    // skip the left subtree by moving to the left most descendant.
+                    m_node = m_node->get_leftmost_descendant();
+                }
+                m_node = m_node->get_prev();
+            }
+
+            if (m_node) m_inner = m_node->last();
+            return m_node;
+        }
+
+        /** Move the inner cursor back one element.
+            If that would move before the first interval in the node that
+            intersects @a intv, the cursor is made invalid.
+         */
+        void retreat_inner(
+            interval_type const& intv //!< [in] Query interval for this layer
+            )
+        {
+            if (m_set) {
+                std::size_t k = m_pos;
+                this->seek_inner(intv.min());
+                m_pos = k == m_pos ? m_end : k - 1;
+            } else if (m_inner == m_node->begin(intv.min())) {
+                m_inner = m_node->end();
+            } else {
+                --m_inner;
+            }
+        }
+
         /** Set the inner cursor.
             Use @c is_valid to check for success.
          */
@@ -877,14 +1779,63 @@ protected:
             payload_ptr&             //!< [ignored]
             )
         {
-            m_inner = m_node->begin(region.head.min());
+            this->seek_inner(region.head.min());
+        }
+
+        /** Set the inner cursor to resume iteration at @a mark.
+            The current node must be the first node with a metric not less
+            than the minimum of @a mark. If it does not intersect the query
+            region the cursor is scanned forward, in which case @c m_node
+            may become @c NIL.
+            @return @c true if the cursor is at the interval of @a mark in this
+            layer, @c false if it is past that interval.
+         */
+        bool fill_resume_inner(
+            interval_cons const& region, //!< [in] Query region
+            interval_cons const& mark    //!< [in] Resume location
+            )
+        {
+            bool exact = false;
+            if (!this->intersects_local(region.head)) {
+                // Any node found by the scan has a strictly larger metric than @a mark.
+                this->scan(region);
+            } else if (this->node_metric() == mark.head.min()) {
+                this->seek_inner(std::max(region.head.min(), mark.head.max()));
+                exact = this->is_valid() && this->inner_max() == mark.head.max();
+            } else {
+                this->seek_inner(region.head.min());
+            }
+            return exact;
+        }
+
+        /** Compute the position of the current element among elements with an identical region.
+            @return The number of elements with the same interval that precede the current element.
+         */
+        std::size_t inner_rank() const
+        {
+            std::size_t zret = 0;
+            if (m_set) {
+                for ( std::size_t k = m_pos ; k > m_first && m_set->interval(k - 1).max() == this->inner_max() ; --k )
+                    ++zret;
+            } else {
+                typename node::inner_set::iterator spot(m_node->begin(m_inner->first));
+                for ( ; spot != m_inner ; ++spot ) ++zret;
+            }
+            return zret;
         }
 
         /** Load client data for this layer.
          */
         void load_client_data(interval_cons& location) {
             // Just load the interval data for the layer. Sub classes will handle everything else.
-            location.head = interval_type(m_node->get_metric(), m_inner->first);
+            location.head = interval_type(this->node_metric(), this->inner_max());
+        }
+
+        //! Test if this cursor is at the same element of this layer as @a that.
+        bool same_position(cursor_base const& that) const
+        {
+            return m_node == that.m_node && m_set == that.m_set
+                && (m_set ? m_pos == that.m_pos : (!m_node || m_inner == that.m_inner));
         }
     };
 
@@ -901,27 +1852,35 @@ protected:
         bottom_cursor_variant() : super() { }
         //! Construct cursor to refer to node @a n.
         bottom_cursor_variant(
-            typename node::handle const& n  //!< initial node for the iteration
+            position const& n  //!< initial node for the iteration
             ) : super(n)
         {
         }
 
         /** Fill the inner cursor with an exact match only.
+            If @a target is not @c NULL the element whose payload is stored
+            there is preferred, see @c entry_handle.
          */
         void fill_exact(
             key_type const& r,            //!< [in] Target region
             mapped_type const& p,       //!< [in] Target payload
+            void const* target,         //!< [in] Stored payload of the target, or @c NULL
             interval_cons& location,    //!< [out] Storage for current region
             payload_ptr& data           //!< [out] Storage for current payload
             )
         {
+            typename payload_traits::matcher match(p);
+            if (target && this->seek_stored(r.head.max(), target, match)) {
+                this->load_client_data(location, data);
+                return;
+            }
             // At the bottom, it's a multimap so we have to check successive
             // elements until 
             // - we run off the end
             // - we go past the matching interval maxima
             // - we find a matching payload
-            for ( ; this->is_valid() && super::m_inner->first == r.head.max() ; ++super::m_inner ) {
-                if (super::m_inner->second == p) {
+            for ( ; this->is_valid() && this->inner_max() == r.head.max() ; this->advance_inner() ) {
+                if (match(this->inner_payload())) {
                     this->load_client_data(location, data);
                     return;
                 }
@@ -929,6 +1888,69 @@ protected:
             this->invalidate();
         }
 
+        /** Look for the element with the stored payload @a target by address.
+            This avoids comparing the payloads of elements with the same
+            interval. The element may have been moved and another put in its
+            place, so the payload at that address is checked with @a match
+            before the cursor is moved.
+            @return @c true if the cursor was moved to the element, @c false
+            if it was not found or did not match, in which case the cursor is
+            not changed.
+         */
+        bool seek_stored(
+            metric_type const& m,   //!< [in] Interval maximum of the element
+            void const* target,     //!< [in] Stored payload of the element
+            typename payload_traits::matcher const& match //!< [in] Payload check
+            )
+        {
+            if (super::m_set) {
+                for ( std::size_t k = super::m_pos ; k < super::m_end && super::m_set->interval(k).max() == m ; ++k ) {
+                    if (&super::m_set->payload(k) == target) {
+                        if (!match(super::m_set->payload(k))) return false;
+                        super::m_pos = k;
+                        return true;
+                    }
+                }
+            } else if (this->is_valid()) {
+                typename node::inner_set::iterator limit(super::m_node->m_maxima.upper_bound(m));
+                for ( typename node::inner_set::iterator spot = super::m_inner ; spot != limit ; ++spot ) {
+                    if (&spot->second == target) {
+                        if (!match(spot->second)) return false;
+                        super::m_inner = spot;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        /** Fill the inner cursor to resume iteration at @a mark.
+            Because this layer is a multimap, @a rank elements with an identical
+            region are skipped.
+            @note Caller must verify success via @c is_valid.
+         */
+        void fill_resume(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons const& mark,      //!< [in] Resume location
+            std::size_t rank,               //!< [in] Duplicates to skip at @a mark
+            interval_cons&,                 //!< [ignored]
+            payload_ptr&                    //!< [ignored]
+            )
+        {
+            if (this->fill_resume_inner(region, mark)) {
+                for ( ; rank && this->is_valid() && this->inner_max() == mark.head.max() ; --rank )
+                    this->advance_inner();
+            }
+        }
+
+        /** Compute the position of the current element among elements with an identical region.
+            @return The number of elements with the same region that precede the current element.
+         */
+        std::size_t rank() const
+        {
+            return this->is_valid() ? this->inner_rank() : 0;
+        }
+
         /** Load client data for this layer.
          */
         void load_client_data(
@@ -937,7 +1959,7 @@ protected:
             )
         {
             this->super::load_client_data(location); // do standard interval data
-            data = &super::m_inner->second; // At the bottom, get the payload
+            data = &payload_traits::get(this->inner_payload()); // At the bottom, get the payload
         }
 
         /** Try to make the cursor valid, moving forward as necessary.
@@ -971,11 +1993,54 @@ protected:
             )
         {
             if (this->is_valid()) {
-                ++super::m_inner;
+                this->advance_inner();
                 this->validate_forward(region,location,data);
             }
         }
 
+        /** Set the inner cursor to the last element of the current node.
+         */
+        void fill_last_inner_cursor(
+            interval_cons const&,   //!< [ignored]
+            interval_cons&,         //!< [ignored]
+            payload_ptr&            //!< [ignored]
+            )
+        {
+            this->seek_last_inner();
+        }
+
+        /** Try to make the cursor valid, moving backward as necessary.
+            This is the reverse of @c validate_forward.
+            @return @c true if the cursor is now valid, @c false otherwise.
+         */
+        bool validate_backward(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons& location,        //!< [out] Current region
+            payload_ptr& data               //!< [out] Payload for current region
+            )
+        {
+            bool valid = false;
+            if (this->is_valid() || this->rscan(region.head)) {
+                valid = true;
+                this->load_client_data(location, data);
+            }
+            return valid;
+        }
+
+        /** Move cursor to previous region.
+         */
+        void prev(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons& location,        //!< [out] Current region
+            payload_ptr& data               //!< [out] Payload for current region
+            )
+        {
+            if (this->is_valid()) {
+                this->retreat_inner(region.head);
+                this->validate_backward(region,location,data);
+            }
+        }
+
         /** Delete the element to which the cursor refers.
             @return The new root node after the erase, or NIL if the root node didn't change.
             @internal Ugly style of return, but we don't have good access to the root node
@@ -985,7 +2050,10 @@ protected:
         {
             bool valid = false;
             typename node::handle root;
-            if (this->is_valid()) {
+            if (super::m_set) {
+                // The layer removes the set if it is now empty.
+                if (this->is_valid()) super::m_set->erase(super::m_pos);
+            } else if (this->is_valid()) {
                 super::m_node->erase(super::m_inner);
                 if (super::m_node->is_empty()) {
                     root = super::m_node->remove();
@@ -996,11 +2064,24 @@ protected:
             }
             return std::make_pair(root, valid);
         }
+
+        /** Replace the payload of the element to which the cursor refers.
+            @return The stored payload.
+         */
+        void const* assign_payload(
+            mapped_type const& p //!< [in] New payload
+            ) const
+        {
+            PAYLOAD& zret = this->inner_payload();
+            zret = payload_traits::store(p);
+            return &zret;
+        }
+
         /** Equality operator.
             @internal Have to check everything because MSVC 8.0 verifies iterator containers.
          */
         bool operator == (self const& rhs) const {
-            return super::m_node == rhs.m_node && ( !super::m_node || super::m_inner == rhs.m_inner);
+            return this->same_position(rhs);
         }
     };
 
@@ -1018,7 +2099,7 @@ protected:
         upper_cursor_variant() : super() { }
         //! Construct to refer to a specific node.
         upper_cursor_variant(
-            typename node::handle const& n          //!< initial node for the iteration
+            position const& n          //!< initial node for the iteration
             ) : super(n)
         {
         }
@@ -1039,7 +2120,7 @@ protected:
             payload_ptr& data               //!< [out] Payload for current region
             )
         {
-            m_lower = util::make_lower_cursor(super::m_inner->second, r, location, data);
+            m_lower = util::make_lower_cursor(this->inner_payload(), r, location, data);
         }
 
         /** Load the inner and lower cursors, if possible.
@@ -1066,13 +2147,14 @@ protected:
         void fill_exact(
             key_type const& r,              //!< [in] Target region
             mapped_type const& p,           //!< [in] Target payload
+            void const* target,             //!< [in] Stored payload of the target, or @c NULL
             interval_cons& location,        //!< [out] Storage for current region
             payload_ptr& data               //!< [out] Storage for current payload
             )
         {
             if (this->is_valid()) {
                 // This layer is OK, ripple.
-                m_lower = util::make_lower_cursor_exact(super::m_inner->second, r, p, location, data);
+                m_lower = util::make_lower_cursor_exact(this->inner_payload(), r, p, target, location, data);
                 // Check just the lower layer to see if the ripple worked.
                 if (m_lower.is_valid()) { // yes, load up the layer interval data.
                     this->load_client_data(location);
@@ -1082,6 +2164,36 @@ protected:
             }
         }
 
+        /** Load the inner and lower cursors to resume iteration at @a mark.
+            If this layer is at the interval of @a mark the lower cursor resumes
+            as well, otherwise the lower cursor starts at its beginning.
+            @note Caller must verify success via @c is_valid.
+         */
+        void fill_resume(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons const& mark,      //!< [in] Resume location
+            std::size_t rank,               //!< [in] Duplicates to skip at @a mark
+            interval_cons& location,        //!< [out] Current region
+            payload_ptr& data               //!< [out] Payload for current region
+            )
+        {
+            bool exact = this->fill_resume_inner(region, mark);
+            if (this->is_valid()) {
+                if (exact)
+                    m_lower = util::make_lower_cursor_resume(this->inner_payload(), region, mark, rank, location, data);
+                else
+                    this->fill_lower_cursor(region, location, data);
+            }
+        }
+
+        /** Compute the position of the current element among elements with an identical region.
+            @internal Only the bottom layer can have duplicates, so this just ripples down.
+         */
+        std::size_t rank() const
+        {
+            return m_lower.rank();
+        }
+
         /** Try to make the cursor valid, moving forward as necessary.
             Load client data if successful.
             @return @c true if the cursor is now valid, @c false otherwise.
@@ -1095,7 +2207,7 @@ protected:
             )
         {
             // Scan while we still have nodes left in this layer.
-            while (super::m_node && !m_lower.is_valid()) {
+            while (this->has_node() && !m_lower.is_valid()) {
                 bool should_do_fill = false;
                 // If @a fill gets set to @true in either clause, then it should
                 // be the case that @a m_inner is valid but @a m_lower is bad.
@@ -1107,7 +2219,7 @@ protected:
                         represented by a later inner node is a superset of all previous
                         inner nodes.
                     */
-                    ++super::m_inner;
+                    this->advance_inner();
                     // Set @a should_do_fill if the increment didn't move past the last interval in this node.
                     should_do_fill = this->is_valid();
                 } else {
@@ -1152,6 +2264,63 @@ protected:
             }
         }
 
+        /** Load the inner cursor with the last element of the current node and
+            the lower cursor with the last intersecting element in that element.
+            @note Caller must verify success via @c is_valid.
+         */
+        void fill_last_inner_cursor(
+            interval_cons const& r,     //!< [in] Query region
+            interval_cons& location,    //!< [out] Current region
+            payload_ptr& data           //!< [out] Payload for current region
+            )
+        {
+            this->seek_last_inner();
+            m_lower = util::make_lower_cursor_last(this->inner_payload(), r, location, data);
+        }
+
+        /** Try to make the cursor valid, moving backward as necessary.
+            This is the reverse of @c validate_forward.
+            @return @c true if the cursor is now valid, @c false otherwise.
+         */
+        bool validate_backward(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons& location,        //!< [out] Current region
+            payload_ptr& data               //!< [out] Payload for current region
+            )
+        {
+            while (this->has_node() && !m_lower.is_valid()) {
+                bool should_do_fill = false;
+                if (this->is_valid()) {
+                    this->retreat_inner(region.head);
+                    should_do_fill = this->is_valid();
+                } else {
+                    should_do_fill = this->rscan(region.head);
+                }
+                if (should_do_fill)
+                    m_lower = util::make_lower_cursor_last(this->inner_payload(), region, location, data);
+            }
+
+            if (this->is_valid()) {
+                this->load_client_data(location);
+                return true;
+            }
+            return false;
+        }
+
+        /** Move cursor to previous intersecting region.
+         */
+        void prev(
+            interval_cons const& region,    //!< [in] Query region
+            interval_cons& location,        //!< [out] Current region
+            payload_ptr& data           //!< [out] Payload for current region
+            )
+        {
+            if (this->is_valid()) {
+                m_lower.prev(region.tail,location.tail,data);
+                this->validate_backward(region,location,data);
+            }
+        }
+
         /** Delete the element to which the cursor refers.
             @return A pair of a node and a flag. If the flag is set, the node is the new root node.
             @internal Ugly style of return, but we don't have good access to the root node
@@ -1162,26 +2331,41 @@ protected:
             bool valid = false;
             typename node::handle root;
             if (this->super::is_valid()) {
-                util::erase_lower(super::m_inner->second, m_lower);
+                util::erase_lower(this->inner_payload(), m_lower);
                 // clean up if necessary
-                if (super::m_inner->second.is_empty()) {
-                    super::m_node->erase(super::m_inner);
-                    if (super::m_node->is_empty()) {
-                        root = super::m_node->remove();
-                        valid = true;
+                if (this->inner_payload().is_empty()) {
+                    if (super::m_set) {
+                        // The layer removes the set if it is now empty.
+                        super::m_set->erase(super::m_pos);
                     } else {
-                        super::m_node->ripple_structure_fixup();
+                        super::m_node->erase(super::m_inner);
+                        if (super::m_node->is_empty()) {
+                            root = super::m_node->remove();
+                            valid = true;
+                        } else {
+                            super::m_node->ripple_structure_fixup();
+                        }
                     }
                 }
             }
             return std::make_pair(root, valid);
         }
 
+        /** Replace the payload of the element to which the cursor refers.
+            @return The stored payload.
+         */
+        void const* assign_payload(
+            mapped_type const& p //!< [in] New payload
+            ) const
+        {
+            return m_lower.assign_payload(p);
+        }
+
         /** Equality operator.
             @internal Have to check everything because MSVC 8.0 verifies iterator containers.
          */
         bool operator == (self const& rhs) const {
-            return super::m_node == rhs.m_node && ( !super::m_node || ( super::m_inner == rhs.m_inner && m_lower == rhs.m_lower));
+            return this->same_position(rhs) && ( !this->has_node() || m_lower == rhs.m_lower);
         }
     };
     //@}
@@ -1196,6 +2380,8 @@ protected:
 		     , upper_cursor_variant
 		     , bottom_cursor_variant
 		     > cursor_super;
+    //! Marker type to select reverse iteration constructors.
+    struct reverse_tag { };
     /** This is the internal implementation class for iteration over the
         flowspace. Clients will find its API difficult and tricky to use.
         Clients should use the STL standard @c iterator class instead.
@@ -1222,14 +2408,14 @@ protected:
         /** Standard constructor.
          */
         cursor(
-            typename node::handle const& n, //!< initial node for the iteration
+            position const& n, //!< initial node for the iteration
             interval_cons const& region,    //!< the iteration region
             interval_cons& location,        //!< where to store current location data
             payload_ptr& data           //!< where to store client data
             )
             : super(n)
         {
-            if (super::m_node) {
+            if (this->has_node()) {
                 this->fill_inner_cursor(region, location, data);
                 this->validate_forward(region, location, data);
             }
@@ -1242,14 +2428,57 @@ protected:
             local_iterator const& spot,     //!< matching interval in this layer
             key_type const& r,              //!< [in] Target region
             mapped_type const& p,           //!< [in] Target payload
+            void const* target,             //!< [in] Stored payload of the target, or @c NULL
             interval_cons& location,        //!< [out] Storage for current region
             payload_ptr& data           //!< [out] Storage for current payload
             )
-            : super(spot.m_node)
+            : super(spot.get_position())
+        {
+            if (this->has_node()) {
+                if (super::m_set) super::m_pos = spot.m_pos;
+                else super::m_inner = spot.m_spot;
+                this->fill_exact(r, p, target, location, data);
+            }
+            // otherwise the cursor is left in the invalid state
+        }
+
+        /** Reverse constructor.
+            The cursor is placed on the last element in @a region.
+         */
+        cursor(
+            position const& n, //!< last node intersecting @a region in this layer
+            interval_cons const& region,    //!< the iteration region
+            interval_cons& location,        //!< where to store current location data
+            payload_ptr& data,          //!< where to store client data
+            reverse_tag                 //!< [ignored]
+            )
+            : super(n)
+        {
+            if (this->has_node()) {
+                this->fill_last_inner_cursor(region, location, data);
+                this->validate_backward(region, location, data);
+            }
+            // otherwise the cursor is left in the invalid state
+        }
+
+        /** Resume constructor.
+            The cursor is placed on the first element in @a region that is not
+            lexicographically before @a mark.
+         */
+        cursor(
+            position const& n, //!< first node not less than @a mark in this layer
+            interval_cons const& region,    //!< the iteration region
+            interval_cons const& mark,      //!< [in] Resume location
+            std::size_t rank,               //!< [in] Duplicates to skip at @a mark
+            interval_cons& location,        //!< where to store current location data
+            payload_ptr& data           //!< where to store client data
+            )
+            : super(n)
         {
-            if (super::m_node) {
-                super::m_inner = spot.m_spot;
-                this->fill_exact(r, p, location, data);
+            if (this->has_node()) {
+                this->fill_resume(region, mark, rank, location, data);
+                // The resume fill may have scanned off the end of the layer.
+                if (this->has_node()) this->validate_forward(region, location, data);
             }
             // otherwise the cursor is left in the invalid state
         }
@@ -1284,6 +2513,8 @@ protected:
     //! Utility class for bottom layer.
     struct bottom_util
     {
+        //! There is no lower layer to intern.
+        struct lower_pool { };
     };
 
     //! Utility class for upper layers.
@@ -1296,6 +2527,74 @@ protected:
         // super class typedefs, while MSC does, making any dependence on that
         // not feasible.
 
+        //! Intern pool for the next lower layer.
+        typedef typename PAYLOAD::intern_pool lower_pool;
+
+        //! Ripple an insert request to lower layers.
+        static void const* insert_lower(
+            PAYLOAD& space, //!< Next lower space
+            typename PAYLOAD::value_type const& v, //!< Value to insert
+            bool deferred //!< Defer structure fixups
+            )
+        {
+            return static_cast<upper_util&>(space).insert_value(v, deferred);
+        }
+
+        //! Ripple a flush request to lower layers.
+        static void flush_lower(
+            PAYLOAD& space //!< Next lower space
+            )
+        {
+            space.flush();
+        }
+
+        //! Ripple a walk to lower layers.
+        template < typename R, typename F >
+        static void walk_lower(
+            PAYLOAD const& space, //!< Next lower space
+            typename layer::interval_cons& location, //!< [out] Storage for location of the current element
+            R const& r, //!< Complete location of the current element
+            F& f //!< Client functor
+            )
+        {
+            static_cast<upper_util const&>(space).walk(location.tail, r, f);
+        }
+
+        //! Ripple an intern request to lower layers.
+        static std::size_t intern_lower(
+            PAYLOAD& space, //!< Next lower space
+            lower_pool& pool //!< Intern pool for @a space
+            )
+        {
+            return static_cast<upper_util&>(space).intern(pool);
+        }
+
+        //! Make a lower layer share the content of another.
+        static void share_lower(
+            PAYLOAD& space, //!< Next lower space
+            PAYLOAD const& that //!< Space to share
+            )
+        {
+            static_cast<upper_util&>(space).share(that);
+        }
+
+        //! Get the identity of the content of a lower layer, its tree or set.
+        static void const* identity_of(
+            PAYLOAD const& space //!< Next lower space
+            )
+        {
+            return static_cast<upper_util const&>(space).identity();
+        }
+
+        //! Ripple an unshare request to lower layers.
+        static bool unshare_lower(
+            PAYLOAD& space, //!< Next lower space
+            typename layer::interval_cons const& r //!< Location of the target element
+            )
+        {
+            return static_cast<upper_util&>(space).unshare_path(r.tail);
+        }
+
         //! Ripple an erase request to lower layers.
         static void erase_lower(
             PAYLOAD& space, //!< Next lower space
@@ -1323,22 +2622,61 @@ protected:
             PAYLOAD& space,             //!< [in] Flowspace for the cursor
             typename layer::interval_cons const& r,     //!< [in] Query region
             typename layer::mapped_type const& p,       //!< [in] Target payload
+            void const* target,         //!< [in] Stored payload of the target, or @c NULL
             typename layer::interval_cons& location,    //!< [out] Storage for location of the current element
             payload_ptr& data           //!< [out] Payload of the current element
             )
         {
             typename PAYLOAD::cursor lc;
-            lc = static_cast<upper_util&>(space).make_cursor_exact(r.tail, p, location.tail, data);
+            lc = static_cast<upper_util&>(space).make_cursor_exact(r.tail, p, target, location.tail, data);
             return lc;
         }
-    };
-    //!@}
 
-    //! The effective utility class.
-    typedef typename mpl::if_c<IS_UPPER, upper_util, bottom_util>::type util;
-    
-    /** Make a cursor for this layer that intersects a region.
-        @note Internal use only, because some of the argument types
+        //! Create a cursor in the next lower layer at the last intersecting element.
+        static typename PAYLOAD::cursor make_lower_cursor_last(
+            PAYLOAD& space,             //!< [in] Flowspace for the cursor
+            typename layer::interval_cons const& r,     //!< [in] Query region
+            typename layer::interval_cons& location,    //!< [out] Storage for location of the current element
+            payload_ptr& data           //!< [out] Payload of the current element
+            )
+        {
+            typename PAYLOAD::cursor lc;
+            lc = static_cast<upper_util&>(space).make_cursor_last(r.tail, location.tail, data);
+            return lc;
+        }
+
+        //! Create a cursor in the next lower layer resuming at a location.
+        static typename PAYLOAD::cursor make_lower_cursor_resume(
+            PAYLOAD& space,             //!< [in] Flowspace for the cursor
+            typename layer::interval_cons const& r,     //!< [in] Query region
+            typename layer::interval_cons const& mark,  //!< [in] Resume location
+            std::size_t rank,           //!< [in] Duplicates to skip at @a mark
+            typename layer::interval_cons& location,    //!< [out] Storage for location of the current element
+            payload_ptr& data           //!< [out] Payload of the current element
+            )
+        {
+            typename PAYLOAD::cursor lc;
+            lc = static_cast<upper_util&>(space).make_cursor_resume(r.tail, mark.tail, rank, location.tail, data);
+            return lc;
+        }
+    };
+    //!@}
+
+    //! The effective utility class.
+    typedef typename mpl::if_c<IS_UPPER, upper_util, bottom_util>::type util;
+
+    /** The distinct layers found by @c intern for this layer and those below it.
+        Each is held by a layer that shares it, indexed by the hash of its content.
+     */
+    struct intern_pool
+    {
+        typedef std::multimap<std::size_t, layer> table; //!< Layers by content hash.
+        table m_trees; //!< Distinct layers of this layer.
+        typename util::lower_pool m_lower; //!< Pool for the next lower layer.
+    };
+    
+    /** Make a cursor for this layer that intersects a region.
+        @note Internal use only, because some of the argument types
         are not public.
      */
     cursor make_cursor(
@@ -1351,16 +2689,43 @@ protected:
         return spot;
     }
 
+    /** Make a cursor for this layer at the last element that intersects a region.
+     */
+    cursor make_cursor_last(
+        interval_cons const& r,     //!< [in] Target region
+        interval_cons& l,           //!< [out] Storage for current region
+        payload_ptr& d          //!< [in,out] Reference to payload
+        )
+    {
+        cursor spot(this->find_last_intersecting(r.head), r, l, d, reverse_tag());
+        return spot;
+    }
+
     /** Make a cursor for this layer that exactly matches a region.
      */
     cursor make_cursor_exact(
         key_type const& r,          //!< [in] Target region
         mapped_type const& p,       //!< [in] Target payload
+        void const* target,         //!< [in] Stored payload of the target, or @c NULL
         interval_cons& location,    //!< [out] Storage for current region
         payload_ptr& data       //!< [in,out] Reference to payload
         )
     {
-        cursor spot(this->find(r.head), r, p, location, data);
+        cursor spot(this->find(r.head), r, p, target, location, data);
+        return spot;
+    }
+
+    /** Make a cursor for this layer that resumes iteration at a location.
+     */
+    cursor make_cursor_resume(
+        interval_cons const& r,     //!< [in] Query region
+        interval_cons const& mark,  //!< [in] Resume location
+        std::size_t rank,           //!< [in] Duplicates to skip at @a mark
+        interval_cons& location,    //!< [out] Storage for current region
+        payload_ptr& data       //!< [in,out] Reference to payload
+        )
+    {
+        cursor spot(this->find_not_less(mark.head.min()), r, mark, rank, location, data);
         return spot;
     }
 
@@ -1373,15 +2738,133 @@ protected:
         bool flag;
         boost::tie(r, flag) = spot.erase();
         if (flag) m_root = r;
+        if (m_small && !m_small->m_size) this->release();
+        else if (m_root && SMALL_SIZE / 2) this->demote(SMALL_SIZE / 2);
     }
 	
 public:
+    /** Continuation token for resuming a region query.
+        This records an iteration position as a value, the region of the element
+        (the minimum and maximum in each layer) and, because the bottom layer may hold
+        several elements with the same region, the position among those elements.
+        It holds no reference in to the flowspace and so remains usable across
+        modifications and can be written to and read from a stream.
+
+        Resuming with a token yields the first element of the query region that
+        is not lexicographically before the recorded position. If that element
+        was erased in the meantime, iteration continues with its successor.
+
+        @see iterator::get_continuation
+        @see layer::resume
+     */
+    class continuation
+    {
+    public:
+        typedef continuation self; //!< Self reference type.
+
+        /** Default constructor.
+            This is the token for the end of an iteration.
+         */
+        continuation() : m_rank(0) { }
+
+        //! Test if this token marks the end of an iteration.
+        bool is_end() const { return !imp::is_valid(m_location); }
+
+        //! Get the region of the element for the token.
+        key_type const& get_region() const { return m_location; }
+
+        //! Equality.
+        bool operator == ( self const& that ) const
+        {
+            return m_location == that.m_location && m_rank == that.m_rank;
+        }
+        //! Inequality.
+        bool operator != ( self const& that ) const { return !(*this == that); }
+
+        /** Write the token to a stream.
+            The format is the region followed by '#' and the rank.
+         */
+        friend LOCAL std::ostream& operator << (std::ostream& s, self const& c)
+        {
+            ngeo::detail::print(s, c.m_location);
+            return s << " #" << c.m_rank;
+        }
+
+        /** Read a token from a stream.
+            The stream fail bit is set if the input isn't a valid token.
+         */
+        friend LOCAL std::istream& operator >> (std::istream& s, self& c)
+        {
+            char sep;
+            self tmp;
+            if (imp::read_region(s, tmp.m_location) && (s >> std::ws >> sep) && '#' == sep && (s >> tmp.m_rank))
+                c = tmp;
+            else
+                s.setstate(std::ios::failbit);
+            return s;
+        }
+
+    protected:
+        key_type m_location; //!< Region of the element.
+        std::size_t m_rank; //!< Position among elements with the same region.
+
+        friend class layer;
+    };
+
+    /** Handle to an element, returned by @c insert.
+        The handle stays valid until the element is erased, and can be used
+        to @c erase or @c update the element without searching for it by
+        payload.
+
+        The handle holds a copy of the value of the element, including the
+        payload, so each handle costs as much as the payload to copy and
+        store. For large payloads use @c interned, for which the copy is an
+        id and payloads are compared by id.
+
+        The handle also holds the location of the payload in the bottom
+        layer. This is only a hint. Elements can move, such as when a small
+        layer changes or a shared tree is copied, and another element can
+        take the location. The payload there is always compared with the
+        payload in the handle, and if it does not match the element is found
+        by its value instead. A match on the hint avoids comparing the
+        payloads of the other elements with the same region. If there are
+        several identical elements any one of them may be used.
+     */
+    class entry_handle
+    {
+    public:
+        typedef entry_handle self; //!< Self reference type.
+
+        //! Default constructor, refers to no element.
+        entry_handle() : m_spot(0) { }
+
+        //! Test if this refers to an element.
+        bool is_valid() const { return 0 != m_spot; }
+
+        //! Get the value of the element.
+        value_copy const& get_value() const { return m_value; }
+
+    protected:
+        //! Construct for the element @a v with stored payload @a spot.
+        entry_handle(value_type const& v, void const* spot) : m_value(v.first, v.second), m_spot(spot) { }
+
+        value_copy m_value; //!< Value of the element, used to check and find it.
+        void const* m_spot; //!< Last known location of the stored payload, a hint only.
+
+        friend class layer;
+    };
+
     /** Iterator for region queries.
         The value type for the iterator is a pair.
         The @c first element is the stored region (not the query region).
         The @c second element is the value stored with that region.
+
+        The iterator can be moved in either direction. Because an end iterator
+        does not refer to a query region it cannot be decremented. Instead, use
+        @c layer::rbegin to get an iterator for the last element of a query region
+        and decrement until the iterator is equal to @c layer::rend.
      */
-    class iterator : public std::iterator<std::forward_iterator_tag, value_type_ref> {	
+    class iterator : public std::iterator<std::bidirectional_iterator_tag, value_type_ref> {	
     private:
         region m_region;    //!< The query region
         value_type_ref m_data;  //!< Client data object for dereference
@@ -1399,7 +2882,7 @@ public:
 	    /** Construct to refer the specified node.
          */
     	iterator(
-            typename node::handle const& n, //!< Starting node
+            position const& n, //!< Starting node
             region const& r                //!< the region over which to iterate
 	    )
             : m_region(r)
@@ -1414,16 +2897,48 @@ public:
          */
         iterator(
             local_iterator const& spot, //!< Local interval
-            typename layer::value_type const& v //!< Target element data
+            key_type const& r, //!< Target region
+            mapped_type const& p, //!< Target payload
+            void const* target //!< Stored payload of the target, or @c NULL
         )
             : m_region(layer::all())
             , m_data(m_default_payload)
             , m_ptr(&m_default_payload)
-            , m_cursor(spot, v.first, v.second, const_cast<region&>(m_data.first), m_ptr)
+            , m_cursor(spot, r, p, target, const_cast<region&>(m_data.first), m_ptr)
         {
             this->update_payload_reference(m_data.first); // regiion is set by m_cursor constructor.
         }
 
+        /** Construct to refer to the last element of a region.
+         */
+        iterator(
+            position const& n, //!< Last intersecting node
+            region const& r,                //!< the region over which to iterate
+            reverse_tag tag                 //!< Reverse iteration marker
+        )
+            : m_region(r)
+            , m_data(m_default_payload)
+            , m_ptr(&m_default_payload)
+            , m_cursor(n, r, const_cast<region&>(m_data.first), m_ptr, tag)
+        {
+            this->update_payload_reference(m_data.first); // region is set by m_cursor constructor.
+        }
+
+        /** Constructor to resume a region query.
+         */
+        iterator(
+            position const& n, //!< First node not less than the token
+            region const& r,                //!< the region over which to iterate
+            continuation const& c           //!< Resume location
+        )
+            : m_region(r)
+            , m_data(m_default_payload)
+            , m_ptr(&m_default_payload)
+            , m_cursor(n, r, c.m_location, c.m_rank, const_cast<region&>(m_data.first), m_ptr)
+        {
+            this->update_payload_reference(m_data.first); // region is set by m_cursor constructor.
+        }
+
         /** Rewrite reference in @a m_data to refer to the same instance as @a m_ptr.
          */
         void update_payload_reference(region const& r) {
@@ -1441,8 +2956,12 @@ public:
              *  should be much cheaper than a pair of heap operations. It is not
              *  permitted to directly construct the reference member so we
              *  can't avoid the copy that way either.
+             *  @a r is often @a m_data.first, which is dead once the placement
+             *  new starts, so it must be copied out first. Optimized builds
+             *  otherwise can read garbage for the region.
              */
-            new (&m_data) value_type_ref(r, *m_ptr);
+            region tmp(r);
+            new (&m_data) value_type_ref(tmp, *m_ptr);
         }
 
     public:
@@ -1469,6 +2988,24 @@ public:
             ++*this;
             return old;
         }
+
+        //! Prefix decrement operator
+        iterator& operator -- () {
+            region r;
+            m_ptr = &m_default_payload;
+            m_cursor.prev(m_region, r, m_ptr);
+            this->update_payload_reference(r);
+
+            return *this;
+        }
+
+        //! Postfix decrement operator
+        iterator operator -- (int)
+        {
+            iterator old(*this);
+            --*this;
+            return old;
+        }
         
         //! Assignment
         self& operator = ( self const& that )
@@ -1493,6 +3030,20 @@ public:
         //! Dereference operator
         value_type_ref const * operator -> () const { return &m_data; }
 
+        /** Get a continuation token for the current position.
+            The token for an end iterator is an end token.
+            @see layer::resume
+         */
+        continuation get_continuation() const
+        {
+            continuation zret;
+            if (m_cursor.is_valid()) {
+                zret.m_location = m_data.first;
+                zret.m_rank = m_cursor.rank();
+            }
+            return zret;
+        }
+
         /** Print text describing the iterator state on a stream.
          */
         std::ostream& print(std::ostream& s) const {
@@ -1504,7 +3055,7 @@ public:
     };
 
     //! Iterator for const flowspace.
-    class const_iterator : public std::iterator<std::forward_iterator_tag, value_type_ref const>
+    class const_iterator : public std::iterator<std::bidirectional_iterator_tag, value_type_ref const>
     {
     private:
         typename layer::iterator m_spot; //!< Real iterator.
@@ -1549,6 +3100,19 @@ public:
             ++m_spot;
             return copy;
         }
+        //! pre-decrement
+        self& operator-- ()
+        {
+            --m_spot;
+            return *this;
+        }
+        //! post-decrement
+        self operator-- (int)
+        {
+            self copy(*this);
+            --m_spot;
+            return copy;
+        }
         //! Equality
         bool operator == ( self const& that ) const
         {
@@ -1575,6 +3139,9 @@ public:
         //! Dereference operator
         value_type_ref const* operator -> () { return m_spot.operator->(); }
 
+        //! Get a continuation token for the current position.
+        continuation get_continuation() const { return m_spot.get_continuation(); }
+
         /** Print text describing the iterator state on a stream.
          */
         std::ostream& print(std::ostream& s) const {
@@ -1585,13 +3152,49 @@ public:
 
     //! Default constructor
     /*! Constructs an empty layer. */
-    layer()
+    layer() : m_small(0), m_deferred(0)
     {
     }
 
+    /** Copy constructor.
+        This is a deep copy, the new layer shares no nodes with @a that, except
+        for trees shared by @c intern. Those are immutable and so are shared by
+        the copy as well.
+        The tree shape is copied directly so the cost is linear.
+     */
+    layer(self const& that) : m_small(0), m_deferred(0)
+    {
+        if (that.is_shared()) {
+            this->share(that);
+        } else if (that.m_root) {
+            node* last = 0;
+            m_root = that.m_root->clone(last, false);
+        } else if (that.m_small) {
+            m_small = that.m_small->copy(false);
+        }
+    }
+
+    //! Assignment, a deep copy.
+    self& operator = (self const& that)
+    {
+        if (this != &that) {
+            self tmp(that);
+            this->swap(tmp);
+        }
+        return *this;
+    }
+
+    //! Exchange contents with @a that.
+    void swap(self& that)
+    {
+        m_root.swap(that.m_root);
+        std::swap(m_small, that.m_small);
+    }
+
     //! Destructor
     ~layer()
     {
+        this->release();
     }
 
     /** Return a region that covers the entire flowspace */
@@ -1605,7 +3208,7 @@ public:
     //! Check if the flowspace is empty.
     bool is_empty() const
     {
-        return !m_root;
+        return !m_root && !m_small;
     }
 
     /** Standard iterator.
@@ -1630,7 +3233,8 @@ public:
      */
     iterator begin(region const& r)
     {
-        typename node::handle n = this->find_intersecting(r.head);
+        this->flush();
+        position n = this->find_intersecting(r.head);
         return iterator(n,r);
     }
     //! Overload for user convenience (const version).
@@ -1639,6 +3243,72 @@ public:
         return const_iterator(const_cast<self*>(this)->begin(r));
     }
 
+    /** Reverse region query iterator.
+        This returns an iterator that refers to the last region in the
+        lexicographically ordered set of regions that intersect @a r.
+        Decrementing the iterator moves toward the first region.
+     */
+    iterator rbegin(region const& r)
+    {
+        this->flush();
+        return iterator(this->find_last_intersecting(r.head), r, reverse_tag());
+    }
+    //! Overload for user convenience (const version).
+    const_iterator rbegin(region const& r) const
+    {
+        return const_iterator(const_cast<self*>(this)->rbegin(r));
+    }
+    //! Reverse iterator over the entire flowspace.
+    iterator rbegin()
+    {
+        return this->rbegin(this->all());
+    }
+    //! Overload for user convenience (const version).
+    const_iterator rbegin() const
+    {
+        return const_iterator(const_cast<self*>(this)->rbegin());
+    }
+
+    /** Reverse query region iterator end.
+        This is the value of an iterator decremented past the first region.
+        @note This is identical to @c end.
+     */
+    iterator rend()
+    {
+        return iterator();
+    }
+    //! Overload for user convenience (const version).
+    const_iterator rend() const
+    {
+        return const_iterator();
+    }
+
+    /** Resume a region query.
+        @a c is a token from @c iterator::get_continuation for an iteration over
+        the query region @a r. This returns an iterator that refers to the first
+        region in the query set that is not lexicographically before the token.
+        The cost is logarithmic in each layer, independent of how far the
+        original iteration had progressed.
+        @note The flowspace may be modified between obtaining the token and
+        resuming, although iteration is only consistent for elements that are
+        not modified in the meantime.
+     */
+    iterator resume(
+        region const& r,        //!< Query region
+        continuation const& c   //!< Resume location
+        )
+    {
+        if (c.is_end()) return this->end();
+        this->flush();
+        position n = this->find_not_less(c.m_location.head.min());
+        return iterator(n, r, c);
+    }
+    //! Overload for user convenience (const version).
+    const_iterator resume(region const& r, continuation const& c) const
+    {
+        return const_iterator(const_cast<self*>(this)->resume(r, c));
+    }
+
     /** Query region iterator.
         This returns a query region iterator that is past the end of the
         query region set.
@@ -1680,7 +3350,8 @@ public:
         ( value_type const& v //!< Element data to find
         )
     {
-        return iterator(this->find(v.first.head), v);
+        this->flush();
+        return iterator(this->find(v.first.head), v.first, v.second, 0);
     }
     //! Overload for user covenience (const version)
     const_iterator find
@@ -1689,38 +3360,228 @@ public:
     {
         return const_iterator(const_cast<self*>(this)->find(v));
     }
+
+    /** Locate the element for a handle.
+        @return An iterator for the element, or the end iterator if @a h is
+        not valid.
+     */
+    iterator find
+        ( entry_handle const& h //!< Handle for the element
+        )
+    {
+        if (!h.is_valid()) return this->end();
+        this->flush();
+        return iterator(this->find(h.m_value.first.head), h.m_value.first, h.m_value.second, h.m_spot);
+    }
+    //! Overload for user covenience (const version)
+    const_iterator find
+        ( entry_handle const& h //!< Handle for the element
+        ) const
+    {
+        return const_iterator(const_cast<self*>(this)->find(h));
+    }
     
     /** Add an interval with data to the flowspace.
-        @return Indeterminate value.
+        @note This invalidates iterators in to any layer kept in the small
+        form that is changed, see @c NG_FLOWSPACE_SMALL_LAYER. The same is
+        true for @c erase.
+        @return A handle for the new element.
      */
-    bool insert(
+    entry_handle insert(
         value_type const& v //!< The region to insert
         )
     {
-        assert(imp::is_valid(v.first));
-        if (! m_root) {
-            m_root = new node(v);
-            m_root->set_color(node::BLACK);
+        return entry_handle(v, this->insert_value(v, m_deferred > 0));
+    }
+
+    /** Call @a f for every element, in lexicographic order.
+        @a f is called with the region and the payload of each element. This
+        walks the trees directly without the overhead of a query iterator, for
+        bulk processing of the entire flowspace.
+        @note The flowspace must not be modified by @a f.
+     */
+    template < typename F > void for_each(F& f) const
+    {
+        region r;
+        this->walk(static_cast<interval_cons&>(r), r, f);
+    }
+
+    /** Order of values for @c build.
+        This is by the minimum and then the maximum of the first interval.
+     */
+    struct build_order {
+        //! Functor operator.
+        bool operator () (value_copy const& lhs, value_copy const& rhs) const {
+            return lhs.first.head.min() < rhs.first.head.min()
+                || (!(rhs.first.head.min() < lhs.first.head.min()) && lhs.first.head.max() < rhs.first.head.max())
+                ;
+        }
+    };
+
+    /** Replace the contents with @a values in a single build step.
+        The result is the same as clearing the flowspace and inserting the
+        elements of @a values in order, but the tree is built directly in
+        balanced form with no rebalancing or fixups, and the lower layers are
+        built the same way. The cost after sorting is linear.
+
+        @a values is stable sorted in to @c build_order, so values with the
+        same interval keep their relative order. The sort is skipped if
+        @a values is already in that order.
+
+        If there are few enough values for the small form they are inserted.
+     */
+    void build(
+        value_group& values //!< [in,out] Values for the flowspace
+        )
+    {
+        build_order order;
+        typename node::handle root;
+        std::vector<typename node::handle> nodes;
+
+        for ( size_t i = 1 ; i < values.size() ; ++i ) {
+            if (order(values[i], values[i-1])) {
+                std::stable_sort(values.begin(), values.end(), order);
+                break;
+            }
+        }
+        if (values.size() <= SMALL_SIZE) {
+            self tmp;
+            for ( size_t i = 0 ; i < values.size() ; ++i ) {
+                assert(imp::is_valid(values[i].first));
+                tmp.insert_value(value_type(values[i].first, values[i].second), false);
+            }
+            this->swap(tmp);
+            return;
+        }
+        // One node for each distinct minimum.
+        for ( size_t i = 0 ; i < values.size() ; ) {
+            size_t start = i;
+            for ( ; i < values.size() && !(values[start].first.head.min() < values[i].first.head.min()) ; ++i )
+                assert(imp::is_valid(values[i].first));
+            nodes.push_back(new node(&values[start], &values[0] + i));
+        }
+        root = link_nodes(nodes);
+        this->release();
+        m_root.swap(root);
+    }
+
+    void erase(iterator const& spot)
+    {
+        // The tree must be clean before it is restructured.
+        this->flush();
+        if (spot == this->end()) return;
+        /*  If the element is in a shared tree, the trees on the path to it are
+            copied and the element erased from the copy. The cursor refers to
+            the original, so the element must be found again.
+         */
+        if (this->unshare_path(spot->first)) {
+            // The original is still held by the layers that share it.
+            value_type v(spot->first, spot->second);
+            this->erase(this->find(v).m_cursor);
         } else {
-            typename node::handle n;
-            typename node::direction d;
+            this->erase(spot.m_cursor);
+        }
+    }
 
-            // Find insert location
-            boost::tie(n, d) = m_root->search(boost::bind(&node::compare_metric, _1, v.first.head.min()));
-            if (node::NONE == d) { // already an outer tree node for this metric, add this value to that node.
-                n->insert(v);
-                n->ripple_structure_fixup();
-            } else { // Not in the tree, but this node should be the parent
-                m_root = boost::dynamic_pointer_cast<node>(n->insert_child(new node(v), d));
+    /** Erase the element for @a h.
+        The handle, and any copies of it, are no longer valid.
+     */
+    void erase(entry_handle const& h)
+    {
+        this->erase(this->find(h));
+    }
+
+    /** Replace the payload of the element for @a h with @a p.
+        The region is not changed, so no structure is updated. @a h is updated
+        and remains valid.
+        @return @c true if the element was found, @c false otherwise.
+     */
+    bool update(
+        entry_handle& h, //!< [in,out] Handle for the element
+        mapped_type const& p //!< [in] New payload
+        )
+    {
+        bool zret = false;
+        if (h.is_valid()) {
+            // Shared trees are copied first, the payload must not change in other layers.
+            this->flush();
+            this->unshare_path(h.m_value.first);
+            iterator spot(this->find(h));
+            if (spot != this->end()) {
+                h.m_spot = spot.m_cursor.assign_payload(p);
+                h.m_value.second = p;
+                zret = true;
             }
         }
+        return zret;
+    }
 
-        return true;
+    /** Share identical sub-layers.
+        Upper layers hold a nested flowspace for each interval, and in typical
+        use many of these have the same content. This finds the nested
+        flowspaces with identical content, in every layer, and makes each set
+        of them share a single tree or small set. Lower layers are done first
+        so that an upper flowspace compares equal only if its lower layers are
+        already shared.
+
+        A shared tree or small set is immutable. An @c insert or @c erase that modifies a
+        shared flowspace first copies the top level of its tree, so the cost
+        is proportional to the size of that flowspace and not the layers
+        below it, which remain shared. Copies of this flowspace share the
+        shared trees as well. Sharing is only among the sub-layers of this
+        flowspace and its copies, and a later @c intern will find sharing
+        lost by updates.
+
+        The payload type must have equality and @c boost::hash.
+
+        @note A payload in a shared tree must not be modified through an iterator,
+        because that changes it for every flowspace that shares the tree. Use
+        @c erase and @c insert instead.
+
+        @return The number of sub-layers that were changed to share a tree.
+     */
+    std::size_t intern()
+    {
+        intern_pool pool;
+        this->flush();
+        return this->intern_lower_layers(pool.m_lower);
     }
 
-    void erase(iterator const& spot)
+    /** Scope for a batch of updates.
+        While an instance exists, inserts in to @a l do not update the cached
+        subtree data of the ancestors of the modified nodes. Those nodes are only
+        marked and are recomputed once, bottom up, when the scope ends. This
+        avoids redoing the same fixups in the upper part of the tree for every
+        insert. The deferral applies to the lower layers as well.
+
+        Queries (@c begin, @c rbegin, @c find, @c resume) and @c erase are
+        permitted in the scope but force a @c flush first, so a batch should
+        be organized to avoid them.
+
+        Scopes can be nested, the flush is done when the outermost scope ends.
+     */
+    class batch_update
     {
-        this->erase(spot.m_cursor);
+    public:
+        //! Start a batch for the flowspace @a l.
+        explicit batch_update(layer& l) : m_layer(l) { ++m_layer.m_deferred; }
+        //! End the batch, recomputing the deferred fixups.
+        ~batch_update() { if (0 == --m_layer.m_deferred) m_layer.flush(); }
+    private:
+        layer& m_layer; //!< Target flowspace.
+
+        // Not copyable.
+        batch_update(batch_update const&);
+        batch_update& operator = (batch_update const&);
+    };
+
+    /** Recompute any cached data deferred by a @c batch_update.
+        @note This is constant time if there is nothing to recompute.
+     */
+    void flush()
+    {
+        if (m_root && m_root->m_dirty) m_root->flush();
+        else if (m_small && m_small->m_dirty) m_small->flush();
     }
 
     //! Write iterator to stream.
@@ -1741,18 +3602,370 @@ public:
         return s << vt.first << " = " << vt.second;
     }
 
+    /** Write value to a buffer as text.
+        This is the same text as stream output, for use with @c ngeo::text_writer.
+     */
+    friend LOCAL char* to_chars(char* first, char* last, value_type_ref const& vt)
+    {
+        if (0 != (first = to_chars(first, last, vt.first))
+            && 0 != (first = ngeo::detail::copy_chars(first, last, " = ", 3))
+        )
+            first = to_chars(first, last, vt.second);
+        return first;
+    }
+
     std::ostream& print(std::ostream & s, int indent)
     {
+        if (m_small) {
+            for ( std::size_t k = 0 ; k < m_small->m_size ; ++k ) {
+                for ( int i = 0 ; i < indent ; ++i ) s << '-';
+                s << "Interval=" << m_small->interval(k) << '\n';
+            }
+            return s;
+        }
     	return m_root->print(s, indent, 0, 0);
     }
     
     bool validate()
     {
+        this->flush();
+        if (m_small) return m_small->validate();
         return !m_root || m_root->validate();
     }
 
 protected:
     typename node::handle m_root; //!< The root of the tree
+    small_set* m_small; //!< The elements in the small form, if there is no tree.
+    int m_deferred; //!< Depth of @c batch_update scopes.
+
+    /** Link @a nodes, which are in order, in to a balanced tree.
+        @return The root of the tree, or @c NIL if @a nodes is empty.
+     */
+    static typename node::handle link_nodes(
+        std::vector<typename node::handle> const& nodes //!< Nodes for the tree
+        )
+    {
+        typename node::handle root;
+        if (!nodes.empty()) {
+            node* last = 0;
+            int red = 0; // Depth of the last level, which is full only if this ends up empty.
+            for ( size_t n = nodes.size() + 1 ; n > 1 ; n >>= 1 ) ++red;
+            root = node::link(&nodes[0], nodes.size(), 0, red, last);
+        }
+        return root;
+    }
+
+    /** Add @a v in the small form.
+        @return The stored payload of @a v, or @c NULL if the layer is full in
+        which case nothing is done.
+     */
+    void const* insert_small(
+        value_type const& v, //!< The region to insert
+        bool deferred        //!< Defer structure fixups in lower layers
+        )
+    {
+        interval_type const& intv = v.first.head;
+        std::size_t k = m_small ? m_small->upper_bound(intv) : 0;
+        void const* zret = 0;
+        // Add to the lower layer of an existing element if possible.
+        if (k && m_small->interval(k - 1) == intv)
+            zret = node::inner_content::type::merge(m_small->payload(k - 1), v, deferred);
+        if (!zret) {
+            if ((m_small ? m_small->m_size : 0) >= SMALL_SIZE) return 0;
+            if (!m_small) m_small = small_set::create(1);
+            else if (m_small->m_size == m_small->m_capacity) m_small = m_small->grow();
+            zret = m_small->insert(k, v, deferred);
+        }
+        if (deferred) m_small->m_dirty = true;
+        return zret;
+    }
+
+    /** Change from the small form to a tree.
+        The payloads are moved to the nodes.
+     */
+    void promote()
+    {
+        std::vector<typename node::handle> nodes;
+        // The nodes are built clean.
+        if (m_small->m_dirty) m_small->flush();
+        for ( std::size_t k = 0, n ; k < m_small->m_size ; k = n ) {
+            n = m_small->run_end(k);
+            nodes.push_back(new node(*m_small, k, n));
+        }
+        typename node::handle root(link_nodes(nodes));
+        this->release();
+        m_root.swap(root);
+    }
+
+    /** Change from a tree to the small form if there are at most @a limit elements.
+        The tree must be clean and not shared.
+     */
+    void demote(
+        std::size_t limit //!< Maximum number of elements
+        )
+    {
+        std::size_t n = 0;
+        node* first = m_root->get_leftmost_descendant();
+        for ( node* x = first ; x ; x = x->get_next() ) {
+            if ((n += x->m_maxima.size()) > limit) return;
+        }
+        small_set* s = small_set::create(n);
+        for ( node* x = first ; x ; x = x->get_next() ) {
+            for ( typename node::inner_set::iterator spot = x->m_maxima.begin() ; spot != x->m_maxima.end() ; ++spot )
+                s->append(interval_type(x->m_metric, spot->first), spot->second);
+        }
+        this->release();
+        m_small = s;
+    }
+
+    /** Call @a f for every element, in lexicographic order.
+        The interval for each element is stored in @a location and @a r, which
+        contains @a location, is passed to @a f.
+     */
+    template < typename R, typename F > void walk(
+        interval_cons& location, //!< [out] Storage for the location in this layer
+        R const& r, //!< Complete location of the element
+        F& f //!< Client functor
+        ) const
+    {
+        const_cast<self*>(this)->flush();
+        if (m_small) {
+            for ( std::size_t k = 0 ; k < m_small->m_size ; ++k ) {
+                location.head = m_small->interval(k);
+                node::inner_walker::type::func(m_small->payload(k), location, r, f);
+            }
+            return;
+        }
+        if (!m_root) return;
+        for ( node* n = m_root->get_leftmost_descendant() ; n ; n = n->get_next() ) {
+            for ( typename node::inner_set::const_iterator spot = n->m_maxima.begin() ; spot != n->m_maxima.end() ; ++spot ) {
+                location.head = interval_type(n->m_metric, spot->first);
+                node::inner_walker::type::func(spot->second, location, r, f);
+            }
+        }
+    }
+
+    //! Test if the content of this layer is shared with another layer.
+    bool is_shared() const
+    {
+        return (m_root && m_root->m_owners > 1) || (m_small && m_small->m_owners > 1);
+    }
+
+    //! Get the identity of the content of this layer, its tree or set.
+    void const* identity() const
+    {
+        return m_root ? static_cast<void const*>(m_root.get()) : m_small;
+    }
+
+    /** Share the content of @a that.
+        The current content, if any, is released.
+     */
+    void share(
+        self const& that //!< Layer to share
+        )
+    {
+        typename node::handle root(that.m_root);
+        small_set* s = that.m_small;
+        if (root) ++root->m_owners;
+        if (s) ++s->m_owners;
+        this->release();
+        m_root.swap(root);
+        m_small = s;
+    }
+
+    /** Give up ownership of the current content, leaving this layer empty.
+        This must be done before the root handle is dropped or replaced by
+        anything other than a restructure of the tree.
+     */
+    void release()
+    {
+        if (m_root) {
+            --m_root->m_owners;
+            m_root = 0;
+        }
+        if (m_small) {
+            if (0 == --m_small->m_owners) small_set::destroy(m_small);
+            m_small = 0;
+        }
+    }
+
+    /** Make the content of this layer unshared, copying it if necessary.
+        The copy shares the lower layers.
+        @return @c true if the content was copied.
+     */
+    bool unshare()
+    {
+        if (m_root && m_root->m_owners > 1) {
+            node* last = 0;
+            typename node::handle root(m_root->clone(last, true));
+            this->release();
+            m_root.swap(root);
+        } else if (m_small && m_small->m_owners > 1) {
+            small_set* s = m_small->copy(true);
+            this->release();
+            m_small = s;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /** Make the layers on the path to the element at @a r unshared.
+        @return @c true if any layer was copied.
+     */
+    bool unshare_path(
+        interval_cons const& r //!< Location of the element
+        )
+    {
+        bool zret = this->unshare();
+        local_iterator spot(this->find(r.head));
+        if (spot.is_valid()) zret = node::inner_content::type::unshare(spot.payload(), r) || zret;
+        return zret;
+    }
+
+    /** Intern the sub-layers of this layer.
+        Shared content is immutable, so it is left as is.
+        @return The number of sub-layers that were changed to share content.
+     */
+    std::size_t intern_lower_layers(
+        typename util::lower_pool& pool //!< Pool for the next lower layer
+        )
+    {
+        std::size_t zret = 0;
+        if (this->is_shared()) {
+            // Leave it be.
+        } else if (m_small) {
+            for ( std::size_t k = 0 ; k < m_small->m_size ; ++k )
+                zret += node::inner_content::type::intern(m_small->payload(k), pool);
+        } else if (m_root) {
+            for ( node* n = m_root->get_leftmost_descendant() ; n ; n = n->get_next() ) {
+                for ( typename node::inner_set::iterator spot = n->m_maxima.begin() ; spot != n->m_maxima.end() ; ++spot )
+                    zret += node::inner_content::type::intern(spot->second, pool);
+            }
+        }
+        return zret;
+    }
+
+    /** Intern this layer and its sub-layers.
+        If a layer with the same content is in @a pool this layer is changed
+        to share it, otherwise this layer is added to @a pool. An unshared
+        tree with few enough elements is changed to the small form first, so
+        that layers with the same content have the same form.
+        @return The number of layers that were changed to share content.
+     */
+    std::size_t intern(
+        intern_pool& pool //!< Pool for this layer
+        )
+    {
+        std::size_t zret = this->intern_lower_layers(pool.m_lower);
+        if (m_root && !this->is_shared()) this->demote(SMALL_SIZE);
+        if (!this->is_empty()) {
+            std::size_t h = this->content_hash();
+            typename intern_pool::table::iterator spot, limit;
+            for ( boost::tie(spot, limit) = pool.m_trees.equal_range(h) ; spot != limit ; ++spot ) {
+                if (spot->second.identity() == this->identity()) return zret;
+                if (this->same_content(spot->second)) {
+                    this->share(spot->second);
+                    return zret + 1;
+                }
+            }
+            pool.m_trees.insert(spot, typename intern_pool::table::value_type(h, self()))->second.share(*this);
+        }
+        return zret;
+    }
+
+    /** Hash the content of this layer.
+        The layer must not be empty.
+     */
+    std::size_t content_hash() const
+    {
+        std::size_t zret = 0;
+        if (m_small) {
+            for ( std::size_t k = 0 ; k < m_small->m_size ; ++k ) {
+                imp::hash_metric(zret, m_small->interval(k).min());
+                imp::hash_metric(zret, m_small->interval(k).max());
+                node::inner_content::type::hash(zret, m_small->payload(k));
+            }
+            return zret;
+        }
+        for ( node* n = m_root->get_leftmost_descendant() ; n ; n = n->get_next() ) {
+            imp::hash_metric(zret, n->m_metric);
+            for ( typename node::inner_set::const_iterator spot = n->m_maxima.begin() ; spot != n->m_maxima.end() ; ++spot ) {
+                imp::hash_metric(zret, spot->first);
+                node::inner_content::type::hash(zret, spot->second);
+            }
+        }
+        return zret;
+    }
+
+    /** Compare the content of this layer with the content of @a that.
+        Neither layer may be empty. Layers in different forms are not equal.
+     */
+    bool same_content(
+        self const& that //!< Layer to compare
+        ) const
+    {
+        if (m_small || that.m_small) {
+            if (!m_small || !that.m_small || m_small->m_size != that.m_small->m_size) return false;
+            for ( std::size_t k = 0 ; k < m_small->m_size ; ++k ) {
+                if (!(m_small->interval(k) == that.m_small->interval(k))
+                    || !node::inner_content::type::equal(m_small->payload(k), that.m_small->payload(k))
+                ) return false;
+            }
+            return true;
+        }
+        node* n = m_root->get_leftmost_descendant();
+        node* m = that.m_root->get_leftmost_descendant();
+        for ( ; n && m ; n = n->get_next(), m = m->get_next() ) {
+            if (!(n->m_metric == m->m_metric) || n->m_maxima.size() != m->m_maxima.size()) return false;
+            typename node::inner_set::const_iterator ns = n->m_maxima.begin(), ms = m->m_maxima.begin();
+            for ( ; ns != n->m_maxima.end() ; ++ns, ++ms ) {
+                if (!(ns->first == ms->first) || !node::inner_content::type::equal(ns->second, ms->second)) return false;
+            }
+        }
+        return !n && !m;
+    }
+
+    /** Add an interval with data to the flowspace.
+        If @a deferred is set structure fixups are deferred, see @c batch_update.
+        A layer with no tree is kept in the small form while there is room and
+        changed to a tree when there is not.
+        @return The stored payload of @a v in the bottom layer.
+     */
+    void const* insert_value(
+        value_type const& v, //!< The region to insert
+        bool deferred        //!< Defer structure fixups
+        )
+    {
+        void const* zret = 0;
+        assert(imp::is_valid(v.first));
+        // Immediate fixups presume clean children.
+        if (!deferred) this->flush();
+        this->unshare();
+        if (!m_root && 0 != (zret = this->insert_small(v, deferred))) return zret;
+        if (m_small) this->promote();
+        if (! m_root) {
+            m_root = new node(v, zret);
+            m_root->set_color(node::BLACK);
+        } else {
+            typename node::handle n;
+            typename node::direction d;
+
+            // Find insert location
+            boost::tie(n, d) = m_root->search(boost::bind(&node::compare_metric, _1, v.first.head.min()));
+            if (node::NONE == d) { // already an outer tree node for this metric, add this value to that node.
+                zret = n->insert(v, deferred);
+                if (deferred) n->mark_dirty();
+                else n->ripple_structure_fixup();
+            } else { // Not in the tree, but this node should be the parent
+                typename node::handle c(new node(v, zret));
+                m_root = boost::dynamic_pointer_cast<node>(n->insert_child(c, d));
+                if (deferred) c->propagate_dirty();
+            }
+        }
+
+        return zret;
+    }
 
     // Try to declare all other layer instantiations as friends of this one.
     template < typename T > friend struct imp::member_cursor_mf::apply;
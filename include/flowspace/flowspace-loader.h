@@ -0,0 +1,373 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <cstring>
+# include <vector>
+# include <fstream>
+# include <algorithm>
+# include <boost/bind.hpp>
+# include <boost/ref.hpp>
+# include <boost/function.hpp>
+# include <boost/utility/string_ref.hpp>
+# include <boost/thread/thread.hpp>
+# include <boost/interprocess/file_mapping.hpp>
+# include <boost/interprocess/mapped_region.hpp>
+
+# include <ngeo/parse_result.hpp>
+# include <ngeo/ip_base.hpp>
+# include <flowspace/flowspace-layer.h>
+
+/** @file
+    Parallel loading of a flowspace from a rule file.
+
+    Chunks of the file are parsed by a group of Boost.Thread workers, so code
+    that only builds a flowspace with @c insert does not depend on this header.
+ */
+
+namespace ngeo { namespace flowspace {
+
+namespace imp {
+    //! @cond IMPLEMENTATION
+
+    // Test for a blank (field separator) character.
+    inline bool is_blank(char c) { return ' ' == c || '\t' == c || '\r' == c; }
+
+    // Offset of the first non-blank character in @a text at or after @a pos.
+    inline std::size_t skip_blank(boost::string_ref text, std::size_t pos)
+    {
+        while (pos < text.size() && is_blank(text[pos])) ++pos;
+        return pos;
+    }
+
+    // Offset of the first blank character in @a text at or after @a pos.
+    inline std::size_t skip_field(boost::string_ref text, std::size_t pos)
+    {
+        while (pos < text.size() && !is_blank(text[pos])) ++pos;
+        return pos;
+    }
+
+    // Parse an address interval. This accepts a range, a network or a single address.
+    inline parse_result parse_field(boost::string_ref text, ip4_range& r)
+    {
+        return parse(text, r);
+    }
+    inline parse_result parse_field(boost::string_ref text, interval<ip4_addr>& intv)
+    {
+        ip4_range r;
+        parse_result zret = parse(text, r);
+        if (zret.is_ok()) intv = r;
+        return zret;
+    }
+
+    // Parse a port interval. This accepts a range or a single port.
+    inline parse_result parse_field(boost::string_ref text, ip_port_range& r)
+    {
+        return parse(text, r);
+    }
+    inline parse_result parse_field(boost::string_ref text, interval<ip_port>& intv)
+    {
+        ip_port_range r;
+        parse_result zret = parse(text, r);
+        if (zret.is_ok()) intv = r;
+        return zret;
+    }
+
+    // Parse any other interval, as a single value or two values separated by '-'.
+    template < typename T > parse_result parse_field(boost::string_ref text, interval<T>& intv)
+    {
+        T min, max;
+        parse_result zret = parse(text, min);
+        if (zret.is_ok()) {
+            max = min;
+            if (zret.position < text.size() && '-' == text[zret.position]) {
+                std::size_t offset = zret.position + 1;
+                zret = parse(text.substr(offset), max);
+                zret.position += offset;
+            }
+            if (zret.is_ok()) intv.set(min, max);
+        }
+        return zret;
+    }
+
+    // Parse the field at @a pos in to @a intv and move @a pos past it.
+    template < typename H > parse_result parse_region_field(
+        boost::string_ref text,
+        std::size_t& pos,
+        H& intv
+        )
+    {
+        std::size_t start = skip_blank(text, pos);
+        boost::string_ref field(text.substr(start, skip_field(text, start) - start));
+        parse_result zret;
+
+        pos = start + field.size();
+        if (field.empty()) {
+            zret.code = parse_result::INVALID;
+        } else if (field == "*") {
+            intv = H::all();
+        } else if ((zret = parse_field(field, intv)).is_ok()) {
+            if (zret.position != field.size()) zret.code = parse_result::INVALID;
+            else if (intv.is_empty()) zret = parse_result(parse_result::INVALID, 0);
+        }
+        zret.position += start;
+        return zret;
+    }
+
+    // Parse a region, bottom case.
+    template < typename H > parse_result parse_region(
+        boost::string_ref text,
+        std::size_t& pos,
+        boost::tuples::cons<H, boost::tuples::null_type>& r
+        )
+    {
+        return parse_region_field(text, pos, r.head);
+    }
+
+    // Parse a region, upper case. Parse our field and ripple down.
+    template < typename H, typename T > parse_result parse_region(
+        boost::string_ref text,
+        std::size_t& pos,
+        boost::tuples::cons<H,T>& r
+        )
+    {
+        parse_result zret = parse_region_field(text, pos, r.head);
+        if (zret.is_ok()) zret = parse_region(text, pos, r.tail);
+        return zret;
+    }
+    //! @endcond
+} // namespace imp
+
+/** Bulk loader for a flowspace from a rule file.
+
+    A rule file has one rule per line. A rule is the intervals of the region,
+    one field per dimension in layer order, then "->" and then the payload.
+    Fields are separated by spaces or tabs. Blank lines and lines that start
+    with '#' are ignored. For example, for source address, destination address
+    and destination port
+
+    @code
+    10.0.0.0/8 192.168.0.0/16 80-443 -> allow
+    @endcode
+
+    A field is "*" for the entire dimension, or is parsed with the @c parse
+    function for the interval. Address fields accept a range, a network or a
+    single address. Other fields accept a single value or two values separated
+    by '-'. Because fields are delimited by blanks, a field must not contain
+    any. The payload is the rest of the line less trailing blanks and is
+    converted by a client supplied parser.
+
+    The text is split in to line aligned chunks that are parsed in parallel.
+    The workers do not allocate per rule, beyond what the payload parser
+    does, and each sorts its rules. The sorted batches are merged and the
+    flowspace is then built in one step with @c layer::build, which is
+    equivalent to inserting the rules in file order.
+
+    Every line that is not a valid rule is reported with its line and column.
+    If there are any such lines the flowspace is not changed.
+
+    @a LAYER is the flowspace type.
+ */
+template < typename LAYER >
+class rule_loader
+{
+public:
+    typedef rule_loader self; //!< Self reference type.
+    typedef LAYER layer_type; //!< Type of the flowspace.
+    typedef typename LAYER::value_copy value_copy; //!< Type of a parsed rule.
+    typedef typename LAYER::value_group value_group; //!< Type of a set of rules.
+    typedef typename LAYER::mapped_type mapped_type; //!< Type of the payload.
+    /** Payload parser.
+        This is passed the payload text and must set the payload. The text
+        is rejected unless the result is @c OK and uses all of the text.
+        @note This is called concurrently from the worker threads and must
+        not throw.
+     */
+    typedef boost::function<parse_result (boost::string_ref, mapped_type&)> payload_parser;
+
+    /// A line that is not a valid rule.
+    struct error {
+        std::size_t line; //!< Line number, starting at 1.
+        std::size_t column; //!< Column of the invalid input, starting at 1.
+        parse_result::code_type code; //!< What was wrong.
+    };
+    typedef std::vector<error> error_list; //!< Errors for a load, in line order.
+
+    /** Standard constructor.
+        If @a threads is 0 the number of hardware threads is used.
+     */
+    explicit rule_loader(
+        payload_parser const& parser, //!< Parser for payloads.
+        unsigned threads = 0 //!< Number of threads to use.
+        )
+        : m_parser(parser)
+        , m_threads(threads ? threads : boost::thread::hardware_concurrency())
+        , m_count(0)
+    {
+        if (0 == m_threads) m_threads = 1;
+    }
+
+    /** Load the rule file at @a path in to @a space, replacing its contents.
+        The file is memory mapped for parsing.
+        @return @c true if every line was valid, @c false if not in which case
+        @a space is not changed.
+        @throws boost::interprocess::interprocess_exception if the file cannot
+        be opened or mapped.
+     */
+    bool load(
+        char const* path, //!< Path to the rule file.
+        layer_type& space //!< [out] Flowspace to load.
+        )
+    {
+        // A region can't be mapped for an empty file.
+        if (0 == std::ifstream(path, std::ios::binary | std::ios::ate).tellg())
+            return this->load(boost::string_ref(), space);
+        boost::interprocess::file_mapping file(path, boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+        return this->load(boost::string_ref(static_cast<char const*>(region.get_address()), region.get_size()), space);
+    }
+
+    /** Load the rules in @a text in to @a space, replacing its contents.
+        @return @c true if every line was valid, @c false if not in which case
+        @a space is not changed.
+     */
+    bool load(
+        boost::string_ref text, //!< Rule text.
+        layer_type& space //!< [out] Flowspace to load.
+        )
+    {
+        // Below this many bytes per thread it's not worth starting threads.
+        static std::size_t const MIN_CHUNK = 1 << 16;
+        std::size_t n = std::max<std::size_t>(1, std::min<std::size_t>(m_threads, text.size() / MIN_CHUNK));
+        std::vector<chunk> chunks(n);
+        std::size_t start = 0;
+
+        // Split on line boundaries.
+        for ( std::size_t i = 0 ; i < n ; ++i ) {
+            std::size_t end = text.size() * (i + 1) / n;
+            if (end < start) end = start;
+            if (i + 1 < n && end < text.size()) {
+                void const* eol = std::memchr(text.data() + end, '\n', text.size() - end);
+                end = eol ? static_cast<char const*>(eol) - text.data() + 1 : text.size();
+            }
+            chunks[i].m_text = text.substr(start, end - start);
+            start = end;
+        }
+
+        if (n > 1) {
+            boost::thread_group group;
+            for ( std::size_t i = 1 ; i < n ; ++i )
+                group.create_thread(boost::bind(&self::parse_chunk, this, boost::ref(chunks[i])));
+            this->parse_chunk(chunks[0]);
+            group.join_all();
+        } else {
+            this->parse_chunk(chunks[0]);
+        }
+
+        // Convert to file line numbers and gather the errors.
+        std::size_t line = 0;
+        m_errors.clear();
+        m_count = 0;
+        for ( std::size_t i = 0 ; i < n ; ++i ) {
+            for ( typename error_list::iterator spot = chunks[i].m_errors.begin() ; spot != chunks[i].m_errors.end() ; ++spot ) {
+                spot->line += line;
+                m_errors.push_back(*spot);
+            }
+            line += chunks[i].m_lines;
+            m_count += chunks[i].m_values.size();
+        }
+        if (!m_errors.empty()) {
+            m_count = 0;
+            return false;
+        }
+
+        // Merge the sorted batches, in chunk order so that equal rules stay in file order.
+        value_group values;
+        std::vector<std::size_t> bounds(1, 0);
+        values.reserve(m_count);
+        for ( std::size_t i = 0 ; i < n ; ++i ) {
+            values.insert(values.end(), chunks[i].m_values.begin(), chunks[i].m_values.end());
+            value_group().swap(chunks[i].m_values);
+            bounds.push_back(values.size());
+        }
+        for ( std::size_t width = 1 ; width < n ; width *= 2 ) {
+            for ( std::size_t i = 0 ; i + width < n ; i += 2 * width ) {
+                std::inplace_merge(values.begin() + bounds[i], values.begin() + bounds[i + width]
+                    , values.begin() + bounds[std::min(i + 2 * width, n)], typename layer_type::build_order());
+            }
+        }
+        space.build(values);
+        return true;
+    }
+
+    //! Errors from the last load.
+    error_list const& errors() const { return m_errors; }
+    //! Number of rules loaded by the last load.
+    std::size_t count() const { return m_count; }
+
+protected:
+    /// Work for one thread.
+    struct chunk {
+        boost::string_ref m_text; //!< Text to parse, whole lines.
+        std::size_t m_lines; //!< Number of lines in the text.
+        value_group m_values; //!< Parsed rules, sorted.
+        error_list m_errors; //!< Invalid lines, numbered from the start of the chunk.
+
+        chunk() : m_lines(0) {}
+    };
+
+    /// Parse the rules in @a c.
+    void parse_chunk(chunk& c) const
+    {
+        boost::string_ref text(c.m_text);
+        value_copy v;
+
+        while (!text.empty()) {
+            void const* eol = std::memchr(text.data(), '\n', text.size());
+            std::size_t len = eol ? static_cast<char const*>(eol) - text.data() : text.size();
+            boost::string_ref line(text.substr(0, len));
+            parse_result result;
+
+            ++c.m_lines;
+            text.remove_prefix(eol ? len + 1 : len);
+            std::size_t pos = imp::skip_blank(line, 0);
+            if (pos == line.size() || '#' == line[pos]) continue;
+            if ((result = this->parse_rule(line, v)).is_ok()) {
+                c.m_values.push_back(v);
+            } else {
+                error e = { c.m_lines, result.position + 1, result.code };
+                c.m_errors.push_back(e);
+            }
+        }
+        std::stable_sort(c.m_values.begin(), c.m_values.end(), typename layer_type::build_order());
+    }
+
+    /// Parse the rule in @a line in to @a v.
+    parse_result parse_rule(boost::string_ref line, value_copy& v) const
+    {
+        std::size_t pos = 0;
+        parse_result zret = imp::parse_region(line, pos, v.first);
+
+        if (zret.is_ok()) {
+            pos = imp::skip_blank(line, pos);
+            if (line.substr(pos, 2) != "->") return parse_result(parse_result::INVALID, pos);
+            pos = imp::skip_blank(line, pos + 2);
+            boost::string_ref payload(line.substr(pos));
+            while (!payload.empty() && imp::is_blank(payload.back())) payload.remove_suffix(1);
+            if (payload.empty()) return parse_result(parse_result::INVALID, pos);
+            zret = m_parser(payload, v.second);
+            if (zret.is_ok() && zret.position != payload.size()) zret.code = parse_result::INVALID;
+            zret.position += pos;
+        }
+        return zret;
+    }
+
+    payload_parser m_parser; //!< Payload parser.
+    unsigned m_threads; //!< Number of threads.
+    error_list m_errors; //!< Errors from the last load.
+    std::size_t m_count; //!< Rules from the last load.
+};
+
+}} // namespace flowspace, ngeo
@@ -26,6 +26,17 @@
     Internal nodes used by a flowspace.
  */
 
+/** Maintain a predecessor thread in the nodes.
+    If set, each node carries a pointer to its in order predecessor so that
+    reverse traversal is constant time per step, at the cost of one pointer
+    per node. Otherwise the predecessor is computed from the tree structure
+    in log(N) time. This changes the layout of @c node_base, so the library
+    and its clients must be compiled with the same value.
+ */
+# if !defined(NG_FLOWSPACE_PREV_THREAD)
+#   define NG_FLOWSPACE_PREV_THREAD 1
+# endif
+
 namespace ngeo { namespace flowspace { namespace imp {
 
 /** Red/Black tree base node.
@@ -55,7 +66,11 @@ public:
 
     // Methods
     /* We don't initialize the handles because they take of themselves */
-    node_base() : m_color(RED), m_parent(0), m_next(0) { }; //!< Default constructor
+    node_base() : m_color(RED), m_parent(0), m_next(0)
+# if NG_FLOWSPACE_PREV_THREAD
+        , m_prev(0)
+# endif
+    { }; //!< Default constructor
     /* Need a virtual destructor because we have virtual methods */
     virtual ~node_base() { }
 
@@ -153,7 +168,8 @@ public:
     handle get_next() const { handle n(m_next); return n; }
 
     /** Get the previous node for in-order traversal.
-        @note This is a log(N) time operation.
+        @note This is a constant time operation if @c NG_FLOWSPACE_PREV_THREAD
+        is set, otherwise it is a log(N) time operation.
         @return A handle to the previous in-order node or @c NIL if this is the first node.
      */
     handle get_prev() const;
@@ -192,7 +208,7 @@ public:
         the iterator. The node passed to the constructor just sets the current
         location.
      */
-    class API iterator : public std::iterator<std::forward_iterator_tag, node_base, int>
+    class API iterator : public std::iterator<std::bidirectional_iterator_tag, node_base, int>
     {
     public:
         iterator(); //!< Default constructor, iterator with undefined value
@@ -209,6 +225,8 @@ public:
         pointer operator -> (); //!< dereference operator
         iterator& operator++(); //!< next node (prefix)
         iterator operator++(int); //!< next node (postfix)
+        iterator& operator--(); //!< previous node (prefix)
+        iterator operator--(int); //!< previous node (postfix)
 
         /** Equality.
             @return @c true if the iterators refer to the same node.
@@ -228,12 +246,15 @@ protected:
 
     /*	Need to be a little careful here, because we're using reference
         counting pointers and the parent pointer creates a cycle.
-        For that reason the parent and next pointers are raw pointers.
+        For that reason the parent and thread pointers are raw pointers.
      */
     handle m_left; //!< left child
     handle m_right; //!< right child
     self* m_parent; //!< parent node (needed for rotations)
     self* m_next;   //!< next node in order traversal
+# if NG_FLOWSPACE_PREV_THREAD
+    self* m_prev;   //!< previous node in order traversal
+# endif
 
     /** Replace this node with another node.
         This is presumed to be non-order modifying so the next reference
@@ -0,0 +1,275 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <vector>
+# include <algorithm>
+# include <boost/bind.hpp>
+# include <boost/atomic.hpp>
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/thread.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/thread_time.hpp>
+# include <boost/date_time/posix_time/posix_time_types.hpp>
+
+# include <flowspace/flowspace-layer.h>
+
+/** @file
+    Asynchronous update pipeline for a flowspace.
+
+    The builder thread and the update queue use Boost.Thread, so only code that
+    updates a flowspace asynchronously has to link it.
+ */
+
+namespace ngeo { namespace flowspace {
+
+/** Asynchronous update pipeline for a flowspace.
+
+    Updates are decoupled from queries. Producers (any number of threads) queue
+    @c insert and @c erase operations without blocking. A builder thread owned
+    by the pipeline drains the queue, cancels inserts that are erased in the same
+    batch, applies the rest to a private flowspace and then publishes an immutable
+    copy of that flowspace as the read snapshot. Readers get the current snapshot
+    with @c snapshot and iterate it without any coordination with updates.
+
+    A snapshot is published when either @a period has passed since the previous
+    publication or @a batch operations are pending, whichever is first. Operations
+    are applied in the order they were queued, except that the relative order of
+    operations from different producers is that of their arrival at the queue.
+
+    @note Publishing copies the private flowspace, so the cost per publication is
+    linear in its size. The rates should be chosen so that this is amortized over
+    many operations.
+
+    @a LAYER is the flowspace type.
+ */
+template < typename LAYER >
+class update_pipeline
+{
+public:
+    typedef update_pipeline self; //!< Self reference type.
+    typedef LAYER layer_type; //!< Type of the flowspace.
+    typedef typename LAYER::value_type value_type; //!< Type of the flowspace elements.
+    /** Read snapshot type.
+        A snapshot is never modified after publication.
+     */
+    typedef boost::shared_ptr<layer_type const> snapshot_type;
+
+    /** Standard constructor.
+        The builder thread is started by the constructor.
+     */
+    update_pipeline(
+        layer_type const& initial = layer_type(), //!< Initial content.
+        boost::posix_time::time_duration period = boost::posix_time::milliseconds(10), //!< Maximum time between publications.
+        std::size_t batch = 1000 //!< Pending operations that force a publication.
+        )
+        : m_head(0)
+        , m_pending(0)
+        , m_enqueued(0)
+        , m_published(0)
+        , m_work(initial)
+        , m_period(period)
+        , m_batch(batch ? batch : 1)
+        , m_stop(false)
+        , m_sync(false)
+        , m_snapshot(new layer_type(initial))
+    {
+        m_builder = boost::thread(boost::bind(&self::run, this));
+    }
+
+    /** Destructor.
+        Pending operations are applied and published before the builder thread is stopped.
+     */
+    ~update_pipeline()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_one();
+        m_builder.join();
+        // Operations queued after the final drain are dropped.
+        operation* op = m_head.exchange(0, boost::memory_order_acquire);
+        while (op) {
+            operation* tmp = op;
+            op = op->m_next;
+            delete tmp;
+        }
+    }
+
+    /** Queue an insert of @a v.
+        @note This does not block and may be called from any thread.
+     */
+    void insert(value_type const& v)
+    {
+        this->push(new operation(operation::INSERT, v));
+    }
+
+    /** Queue an erase of @a v.
+        This erases an element identical to @a v, if there is one.
+        @note This does not block and may be called from any thread.
+     */
+    void erase(value_type const& v)
+    {
+        this->push(new operation(operation::ERASE, v));
+    }
+
+    /** Get the current read snapshot.
+        @note This may be called from any thread.
+     */
+    snapshot_type snapshot() const
+    {
+        return boost::atomic_load(&m_snapshot);
+    }
+
+    /** Wait for publication.
+        This blocks until a snapshot that includes every operation queued
+        before the call has been published.
+     */
+    void sync()
+    {
+        boost::uint64_t target = m_enqueued.load(boost::memory_order_acquire);
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        if (m_published < target) {
+            m_sync = true;
+            m_wakeup.notify_one();
+            while (m_published < target)
+                m_done.wait(lock);
+        }
+    }
+
+protected:
+    /** A queued operation.
+        Operations are linked in to an intrusive list to avoid any allocation in the queue itself.
+     */
+    struct operation
+    {
+        typedef enum { INSERT, ERASE } kind; //!< Operation type.
+
+        operation(kind k, value_type const& v) : m_kind(k), m_value(v), m_next(0), m_cancelled(false) { }
+
+        kind m_kind; //!< Operation type.
+        value_type m_value; //!< Operation argument.
+        operation* m_next; //!< Next operation in the queue.
+        bool m_cancelled; //!< Set if coalesced away.
+    };
+
+    /** Add an operation to the queue.
+        This is a lock free push on to a stack. The builder reverses the
+        stack when it is drained to recover the queue order.
+     */
+    void push(operation* op)
+    {
+        operation* head = m_head.load(boost::memory_order_relaxed);
+        do {
+            op->m_next = head;
+        } while (!m_head.compare_exchange_weak(head, op, boost::memory_order_release, boost::memory_order_relaxed));
+        m_enqueued.fetch_add(1, boost::memory_order_release);
+        // Wake the builder early if the batch limit was just reached. If the
+        // notification is missed the builder wakes at the end of the period anyway.
+        if (m_pending.fetch_add(1, boost::memory_order_relaxed) + 1 == m_batch)
+            m_wakeup.notify_one();
+    }
+
+    /** Drain the queue and apply the operations to the private flowspace.
+        @return The number of operations drained.
+     */
+    std::size_t apply()
+    {
+        operation* op = m_head.exchange(0, boost::memory_order_acquire);
+        std::vector<operation*> ops;
+
+        m_pending.store(0, boost::memory_order_relaxed);
+        // Reverse the stack to queue order.
+        for ( ; op ; op = op->m_next ) ops.push_back(op);
+        std::reverse(ops.begin(), ops.end());
+
+        // An erase cancels the most recent matching insert in the same batch. The search
+        // is limited to the preceding @a m_batch operations to bound the cost of a large drain.
+        for ( std::size_t i = 0 ; i < ops.size() ; ++i ) {
+            if (operation::ERASE == ops[i]->m_kind) {
+                for ( std::size_t j = i ; j > 0 && i - j < m_batch ; --j ) {
+                    operation* prior = ops[j-1];
+                    if (!prior->m_cancelled && operation::INSERT == prior->m_kind
+                        && prior->m_value.first == ops[i]->m_value.first
+                        && prior->m_value.second == ops[i]->m_value.second
+                    ) {
+                        prior->m_cancelled = ops[i]->m_cancelled = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Inserts in a run defer their fixups to the end of the run or the next erase.
+        typename layer_type::batch_update batch(m_work);
+        for ( std::size_t i = 0 ; i < ops.size() ; ++i ) {
+            op = ops[i];
+            if (!op->m_cancelled) {
+                if (operation::INSERT == op->m_kind) m_work.insert(op->m_value);
+                else m_work.erase(m_work.find(op->m_value));
+            }
+            delete op;
+        }
+        return ops.size();
+    }
+
+    //! Builder thread body.
+    void run()
+    {
+        bool stop = false;
+        while (!stop) {
+            boost::system_time deadline = boost::get_system_time() + m_period;
+            bool sync;
+            {
+                boost::unique_lock<boost::mutex> lock(m_mutex);
+                while (!m_stop && !m_sync && m_pending.load(boost::memory_order_relaxed) < m_batch)
+                    if (!m_wakeup.timed_wait(lock, deadline)) break;
+                stop = m_stop;
+                sync = m_sync;
+            }
+
+            // Take the count before draining so it never overstates what was applied.
+            boost::uint64_t enqueued = m_enqueued.load(boost::memory_order_acquire);
+            if (this->apply()) {
+                boost::atomic_store(&m_snapshot, snapshot_type(new layer_type(m_work)));
+            }
+
+            {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                m_published = enqueued;
+                // A request made after the drain is served by the next cycle at the latest.
+                if (sync) m_sync = false;
+            }
+            m_done.notify_all();
+        }
+    }
+
+    boost::atomic<operation*> m_head; //!< Top of the operation stack.
+    boost::atomic<std::size_t> m_pending; //!< Operations queued since the last drain.
+    boost::atomic<boost::uint64_t> m_enqueued; //!< Total operations queued.
+    boost::uint64_t m_published; //!< Total operations included in the snapshot. Protected by @a m_mutex.
+
+    layer_type m_work; //!< Private flowspace, only accessed by the builder thread.
+    boost::posix_time::time_duration m_period; //!< Maximum time between publications.
+    std::size_t m_batch; //!< Pending operations that force a publication.
+
+    boost::mutex m_mutex; //!< Protects the builder control flags.
+    boost::condition_variable m_wakeup; //!< Signal the builder thread.
+    boost::condition_variable m_done; //!< Signal a publication to @c sync waiters.
+    bool m_stop; //!< Set to stop the builder thread.
+    bool m_sync; //!< Set to request immediate publication.
+
+    snapshot_type m_snapshot; //!< Current read snapshot, accessed atomically.
+    boost::thread m_builder; //!< Builder thread.
+
+private:
+    // Not copyable.
+    update_pipeline(self const&);
+    self& operator = (self const&);
+};
+
+}} // namespace flowspace, ngeo
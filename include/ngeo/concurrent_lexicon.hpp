@@ -0,0 +1,204 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/lock_guard.hpp>
+# include <ngeo/lexicon.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Lexicon that can be read and updated concurrently.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** A @c lexicon that is safe to use from multiple threads.
+
+    The names are kept in an immutable @c lexicon which is replaced as a whole
+    on every change. A reader gets the current @c lexicon as a snapshot, which
+    stays valid and unchanged for as long as the reader holds it, and does not
+    block writers. A writer copies the current @c lexicon, changes the copy and
+    then publishes it as the new current @c lexicon. Writers are serialized by a
+    mutex, and if a change throws the current @c lexicon is not changed.
+
+    This makes reads cheap and writes expensive, which is the expected use
+    for naming - many threads parse names, and names are changed rarely, if
+    ever, after initialization.
+
+    The methods that read names take a new snapshot for each call. A client
+    that does many lookups together, such as parsing a rule file, can take one
+    snapshot with @c snapshot and use it directly. This is also the way to get
+    consistent results across several lookups.
+
+    This is the lexicon type for the IP value types, and provides the same
+    interface as @c lexicon for initialization, conversion and update.
+
+    @note Iteration is available only through a snapshot.
+ */
+template < typename K ///< Type of which to name instances
+         >
+class concurrent_lexicon
+{
+public:
+    typedef concurrent_lexicon self; ///< Self reference type.
+    typedef lexicon<K> lexicon_type; ///< Underlying lexicon type.
+    typedef typename lexicon_type::key_type key_type; ///< Key type.
+    typedef typename lexicon_type::name_type name_type; ///< Name type.
+    typedef typename lexicon_type::init init; ///< Initialization structure.
+    typedef typename lexicon_type::key_generator key_generator; ///< Functor for a default key.
+    typedef typename lexicon_type::name_generator name_generator; ///< Functor for a default name.
+    /// A read only view of the names at a point in time.
+    typedef boost::shared_ptr<lexicon_type const> snapshot_type;
+
+    /// Default constructor.
+    concurrent_lexicon() : m_current(new lexicon_type) {}
+    /// Construct from initialization structure.
+    concurrent_lexicon(init& d) : m_current(new lexicon_type(d)) {}
+
+    /** Get the current names.
+        @note This does not block and may be called from any thread.
+     */
+    snapshot_type snapshot() const { return boost::atomic_load(&m_current); }
+
+    /// @name Lookup
+    /// Each of these uses a new snapshot. @see lexicon
+    //@{
+    /// Find the primary name for @a key.
+    name_type operator [] (key_type key) const { return (*this->snapshot())[key]; }
+    /// Convert @a name to the key with which it is associated.
+    key_type operator [] (name_type const& name) const { return (*this->snapshot())[name]; }
+    /// Test if @a name is defined.
+    bool contains(name_type const& name) const { return this->snapshot()->contains(name); }
+    /// Test if a name is defined for @a key.
+    bool contains(key_type key) const { return this->snapshot()->contains(key); }
+    /// Get the number of defined names.
+    size_t size() const { return this->snapshot()->size(); }
+    /// Get the number of defined names.
+    size_t count() const { return this->size(); }
+    /// Get the number of defined names for @a key.
+    size_t count(key_type key) const { return this->snapshot()->count(key); }
+    //@}
+
+    /// @name Update
+    /// Each of these publishes a new snapshot. @see lexicon
+    //@{
+    /// Replace the names with the contents of @a d.
+    self& operator = (init& d) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        *lex = d;
+        return this->publish(lex);
+    }
+    /// Add the contents of @a d.
+    self& operator += (init const& d) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        *lex += d;
+        return this->publish(lex);
+    }
+    /// Define a @a name for a @a key.
+    self& define(key_type key, name_type const& name) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->define(key, name);
+        return this->publish(lex);
+    }
+    /// Set @a name as the primary for @a key.
+    self& set_primary(key_type key, name_type const& name) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_primary(key, name);
+        return this->publish(lex);
+    }
+    /// Remove a name.
+    /// @return @c true if the name was present, @c false if it was not defined.
+    bool undefine(name_type const& name) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        bool zret = lex->undefine(name);
+        if (zret) this->publish(lex);
+        return zret;
+    }
+    /// Remove all names for @a key.
+    /// @return @c true if at least one name was defined for @a key, @c false otherwise.
+    bool undefine(key_type key) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        bool zret = lex->undefine(key);
+        if (zret) this->publish(lex);
+        return zret;
+    }
+    /// Set the default name.
+    self& set_default_name(name_type const& name) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_default_name(name);
+        return this->publish(lex);
+    }
+    /// Set the default name.
+    self& set_default_name(char const* name) { return this->set_default_name(name_type(name)); }
+    /// Set the default name formatter.
+    self& set_default_name(name_generator const& f) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_default_name(f);
+        return this->publish(lex);
+    }
+    /// Set the default key.
+    self& set_default_key(key_type key) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_default_key(key);
+        return this->publish(lex);
+    }
+    /// Set the default key handler.
+    self& set_default_key(key_generator const& f) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_default_key(f);
+        return this->publish(lex);
+    }
+    /// Keep the names sorted by key for positional access.
+    self& set_auto_sort(bool flag = true) {
+        lock_type lock(m_mutex);
+        boost::shared_ptr<lexicon_type> lex(this->copy());
+        lex->set_auto_sort(flag);
+        return this->publish(lex);
+    }
+    //@}
+
+protected:
+    typedef boost::lock_guard<boost::mutex> lock_type; ///< Writer lock.
+
+    /// Copy the current names for update.
+    /// @internal Must be called with the writer lock held.
+    boost::shared_ptr<lexicon_type> copy() const {
+        return boost::shared_ptr<lexicon_type>(new lexicon_type(*m_current));
+    }
+
+    /** Make @a lex the current names.
+        @internal Must be called with the writer lock held.
+        The positional index is sorted here, if needed, because it is otherwise
+        sorted lazily on read which is not safe for a shared snapshot.
+     */
+    self& publish(boost::shared_ptr<lexicon_type> const& lex) {
+        lex->auto_sort();
+        boost::atomic_store(&m_current, snapshot_type(lex));
+        return *this;
+    }
+
+    snapshot_type m_current; ///< Current names.
+    boost::mutex m_mutex; ///< Serializes writers.
+
+private:
+    // Not copyable.
+    concurrent_lexicon(self const&);
+    self& operator = (self const&);
+};
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
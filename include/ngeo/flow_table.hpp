@@ -0,0 +1,342 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <boost/atomic.hpp>
+# include <boost/cstdint.hpp>
+# include <boost/scoped_array.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/lock_guard.hpp>
+# include <ngeo/ip_service.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Connection tracking table.
+
+    Writers to the table are serialized with a Boost.Thread mutex, so it is not
+    part of @c ip_service.hpp where @c ip4_flow is defined.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** Concurrent connection table keyed by @c ip4_flow.
+
+    This remembers a value, such as the verdict from classifying the first
+    packet against a flowspace, for each active flow so that later packets in
+    the flow can skip the classification.
+
+    The table is open addressed with linear probing, in a fixed number of
+    buckets set at construction. Lookups are lock free: each bucket has a
+    version which a writer makes odd while it changes the bucket, and a
+    reader retries if the version was odd or changed while it copied the
+    bucket. Writers (@c insert, @c erase, @c sweep, @c clear) are serialized
+    by a mutex.
+
+    Each flow has a last used time, set by @c insert and by @c find when a time
+    is passed. @c sweep removes flows that have been idle for longer than the
+    idle timeout. It examines a given number of buckets per call, continuing
+    from where the previous call stopped, so the cost of expiring flows can be
+    spread out.
+
+    Times are in caller defined units, typically seconds, and may wrap.
+
+    @a V must be default constructible and trivially copyable, because readers
+    may copy a value while it is being written and then discard the copy.
+
+    @note The table does not grow. @c insert fails if the table is full, which
+    is when 3/4 of the buckets are in use. Erased buckets are reused.
+ */
+template < typename V ///< Value type.
+         >
+class flow_table
+{
+public:
+    typedef flow_table self; ///< Self reference type.
+    typedef ip4_flow key_type; ///< Key type.
+    typedef V value_type; ///< Value type.
+    typedef boost::uint32_t time_type; ///< Time stamp type.
+
+    /** Constructor.
+        @a capacity is rounded up to a power of 2.
+     */
+    flow_table(
+        std::size_t capacity, ///< [in] Number of buckets.
+        time_type idle_timeout ///< [in] Time a flow can be idle before @c sweep removes it.
+    );
+
+    /** Find the value for a flow.
+        @return @c true and the value in @a v if @a key is in the table, @c false otherwise.
+        @a v is not changed if @a key is not found.
+        @note This does not block and may be called from any thread.
+     */
+    bool find(
+        key_type const& key, ///< [in] Flow.
+        value_type& v ///< [out] Value for @a key.
+    ) const {
+        return this->search(key, v) != NPOS;
+    }
+
+    /** Find the value for a flow and mark it as used at @a now.
+        @see find(key_type const&, value_type&) const
+     */
+    bool find(
+        key_type const& key, ///< [in] Flow.
+        value_type& v, ///< [out] Value for @a key.
+        time_type now ///< [in] Current time.
+    ) {
+        std::size_t idx = this->search(key, v);
+        if (idx == NPOS) return false;
+        m_buckets[idx].m_last_used.store(now, boost::memory_order_relaxed);
+        return true;
+    }
+
+    /** Set the value for a flow.
+        If @a key is already in the table its value is replaced.
+        @return @c true if the value was stored, @c false if the table is full.
+     */
+    bool insert(
+        key_type const& key, ///< [in] Flow.
+        value_type const& v, ///< [in] Value.
+        time_type now ///< [in] Current time.
+    );
+
+    /** Remove a flow.
+        @return @c true if @a key was removed, @c false if it was not in the table.
+     */
+    bool erase(
+        key_type const& key ///< [in] Flow.
+    );
+
+    /** Remove idle flows.
+        Check the next @a n buckets and remove any flow that has not been used
+        for more than the idle timeout as of @a now.
+        @return The number of flows removed.
+     */
+    std::size_t sweep(
+        time_type now, ///< [in] Current time.
+        std::size_t n ///< [in] Number of buckets to check.
+    );
+
+    /// Remove all flows.
+    self& clear();
+
+    /// Number of flows.
+    std::size_t size() const { return m_count.load(boost::memory_order_relaxed); }
+    /// Number of buckets.
+    std::size_t capacity() const { return m_mask + 1; }
+    /// Idle timeout.
+    time_type idle_timeout() const { return m_timeout; }
+
+protected:
+    /// Bucket states.
+    enum state_type { EMPTY, FULL, DELETED };
+
+    /// Result of reading a bucket.
+    enum probe_type { PROBE_MATCH, PROBE_NEXT, PROBE_STOP };
+
+    static std::size_t const NPOS = ~static_cast<std::size_t>(0); ///< Not found index.
+
+    /// A table bucket.
+    struct bucket {
+        boost::atomic<boost::uint32_t> m_version; ///< Write version, odd while being written.
+        boost::atomic<time_type> m_last_used; ///< Time of last use.
+        state_type m_state; ///< Bucket state.
+        key_type m_key; ///< Flow.
+        value_type m_value; ///< Value for the flow.
+    };
+
+    /// Read bucket @a b for @a key, and if it matches copy the value to @a v.
+    probe_type probe(bucket const& b, key_type const& key, value_type& v) const;
+
+    /// Find the bucket for @a key and copy its value to @a v, returning its index or @c NPOS.
+    std::size_t search(key_type const& key, value_type& v) const {
+        std::size_t idx = key.hash() & m_mask;
+        for ( std::size_t i = 0 ; i <= m_mask ; ++i, idx = (idx + 1) & m_mask ) {
+            probe_type r = this->probe(m_buckets[idx], key, v);
+            if (PROBE_MATCH == r) return idx;
+            if (PROBE_STOP == r) break;
+        }
+        return NPOS;
+    }
+
+    /// Start writing bucket @a b.
+    static void write_begin(bucket& b) {
+        b.m_version.store(b.m_version.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_release);
+    }
+    /// Finish writing bucket @a b.
+    static void write_end(bucket& b) {
+        b.m_version.store(b.m_version.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+    }
+
+    /// Remove the flow in bucket @a idx.
+    void remove(std::size_t idx);
+
+    boost::scoped_array<bucket> m_buckets; ///< Buckets.
+    std::size_t m_mask; ///< Bucket index mask.
+    std::size_t m_limit; ///< Maximum number of buckets in use.
+    std::size_t m_used; ///< Buckets not empty.
+    std::size_t m_cursor; ///< Next bucket for @c sweep.
+    time_type m_timeout; ///< Idle timeout.
+    boost::atomic<std::size_t> m_count; ///< Number of flows.
+    boost::mutex m_mutex; ///< Serializes writers.
+
+private:
+    // Not copyable.
+    flow_table(self const&);
+    self& operator = (self const&);
+};
+/* ------------------------------------------------------------------------ */
+template < typename V >
+flow_table<V>::flow_table(std::size_t capacity, time_type idle_timeout)
+    : m_used(0)
+    , m_cursor(0)
+    , m_timeout(idle_timeout)
+    , m_count(0)
+{
+    std::size_t n = 16;
+    while (n < capacity) n <<= 1;
+    m_buckets.reset(new bucket[n]);
+    m_mask = n - 1;
+    m_limit = n - n / 4;
+    for ( std::size_t i = 0 ; i < n ; ++i ) {
+        m_buckets[i].m_version.store(0, boost::memory_order_relaxed);
+        m_buckets[i].m_last_used.store(0, boost::memory_order_relaxed);
+        m_buckets[i].m_state = EMPTY;
+    }
+}
+
+template < typename V > typename flow_table<V>::probe_type
+flow_table<V>::probe(bucket const& b, key_type const& key, value_type& v) const {
+    value_type tmp;
+    while (true) {
+        boost::uint32_t version = b.m_version.load(boost::memory_order_acquire);
+        if (version & 1) continue; // being written.
+        state_type state = b.m_state;
+        bool match = FULL == state && b.m_key == key;
+        if (match) tmp = b.m_value;
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (b.m_version.load(boost::memory_order_relaxed) != version) continue;
+        if (match) {
+            v = tmp;
+            return PROBE_MATCH;
+        }
+        return EMPTY == state ? PROBE_STOP : PROBE_NEXT;
+    }
+}
+
+template < typename V > bool
+flow_table<V>::insert(key_type const& key, value_type const& v, time_type now) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::size_t slot = NPOS; // bucket to use if @a key is not found.
+    std::size_t idx = key.hash() & m_mask;
+
+    for ( std::size_t i = 0 ; i <= m_mask ; ++i, idx = (idx + 1) & m_mask ) {
+        bucket& b = m_buckets[idx];
+        if (EMPTY == b.m_state) {
+            if (NPOS == slot) slot = idx;
+            break;
+        } else if (FULL == b.m_state) {
+            if (b.m_key == key) {
+                write_begin(b);
+                b.m_value = v;
+                write_end(b);
+                b.m_last_used.store(now, boost::memory_order_relaxed);
+                return true;
+            }
+        } else if (NPOS == slot) {
+            slot = idx; // first deleted bucket.
+        }
+    }
+
+    if (NPOS == slot) return false;
+
+    bucket& b = m_buckets[slot];
+    if (EMPTY == b.m_state) {
+        if (m_used >= m_limit) return false;
+        ++m_used;
+    }
+    b.m_last_used.store(now, boost::memory_order_relaxed);
+    write_begin(b);
+    b.m_key = key;
+    b.m_value = v;
+    b.m_state = FULL;
+    write_end(b);
+    ++m_count;
+    return true;
+}
+
+template < typename V > bool
+flow_table<V>::erase(key_type const& key) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::size_t idx = key.hash() & m_mask;
+
+    for ( std::size_t i = 0 ; i <= m_mask ; ++i, idx = (idx + 1) & m_mask ) {
+        bucket& b = m_buckets[idx];
+        if (EMPTY == b.m_state) break;
+        if (FULL == b.m_state && b.m_key == key) {
+            this->remove(idx);
+            return true;
+        }
+    }
+    return false;
+}
+
+template < typename V > std::size_t
+flow_table<V>::sweep(time_type now, std::size_t n) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::size_t zret = 0;
+
+    if (n > m_mask + 1) n = m_mask + 1;
+    for ( ; n ; --n, m_cursor = (m_cursor + 1) & m_mask ) {
+        bucket& b = m_buckets[m_cursor];
+        if (FULL == b.m_state && static_cast<time_type>(now - b.m_last_used.load(boost::memory_order_relaxed)) > m_timeout) {
+            this->remove(m_cursor);
+            ++zret;
+        }
+    }
+    return zret;
+}
+
+template < typename V > flow_table<V>&
+flow_table<V>::clear() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    for ( std::size_t i = 0 ; i <= m_mask ; ++i ) {
+        bucket& b = m_buckets[i];
+        if (EMPTY != b.m_state) {
+            write_begin(b);
+            b.m_state = EMPTY;
+            write_end(b);
+        }
+    }
+    m_used = 0;
+    m_count.store(0, boost::memory_order_relaxed);
+    return *this;
+}
+
+template < typename V > void
+flow_table<V>::remove(std::size_t idx) {
+    bucket& b = m_buckets[idx];
+    write_begin(b);
+    b.m_state = DELETED;
+    write_end(b);
+    --m_count;
+
+    /*  A probe stops at an empty bucket, so a run of deleted buckets just before
+        an empty bucket can be made empty without changing any lookup result.
+     */
+    if (EMPTY != m_buckets[(idx + 1) & m_mask].m_state) return;
+    while (DELETED == m_buckets[idx].m_state) {
+        bucket& d = m_buckets[idx];
+        write_begin(d);
+        d.m_state = EMPTY;
+        write_end(d);
+        --m_used;
+        idx = (idx - 1) & m_mask;
+    }
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -0,0 +1,371 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <string>
+# include <vector>
+# include <algorithm>
+# include <stdexcept>
+# include <boost/cstdint.hpp>
+# include <boost/utility/string_ref.hpp>
+# include <ngeo/lexicon.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Read only snapshot of a @c lexicon for fast name conversion.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** A read only copy of a @c lexicon for small dense key domains.
+
+    A @c lexicon is built for flexibility - names can be added and removed at
+    any time, and every lookup is a search in a tree or hash index. For types
+    such as @c ip_protocol, @c icmp_type and @c ip_port the keys are small
+    integers and the names rarely change after initialization, so a snapshot
+    can make both directions of conversion constant time.
+
+    - Keys are converted to names by direct indexing of an array over the key
+      range.
+    - Names are converted to keys with a minimal perfect hash of the case
+      folded names, so that exactly one name has to be compared (ignoring case)
+      to resolve a name.
+
+    Names are returned as @c boost::string_ref into storage owned by the
+    snapshot, and no conversion allocates memory (except to report an error).
+
+    The snapshot does not track changes to the source @c lexicon, it must be
+    rebuilt to pick them up.
+
+    Default names and keys are copied from the source @c lexicon. A default name
+    functor is evaluated for every key in the key range that has no name when
+    the snapshot is built. Outside of the key range only a default name that is
+    a value is used.
+
+    @a K must be constructible from and provide @c host_order to convert to its
+    @c host_type, which must be an integral type. This is the case for the IP value
+    types.
+ */
+template < typename K ///< Type of which to name instances
+         >
+class frozen_lexicon
+{
+public:
+    typedef frozen_lexicon self; ///< Self reference type.
+    typedef K key_type; ///< Key type.
+    typedef typename K::host_type host_type; ///< Integral type for keys.
+    typedef boost::string_ref name_type; ///< Type used for names.
+    typedef ngeo::lexicon<K> lexicon_type; ///< Source lexicon type.
+
+    /// Default constructor, no names.
+    frozen_lexicon();
+
+    /** Construct from @a lex.
+        The key range is from the smallest to the largest key with a name.
+     */
+    explicit frozen_lexicon(
+        lexicon_type const& lex ///< [in] Source lexicon.
+    );
+
+    /** Construct from @a lex with an explicit key range.
+        The range is extended if needed to cover every key with a name. This
+        is useful to have default names for the entire domain of @a K
+        resolved in advance.
+     */
+    frozen_lexicon(
+        lexicon_type const& lex, ///< [in] Source lexicon.
+        key_type min, ///< [in] Minimum key.
+        key_type max ///< [in] Maximum key.
+    );
+
+    /** Find the primary name for @a key.
+        If @a key has no name the default name is used, if there is one.
+        @return @c true and the name in @a name if found, @c false otherwise.
+     */
+    bool find(
+        key_type key, ///< [in] Search key.
+        name_type& name ///< [out] Name for @a key.
+    ) const;
+
+    /** Find the key for @a name, ignoring case.
+        The default key is not used.
+        @return @c true and the key in @a key if @a name is defined, @c false otherwise.
+     */
+    bool find(
+        name_type name, ///< [in] Search name.
+        key_type& key ///< [out] Key for @a name.
+    ) const;
+
+    /** Find the primary name for @a key.
+        @return The primary name for @a key.
+        @throw std::domain_error If @a key does not have an associated name and no default has been set.
+     */
+    name_type operator [] (key_type key) const;
+
+    /** Convert @a name to the key with which it is associated.
+        If @a name is not defined and the default key is a functor, the functor is invoked
+        with a copy of @a name.
+        @return The key associated with @a name.
+        @throw std::domain_error If @a name is not associated with any key and no default has been set.
+     */
+    key_type operator [] (name_type name) const;
+    /// @c std::string overload, to be unambiguous with respect to conversions to @a K.
+    key_type operator [] (std::string const& name) const { return (*this)[name_type(name)]; }
+    /// C string overload, to be unambiguous with respect to conversions to @a K.
+    key_type operator [] (char const* name) const { return (*this)[name_type(name)]; }
+
+    /// Number of defined names.
+    std::size_t size() const { return m_slots.size(); }
+    /// Test if there are no names.
+    bool empty() const { return m_slots.empty(); }
+    /// Minimum key in the direct indexed range.
+    key_type min() const { return key_type(static_cast<host_type>(m_lo)); }
+    /// Maximum key in the direct indexed range.
+    key_type max() const { return key_type(static_cast<host_type>(m_lo + m_by_key.size() - 1)); }
+
+protected:
+    /// A name, as a location in the text storage.
+    struct text_ref {
+        boost::uint32_t m_offset; ///< Offset in @c m_text.
+        boost::uint32_t m_length; ///< Length of the name.
+    };
+    /// Perfect hash table slot.
+    struct slot {
+        text_ref m_name; ///< Name.
+        key_type m_key; ///< Key for the name.
+    };
+
+    static boost::uint32_t const NONE = ~static_cast<boost::uint32_t>(0); ///< Invalid text offset.
+
+    /// Fold an ASCII character to lower case.
+    static unsigned char fold(char c) {
+        return static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+    }
+    /// Hash of the case folded @a name.
+    static boost::uint64_t hash(name_type name, boost::uint64_t salt) {
+        boost::uint64_t h = 14695981039346656037ULL ^ salt;
+        for ( name_type::const_iterator spot = name.begin(), limit = name.end() ; spot != limit ; ++spot ) {
+            h ^= fold(*spot);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+    /// Finalize hash bits.
+    static boost::uint64_t mix(boost::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    /// Reduce @a h to [0, @a n).
+    static std::size_t reduce(boost::uint64_t h, std::size_t n) {
+        return static_cast<std::size_t>(((h >> 32) * n) >> 32);
+    }
+    /// Hash table bucket for @a h.
+    std::size_t bucket_of(boost::uint64_t h) const { return reduce(mix(h), m_seeds.size()); }
+    /// Slot for @a h with displacement @a seed.
+    std::size_t slot_of(boost::uint64_t h, boost::uint32_t seed) const {
+        return reduce(mix(h ^ ((seed + 1) * 0x9e3779b97f4a7c15ULL)), m_slots.size());
+    }
+
+    /// Index in the key array for @a key.
+    static long index_of(key_type const& key) { return static_cast<long>(key.host_order()); }
+    /// Name for @a ref.
+    name_type text(text_ref const& ref) const { return name_type(m_text.data() + ref.m_offset, ref.m_length); }
+    /// Store @a name and return a reference to it.
+    text_ref store(std::string const& name);
+    /// Compare @a name to @a ref ignoring case.
+    bool equal(name_type name, text_ref const& ref) const;
+
+    /// Load from @a lex with the key range [@a lo, @a hi].
+    void load(lexicon_type const& lex, long lo, long hi, bool fixed);
+    /// Build the perfect hash for @a names.
+    void build_hash(std::vector<std::pair<std::string, key_type> > const& names);
+
+    std::string m_text; ///< Storage for all names.
+    long m_lo; ///< Key index for the first element of @c m_by_key.
+    std::vector<text_ref> m_by_key; ///< Primary or default name by key.
+    text_ref m_default_name; ///< Default name outside of the key range.
+    std::vector<slot> m_slots; ///< Perfect hash slots, one per name.
+    std::vector<boost::uint32_t> m_seeds; ///< Displacement per hash bucket.
+    boost::uint64_t m_salt; ///< Hash salt.
+    /// Default key handler, from the source lexicon.
+    boost::variant<typename lexicon_type::nil_type, key_type, typename lexicon_type::key_generator> m_default_key;
+};
+/* ------------------------------------------------------------------------ */
+template < typename K >
+frozen_lexicon<K>::frozen_lexicon() : m_lo(0), m_salt(0) {
+    m_default_name.m_offset = NONE;
+    m_default_name.m_length = 0;
+}
+
+template < typename K >
+frozen_lexicon<K>::frozen_lexicon(lexicon_type const& lex) : m_lo(0), m_salt(0) {
+    this->load(lex, 0, -1, false);
+}
+
+template < typename K >
+frozen_lexicon<K>::frozen_lexicon(lexicon_type const& lex, key_type min, key_type max) : m_lo(0), m_salt(0) {
+    this->load(lex, index_of(min), index_of(max), true);
+}
+
+template < typename K > typename frozen_lexicon<K>::text_ref
+frozen_lexicon<K>::store(std::string const& name) {
+    text_ref zret;
+    zret.m_offset = static_cast<boost::uint32_t>(m_text.size());
+    zret.m_length = static_cast<boost::uint32_t>(name.size());
+    m_text.append(name);
+    return zret;
+}
+
+template < typename K > bool
+frozen_lexicon<K>::equal(name_type name, text_ref const& ref) const {
+    if (name.size() != ref.m_length) return false;
+    char const* s = m_text.data() + ref.m_offset;
+    for ( std::size_t i = 0 ; i < name.size() ; ++i )
+        if (fold(name[i]) != fold(s[i])) return false;
+    return true;
+}
+
+template < typename K > void
+frozen_lexicon<K>::load(lexicon_type const& lex, long lo, long hi, bool fixed) {
+    typedef typename lexicon_type::name_type string_type;
+    typedef typename lexicon_type::name_generator name_generator;
+    std::vector<std::pair<std::string, key_type> > names;
+
+    m_default_name.m_offset = NONE;
+    m_default_name.m_length = 0;
+    if (1 == lex._default_name.which())
+        m_default_name = this->store(boost::get<string_type>(lex._default_name));
+    m_default_key = lex._default_key;
+
+    for ( typename lexicon_type::const_iterator spot = lex.begin(), limit = lex.end() ; spot != limit ; ++spot ) {
+        long idx = index_of(spot->key());
+        if (!fixed && names.empty()) lo = hi = idx;
+        lo = std::min(lo, idx);
+        hi = std::max(hi, idx);
+        names.push_back(std::make_pair(spot->name(), spot->key()));
+    }
+    if (hi < lo) return; // no names and no range.
+
+    m_lo = lo;
+    m_by_key.resize(hi - lo + 1, m_default_name);
+    for ( typename lexicon_type::const_iterator spot = lex.begin(), limit = lex.end() ; spot != limit ; ++spot )
+        if (spot->is_primary()) m_by_key[index_of(spot->key()) - m_lo] = this->store(spot->name());
+
+    if (2 == lex._default_name.which()) {
+        name_generator const& f = boost::get<name_generator>(lex._default_name);
+        for ( std::size_t i = 0 ; i < m_by_key.size() ; ++i )
+            if (NONE == m_by_key[i].m_offset) m_by_key[i] = this->store(f(key_type(static_cast<host_type>(m_lo + static_cast<long>(i)))));
+    }
+    this->build_hash(names);
+}
+
+/*  This is the "hash and displace" construction. Names are hashed in to
+    buckets, with about two names per bucket. Buckets are placed largest first,
+    and for each a seed is searched for that puts all of its names in free
+    slots. Lookup is a hash, a seed load, and a second hash to get the slot.
+ */
+template < typename K > void
+frozen_lexicon<K>::build_hash(std::vector<std::pair<std::string, key_type> > const& names) {
+    // Give up on a seed search after this many tries and change the salt.
+    static boost::uint32_t const MAX_SEED = 1 << 20;
+    std::size_t n = names.size();
+    std::vector<boost::uint64_t> hashes(n);
+    std::vector<std::vector<std::size_t> > buckets;
+    std::vector<std::pair<std::size_t, std::size_t> > order; // (size, bucket)
+    std::vector<char> used;
+    std::vector<std::size_t> placed;
+
+    if (0 == n) return;
+    m_slots.resize(n);
+    m_seeds.assign(n / 2 + 1, 0);
+    for ( m_salt = 0 ; ; ++m_salt ) {
+        buckets.assign(m_seeds.size(), std::vector<std::size_t>());
+        for ( std::size_t i = 0 ; i < n ; ++i ) {
+            hashes[i] = hash(names[i].first, m_salt);
+            buckets[this->bucket_of(hashes[i])].push_back(i);
+        }
+        order.clear();
+        for ( std::size_t b = 0 ; b < buckets.size() ; ++b )
+            if (!buckets[b].empty()) order.push_back(std::make_pair(buckets[b].size(), b));
+        std::sort(order.begin(), order.end());
+        used.assign(n, false);
+
+        bool ok = true;
+        for ( std::size_t k = order.size() ; ok && k-- > 0 ; ) {
+            std::vector<std::size_t> const& bucket = buckets[order[k].second];
+            boost::uint32_t seed = 0;
+            for ( ; seed < MAX_SEED ; ++seed ) {
+                placed.clear();
+                for ( std::size_t j = 0 ; j < bucket.size() ; ++j ) {
+                    std::size_t s = this->slot_of(hashes[bucket[j]], seed);
+                    if (used[s] || placed.end() != std::find(placed.begin(), placed.end(), s)) break;
+                    placed.push_back(s);
+                }
+                if (placed.size() == bucket.size()) break;
+            }
+            if (seed == MAX_SEED) {
+                ok = false;
+            } else {
+                m_seeds[order[k].second] = seed;
+                for ( std::size_t j = 0 ; j < bucket.size() ; ++j ) {
+                    used[placed[j]] = true;
+                    m_slots[placed[j]].m_key = names[bucket[j]].second;
+                    m_slots[placed[j]].m_name = this->store(names[bucket[j]].first);
+                }
+            }
+        }
+        if (ok) break;
+    }
+}
+
+template < typename K > bool
+frozen_lexicon<K>::find(key_type key, name_type& name) const {
+    text_ref const* ref = &m_default_name;
+    long idx = index_of(key) - m_lo;
+    if (0 <= idx && idx < static_cast<long>(m_by_key.size())) ref = &m_by_key[idx];
+    if (NONE == ref->m_offset) return false;
+    name = this->text(*ref);
+    return true;
+}
+
+template < typename K > bool
+frozen_lexicon<K>::find(name_type name, key_type& key) const {
+    if (m_slots.empty()) return false;
+    boost::uint64_t h = hash(name, m_salt);
+    slot const& s = m_slots[this->slot_of(h, m_seeds[this->bucket_of(h)])];
+    if (!this->equal(name, s.m_name)) return false;
+    key = s.m_key;
+    return true;
+}
+
+template < typename K > typename frozen_lexicon<K>::name_type
+frozen_lexicon<K>::operator [] (key_type key) const {
+    name_type zret;
+    if (!this->find(key, zret))
+        throw std::domain_error((boost::format("Lexicon Error: no names defined for value '%1%'") % key).str());
+    return zret;
+}
+
+template < typename K > typename frozen_lexicon<K>::key_type
+frozen_lexicon<K>::operator [] (name_type name) const {
+    typedef typename lexicon_type::key_generator key_generator;
+    key_type zret;
+    if (!this->find(name, zret)) {
+        if (1 == m_default_key.which())
+            zret = boost::get<key_type>(m_default_key);
+        else if (2 == m_default_key.which())
+            zret = boost::get<key_generator>(m_default_key)(std::string(name.data(), name.size()));
+        else
+            throw std::domain_error((boost::format("Lexicon Error: use of undefined name '%1%'") % name).str());
+    }
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -39,4 +39,5 @@
 /* ------------------------------------------------------------------------ */
 # include <ngeo/ip_base.hpp>
 # include <ngeo/ip_service.hpp>
+# include <ngeo/ip6_base.hpp>
 /* ------------------------------------------------------------------------ */
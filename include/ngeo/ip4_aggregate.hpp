@@ -0,0 +1,142 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <vector>
+# include <utility>
+# include <algorithm>
+# include <ngeo/ip_base.hpp>
+# include <ngeo/radix_sort.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Aggregation (supernetting) of IPv4 network lists.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/// @cond IMPLEMENTATION
+namespace detail {
+    /** Append the minimal network cover of the union of @a nets to @a out.
+        @a nets must be in address order. Overlapping and adjacent networks are
+        merged in to ranges in a single pass, and each range is converted to
+        the fewest networks that cover it.
+     */
+    inline void
+    aggregate_sorted(ip4_net const* nets, std::size_t n, std::vector<ip4_net>& out) {
+        std::size_t i = 0;
+        while (i < n) {
+            ip4_addr::host_type min = nets[i].addr().host_order();
+            ip4_addr::host_type max = nets[i].max_addr().host_order();
+            for ( ++i ; i < n ; ++i ) {
+                // Stop at a gap, unless the range already reaches the end of the address space.
+                if (max != ip4_addr::MAX.host_order() && nets[i].addr().host_order() > max + 1) break;
+                max = std::max(max, nets[i].max_addr().host_order());
+            }
+            ip4_range r = ip4_range(ip4_addr(min), ip4_addr(max));
+            std::copy(r.net_begin(), r.net_end(), std::back_inserter(out));
+        }
+    }
+
+    /// Payload ordering for a permutation of network / payload pairs.
+    template < typename T > struct aggregate_payload_order {
+        std::pair<ip4_net, T> const* m_values; //!< Values being sorted.
+        /// Comparison.
+        bool operator () (boost::uint32_t lhs, boost::uint32_t rhs) const {
+            return m_values[lhs].second < m_values[rhs].second;
+        }
+    };
+}
+/// @endcond
+
+/** Aggregate a list of networks.
+
+    The result is the smallest set of networks that contains exactly the
+    same addresses as the input. Networks that are subsets of other networks
+    are dropped and adjacent networks are merged in to their parent networks
+    as far as possible. The result is in address order and has no overlaps.
+
+    The input can be any sequence of values that explicitly convert to
+    @c ip4_net, such as @c ip4_net or @c ip4_addr. Empty networks are ignored.
+
+    The cost is a radix sort of the input followed by a single linear pass.
+ */
+template < typename I > std::vector<ip4_net>
+aggregate(
+    I first, //!< [in] Start of input.
+    I last, //!< [in] End of input.
+    unsigned threads = 1 //!< [in] Number of threads for sorting.
+) {
+    std::vector<ip4_net> nets;
+    std::vector<ip4_net> zret;
+    for ( ; first != last ; ++first ) {
+        ip4_net net(*first);
+        if (!net.is_empty()) nets.push_back(net);
+    }
+    if (!nets.empty()) {
+        radix_sort(&nets[0], nets.size(), threads);
+        detail::aggregate_sorted(&nets[0], nets.size(), zret);
+    }
+    return zret;
+}
+
+/** Aggregate a list of networks with payloads.
+
+    This is the same as @c aggregate for each set of networks with equal
+    payloads. Networks are merged only with networks that have an equal
+    payload, and networks with different payloads are never combined even
+    if they overlap. The result is in address order, and for the same network
+    in payload order.
+
+    @a T must be less than comparable and copy constructible. Payloads
+    are equal if neither is less than the other.
+ */
+template < typename T > std::vector<std::pair<ip4_net, T> >
+aggregate(
+    std::pair<ip4_net, T> const* values, //!< [in] Networks and payloads.
+    std::size_t n, //!< [in] Number of values.
+    unsigned threads = 1 //!< [in] Number of threads for sorting.
+) {
+    typedef std::pair<ip4_net, T> value_type;
+    std::vector<value_type> zret;
+    std::vector<ip4_net> nets;
+    std::vector<boost::uint32_t> perm;
+    std::vector<ip4_net> group;
+    std::vector<ip4_net> cover;
+
+    if (0 == n) return zret;
+
+    // Order by address, then stable sort by payload to get each payload's networks in address order.
+    for ( std::size_t i = 0 ; i < n ; ++i ) nets.push_back(values[i].first);
+    radix_permutation(&nets[0], n, perm, threads);
+    detail::aggregate_payload_order<T> order = { values };
+    std::stable_sort(perm.begin(), perm.end(), order);
+
+    for ( std::size_t i = 0 ; i < n ; ) {
+        std::size_t start = i;
+        group.clear();
+        for ( ; i < n && !order(perm[start], perm[i]) ; ++i )
+            if (!nets[perm[i]].is_empty()) group.push_back(nets[perm[i]]);
+        cover.clear();
+        if (!group.empty()) detail::aggregate_sorted(&group[0], group.size(), cover);
+        for ( std::size_t k = 0 ; k < cover.size() ; ++k )
+            zret.push_back(value_type(cover[k], values[perm[start]].second));
+    }
+
+    // Put the result in address order.
+    nets.clear();
+    for ( std::size_t i = 0 ; i < zret.size() ; ++i ) nets.push_back(zret[i].first);
+    if (!nets.empty()) {
+        radix_permutation(&nets[0], nets.size(), perm, threads);
+        std::vector<value_type> sorted;
+        sorted.reserve(zret.size());
+        for ( std::size_t i = 0 ; i < perm.size() ; ++i ) sorted.push_back(zret[perm[i]]);
+        zret.swap(sorted);
+    }
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
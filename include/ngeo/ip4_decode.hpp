@@ -0,0 +1,155 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <cstring>
+# include <boost/cstdint.hpp>
+# include <ngeo/ip_service.hpp>
+# if defined(_MSC_VER)
+#   include <stdlib.h>
+# endif
+/* ------------------------------------------------------------------------ */
+# if defined(_MSC_VER)
+#   if NG_STATIC
+#       define API
+#   else
+#       if defined(NETWORK_GEOGRAPHICS_IP_API)
+#           define API _declspec(dllexport)
+#       else
+#           define API _declspec(dllimport)
+#       endif
+#   endif
+# else
+#   define API
+# endif
+/* ------------------------------------------------------------------------ */
+/** @file
+    Decoding of raw IPv4 packet headers in to flow keys.
+
+    The headers are read in place, the fields are extracted directly in to an
+    @c ip4_flow in host order. The result can be used for connection table
+    lookups, or the fields used as flowspace query points.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/// Result of decoding a packet header.
+enum ip4_decode_status {
+    DECODE_OK, //!< Complete flow key.
+    /** Not the first fragment of a packet.
+        The addresses and protocol are set, the ports are zero because the
+        transport header is in the first fragment.
+     */
+    DECODE_FRAGMENT,
+    /** The transport header is cut off.
+        The addresses and protocol are set, the ports are zero.
+     */
+    DECODE_TRUNCATED,
+    DECODE_INVALID //!< Not a valid IPv4 header, the flow is not changed.
+};
+
+/// @cond IMPLEMENTATION
+namespace detail {
+    /// Load a 16 bit big endian value.
+    inline boost::uint16_t load_be16(unsigned char const* p) {
+        return static_cast<boost::uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    /// Load a 32 bit big endian value.
+    inline boost::uint32_t load_be32(unsigned char const* p) {
+        boost::uint32_t x;
+        std::memcpy(&x, p, sizeof(x));
+# if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap32(x);
+# elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return x;
+# elif defined(_MSC_VER)
+        return _byteswap_ulong(x);
+# else
+        return (static_cast<boost::uint32_t>(p[0]) << 24) | (static_cast<boost::uint32_t>(p[1]) << 16)
+            | (static_cast<boost::uint32_t>(p[2]) << 8) | p[3];
+# endif
+    }
+}
+/// @endcond
+
+/** Decode the IPv4 header at @a data in to @a flow.
+
+    @a data is the start of the IPv4 header and @a len the number of captured
+    bytes. Nothing outside of [@a data, @a data + @a len) is read. If the IP
+    total length is less than @a len, the rest is treated as padding.
+
+    For TCP and UDP the ports are read from the transport header. For ICMP
+    the message type and code are stored in the port fields, as for
+    @c ip4_flow. Other protocols have zero ports. IP options are skipped.
+
+    @return The decoding status, @a flow is set unless it is @c DECODE_INVALID.
+ */
+inline ip4_decode_status
+decode(
+    unsigned char const* data, //!< [in] IPv4 header.
+    std::size_t len, //!< [in] Bytes available at @a data.
+    ip4_flow& flow //!< [out] Flow key.
+) {
+    if (len < 20 || (data[0] >> 4) != 4) return DECODE_INVALID;
+
+    std::size_t hlen = (data[0] & 0x0F) << 2;
+    std::size_t total = detail::load_be16(data + 2);
+    if (hlen < 20 || hlen > len || total < hlen) return DECODE_INVALID;
+    if (total < len) len = total;
+
+    boost::uint8_t proto = data[9];
+    boost::uint32_t src = detail::load_be32(data + 12);
+    boost::uint32_t dst = detail::load_be32(data + 16);
+    unsigned char const* l4 = data + hlen;
+    std::size_t l4len = len - hlen;
+
+    if (detail::load_be16(data + 6) & 0x1FFF) { // fragment offset.
+        flow.assign(src, 0, dst, 0, proto);
+        return DECODE_FRAGMENT;
+    }
+
+    switch (proto) {
+        case ip_protocol::HOST_TCP:
+        case ip_protocol::HOST_UDP:
+            if (l4len < 4) break;
+            flow.assign(src, detail::load_be16(l4), dst, detail::load_be16(l4 + 2), proto);
+            return DECODE_OK;
+        case ip_protocol::HOST_ICMP:
+            if (l4len < 2) break;
+            flow.assign(src, l4[0], dst, l4[1], proto);
+            return DECODE_OK;
+        default:
+            flow.assign(src, 0, dst, 0, proto);
+            return DECODE_OK;
+    }
+    flow.assign(src, 0, dst, 0, proto);
+    return DECODE_TRUNCATED;
+}
+
+/** Decode a burst of packets.
+
+    This is the same as calling @c decode for each packet, but the packet
+    data is prefetched ahead of decoding so that the memory latency for the
+    burst is overlapped.
+
+    @a flows and @a status must have room for @a n elements. @a status can be
+    null if it is not needed. The flow for a packet that is not valid is set
+    to all zero.
+
+    @return The number of packets with status @c DECODE_OK.
+ */
+API std::size_t
+decode(
+    unsigned char const* const* packets, //!< [in] IPv4 headers.
+    std::size_t const* lengths, //!< [in] Bytes available for each packet.
+    std::size_t n, //!< [in] Number of packets.
+    ip4_flow* flows, //!< [out] Flow keys.
+    ip4_decode_status* status //!< [out] Decode status for each packet.
+);
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+# undef API
+/* ------------------------------------------------------------------------ */
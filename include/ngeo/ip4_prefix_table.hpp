@@ -0,0 +1,342 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <map>
+# include <vector>
+# include <boost/cstdint.hpp>
+# include <ngeo/ip_base.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Longest prefix match table for IPv4 networks.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** Longest prefix match table.
+
+    This is a single dimension container keyed by @c ip4_net, for routing or
+    geolocation style data where the value for an address is the value of the
+    most specific network that contains it. A lookup is one or two array
+    accesses regardless of the number of networks.
+
+    The layout is DIR-24-8. There is a first level array with an entry for
+    every /24. An entry either holds the result for the entire /24 or refers
+    to a second level chunk of 256 entries, one per address in the /24.
+    Chunks are allocated only for /24s that contain a network longer than
+    /24. Every entry also records the length of the network that set it, so
+    that inserting a shorter network does not overwrite a longer one and
+    erasing a network can restore the next shorter one.
+
+    The first level array is always 2^24 entries (64MB), allocated when the
+    table is constructed. This is intended for large tables, for a handful of
+    networks a @c flowspace::layer is the better choice.
+
+    The networks themselves are also kept so that erase can find the covering
+    network, and for iteration.
+
+    @c T must be copy constructible and assignable.
+ */
+template < typename T ///< Value type.
+         >
+class ip4_prefix_table
+{
+public:
+    typedef ip4_prefix_table self; ///< Self reference type.
+    typedef T value_type; ///< Stored value type.
+
+    /// Default constructor, an empty table.
+    ip4_prefix_table()
+        : m_root(ROOT_SIZE, 0)
+        , m_count(0)
+    {
+    }
+
+    /** Set the value for a network.
+        If @a net is already in the table its value is replaced. An empty
+        network is ignored.
+        @return @c true if @a net was added, @c false if it was already present.
+     */
+    bool insert(
+        ip4_net const& net, ///< [in] Network.
+        value_type const& v ///< [in] Value for @a net.
+    );
+
+    /** Remove a network.
+        Addresses in @a net revert to the value of the longest remaining network
+        that contains them, if any.
+        @return @c true if @a net was removed, @c false if it was not in the table.
+     */
+    bool erase(
+        ip4_net const& net ///< [in] Network.
+    );
+
+    /** Find the value for an address.
+        @return A pointer to the value of the longest network containing
+        @a addr, or null if no network contains it.
+     */
+    value_type const* lookup(
+        ip4_addr const& addr ///< [in] Address.
+    ) const {
+        entry_type e = m_root[addr.host_order() >> CHUNK_BITS];
+        if (e & CHUNK_FLAG)
+            e = m_chunks[((e & ~CHUNK_FLAG) << CHUNK_BITS) | (addr.host_order() & CHUNK_MASK)];
+        return this->value(e);
+    }
+
+    /** Find the values for a batch of addresses.
+        This is the same as calling @c lookup for each address, but the memory
+        accesses for the batch are overlapped.
+        @a result must have room for @a n pointers.
+     */
+    void lookup(
+        ip4_addr const* addrs, ///< [in] Addresses.
+        std::size_t n, ///< [in] Number of addresses.
+        value_type const** result ///< [out] Values, null for no match.
+    ) const;
+
+    /** Find the value for an exact network.
+        @return A pointer to the value of @a net, or null if @a net is not in the table.
+     */
+    value_type const* find(
+        ip4_net const& net ///< [in] Network.
+    ) const {
+        typename rule_map::const_iterator spot = m_rules[net.mask().count()].find(net.addr().host_order());
+        return spot == m_rules[net.mask().count()].end() ? 0 : &m_values[spot->second - 1];
+    }
+
+    /// Number of networks in the table.
+    std::size_t size() const { return m_count; }
+    /// Check for no networks.
+    bool empty() const { return 0 == m_count; }
+    /// Remove all networks.
+    self& clear();
+
+    /** Call @a f for every network.
+        The networks are visited from least to most specific, and in
+        address order for the same length. @a f is passed the network and value.
+     */
+    template < typename F > void for_each(F f) const {
+        for ( int len = 0 ; len <= static_cast<int>(ip4_addr::WIDTH) ; ++len )
+            for ( typename rule_map::const_iterator spot = m_rules[len].begin(), limit = m_rules[len].end() ; spot != limit ; ++spot )
+                f(ip4_net(ip4_addr(spot->first), ip4_mask(len)), m_values[spot->second - 1]);
+    }
+
+protected:
+    /** Table entry.
+        If @c CHUNK_FLAG is set the rest of the entry is a chunk index.
+        Otherwise it is the length of the network that set the entry in the
+        bits above @c INDEX_BITS, and a value index below that.
+        Value index zero is no value, otherwise it is one more than the
+        index in @a m_values.
+     */
+    typedef boost::uint32_t entry_type;
+
+    static int const CHUNK_BITS = 8; ///< Address bits resolved by a chunk.
+    static int const ROOT_BITS = ip4_addr::WIDTH - CHUNK_BITS; ///< Address bits resolved by the root.
+    static std::size_t const ROOT_SIZE = static_cast<std::size_t>(1) << ROOT_BITS; ///< Number of root entries.
+    static std::size_t const CHUNK_SIZE = static_cast<std::size_t>(1) << CHUNK_BITS; ///< Entries per chunk.
+    static boost::uint32_t const CHUNK_MASK = CHUNK_SIZE - 1; ///< Address bits for chunk index.
+    static entry_type const CHUNK_FLAG = static_cast<entry_type>(1) << 31; ///< Entry is a chunk index.
+    static int const INDEX_BITS = 25; ///< Bits for value index.
+    static entry_type const INDEX_MASK = (static_cast<entry_type>(1) << INDEX_BITS) - 1;
+
+    /// Networks of one length, address to value index.
+    typedef std::map<boost::uint32_t, entry_type> rule_map;
+
+    /// Construct an entry.
+    static entry_type make_entry(int len, entry_type idx) {
+        return (static_cast<entry_type>(len) << INDEX_BITS) | idx;
+    }
+    /// Network length for entry.
+    static int entry_length(entry_type e) { return static_cast<int>(e >> INDEX_BITS); }
+    /// Value for entry.
+    value_type const* value(entry_type e) const {
+        entry_type idx = e & INDEX_MASK;
+        return idx ? &m_values[idx - 1] : 0;
+    }
+
+    /** Write @a e to entries in [@a first, @a last].
+        For insert (@a exact is @c false) this is every entry set by a network no
+        longer than @a len. For erase (@a exact is @c true) it is every entry set
+        by the network being removed, which has length @a len.
+     */
+    void fill(entry_type* first, entry_type* last, entry_type e, int len, bool exact) {
+        for ( ; first <= last ; ++first ) {
+            int n = entry_length(*first);
+            if (exact ? n == len : n <= len) *first = e;
+        }
+    }
+
+    /// Update the root and chunk entries for the addresses in [@a min, @a max].
+    void update(boost::uint32_t min, boost::uint32_t max, entry_type e, int len, bool exact);
+
+    /// Convert root entry @a idx to a chunk.
+    entry_type split(std::size_t idx);
+    /// Convert the chunk for root entry @a idx back to a single entry if it has no long networks.
+    void merge(std::size_t idx);
+
+    /// Longest network in the table strictly shorter than @a len that contains @a addr.
+    entry_type covering(boost::uint32_t addr, int len) const;
+
+    std::vector<entry_type> m_root; ///< First level table.
+    std::vector<entry_type> m_chunks; ///< Second level chunks.
+    std::vector<entry_type> m_free_chunks; ///< Unused chunk indices.
+    std::vector<value_type> m_values; ///< Values.
+    std::vector<entry_type> m_free_values; ///< Unused value indices.
+    rule_map m_rules[ip4_addr::WIDTH + 1]; ///< Networks by length.
+    std::size_t m_count; ///< Number of networks.
+};
+/* ------------------------------------------------------------------------ */
+template < typename T > bool
+ip4_prefix_table<T>::insert(ip4_net const& net, value_type const& v) {
+    if (net.is_empty()) return false;
+
+    int len = net.mask().count();
+    boost::uint32_t min = net.addr().host_order();
+    std::pair<typename rule_map::iterator, bool> spot = m_rules[len].insert(std::make_pair(min, entry_type(0)));
+
+    if (!spot.second) {
+        // Existing network, replace the value in place.
+        m_values[spot.first->second - 1] = v;
+        return false;
+    }
+
+    entry_type idx;
+    if (m_free_values.empty()) {
+        m_values.push_back(v);
+        idx = m_values.size();
+    } else {
+        idx = m_free_values.back();
+        m_free_values.pop_back();
+        m_values[idx - 1] = v;
+    }
+    spot.first->second = idx;
+    ++m_count;
+
+    this->update(min, net.max_addr().host_order(), make_entry(len, idx), len, false);
+    return true;
+}
+
+template < typename T > bool
+ip4_prefix_table<T>::erase(ip4_net const& net) {
+    if (net.is_empty()) return false;
+
+    int len = net.mask().count();
+    boost::uint32_t min = net.addr().host_order();
+    typename rule_map::iterator spot = m_rules[len].find(min);
+
+    if (spot == m_rules[len].end()) return false;
+
+    entry_type idx = spot->second;
+    m_rules[len].erase(spot);
+    m_values[idx - 1] = value_type();
+    m_free_values.push_back(idx);
+    --m_count;
+
+    this->update(min, net.max_addr().host_order(), this->covering(min, len), len, true);
+    return true;
+}
+
+template < typename T > void
+ip4_prefix_table<T>::lookup(ip4_addr const* addrs, std::size_t n, value_type const** result) const {
+    std::size_t const BATCH = 16;
+    entry_type e[BATCH];
+    while (n) {
+        std::size_t k = n < BATCH ? n : BATCH;
+        // Issue all of the root loads before using any of them.
+        for ( std::size_t i = 0 ; i < k ; ++i )
+            e[i] = m_root[addrs[i].host_order() >> CHUNK_BITS];
+        for ( std::size_t i = 0 ; i < k ; ++i )
+            if (e[i] & CHUNK_FLAG)
+                e[i] = m_chunks[((e[i] & ~CHUNK_FLAG) << CHUNK_BITS) | (addrs[i].host_order() & CHUNK_MASK)];
+        for ( std::size_t i = 0 ; i < k ; ++i )
+            result[i] = this->value(e[i]);
+        addrs += k;
+        result += k;
+        n -= k;
+    }
+}
+
+template < typename T > ip4_prefix_table<T>&
+ip4_prefix_table<T>::clear() {
+    std::fill(m_root.begin(), m_root.end(), 0);
+    m_chunks.clear();
+    m_free_chunks.clear();
+    m_values.clear();
+    m_free_values.clear();
+    for ( int len = 0 ; len <= static_cast<int>(ip4_addr::WIDTH) ; ++len )
+        m_rules[len].clear();
+    m_count = 0;
+    return *this;
+}
+
+template < typename T > void
+ip4_prefix_table<T>::update(boost::uint32_t min, boost::uint32_t max, entry_type e, int len, bool exact) {
+    std::size_t first = min >> CHUNK_BITS;
+
+    if (len > ROOT_BITS) {
+        // Inside a single /24, always in a chunk.
+        entry_type root = m_root[first];
+        entry_type chunk = (root & CHUNK_FLAG) ? root & ~CHUNK_FLAG : this->split(first);
+        entry_type* base = &m_chunks[chunk << CHUNK_BITS];
+        this->fill(base + (min & CHUNK_MASK), base + (max & CHUNK_MASK), e, len, exact);
+        if (exact) this->merge(first);
+        return;
+    }
+
+    std::size_t last = max >> CHUNK_BITS;
+    for ( std::size_t idx = first ; idx <= last ; ++idx ) {
+        entry_type root = m_root[idx];
+        if (root & CHUNK_FLAG) {
+            entry_type* base = &m_chunks[(root & ~CHUNK_FLAG) << CHUNK_BITS];
+            this->fill(base, base + CHUNK_MASK, e, len, exact);
+        } else {
+            int n = entry_length(root);
+            if (exact ? n == len : n <= len) m_root[idx] = e;
+        }
+    }
+}
+
+template < typename T > typename ip4_prefix_table<T>::entry_type
+ip4_prefix_table<T>::split(std::size_t idx) {
+    entry_type chunk;
+    if (m_free_chunks.empty()) {
+        chunk = m_chunks.size() >> CHUNK_BITS;
+        m_chunks.resize(m_chunks.size() + CHUNK_SIZE);
+    } else {
+        chunk = m_free_chunks.back();
+        m_free_chunks.pop_back();
+    }
+    entry_type* base = &m_chunks[chunk << CHUNK_BITS];
+    std::fill(base, base + CHUNK_SIZE, m_root[idx]);
+    m_root[idx] = chunk | CHUNK_FLAG;
+    return chunk;
+}
+
+template < typename T > void
+ip4_prefix_table<T>::merge(std::size_t idx) {
+    entry_type chunk = m_root[idx] & ~CHUNK_FLAG;
+    entry_type* base = &m_chunks[chunk << CHUNK_BITS];
+    // If nothing longer than the root is left, all entries are the same.
+    for ( std::size_t i = 0 ; i < CHUNK_SIZE ; ++i )
+        if (entry_length(base[i]) > ROOT_BITS) return;
+    m_root[idx] = base[0];
+    m_free_chunks.push_back(chunk);
+}
+
+template < typename T > typename ip4_prefix_table<T>::entry_type
+ip4_prefix_table<T>::covering(boost::uint32_t addr, int len) const {
+    while (len-- > 0) {
+        boost::uint32_t key = len ? addr & (~static_cast<boost::uint32_t>(0) << (ip4_addr::WIDTH - len)) : 0;
+        typename rule_map::const_iterator spot = m_rules[len].find(key);
+        if (spot != m_rules[len].end()) return make_entry(len, spot->second);
+    }
+    return 0;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -0,0 +1,583 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+
+/** @file
+    IPv6 addresses, masks, networks and ranges.
+    These parallel the IPv4 types and can be used as flowspace metrics.
+ */
+
+# include <ngeo/ip_base.hpp>
+# include <boost/cstdint.hpp>
+# include <boost/functional/hash.hpp>
+/* ------------------------------------------------------------------------ */
+# if defined(_MSC_VER)
+#   if NG_STATIC
+#       define API
+#   else
+#       if defined(NETWORK_GEOGRAPHICS_IP_API)
+#           define API _declspec(dllexport)
+#       else
+#           define API _declspec(dllimport)
+#       endif
+#   endif
+# else
+#   define API __attribute__ ((visibility("default")))
+# endif
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+class ip6_mask;
+/* ------------------------------------------------------------------------ */
+/** IPv6 address.
+    The 128 bit value is stored in host order as two 64 bit halves.
+    This class is @ref totally_ordered and supports the arithmetic needed
+    to be an @c interval metric.
+ */
+class API ip6_addr
+    : public boost::totally_ordered <
+        ip6_addr,
+        boost::unit_steppable <
+            ip6_addr,
+            boost::additive <
+                ip6_addr,
+                boost::shiftable <
+                    ip6_addr,
+                    unsigned int,
+                    boost::bitwise <
+                        ip6_addr
+    > > > > > {
+public:
+    typedef ip6_addr self; //!< Self reference type.
+    typedef boost::uint64_t half_type; //!< Storage type for each half of the address.
+
+    //! The size of the address in bits.
+    static unsigned int const WIDTH = 128;
+    //! The size of a half in bits.
+    static unsigned int const HALF_WIDTH = 64;
+
+    //! Default constructor, the zero address.
+    ip6_addr() : _hi(0), _lo(0) { }
+    //! Construct from halves, in host order.
+    ip6_addr(
+        half_type hi, //!< Upper 64 bits.
+        half_type lo //!< Lower 64 bits.
+    ) : _hi(hi), _lo(lo) { }
+
+    /** Construct from a network mask.
+        Only the type changes, the underlying value is preserved.
+     */
+    ip6_addr(ip6_mask const& mask); // definition delayed until ip6_mask is defined.
+
+    /** Construct from text.
+        @throw boost::bad_lexical_cast If @a s is not exactly an address.
+     */
+    ip6_addr(std::string const& s);
+
+    //! Test if @a s is a valid address.
+    static bool is_valid(std::string const& s);
+
+    //! Rewrite address value from halves in host order.
+    self& set(half_type hi, half_type lo) {
+        _hi = hi;
+        _lo = lo;
+        return *this;
+    }
+
+    //! Upper 64 bits in host order.
+    half_type high() const { return _hi; }
+    //! Lower 64 bits in host order.
+    half_type low() const { return _lo; }
+
+    /** Access a 16 bit group.
+        Groups are indexed as written, with the most significant group as 0 and the least as 7.
+     */
+    unsigned int group(size_t index) const {
+        return static_cast<unsigned int>(((index < 4 ? _hi : _lo) >> (16 * (3 - (index & 3)))) & 0xFFFF);
+    }
+
+    /** Copy the address to @a bytes in network order.
+        @a bytes must have room for 16 bytes.
+     */
+    void network_order(unsigned char* bytes) const;
+    //! Set the address from 16 bytes in network order.
+    self& set_network_order(unsigned char const* bytes);
+
+    /// Minimum IPv6 address value.
+    static self const MIN;
+    /// Maximum IPv6 address value.
+    static self const MAX;
+    /// Mark as having built in MIN/MAX members.
+    struct static_MIN_MAX_tag;
+
+    /// @name Numeric operators
+    /// Arithmetic is modulo 2^128.
+    //@{
+    //! Pre-increment.
+    self& operator ++ () {
+        _hi += (++_lo == 0);
+        return *this;
+    }
+    //! Pre-decrement.
+    self& operator -- () {
+        _hi -= (_lo-- == 0);
+        return *this;
+    }
+    //! Add.
+    self& operator += (self const& rhs) {
+        _lo += rhs._lo;
+        _hi += rhs._hi + (_lo < rhs._lo);
+        return *this;
+    }
+    //! Subtract.
+    self& operator -= (self const& rhs) {
+        half_type borrow = _lo < rhs._lo;
+        _lo -= rhs._lo;
+        _hi -= rhs._hi + borrow;
+        return *this;
+    }
+    //! Left shift.
+    self& operator <<= (unsigned int n) {
+        if (n >= WIDTH) _hi = _lo = 0;
+        else if (n >= HALF_WIDTH) { _hi = _lo << (n - HALF_WIDTH); _lo = 0; }
+        else if (n) { _hi = (_hi << n) | (_lo >> (HALF_WIDTH - n)); _lo <<= n; }
+        return *this;
+    }
+    //! Right shift.
+    self& operator >>= (unsigned int n) {
+        if (n >= WIDTH) _hi = _lo = 0;
+        else if (n >= HALF_WIDTH) { _lo = _hi >> (n - HALF_WIDTH); _hi = 0; }
+        else if (n) { _lo = (_lo >> n) | (_hi << (HALF_WIDTH - n)); _hi >>= n; }
+        return *this;
+    }
+    //! Bitwise complement.
+    self operator ~ () const { return self(~_hi, ~_lo); }
+    //! Bitwise and.
+    self& operator &= (self const& rhs) { _hi &= rhs._hi; _lo &= rhs._lo; return *this; }
+    //! Bitwise or.
+    self& operator |= (self const& rhs) { _hi |= rhs._hi; _lo |= rhs._lo; return *this; }
+    //! Bitwise xor.
+    self& operator ^= (self const& rhs) { _hi ^= rhs._hi; _lo ^= rhs._lo; return *this; }
+    //@}
+
+    /** Most significant bit count.
+        @return The number of bits, starting with the MSB,
+        that are set (@a set is @c true) or reset (@a set is @c false).
+     */
+    int msb_count(bool set) const;
+
+    /** Least significant bit count.
+        @return The number of bits, starting with the LSB,
+        that are set (@a set is @c true) or reset (@a set is @c false).
+     */
+    int lsb_count(bool set) const;
+
+private:
+    half_type _hi; //!< Upper 64 bits.
+    half_type _lo; //!< Lower 64 bits.
+};
+
+/** Equality.
+    @relates ip6_addr
+ */
+inline bool operator == (ip6_addr const& lhs, ip6_addr const& rhs) {
+    return ((lhs.high() ^ rhs.high()) | (lhs.low() ^ rhs.low())) == 0;
+}
+
+/** Addresses are ordered by numeric value.
+    @internal Bitwise combination of the comparisons so there is no branch on the upper half.
+    @relates ip6_addr
+ */
+inline bool operator < (ip6_addr const& lhs, ip6_addr const& rhs) {
+    return (lhs.high() < rhs.high()) | ((lhs.high() == rhs.high()) & (lhs.low() < rhs.low()));
+}
+
+/** Write address to stream in the RFC 5952 form.
+    @relates ip6_addr
+ */
+API std::ostream& operator << (std::ostream& s, ip6_addr const& a);
+/** Write an address to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 39 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip6_addr
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip6_addr const& a //!< [in] Value to write.
+);
+/** Read address from stream.
+    This accepts groups of hexadecimal digits separated by colons, with at most
+    one "::" to represent a run of zero groups. The embedded IPv4 form is not supported.
+    @relates ip6_addr
+ */
+API std::istream& operator >> (std::istream& s, ip6_addr& a);
+/** Parse an address from @a text.
+    This accepts the same input as stream input.
+    @relates ip6_addr
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip6_addr& a //!< [out] Parsed value, unchanged on failure.
+);
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+/** IPv6 network mask.
+    The mask is stored as a bit count, it is always a valid mask.
+    Masks are ordered by bit count, as for @c ip4_mask.
+ */
+class API ip6_mask
+    : public boost::totally_ordered<ip6_mask>
+{
+public:
+    typedef ip6_mask self; //!< Self reference type.
+    typedef int host_type; //!< Storage for the bit count.
+
+    static unsigned int const WIDTH = 128; //!< Width in bits of a mask.
+
+    //! Default constructor, no bits set.
+    ip6_mask() : _count(0) { }
+    //! Construct from bit count.
+    ip6_mask(host_type count) : _count(bounded_count(count)) { }
+    /** Construct from an address.
+        This uses the initial sequence of set bits from the address.
+     */
+    explicit ip6_mask(ip6_addr const& a) : _count(a.msb_count(true)) { }
+    //! Construct from a string, which must be a bit count.
+    ip6_mask(std::string const& str);
+
+    //! Rewrite mask with new bit count.
+    void set(host_type count) { _count = bounded_count(count); }
+
+    //! Force a value to be a valid bit count.
+    static host_type bounded_count(host_type count) {
+        return std::min(static_cast<host_type>(WIDTH), std::max(0, count));
+    }
+
+    //! Get the bit count for the mask.
+    host_type count() const { return _count; }
+
+    //! Get the mask bits.
+    ip6_addr bits() const {
+        return _count ? ~ip6_addr() << (WIDTH - _count) : ip6_addr();
+    }
+
+private:
+    host_type _count; //!< Number of set bits.
+};
+
+//! Two masks are equal if their bit counts are equal.
+inline bool operator == (ip6_mask const& lhs, ip6_mask const& rhs) { return lhs.count() == rhs.count(); }
+//! Masks are ordered by bit count.
+inline bool operator < (ip6_mask const& lhs, ip6_mask const& rhs) { return lhs.count() < rhs.count(); }
+
+/** Apply a mask to an address.
+    @relates ip6_mask
+ */
+inline ip6_addr operator & (ip6_addr const& addr, ip6_mask const& mask) { return addr & mask.bits(); }
+/** Apply a mask to an address.
+    @relates ip6_mask
+ */
+inline ip6_addr operator & (ip6_mask const& mask, ip6_addr const& addr) { return addr & mask.bits(); }
+/** Bitwise complement, the host bits of the mask.
+    @relates ip6_mask
+ */
+inline ip6_addr operator ~ (ip6_mask const& mask) { return ~mask.bits(); }
+
+// needed to delay this definition until @c ip6_mask is defined
+inline ip6_addr::ip6_addr(ip6_mask const& m) { *this = m.bits(); }
+
+/** Write the mask to a stream as a bit count.
+    @relates ip6_mask
+ */
+API std::ostream& operator << (std::ostream& s, ip6_mask const& m);
+/** Write a mask to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 3 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip6_mask
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip6_mask const& m //!< [in] Value to write.
+);
+/** Read the mask from a stream, as a bit count.
+    @relates ip6_mask
+ */
+API std::istream& operator >> (std::istream& s, ip6_mask& m);
+/** Parse a mask from @a text.
+    This accepts the same input as stream input.
+    @relates ip6_mask
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip6_mask& m //!< [out] Parsed value, unchanged on failure.
+);
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+/** IPv6 network.
+    This has the same semantics as @c ip4_net.
+ */
+class API ip6_net
+{
+public:
+    typedef ip6_net self; //!< Self reference type.
+
+    //! Separator between the address and mask in the string form.
+    static char const SEPARATOR = '/';
+    //! The character used to represent an empty network.
+    static char const EMPTY_CHAR = '*';
+
+    //! Default constructor. The network is empty.
+    ip6_net() : m_addr(ip6_addr::MAX), m_mask(0) { }
+
+    /** Construct from address and mask.
+        @note The stored address is modified to be compatible with the mask.
+     */
+    ip6_net(
+        ip6_addr const& addr, //!< Address of network.
+        ip6_mask const& mask //!< Mask of network.
+    ) : m_addr(addr & mask), m_mask(mask) { }
+
+    //! Construct a singleton network containing only @a addr.
+    explicit ip6_net(ip6_addr const& addr) : m_addr(addr), m_mask(ip6_addr::WIDTH) { }
+
+    //! Construct from string.
+    ip6_net(std::string const& s);
+
+    //! Reset the network.
+    self& set(ip6_addr const& addr, ip6_mask const& mask) {
+        m_addr = addr & mask;
+        m_mask = mask;
+        return *this;
+    }
+
+    //! The network address, which is also the minimum address in the network.
+    ip6_addr addr() const { return m_addr; }
+    //! The network mask.
+    ip6_mask mask() const { return m_mask; }
+    //! The maximum address in the network.
+    ip6_addr max_addr() const { return m_addr | ~m_mask; }
+
+    //! Test if the network is the empty network.
+    bool is_empty() const { return m_mask.count() == 0 && m_addr != ip6_addr::MIN; }
+
+    //! Check if @a addr is in the network.
+    bool contains(ip6_addr const& addr) const { return (addr & m_mask) == m_addr; }
+
+    //! Test if @c this network is a strict subset of @a that network.
+    bool is_strict_subset_of(self const& that) const {
+        return ((m_addr & that.m_mask) == that.m_addr) && (that.m_mask < m_mask);
+    }
+    //! Test if every address in @c this network is also in @a that.
+    bool is_subset_of(self const& that) const {
+        return ((m_addr & that.m_mask) == that.m_addr) && (that.m_mask <= m_mask);
+    }
+    //! Test if there is at least one address in both networks.
+    bool has_intersection(self const& that) const {
+        ip6_mask m(std::min(m_mask, that.m_mask));
+        return (m_addr & m) == (that.m_addr & m);
+    }
+
+private:
+    ip6_addr m_addr; //!< The network address.
+    ip6_mask m_mask; //!< The network mask.
+};
+
+//! Equality. @relates ip6_net
+inline bool operator == (ip6_net const& lhs, ip6_net const& rhs) {
+    return lhs.addr() == rhs.addr() && lhs.mask() == rhs.mask();
+}
+//! Inequality. @relates ip6_net
+inline bool operator != (ip6_net const& lhs, ip6_net const& rhs) { return !(lhs == rhs); }
+//! Operator form of @c is_strict_subset_of. @relates ip6_net
+inline bool operator < (ip6_net const& lhs, ip6_net const& rhs) { return lhs.is_strict_subset_of(rhs); }
+//! Operator form of @c is_subset_of. @relates ip6_net
+inline bool operator <= (ip6_net const& lhs, ip6_net const& rhs) { return lhs.is_subset_of(rhs); }
+
+/** Write the network to a stream as "ADDR/COUNT", the same as @c ip4_net.
+    @relates ip6_net
+ */
+API std::ostream& operator << (std::ostream& s, ip6_net const& net);
+/** Write a network to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 43 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip6_net
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip6_net const& net //!< [in] Value to write.
+);
+/** Read a network from a stream.
+    The form is the address, optionally followed by a separator and the mask bit count.
+    @relates ip6_net
+ */
+API std::istream& operator >> (std::istream& s, ip6_net& net);
+/** Parse a network from @a text.
+    This accepts the same input as stream input.
+    @relates ip6_net
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip6_net& net //!< [out] Parsed value, unchanged on failure.
+);
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+//! @cond NOT_DOCUMENTED
+// Enable numeric interval methods.
+namespace detail {
+    template <> struct subtraction_trait<ip6_addr> : public std::minus<ip6_addr> {};
+    template <> struct addition_trait<ip6_addr> : public std::plus<ip6_addr> {};
+}
+// This lets us put the template instantation in our library rather than
+// duplicating the code in all clients.
+template struct API interval<ip6_addr>;
+//! @endcond
+
+class ip6_net_generator;
+
+/** Store a range of IPv6 addresses.
+ */
+class API ip6_range
+    : public interval<ip6_addr>
+{
+public:
+    typedef ip6_range self; //!< Self reference type.
+    typedef interval<ip6_addr> super; //!< Super class reference type.
+
+    //! character used between range end values
+    static char const SEPARATOR = '-';
+
+    //! Maximum number of networks in the network cover of a range.
+    static std::size_t const MAX_COVER = 2 * ip6_addr::WIDTH - 2;
+
+    //! Default constructor, the range is empty.
+    ip6_range() : super() { }
+    //! Construct from the super class.
+    ip6_range(super const& s) : super(s) { }
+    //! Construct from two end points.
+    ip6_range(ip6_addr const& x1, ip6_addr const& x2) : super(x1, x2) { }
+    //! Construct a singleton range.
+    ip6_range(ip6_addr const& addr) : super(addr) { }
+    //! Construct a range from a network.
+    ip6_range(ip6_net const& net) : super(net.addr(), net.max_addr()) { }
+    //! Construct from string.
+    ip6_range(std::string const& s);
+
+    //! Iterator for the networks that cover this range.
+    typedef ip6_net_generator net_iterator;
+
+    /** Calculate the next network and update the state.
+        This is the same as @c ip4_range::extract_next_network.
+        @note This modifies the range on which it is called.
+     */
+    bool extract_next_network(ip6_net& net);
+
+    //! Get an iterator for the first network in the network cover of the range.
+    net_iterator net_begin() const;
+    //! Get an iterator past the end of the network cover of the range.
+    net_iterator net_end() const;
+
+    //! Test if the range is also a network.
+    bool is_network() const;
+};
+
+/** Compute the network covers of a sequence of ranges.
+    This is the same as the @c ip4_range overload.
+    @return The number of networks written to @a nets.
+    @relates ip6_range
+ */
+API std::size_t network_cover(
+    ip6_range const* ranges, //!< [in] Ranges to convert.
+    std::size_t n, //!< [in] Number of ranges.
+    ip6_net* nets, //!< [out] Networks.
+    std::size_t capacity, //!< [in] Maximum number of networks to write.
+    std::size_t* converted = 0 //!< [out] Number of ranges converted.
+);
+
+/** Write the range to a stream as "MIN-MAX".
+    @relates ip6_range
+ */
+API std::ostream& operator << (std::ostream& s, ip6_range const& r);
+/** Write a range to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 79 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip6_range
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip6_range const& r //!< [in] Value to write.
+);
+/** Read the range from a stream.
+    This supports the same variations as the @c ip4_range input.
+    @relates ip6_range
+ */
+API std::istream& operator >> (std::istream& s, ip6_range& r);
+/** Parse a range from @a text.
+    This accepts the same input as stream input.
+    @relates ip6_range
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip6_range& r //!< [out] Parsed value, unchanged on failure.
+);
+
+/** Networks from range generator.
+    This is the same as @c ip4_net_generator.
+ */
+class ip6_net_generator
+    : public std::iterator<std::forward_iterator_tag, ip6_net>
+{
+protected:
+    ip6_range m_range; //!< remaining range
+    ip6_net m_data; //!< client data
+public:
+    typedef ip6_net_generator self; //!< Self reference type.
+
+    //! Default constructor.
+    ip6_net_generator() { }
+    //! Construct from a range.
+    ip6_net_generator(ip6_range const& r) : m_range(r) { ++*this; }
+
+    //! Pre-increment.
+    self& operator ++ () {
+        m_range.extract_next_network(m_data);
+        return *this;
+    }
+    //! Post-increment.
+    self operator ++ (int) {
+        self zret(*this);
+        ++*this;
+        return zret;
+    }
+    //! Dereference.
+    ip6_net const& operator * () const { return m_data; }
+    //! Pointer.
+    ip6_net const* operator -> () const { return &m_data; }
+
+    //! Equality.
+    friend bool operator == (self const& lhs, self const& rhs) {
+        return lhs.m_data == rhs.m_data && lhs.m_range == rhs.m_range;
+    }
+    //! Inequality.
+    friend bool operator != (self const& lhs, self const& rhs) { return !(lhs == rhs); }
+};
+/* ------------------------------------------------------------------------ */
+/** Hash an address, for @c boost::hash.
+    @relates ip6_addr
+ */
+inline std::size_t hash_value(ip6_addr const& a) {
+    std::size_t zret = 0;
+    boost::hash_combine(zret, a.high());
+    boost::hash_combine(zret, a.low());
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
+# undef API
@@ -11,6 +11,8 @@
 # include <vector>
 # include <ngeo/numeric_type.hpp>
 # include <ngeo/interval.hpp>
+# include <ngeo/parse_result.hpp>
+# include <ngeo/to_chars.hpp>
 # if !defined(_MSC_VER)
 #   include <endian.h>
 # endif
@@ -37,8 +39,9 @@ class ip4_net;	// declared friend in ip4_mask
 class ip4_pepa;	// declared friend in ip4_mask
 // Declared in name only so that clients do not need to include this header
 // to use the IP library. If you want to access the API elements that use
-// @c lexicon you must include the @c ngeo/lexicon.hpp header.
+// @c lexicon you must include the @c ngeo/concurrent_lexicon.hpp header.
 template < typename T > class lexicon;
+template < typename T > class concurrent_lexicon;
 /* ------------------------------------------------------------------------ */
 /** @file
     Classes for working with basic Internet Protocol data.
@@ -67,7 +70,7 @@ class API ip_port : public
 public:
     typedef ip_port self;               //!< self reference type
     typedef unsigned short host_type;	//!< implementation type
-    typedef ngeo::lexicon<self> lexicon_type;      ///< Name associations
+    typedef ngeo::concurrent_lexicon<self> lexicon_type;      ///< Name associations
 
     //! The width of the type in bits
     static unsigned int const WIDTH = 16;
@@ -192,6 +195,16 @@ API std::ostream& operator << (
     std::ostream& s, //!< [in,out]
     ip_port const& p //!< [in]
 );
+/** Write a port to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 5 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip_port
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip_port const& p //!< [in] Value to write.
+);
 /** Read port from stream.
     @relates ip_port
  */
@@ -199,6 +212,14 @@ API std::istream& operator >> (
     std::istream& s, //!< [in,out]
     ip_port& p       //!< [out]
 );
+/** Parse a port from @a text.
+    This accepts the same input as stream input.
+    @relates ip_port
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip_port& p //!< [out] Parsed value, unchanged on failure.
+);
 
 // These are defined outside the class because of the conditional compilation
 # if (defined(__BYTE_ORDER) && __BYTE_ORDER == __LITTLE_ENDIAN) || defined(_M_IX86)
@@ -289,6 +310,16 @@ API std::ostream& operator << (
     std::ostream& s,       //!< [in,out]
     ip_port_range const& r //!< [in]
 );
+/** Write a port range to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 11 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip_port_range
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip_port_range const& r //!< [in] Value to write.
+);
 /** Read range from stream.
     The input should be in the form "MIN-MAX" where MIN is the minimum port
     value and MAX is the maximum port value. Other variations that are supported
@@ -302,6 +333,14 @@ API std::istream& operator >> (
     std::istream& s,  //!< [in,out]
     ip_port_range& r  //!< [out]
 );
+/** Parse a port range from @a text.
+    This accepts the same input as stream input.
+    @relates ip_port_range
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip_port_range& r //!< [out] Parsed value, unchanged on failure.
+);
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 /** IPv4 address.
@@ -548,6 +587,16 @@ API std::ostream& operator << (
     std::ostream& s, ///< Output stream.
     ip4_addr const& a ///< Output value.
 );
+/** Write an address to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 15 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_addr
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_addr const& a //!< [in] Value to write.
+);
 
 /** Read address from stream.
     This expects the address in octet form.
@@ -557,6 +606,14 @@ API std::istream& operator >> (
     std::istream& s, ///> Input stream.
     ip4_addr& a ///< Input target.
 );
+/** Parse an address from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_addr
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_addr& a //!< [out] Parsed value, unchanged on failure.
+);
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 /** Store an IPv4 network mask.
@@ -758,10 +815,28 @@ operator & (ip4_mask const& mask, ip4_addr const& addr)
     The mask is written in CIDR format.
  */
 API std::ostream& operator << (std::ostream&,  ip4_mask const&);
+/** Write a mask to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 2 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_mask
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_mask const& m //!< [in] Value to write.
+);
 /** Read the mask from a stream.
     The mask can be in either CIDR or octet format.
  */
 API std::istream& operator >> (std::istream& s, ip4_mask& a);
+/** Parse a mask from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_mask
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_mask& m //!< [out] Parsed value, unchanged on failure.
+);
 
 // needed to delay this definition until @c ip4_mask is defined
 inline ip4_addr::ip4_addr(ip4_mask const& m) : _addr(m.host_order()) { }
@@ -1010,12 +1085,30 @@ operator >= (ip4_net const& lhs, ip4_net const& rhs)
     @relates ip4_net
  */
 API std::istream& operator >> (std::istream& s, ip4_net& net);
+/** Parse a network from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_net
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_net& net //!< [out] Parsed value, unchanged on failure.
+);
 /** Write the network to a stream.
     The network is written as "ADDR/MASK" where
     @c ADDR is in octet format and @c MASK is in CIDR format.
     @relates ip4_net
  */
 API std::ostream& operator << (std::ostream& s, ip4_net const& net);
+/** Write a network to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 18 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_net
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_net const& net //!< [in] Value to write.
+);
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 class ip4_net_generator;
@@ -1032,6 +1125,9 @@ public:
     //! character used between range end values
     static char const SEPARATOR = '-';
 
+    //! Maximum number of networks in the network cover of a range.
+    static std::size_t const MAX_COVER = 2 * ip4_addr::WIDTH - 2;
+
     /** Default constructor.
         The range is initially empty.
      */
@@ -1097,6 +1193,26 @@ public:
     bool is_network() const;
 };
 
+/** Compute the network covers of a sequence of ranges.
+    The networks for each range in @a ranges are written to @a nets in order,
+    the same networks as @c ip4_range::net_begin would generate. Each network
+    takes constant time and there is no allocation.
+
+    Conversion stops before the first range whose networks do not all fit in
+    the remaining space. A @a capacity of @c ip4_range::MAX_COVER per range
+    is always sufficient.
+
+    @return The number of networks written to @a nets.
+    @relates ip4_range
+ */
+API std::size_t network_cover(
+    ip4_range const* ranges, //!< [in] Ranges to convert.
+    std::size_t n, //!< [in] Number of ranges.
+    ip4_net* nets, //!< [out] Networks.
+    std::size_t capacity, //!< [in] Maximum number of networks to write.
+    std::size_t* converted = 0 //!< [out] Number of ranges converted.
+);
+
 /** Read the range from a stream.
     The input should be in the form "MIN - MAX" where
     @c MIN is the minimum value in the range and @c MAX
@@ -1104,6 +1220,14 @@ public:
     @relates ip4_range
  */
 API std::istream& operator >> (std::istream& , ip4_range& );
+/** Parse a range from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_range
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_range& r //!< [out] Parsed value, unchanged on failure.
+);
 /** Write the range to a stream.
     The range is written as "MIN-MAX" where
     @c MIN is the minimum value in the range and @c MAX
@@ -1111,6 +1235,16 @@ API std::istream& operator >> (std::istream& , ip4_range& );
     @relates ip4_range
  */
 API std::ostream& operator << (std::ostream& , const ip4_range& );
+/** Write a range to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 31 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_range
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_range const& r //!< [in] Value to write.
+);
 
 /** Networks from range generator.
     This generates networks from a range. It operates in the same way
@@ -1335,6 +1469,14 @@ inline bool operator < (ip4_pepa const& lhs, ip4_pepa const& rhs)
     @relates ip4_pepa
  */
 API std::istream& operator >> (std::istream& s, ip4_pepa& p);
+/** Parse a PEPA from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_pepa
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_pepa& p //!< [out] Parsed value, unchanged on failure.
+);
 /** Write the PEPA to a stream.
     The output is of the form "ADDR/MASK" where
     @c ADDR is an IPv4 address in octet form and
@@ -1342,6 +1484,16 @@ API std::istream& operator >> (std::istream& s, ip4_pepa& p);
     @relates ip4_pepa
  */
 API std::ostream& operator << (std::ostream& s, ip4_pepa const& p);
+/** Write a PEPA to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 18 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_pepa
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_pepa const& p //!< [in] Value to write.
+);
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 /** ICMP message type value.
@@ -1356,7 +1508,7 @@ class API icmp_type
 public:
     typedef icmp_type self; //!< Self reference typedef.
     typedef int host_type; //!< Native storage type.
-    typedef ngeo::lexicon<self> lexicon_type; ///< Lexicon localized for this type.
+    typedef ngeo::concurrent_lexicon<self> lexicon_type; ///< Lexicon localized for this type.
 
     /// @name Predefine values.
     /// This includes all officially defined ICMP message types.
@@ -1391,10 +1543,7 @@ public:
     icmp_type() : _value(INVALID._value) { } //!< Default constructor.
     icmp_type(self const& that) : _value(that._value) { } //!< Copy constructor.
     icmp_type(host_type c) : _value(c) { } //!< Construct from native type.
-    icmp_type(std::string &str) {
-    	std::istringstream istr(str);
-		istr >> *this;
-    }
+    icmp_type(std::string const& str); //!< Construct from text, @c INVALID if not valid.
 
     operator host_type () const { return _value; } //!< User conversion to underlying enum.
     /// Explicit request for underlying host value.
@@ -1461,6 +1610,26 @@ private:
     host_type _value; //!< The raw value.
 };
 
+/** Write an ICMP message type to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, the name of the type.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates icmp_type
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    icmp_type const& t //!< [in] Value to write.
+);
+
+/** Parse an ICMP message type from @a text.
+    This accepts the same input as stream input.
+    @relates icmp_type
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    icmp_type& t //!< [out] Parsed value, unchanged on failure.
+);
+
 // Make the MS compiler happy.
 template class API numeric_type<unsigned char, struct icmp_code_tag>;
 /** ICMP Message code.
@@ -1555,7 +1724,7 @@ class API ip_protocol
 public:
     typedef ip_protocol self; //!< Self reference type.
     typedef int host_type;  //!< Internal storage type.
-    typedef lexicon<self> lexicon_type;
+    typedef concurrent_lexicon<self> lexicon_type;
 
     //! @c host_type value for minimum protocol value.
     static host_type const HOST_MIN = 0;
@@ -1614,11 +1783,7 @@ public:
      */
     explicit ip_protocol
         (std::string const &str ///< Text representation of the protocol
-        )
-    {
-        std::istringstream istr(str);
-        istr >> *this;
-    }
+        );
     self& operator = (self const& x) { _value = x; return *this; } //!< Self assignment.
     self& operator = (host_type x) { _value = bound(x); return *this; } //!< Assignment from host type, to match constructor.
     //@}
@@ -1710,6 +1875,26 @@ public:
         );
 };
 
+/** Write a protocol to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output, at most 4 characters.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip_protocol
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip_protocol const& p //!< [in] Value to write.
+);
+
+/** Parse a protocol from @a text.
+    This accepts the same input as stream input.
+    @relates ip_protocol
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip_protocol& p //!< [out] Parsed value, unchanged on failure.
+);
+
 //! Currently IPv4 protocols are common across IP versions.
 typedef ip_protocol ip4_protocol;
 
@@ -12,6 +12,8 @@
 
 # include <ngeo/ip_base.hpp>
 # include <boost/variant.hpp>
+# include <cstring>
+# include <boost/cstdint.hpp>
 # if !defined(_MSC_VER)
 #   include <endian.h>
 # endif
@@ -277,6 +279,15 @@ API std::istream& operator >> (
     ip4_service& svc         //!< [in,out] Service to store in to
 );
 
+/** Parse a service from @a text.
+    This accepts the same input as stream input.
+    @relates ip4_service
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    ip4_service& svc //!< [out] Parsed value, unchanged on failure.
+);
+
 /** Write the service to a stream.
     @see operator>>(std::istream&, ip4_service&)
     @return @a s
@@ -287,69 +298,361 @@ API std::ostream& operator << (
     ip4_service const& svc //!< [in] Service to write from
 );
 
+/** Write a service to the buffer [@a first, @a last) as text.
+    This writes the same text as stream output.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates ip4_service
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    ip4_service const& svc //!< [in] Value to write.
+);
+
 /* ------------------------------------------------------------------------ */
-// Not in use.
-# if 0
-class API ip4_flow
+/** IPv4 service packed in to a single integer.
+
+    This holds the same value as @c ip4_service, encoded so that comparison
+    and stepping are integer operations. This makes it suitable as a
+    flowspace metric, where a single service dimension can replace a
+    protocol layer with a nested port layer.
+
+    The protocol is stored in the upper bits, offset by one so that
+    @c ip_protocol::INVALID is zero and sorts first. The ancillary data is in
+    the lower @c DATA_BITS bits, the port for TCP and UDP, the message type
+    for ICMP, zero otherwise. The ordering, increment and decrement are the
+    same as for @c ip4_service.
+
+    As with @c ip4_service comparison and text, the ICMP message code is not
+    part of the value and is not stored.
+
+    This class is @ref totally_ordered.
+ */
+class API packed_service
+    : public boost::totally_ordered<packed_service>
 {
 public:
-    typedef ip4_flow self; //!< Self reference type.
-    typedef ip4_service::data data;
+    typedef packed_service self; //!< Self reference type.
+    typedef boost::uint32_t raw_type; //!< Encoded storage type.
 
-    //! Default constructor.
-    ip4_flow();
+    static int const DATA_BITS = 16; //!< Bits for ancillary data.
+    static raw_type const DATA_MASK = (1U << DATA_BITS) - 1; //!< Ancillary data bits.
+
+    /** Default constructor.
+        Construct an invalid service, the same as @c ip4_service().
+     */
+    packed_service() : _value(0) {}
+
+    /// Construct from a service.
+    explicit packed_service(
+        ip4_service const& svc //!< Service.
+    );
 
     /** Construct from protocol.
-        Any ancillary data is default constructed.
+        The ancillary data is the minimum for the protocol.
      */
-    ip4_flow(
-        ip4_protocol const& p //!< Protocol for flow.
-        );
+    explicit packed_service(
+        ip4_protocol const& p //!< Protocol.
+    ) : _value(encode(p.host_order(), 0)) {}
+
+    /// Construct from TCP or UDP and a port.
+    packed_service(
+        ip4_protocol const& p, //!< Protocol.
+        ip4_port const& port //!< Port.
+    ) : _value(encode(p.host_order(), port.host_order())) {}
 
-    /** Construct from a service.
-        The ancillary data for source and destination are the same.
+    /// Construct an ICMP service from a message type.
+    explicit packed_service(
+        icmp_type const& t //!< ICMP message type.
+    ) : _value(encode(ip_protocol::HOST_ICMP, t.host_order())) {}
+
+    /** Construct from an encoded value.
+        @a v must have been obtained from @c raw().
      */
-    ip4_flow(
-        ip4_service const& srv //!< Service for source and destination.
-        ) : m_protocol(srv), m_src(srv.get_data()), m_dst(srv.get_data())
-    {
+    static self from_raw(raw_type v) { self zret; zret._value = v; return zret; }
+
+    static self const MIN; //!< Minimum service value.
+    static self const MAX; //!< Maximum service value.
+    struct static_MIN_MAX_tag; //!< Mark as having built in MIN/MAX members.
+
+    /// Convert to a service.
+    ip4_service service() const;
+
+    /// Protocol.
+    ip4_protocol get_protocol() const { return ip4_protocol(protocol_value()); }
+    /// Type of ancillary data.
+    ip_protocol::data_type get_data_type() const { return ip_protocol(protocol_value()).get_data_type(); }
+    /// Port, valid only if the protocol has a port.
+    ip4_port get_port() const { return ip4_port(static_cast<ip4_port::host_type>(_value & DATA_MASK)); }
+    /// ICMP message type, valid only if the protocol is ICMP.
+    icmp_type get_icmp_type() const { return icmp_type(static_cast<icmp_type::host_type>(_value & DATA_MASK)); }
+    /// Encoded value.
+    raw_type raw() const { return _value; }
+    /// Check the protocol is valid.
+    bool is_valid() const { return ip_protocol::is_valid(protocol_value()); }
+
+    /** Pre-increment.
+        If the ancillary data is at its maximum this moves to the next protocol
+        with its minimum ancillary data. @c MAX does not change.
+     */
+    self& operator ++ () {
+        if ((_value & DATA_MASK) < data_max(protocol_value())) ++_value;
+        else {
+            ip_protocol::host_type p = protocol_value();
+            if (ip_protocol::HOST_MIN <= p && p < ip_protocol::HOST_MAX) _value = encode(p + 1, 0);
+        }
+        return *this;
     }
 
-    /** Construct from ICMP.
-        Source and destination type / code are set from @a i.
+    /** Pre-decrement.
+        If the ancillary data is at its minimum this moves to the previous
+        protocol with its maximum ancillary data. @c MIN does not change.
      */
-    ip4_flow(
-        icmp const& i
-        ) : m_protocol(ip4_protocol::ICMP), m_src(i), m_dst(i)
-    {
+    self& operator -- () {
+        if (_value & DATA_MASK) --_value;
+        else {
+            ip_protocol::host_type p = protocol_value();
+            if (ip_protocol::HOST_MIN < p && p <= ip_protocol::HOST_MAX) _value = encode(p - 1, data_max(p - 1));
+        }
+        return *this;
     }
 
-    /** Constructor for TCP/UDP.
+    /// Post-increment.
+    self operator ++ (int) { self zret(*this); ++*this; return zret; }
+    /// Post-decrement.
+    self operator -- (int) { self zret(*this); --*this; return zret; }
+
+    /// @cond NOT_DOCUMENTED
+    friend bool operator == (self const& lhs, self const& rhs) { return lhs._value == rhs._value; }
+    friend bool operator <  (self const& lhs, self const& rhs) { return lhs._value <  rhs._value; }
+    /// @endcond
+
+    /** Hash a packed service.
+        This is found only by argument dependent lookup on a @c packed_service,
+        so that other types that convert to one still use their own hash.
      */
+    friend std::size_t hash_value(self const& svc) { return svc._value; }
+
+private:
+    raw_type _value; //!< Encoded service.
+
+    /// Encode protocol @a p and ancillary data @a d.
+    static raw_type encode(ip_protocol::host_type p, raw_type d) {
+        return (static_cast<raw_type>(p + 1) << DATA_BITS) | d;
+    }
+    /// Protocol host value.
+    ip_protocol::host_type protocol_value() const {
+        return static_cast<ip_protocol::host_type>(_value >> DATA_BITS) - 1;
+    }
+    /// Maximum ancillary data for protocol @a p.
+    static raw_type data_max(ip_protocol::host_type p) {
+        return p == ip_protocol::HOST_TCP || p == ip_protocol::HOST_UDP ? DATA_MASK
+            : p == ip_protocol::HOST_ICMP ? static_cast<raw_type>(icmp_type::MAX.host_order())
+            : 0;
+    }
+};
+
+/** Read a packed service from a stream.
+    This is the same format as @c ip4_service.
+    @return @a s
+    @relates packed_service
+ */
+API std::istream& operator >> (
+    std::istream& s,         //!< [in,out] Input stream
+    packed_service& svc      //!< [in,out] Service to store in to
+);
+
+/** Parse a packed service from @a text.
+    @relates packed_service
+ */
+API parse_result parse(
+    boost::string_ref text, //!< [in] Input text.
+    packed_service& svc //!< [out] Parsed value, unchanged on failure.
+);
+
+/** Write a packed service to a stream.
+    This is the same format as @c ip4_service.
+    @return @a s
+    @relates packed_service
+ */
+API std::ostream& operator << (
+    std::ostream& s,       //!< [in,out] Output stream
+    packed_service const& svc //!< [in] Service to write from
+);
+
+/** Write a packed service to the buffer [@a first, @a last) as text.
+    @return Pointer past the last character written, or null if there is not enough room.
+    @relates packed_service
+ */
+API char* to_chars(
+    char* first, //!< [in] Start of buffer.
+    char* last, //!< [in] End of buffer.
+    packed_service const& svc //!< [in] Value to write.
+);
+
+/* ------------------------------------------------------------------------ */
+/** IPv4 flow key.
+
+    This is the 5-tuple that identifies a connection: source and destination
+    address, source and destination port, and protocol. It is packed in to 13
+    bytes, padded to 16, so that it is trivially copyable and cheap to hash and
+    compare, for use as the key of a connection table.
+
+    The values are stored in host order. For protocols without ports the port
+    fields are zero. For ICMP the source port field holds the message type and
+    the destination port field the message code.
+
+    @note The protocol must be an actual protocol value (0..255). @c ip_protocol::IP
+    and @c ip_protocol::INVALID can not be stored.
+
+    This class is @ref totally_ordered.
+ */
+class API ip4_flow
+    : public boost::totally_ordered<ip4_flow>
+{
+public:
+    typedef ip4_flow self; //!< Self reference type.
+
+    /// Default constructor, all fields zero.
+    ip4_flow() { this->clear(); }
+
+    /// Construct from a TCP or UDP 5-tuple.
     ip4_flow(
-        ip4_protocol const& pr, //!< Must be TCP or UDP
-        ip4_port const& p //!< Source and destination port.
-        );
+        ip4_addr const& src_addr, //!< Source address.
+        ip4_port const& src_port, //!< Source port.
+        ip4_addr const& dst_addr, //!< Destination address.
+        ip4_port const& dst_port, //!< Destination port.
+        ip4_protocol const& p //!< Protocol.
+    ) {
+        this->set(src_addr, src_port.host_order(), dst_addr, dst_port.host_order(), p);
+    }
 
-    /** Constructor to TCP/UDP.
-     */
+    /// Construct for a protocol without ports.
     ip4_flow(
-        ip4_protocol const& pr, //!< Must be TCP or UDP
-        ip4_port const& src, //!< Source port.
-        ip4_port const& dst  //!< Destination port.
-        );
+        ip4_addr const& src_addr, //!< Source address.
+        ip4_addr const& dst_addr, //!< Destination address.
+        ip4_protocol const& p //!< Protocol.
+    ) {
+        this->set(src_addr, 0, dst_addr, 0, p);
+    }
+
+    /// Construct for an ICMP message.
+    ip4_flow(
+        ip4_addr const& src_addr, //!< Source address.
+        ip4_addr const& dst_addr, //!< Destination address.
+        icmp const& i //!< ICMP message type and code.
+    ) {
+        this->set(src_addr, i.type().host_order(), dst_addr, i.code().raw(), ip_protocol::ICMP);
+    }
+
+    /** Set all of the fields from host order values.
+        This is for packet decoding, where the values are already integers.
+        @return @c this
+     */
+    self& assign(
+        boost::uint32_t src_addr, //!< Source address.
+        boost::uint16_t src_port, //!< Source port or ICMP type.
+        boost::uint32_t dst_addr, //!< Destination address.
+        boost::uint16_t dst_port, //!< Destination port or ICMP code.
+        boost::uint8_t p //!< Protocol.
+    ) {
+        m_src_addr = src_addr;
+        m_dst_addr = dst_addr;
+        m_src_port = src_port;
+        m_dst_port = dst_port;
+        m_protocol = p;
+        m_pad[0] = m_pad[1] = m_pad[2] = 0;
+        return *this;
+    }
+
+    /// Source address.
+    ip4_addr src_addr() const { return ip4_addr(m_src_addr); }
+    /// Destination address.
+    ip4_addr dst_addr() const { return ip4_addr(m_dst_addr); }
+    /// Source port, the ICMP message type for ICMP.
+    ip4_port src_port() const { return ip4_port(m_src_port); }
+    /// Destination port, the ICMP message code for ICMP.
+    ip4_port dst_port() const { return ip4_port(m_dst_port); }
+    /// Protocol.
+    ip4_protocol protocol() const { return ip4_protocol(m_protocol); }
+
+    /// Get a service describing the source of the flow.
+    ip4_service get_src() const;
+    /// Get a service describing the destination of the flow.
+    ip4_service get_dst() const;
+
+    /** The flow in the opposite direction.
+        The source and destination are swapped. For ICMP only the addresses are swapped.
+     */
+    self reversed() const {
+        self zret(*this);
+        std::swap(zret.m_src_addr, zret.m_dst_addr);
+        if (m_protocol != ip_protocol::HOST_ICMP) std::swap(zret.m_src_port, zret.m_dst_port);
+        return zret;
+    }
 
-    //! Get a service describing the source of the flow.
-    ip4_service get_src() const { return ip4_service(m_protocol, m_src); }
-    //! Get a service decribing the destination of the flow.
-    ip4_service get_dst() const { return ip4_service(m_protocol, m_dst); }
+    /// Hash value.
+    std::size_t hash() const {
+        boost::uint64_t a = (static_cast<boost::uint64_t>(m_src_addr) << 32) | m_dst_addr;
+        boost::uint64_t b = (static_cast<boost::uint64_t>(m_src_port) << 24) | (static_cast<boost::uint64_t>(m_dst_port) << 8) | m_protocol;
+        // Multiply and fold, the high bits of the product depend on all of the input bits.
+        boost::uint64_t h = a * UINT64_C(0x9E3779B97F4A7C15) ^ b * UINT64_C(0xC2B2AE3D27D4EB4F);
+        h ^= h >> 29;
+        h *= UINT64_C(0xBF58476D1CE4E5B9);
+        h ^= h >> 32;
+        return static_cast<std::size_t>(h);
+    }
+
+    /// @cond NOT_DOCUMENTED
+    friend bool operator == (self const& lhs, self const& rhs) {
+        return ((lhs.m_src_addr ^ rhs.m_src_addr) | (lhs.m_dst_addr ^ rhs.m_dst_addr)
+            | (lhs.m_src_port ^ rhs.m_src_port) | (lhs.m_dst_port ^ rhs.m_dst_port)
+            | (lhs.m_protocol ^ rhs.m_protocol)) == 0;
+    }
+    friend bool operator < (self const& lhs, self const& rhs) {
+        return lhs.m_src_addr != rhs.m_src_addr ? lhs.m_src_addr < rhs.m_src_addr
+            : lhs.m_dst_addr != rhs.m_dst_addr ? lhs.m_dst_addr < rhs.m_dst_addr
+            : lhs.m_src_port != rhs.m_src_port ? lhs.m_src_port < rhs.m_src_port
+            : lhs.m_dst_port != rhs.m_dst_port ? lhs.m_dst_port < rhs.m_dst_port
+            : lhs.m_protocol < rhs.m_protocol;
+    }
+    /// @endcond
 
 private:
-    ip4_protocol m_protocol;
-    data m_src;
-    data m_dst;
+    boost::uint32_t m_src_addr; //!< Source address.
+    boost::uint32_t m_dst_addr; //!< Destination address.
+    boost::uint16_t m_src_port; //!< Source port or ICMP type.
+    boost::uint16_t m_dst_port; //!< Destination port or ICMP code.
+    boost::uint8_t m_protocol; //!< Protocol.
+    boost::uint8_t m_pad[3]; //!< Padding, always zero.
+
+    /// Zero everything, including the padding.
+    void clear() { std::memset(this, 0, sizeof(*this)); }
+
+    /// Set all of the fields.
+    void set(ip4_addr const& src_addr, ip4_port::host_type src_port,
+             ip4_addr const& dst_addr, ip4_port::host_type dst_port,
+             ip4_protocol const& p) {
+        this->assign(src_addr.host_order(), static_cast<boost::uint16_t>(src_port),
+                     dst_addr.host_order(), static_cast<boost::uint16_t>(dst_port),
+                     static_cast<boost::uint8_t>(p.host_order()));
+    }
 };
-# endif
+
+/// Hash a flow key.
+inline std::size_t hash_value(ip4_flow const& flow) { return flow.hash(); }
+
+/** Write a flow to a stream.
+    The format is "SRC -> DST PROTO", where SRC and DST are "ADDR:PORT" for
+    TCP and UDP, and just the address otherwise. For ICMP the message
+    type follows the protocol.
+    @return @a s
+    @relates ip4_flow
+ */
+API std::ostream& operator << (
+    std::ostream& s,       //!< [in,out] Output stream
+    ip4_flow const& flow   //!< [in] Flow to write.
+);
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 } // namespace ngeo::flowspace
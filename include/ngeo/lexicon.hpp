@@ -28,6 +28,9 @@ namespace ngeo {
 
 namespace bmi = boost::multi_index;
 
+template < typename K > class frozen_lexicon; // forward declare
+template < typename K > class concurrent_lexicon; // forward declare
+
 /** A collection of values with associated names.
     @c Lexicon is the primary container for naming values. It contains a set of
     values, and for each value a set of names and a mark indicating which name
@@ -420,7 +423,7 @@ public:
     lexicon() : _auto_sort(false), _sorted(true) {}
     /// Construct from initialization structure.
     lexicon(init& d)
-        : _auto_sort(false)
+        : _auto_sort(false), _sorted(false)
     {
         this->load_from_init(d);
     }
@@ -460,9 +463,9 @@ public:
     /// @return @c true if @a name is defined for any key in this @c Lexicon.
     bool contains
         (name_type const& name ///< Name to check
-        )
+        ) const
     {
-        name_index nidx = this->by_name();
+        typename Container::template index<BY_NAME>::type const& nidx = _container.template get<BY_NAME>();
         return nidx.end() != nidx.find(name);
     }
 
@@ -477,10 +480,9 @@ public:
     /// @return @c true if a name is defined for @a key, @c false otherwise.
     bool contains
         ( key_type key ///< Search key
-        )
+        ) const
     {
-        key_index kidx = this->by_key();
-        return kidx.end() != this->by_key().find(key);
+        return this->by_key().end() != this->by_key().find(key);
     }
 
     /** Define a @a name for a @a key.
@@ -611,9 +613,9 @@ public:
      */
     name_type operator []
         ( key_type key ///< Search key
-        )
+        ) const
     {
-        iterator spot(this->find(key));
+        const_iterator spot(this->find(key));
         if (spot == this->end()) {
             if (_default_name.which() == 1)
                 return boost::get<name_type>(_default_name);
@@ -631,9 +633,9 @@ public:
      */
     key_type operator []
         ( name_type const& name ///< Search string
-        )
+        ) const
     {
-        iterator spot(this->find(name));
+        const_iterator spot(this->find(name));
         if (spot == this->end()) {
             if (_default_key.which() == 1)
                 return boost::get<key_type>(_default_key);
@@ -656,6 +658,15 @@ public:
         return _container.template project<BY_KEY>(spot);
     }
 
+    /// Find item for @a name.
+    /// @return A @c const_iterator that is either @c end() or references the @c Item for @a name.
+    const_iterator find
+        ( name_type const& name ///< Search value
+        ) const
+    {
+        return _container.template project<BY_KEY>(_container.template get<BY_NAME>().find(name));
+    }
+
     /// Find item for a @a key.
     /// @return An @c iterator that is @c end() if no name is associated with the @a key
     /// or references an @c Item that is the primary for the @a key.
@@ -800,6 +811,9 @@ protected:
 
         _sorted = false;
    }
+
+    template < typename T > friend class frozen_lexicon;
+    template < typename T > friend class concurrent_lexicon;
 };
 
 }
@@ -0,0 +1,51 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <cstddef>
+# include <boost/utility/string_ref.hpp>
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** Result of parsing text in to a value.
+
+    Parsing reads the longest prefix of the text that forms a value, in the
+    same way as stream input. On success @a position is the number of characters
+    used. On failure it is the offset of the character at which the input was
+    found to be invalid, which is the length of the text if the text ended early.
+ */
+struct parse_result
+{
+    typedef parse_result self; //!< Self reference type.
+
+    /// Parse outcomes.
+    typedef enum {
+        OK = 0, //!< Value parsed.
+        INVALID, //!< Malformed input.
+        OUT_OF_RANGE, //!< Numeric value too large for its field.
+        UNKNOWN_NAME //!< Name not in the lexicon for the type.
+    } code_type;
+
+    code_type code; //!< Outcome.
+    std::size_t position; //!< Offset in the text.
+
+    /// Default constructor.
+    parse_result(
+        code_type c = OK, //!< [in] Outcome.
+        std::size_t p = 0 //!< [in] Offset.
+    ) : code(c), position(p) { }
+
+    //! Test for success.
+    bool is_ok() const { return OK == code; }
+    /** Test for a complete parse.
+        @return @c true if parsing succeeded and used all of @a text.
+     */
+    bool is_complete(
+        boost::string_ref text //!< [in] Text that was parsed.
+    ) const { return OK == code && position == text.size(); }
+};
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
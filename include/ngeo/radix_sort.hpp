@@ -0,0 +1,268 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <vector>
+# include <algorithm>
+# include <boost/bind.hpp>
+# include <boost/cstdint.hpp>
+# include <boost/thread/thread.hpp>
+# include <boost/thread/barrier.hpp>
+# include <ngeo/ip_base.hpp>
+# include <ngeo/ip_service.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Radix sorting for IP values.
+
+    Values are sorted by an order preserving unsigned integer key with a least
+    significant digit radix sort, optionally split across threads. This is
+    linear in the number of values, for bulk sorting of very large sets of
+    networks or ranges before building or aggregating.
+
+    The threads of a parallel sort meet at a Boost.Thread barrier after each
+    digit, which is why this is not part of the IP headers.
+    @note Header only library.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** Radix key encoding for @a T.
+
+    Specializations provide
+    - @c key_type, an unsigned integer type.
+    - @c BITS, the number of low bits of the key that are used.
+    - @c key(T const&), the key for a value.
+
+    Keys compare in the same order as the values.
+ */
+template < typename T > struct radix_traits;
+
+/** Radix key for an address.
+    The key is the address.
+ */
+template <> struct radix_traits<ip4_addr> {
+    typedef boost::uint32_t key_type; //!< Key type.
+    static int const BITS = 32; //!< Bits used in the key.
+    /// Key for @a a.
+    static key_type key(ip4_addr const& a) { return a.host_order(); }
+};
+
+/** Radix key for a network.
+    This is the order of @c ip4_net::lexicographic_order, by address and then
+    more specific networks first. The key is the address shifted up 6 bits,
+    with the number of host bits (32 less the mask length) in the low bits.
+ */
+template <> struct radix_traits<ip4_net> {
+    typedef boost::uint64_t key_type; //!< Key type.
+    static int const BITS = 38; //!< Bits used in the key.
+    /// Key for @a n.
+    static key_type key(ip4_net const& n) {
+        return (static_cast<key_type>(n.addr().host_order()) << 6) | (ip4_addr::WIDTH - n.mask().count());
+    }
+};
+
+/** Radix key for a range.
+    This is the order of @c interval::lexicographic_order, by minimum and then
+    by maximum. The key is the minimum in the high 32 bits and the maximum in
+    the low 32 bits.
+ */
+template <> struct radix_traits<ip4_range> {
+    typedef boost::uint64_t key_type; //!< Key type.
+    static int const BITS = 64; //!< Bits used in the key.
+    /// Key for @a r.
+    static key_type key(ip4_range const& r) {
+        return (static_cast<key_type>(r.min().host_order()) << 32) | r.max().host_order();
+    }
+};
+
+/** Radix key for a service.
+    The key is the @c packed_service encoding.
+ */
+template <> struct radix_traits<packed_service> {
+    typedef packed_service::raw_type key_type; //!< Key type.
+    static int const BITS = packed_service::DATA_BITS + 9; //!< Bits used in the key.
+    /// Key for @a s.
+    static key_type key(packed_service const& s) { return s.raw(); }
+};
+
+/// @cond IMPLEMENTATION
+namespace detail {
+    /** One radix sort, shared by all of the threads working on it.
+        Each thread owns a contiguous slice of the input. For every digit the
+        threads count their slice, then thread 0 turns the counts in to output
+        offsets (by digit and then by thread, so the sort is stable), then each
+        thread scatters its slice. A digit where every key is the same is
+        skipped.
+     */
+    template < typename K > struct radix_job {
+        static int const DIGIT_BITS = 8; //!< Bits per pass.
+        static std::size_t const DIGITS = 1 << DIGIT_BITS; //!< Buckets per pass.
+        static K const DIGIT_MASK = DIGITS - 1; //!< Mask for a digit.
+
+        K* m_keys[2]; //!< Input and scratch key arrays.
+        boost::uint32_t* m_index[2]; //!< Input and scratch index arrays, may be null.
+        std::size_t m_n; //!< Number of keys.
+        int m_passes; //!< Number of digits.
+        unsigned m_threads; //!< Number of threads.
+        std::vector<std::size_t> m_counts; //!< Per thread digit counts, then offsets.
+        std::vector<char> m_skip; //!< Per pass, set if the pass does nothing.
+        boost::barrier* m_barrier; //!< Thread synchronization, null if single threaded.
+        int m_result; //!< Which array has the sorted keys.
+
+        /// Wait for all of the threads.
+        void sync() { if (m_barrier) m_barrier->wait(); }
+
+        /// Convert the counts for @a pass to offsets.
+        void offsets(int pass) {
+            std::size_t sum = 0;
+            m_skip[pass] = false;
+            for ( std::size_t d = 0 ; d < DIGITS ; ++d ) {
+                std::size_t total = 0;
+                for ( unsigned t = 0 ; t < m_threads ; ++t ) {
+                    std::size_t& c = m_counts[t * DIGITS + d];
+                    std::size_t tmp = c;
+                    c = sum;
+                    sum += tmp;
+                    total += tmp;
+                }
+                if (total == m_n) m_skip[pass] = true;
+            }
+        }
+
+        /// Work for thread @a t.
+        void run(unsigned t) {
+            std::size_t lo = m_n * t / m_threads;
+            std::size_t hi = m_n * (t + 1) / m_threads;
+            std::size_t* count = &m_counts[t * DIGITS];
+            int cur = 0;
+
+            for ( int pass = 0 ; pass < m_passes ; ++pass ) {
+                int shift = pass * DIGIT_BITS;
+                K const* src = m_keys[cur];
+
+                std::fill(count, count + DIGITS, 0);
+                for ( std::size_t i = lo ; i < hi ; ++i )
+                    ++count[(src[i] >> shift) & DIGIT_MASK];
+                this->sync();
+                if (0 == t) this->offsets(pass);
+                this->sync();
+
+                if (!m_skip[pass]) {
+                    K* dst = m_keys[cur ^ 1];
+                    boost::uint32_t const* isrc = m_index[cur];
+                    boost::uint32_t* idst = m_index[cur ^ 1];
+                    for ( std::size_t i = lo ; i < hi ; ++i ) {
+                        std::size_t spot = count[(src[i] >> shift) & DIGIT_MASK]++;
+                        dst[spot] = src[i];
+                        if (isrc) idst[spot] = isrc[i];
+                    }
+                    cur ^= 1;
+                }
+                this->sync();
+            }
+            if (0 == t) m_result = cur;
+        }
+    };
+}
+/// @endcond
+
+/** Sort unsigned integer keys, carrying an index with each key.
+
+    Only the low @a bits bits of each key are sorted on, the rest must be
+    zero. If @a index is not null it is permuted along with the keys. The
+    sort is stable.
+
+    If @a threads is more than 1 the sort is split across that many threads.
+    Small inputs are always sorted on the calling thread.
+ */
+template < typename K > void
+radix_sort_keys(
+    K* keys, //!< [in,out] Keys.
+    boost::uint32_t* index, //!< [in,out] Index for each key, may be null.
+    std::size_t n, //!< [in] Number of keys.
+    int bits = sizeof(K) * 8, //!< [in] Significant bits in the keys.
+    unsigned threads = 1 //!< [in] Number of threads to use.
+) {
+    typedef detail::radix_job<K> job_type;
+    // Below this many keys per thread it's not worth starting threads.
+    static std::size_t const MIN_PER_THREAD = 1 << 16;
+
+    if (n < 2) return;
+    if (threads < 1) threads = 1;
+    if (n / threads < MIN_PER_THREAD) threads = static_cast<unsigned>(std::max<std::size_t>(1, n / MIN_PER_THREAD));
+
+    std::vector<K> key_tmp(n);
+    std::vector<boost::uint32_t> index_tmp(index ? n : 0);
+    job_type job;
+    job.m_keys[0] = keys;
+    job.m_keys[1] = &key_tmp[0];
+    job.m_index[0] = index;
+    job.m_index[1] = index ? &index_tmp[0] : 0;
+    job.m_n = n;
+    job.m_passes = (bits + job_type::DIGIT_BITS - 1) / job_type::DIGIT_BITS;
+    job.m_threads = threads;
+    job.m_counts.resize(threads * job_type::DIGITS);
+    job.m_skip.resize(job.m_passes);
+    job.m_barrier = 0;
+    job.m_result = 0;
+
+    if (threads > 1) {
+        boost::barrier barrier(threads);
+        boost::thread_group group;
+        job.m_barrier = &barrier;
+        for ( unsigned t = 1 ; t < threads ; ++t )
+            group.create_thread(boost::bind(&job_type::run, &job, t));
+        job.run(0);
+        group.join_all();
+    } else {
+        job.run(0);
+    }
+
+    if (job.m_result) {
+        std::copy(key_tmp.begin(), key_tmp.end(), keys);
+        if (index) std::copy(index_tmp.begin(), index_tmp.end(), index);
+    }
+}
+
+/** Compute the sorted order of @a values.
+    On return @a perm[i] is the index in @a values of the i'th value in
+    sorted order. Equal values keep their relative order.
+ */
+template < typename T > void
+radix_permutation(
+    T const* values, //!< [in] Values.
+    std::size_t n, //!< [in] Number of values.
+    std::vector<boost::uint32_t>& perm, //!< [out] Sorted order.
+    unsigned threads = 1 //!< [in] Number of threads to use.
+) {
+    typedef radix_traits<T> traits;
+    std::vector<typename traits::key_type> keys(n);
+    perm.resize(n);
+    for ( std::size_t i = 0 ; i < n ; ++i ) {
+        keys[i] = traits::key(values[i]);
+        perm[i] = static_cast<boost::uint32_t>(i);
+    }
+    if (n) radix_sort_keys(&keys[0], &perm[0], n, traits::BITS, threads);
+}
+
+/** Sort @a values in place.
+    The order is that of the @c radix_traits key for @a T. The sort is stable.
+ */
+template < typename T > void
+radix_sort(
+    T* values, //!< [in,out] Values.
+    std::size_t n, //!< [in] Number of values.
+    unsigned threads = 1 //!< [in] Number of threads to use.
+) {
+    std::vector<boost::uint32_t> perm;
+    radix_permutation(values, n, perm, threads);
+    std::vector<T> sorted;
+    sorted.reserve(n);
+    for ( std::size_t i = 0 ; i < n ; ++i ) sorted.push_back(values[perm[i]]);
+    std::copy(sorted.begin(), sorted.end(), values);
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -7,15 +7,239 @@
 /** @file
     String comparisons.
     This provides variants of @c strcmp that are useful but not generally available.
+
+    Comparisons of strings with known lengths use ASCII case folding kernels
+    that work on 32 (AVX2) or 16 (SSE2) bytes per step, depending on the
+    instruction set enabled for the compiler, and 8 bytes per step on other
+    little endian targets. A build with @c NG_NO_SIMD defined uses a byte
+    loop. The results are the same in every case.
  */
 
+# include <string>
+# include <algorithm>
 # if !defined(_MSC_VER)
 #   include <string.h>
+# else
+#   include <intrin.h>
+# endif
+# if !defined(NG_NO_SIMD)
+#   if defined(__AVX2__)
+#     define NG_STRCMP_AVX2 1
+#   endif
+#   if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#     define NG_STRCMP_SSE2 1
+#     include <emmintrin.h>
+#   endif
+#   if NG_STRCMP_AVX2
+#     include <immintrin.h>
+#   endif
+#   if (defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_X64)
+#     define NG_STRCMP_SWAR 1
+#   endif
 # endif
 
 /// Network Geographics namespace
 namespace ngeo {
-    
+
+/// @cond IMPLEMENTATION
+namespace detail {
+    /// Fold an ASCII character to lower case.
+    inline unsigned char ascii_tolower(char c) {
+        unsigned char u = static_cast<unsigned char>(c);
+        return static_cast<unsigned char>(u - 'A' < 26u ? u + ('a' - 'A') : u);
+    }
+
+    /// Fold an ASCII character to upper case.
+    inline char ascii_toupper(char c) {
+        unsigned char u = static_cast<unsigned char>(c);
+        return static_cast<char>(u - 'a' < 26u ? u - ('a' - 'A') : u);
+    }
+
+    /// Index of the lowest set bit in non-zero @a x.
+    inline unsigned int lowest_bit(unsigned int x) {
+# if defined(__GNUC__)
+        return __builtin_ctz(x);
+# elif defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, x);
+        return idx;
+# else
+        unsigned int zret = 0;
+        while (!(x & 1)) { x >>= 1; ++zret; }
+        return zret;
+# endif
+    }
+
+# if NG_STRCMP_SSE2
+    /// Fold the upper case ASCII letters in @a x to lower case.
+    inline __m128i ascii_tolower(__m128i x) {
+        // Shift 'A' to -128 so that a signed compare finds 'A'..'Z'.
+        __m128i t = _mm_add_epi8(x, _mm_set1_epi8(static_cast<char>(0x80 - 'A')));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(-128 + 26)), t);
+        return _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    }
+    /// Fold the lower case ASCII letters in @a x to upper case.
+    inline __m128i ascii_toupper(__m128i x) {
+        __m128i t = _mm_add_epi8(x, _mm_set1_epi8(static_cast<char>(0x80 - 'a')));
+        __m128i lower = _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(-128 + 26)), t);
+        return _mm_sub_epi8(x, _mm_and_si128(lower, _mm_set1_epi8(0x20)));
+    }
+# endif
+# if NG_STRCMP_AVX2
+    /// Fold the upper case ASCII letters in @a x to lower case.
+    inline __m256i ascii_tolower(__m256i x) {
+        __m256i t = _mm256_add_epi8(x, _mm256_set1_epi8(static_cast<char>(0x80 - 'A')));
+        __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), t);
+        return _mm256_add_epi8(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    }
+# endif
+
+# if NG_STRCMP_SWAR
+    /** Find the first difference in 8 characters, ignoring ASCII case.
+        The characters are handled as the bytes of a 64 bit integer. The
+        first @a skip characters are not checked.
+        @return The index of the first difference, or 8 if there is none.
+     */
+    inline unsigned int ascii_imismatch8(char const* lhs, char const* rhs, bool stop_at_nul, unsigned int skip) {
+        static unsigned long long const HIGH = 0x8080808080808080ULL;
+        static unsigned long long const LOW = 0x0101010101010101ULL;
+        unsigned long long l, r;
+        memcpy(&l, lhs, sizeof(l));
+        memcpy(&r, rhs, sizeof(r));
+        // For each byte the high bit is set iff the byte is in 'A'..'Z', without carries between bytes.
+        unsigned long long lu = ((l | HIGH) - LOW * 'A') & ~((l | HIGH) - LOW * ('Z' + 1)) & ~l & HIGH;
+        unsigned long long ru = ((r | HIGH) - LOW * 'A') & ~((r | HIGH) - LOW * ('Z' + 1)) & ~r & HIGH;
+        unsigned long long diff = (l | (lu >> 2)) ^ (r | (ru >> 2));
+        // A zero byte sets its high bit, and possibly those of following bytes which don't matter.
+        if (stop_at_nul) diff |= (l - LOW) & ~l & HIGH;
+        diff &= ~0ULL << (skip * 8);
+        if (!diff) return 8;
+#   if defined(__GNUC__)
+        return __builtin_ctzll(diff) >> 3;
+#   else
+        unsigned long idx;
+        _BitScanForward64(&idx, diff);
+        return idx >> 3;
+#   endif
+    }
+# endif
+
+# if NG_STRCMP_SSE2
+    /** Compare 16 characters, ignoring ASCII case.
+        @return A bit mask with a bit set for each character that is the same
+        in both strings (and is not nul, if @a stop_at_nul is set).
+     */
+    inline unsigned int ascii_isame16(char const* lhs, char const* rhs, bool stop_at_nul) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lhs));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rhs));
+        unsigned int same = _mm_movemask_epi8(_mm_cmpeq_epi8(ascii_tolower(l), ascii_tolower(r)));
+        if (stop_at_nul) same &= ~_mm_movemask_epi8(_mm_cmpeq_epi8(l, _mm_setzero_si128()));
+        return same & 0xFFFFu;
+    }
+# endif
+
+    /** Find the first difference between two strings, ignoring ASCII case.
+        If @a stop_at_nul is set a nul character in both strings is treated as
+        a difference, matching the C string functions.
+
+        Strings are compared in blocks. If the length is not a multiple of the
+        block size the last block is aligned to the end of the strings and
+        overlaps the previous one, with the already compared characters masked.
+        @return The index of the first difference, or @a n if there is none.
+     */
+    inline size_t ascii_imismatch
+        ( char const* lhs ///< Left string
+        , char const* rhs ///< Right string
+        , size_t n ///< Length of both strings
+        , bool stop_at_nul ///< Stop at a nul character
+        )
+    {
+        size_t i = 0;
+# if NG_STRCMP_AVX2
+        for ( ; i + 32 <= n ; i += 32 ) {
+            __m256i l = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(lhs + i));
+            __m256i r = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rhs + i));
+            unsigned int same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(ascii_tolower(l), ascii_tolower(r)));
+            if (stop_at_nul) same &= ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, _mm256_setzero_si256()));
+            if (same != 0xFFFFFFFFu) return i + lowest_bit(~same);
+        }
+# endif
+# if NG_STRCMP_SSE2
+        for ( ; i + 16 <= n ; i += 16 ) {
+            unsigned int same = ascii_isame16(lhs + i, rhs + i, stop_at_nul);
+            if (same != 0xFFFFu) return i + lowest_bit(~same & 0xFFFFu);
+        }
+        if (i < n && 16 <= n) {
+            size_t k = n - 16;
+            unsigned int same = ascii_isame16(lhs + k, rhs + k, stop_at_nul) | ((1u << (i - k)) - 1);
+            return same != 0xFFFFu ? k + lowest_bit(~same & 0xFFFFu) : n;
+        }
+# endif
+# if NG_STRCMP_SWAR
+        for ( ; i + 8 <= n ; i += 8 ) {
+            unsigned int j = ascii_imismatch8(lhs + i, rhs + i, stop_at_nul, 0);
+            if (j < 8) return i + j;
+        }
+        if (i < n && 8 <= n) {
+            size_t k = n - 8;
+            return k + ascii_imismatch8(lhs + k, rhs + k, stop_at_nul, static_cast<unsigned int>(i - k));
+        }
+# endif
+        for ( ; i < n ; ++i )
+            if (ascii_tolower(lhs[i]) != ascii_tolower(rhs[i]) || (stop_at_nul && !lhs[i])) break;
+        return i;
+    }
+
+    /** Compare two strings of length @a n, ignoring ASCII case.
+        This is @c strncasecmp in the "C" locale, but faster because the
+        length is known.
+        @internal The glibc @c strncasecmp is already vectorized, and reads
+        ahead within a page which a portable implementation can't do. It is
+        faster for short strings, so it is used directly.
+     */
+    inline int ascii_strnicmp
+        ( char const* lhs ///< Left string
+        , char const* rhs ///< Right string
+        , size_t n ///< Length of both strings
+        )
+    {
+# if defined(__GLIBC__)
+        return strncasecmp(lhs, rhs, n);
+# else
+        size_t i = ascii_imismatch(lhs, rhs, n, true);
+        return i < n ? ascii_tolower(lhs[i]) - ascii_tolower(rhs[i]) : 0;
+# endif
+    }
+
+    /// Copy @a n characters from @a src to @a dst, folding ASCII to upper case.
+    inline void ascii_toupper
+        ( char const* src ///< Source
+        , size_t n ///< Number of characters
+        , char* dst ///< Destination
+        )
+    {
+        size_t i = 0;
+# if NG_STRCMP_SSE2
+        for ( ; i + 16 <= n ; i += 16 )
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), ascii_toupper(_mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i))));
+# endif
+        for ( ; i < n ; ++i ) dst[i] = ascii_toupper(src[i]);
+    }
+
+    /// Compare @a lhs and @a rhs with lengths, ignoring ASCII case.
+    inline int ascii_stricmp(char const* lhs, size_t l_length, char const* rhs, size_t r_length)
+    {
+        int zret = ascii_strnicmp(lhs, rhs, std::min(l_length, r_length));
+        // We get a false equality if one string is an initial subsequence of the other,
+        // so check for that and adjust the result accordingly.
+        if (0 == zret && l_length != r_length)
+            zret = l_length < r_length ? -1 : 1;
+        return zret;
+    }
+}
+/// @endcond
+
+
 /** Compare two C strings, ignoring case.
 
     @return
@@ -67,12 +291,7 @@ inline int stricmp
     , std::string const& rhs ///< Right string
     )
 {
-    int zret = strnicmp(lhs.data(), rhs.data(), std::min(lhs.length(), rhs.length()));
-    // We get a false equality if one string is an initial subsequence of the other,
-    // so check for that and adjust the result accordingly.
-    if (0 == zret && lhs.length() != rhs.length())
-        zret = lhs.length() < rhs.length() ? -1 : 1;
-    return zret;
+    return detail::ascii_stricmp(lhs.data(), lhs.length(), rhs.data(), rhs.length());
 }
 
 /** Compare a @c std:string and a C string, ignoring case and locale.
@@ -87,13 +306,7 @@ inline int stricmp
     , char const* rhs ///< Right string
     )
 {
-    size_t r_length = rhs ? strlen(rhs) : 0;
-    int zret = strnicmp(lhs.data(), rhs, std::min(lhs.length(), r_length));
-    // We get a false equality if one string is an initial subsequence of the other,
-    // so check for that and adjust the result accordingly.
-    if (0 == zret && lhs.length() != r_length)
-        zret = lhs.length() < r_length ? -1 : 1;
-    return zret;
+    return detail::ascii_stricmp(lhs.data(), lhs.length(), rhs, rhs ? strlen(rhs) : 0);
 }
 
 /** Compare a @c std:string and a C string, ignoring case and locale.
@@ -108,13 +321,7 @@ inline int stricmp
     , std::string const& rhs ///< Right string
     )
 {
-    size_t l_length = lhs ? strlen(lhs) : 0;
-    int zret = strnicmp(lhs, rhs.data(), std::min(l_length, rhs.length()));
-    // We get a false equality if one string is an initial subsequence of the other,
-    // so check for that and adjust the result accordingly.
-    if (0 == zret && rhs.length() != l_length)
-        zret = l_length < rhs.length() ? -1 : 1;
-    return zret;
+    return detail::ascii_stricmp(lhs, lhs ? strlen(lhs) : 0, rhs.data(), rhs.length());
 }
 
 } // namespace ngeo
@@ -70,7 +70,7 @@ inline bool iequal
     , std::string const& rhs ///< Right string
     )
 {
-    return 0 == stricmp(lhs, rhs);
+    return lhs.length() == rhs.length() && 0 == stricmp(lhs, rhs);
 }
 
 /** Equality comparator for @c std::string, ignoring case and locale.
@@ -138,6 +138,7 @@ struct string_iless
 {
     typedef std::string::value_type element_type; ///< String element type
     std::locale _locale; ///< Local to use for comparison
+    bool _classic; ///< Set if @a _locale is the classic locale, which has only ASCII case.
 
     /** Default constructor.
         Uses the default locale if @a loc isn't set.
@@ -145,7 +146,7 @@ struct string_iless
     string_iless
         ( std::locale const& loc = std::locale() ///< Locale to use for case conversion
         )
-        : _locale(loc)
+        : _locale(loc), _classic(loc == std::locale::classic())
     {}
 
     /** Compare two strings without regard to case.
@@ -157,6 +158,15 @@ struct string_iless
         , std::string const& right ///< Right hand side
         ) const
     {
+        if (_classic) {
+            size_t n = std::min(left.length(), right.length());
+            size_t i = detail::ascii_imismatch(left.data(), right.data(), n, false);
+            return i < n
+                ? detail::ascii_toupper(left[i]) < detail::ascii_toupper(right[i])
+                : left.length() < right.length()
+                ;
+        }
+
         std::string::const_iterator lspot(left.begin())
                                   , lx(left.end())
                                   , rspot(right.begin())
@@ -176,6 +186,9 @@ struct string_iless
     }
 };
 /* ------------------------------------------------------------------------ */
+/** Case insensitive hash for @c std::string, using the global locale.
+    This is consistent with @c string_iless for the same locale.
+ */
 struct ihash
     : std::unary_function<std::string, std::size_t>
 {
@@ -184,6 +197,17 @@ struct ihash
         std::size_t seed = 0;
         std::locale locale;
 
+        if (locale == std::locale::classic()) {
+            // Only ASCII has case, so fold in blocks.
+            char folded[64];
+            for ( size_t i = 0, n = x.length() ; i < n ; i += sizeof(folded) ) {
+                size_t k = std::min(sizeof(folded), n - i);
+                detail::ascii_toupper(x.data() + i, k, folded);
+                for ( size_t j = 0 ; j < k ; ++j ) boost::hash_combine(seed, folded[j]);
+            }
+            return seed;
+        }
+
         for(std::string::const_iterator it = x.begin();
             it != x.end(); ++it)
         {
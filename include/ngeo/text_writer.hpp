@@ -0,0 +1,126 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <ostream>
+# include <string>
+# include <utility>
+# include <vector>
+# include <ngeo/to_chars.hpp>
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/** Buffered text output.
+
+    Values are formatted with @c to_chars directly in to a local buffer which
+    is written to the output stream in large blocks. This avoids the per value
+    overhead of stream formatting, for dumping large flowspaces or high volume
+    logging. The text is the same as for stream output.
+
+    Any type with a @c to_chars overload can be written. This includes all of
+    the IP types, intervals, flowspace regions and values, and integers.
+    @code
+    ngeo::text_writer w(std::cout);
+    for ( fs::const_iterator spot = space.begin(), limit = space.end() ; spot != limit ; ++spot )
+        w << *spot << '\n';
+    @endcode
+
+    @note The buffer is flushed when the writer is destroyed. The stream is
+    not flushed, only written.
+ */
+class text_writer
+{
+public:
+    typedef text_writer self; //!< Self reference type.
+
+    /// Default buffer size.
+    static std::size_t const DEFAULT_SIZE = 1 << 16;
+
+    /// Construct a writer for @a s.
+    explicit text_writer(
+        std::ostream& s, //!< [in] Output stream.
+        std::size_t size = DEFAULT_SIZE //!< [in] Buffer size.
+    ) : m_stream(s), m_buffer(size < 64 ? 64 : size) {
+        m_spot = &m_buffer[0];
+        m_limit = m_spot + m_buffer.size();
+    }
+
+    /// Destructor, write any buffered text.
+    ~text_writer() { this->flush(); }
+
+    /// Write buffered text to the stream.
+    self& flush() {
+        char* base = &m_buffer[0];
+        if (m_spot > base) m_stream.write(base, m_spot - base);
+        m_spot = base;
+        return *this;
+    }
+
+    /// Write @a n characters from @a text.
+    self& write(char const* text, std::size_t n) {
+        if (static_cast<std::size_t>(m_limit - m_spot) < n) {
+            this->flush();
+            if (m_buffer.size() < n) {
+                // Too large to buffer, send it straight through.
+                m_stream.write(text, n);
+                return *this;
+            }
+        }
+        std::memcpy(m_spot, text, n);
+        m_spot += n;
+        return *this;
+    }
+
+    /// Write a character.
+    self& operator << (char c) {
+        if (m_spot >= m_limit) this->flush();
+        *m_spot++ = c;
+        return *this;
+    }
+
+    /// Write a C string.
+    self& operator << (char const* text) { return this->write(text, std::strlen(text)); }
+    /// Write a string.
+    self& operator << (std::string const& text) { return this->write(text.data(), text.size()); }
+
+    /** Write a flowspace value or other pair.
+        This is written as "FIRST = SECOND", the same as the flowspace value stream output.
+     */
+    template < typename K, typename V >
+    self& operator << (std::pair<K,V> const& v) {
+        return *this << v.first << " = " << v.second;
+    }
+
+    /// Write @a v via @c to_chars.
+    template < typename T >
+    self& operator << (T const& v) {
+        char* spot = to_chars(m_spot, m_limit, v);
+        if (!spot) {
+            this->flush();
+            // If it won't fit in an empty buffer, grow the buffer.
+            while (0 == (spot = to_chars(m_spot, m_limit, v))) {
+                m_buffer.resize(m_buffer.size() * 2);
+                m_spot = &m_buffer[0];
+                m_limit = m_spot + m_buffer.size();
+            }
+        }
+        m_spot = spot;
+        return *this;
+    }
+
+protected:
+    std::ostream& m_stream; //!< Output stream.
+    std::vector<char> m_buffer; //!< Text buffer.
+    char* m_spot; //!< Next character to write in @a m_buffer.
+    char* m_limit; //!< End of @a m_buffer.
+
+private:
+    // Not copyable.
+    text_writer(self const&);
+    self& operator = (self const&);
+};
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -0,0 +1,121 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ------------------------------------------------------------------------ */
+# pragma once
+# include <cstddef>
+# include <cstring>
+# include <boost/tuple/tuple.hpp>
+# include <ngeo/interval.hpp>
+/* ------------------------------------------------------------------------ */
+/** @file
+    Text formatting in to a caller supplied buffer.
+
+    Each @c to_chars overload writes the same text as the corresponding
+    @c operator<< to the characters starting at @a first, without going
+    through a stream. The return value is a pointer past the last character
+    written, or null if there was not enough room between @a first and
+    @a last, in which case the contents of the buffer are unspecified.
+    No terminating nul is written.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+/// @cond IMPLEMENTATION
+namespace detail {
+    /// Copy @a n characters from @a text.
+    inline char* copy_chars(char* first, char* last, char const* text, std::size_t n) {
+        if (static_cast<std::size_t>(last - first) < n) return 0;
+        std::memcpy(first, text, n);
+        return first + n;
+    }
+
+    /// Write the unsigned value @a v in decimal.
+    template < typename U > char*
+    format_decimal(char* first, char* last, U v) {
+        // Pairs of digits for 00 .. 99, to halve the number of divisions.
+        static char const DIGITS[] =
+            "00010203040506070809" "10111213141516171819"
+            "20212223242526272829" "30313233343536373839"
+            "40414243444546474849" "50515253545556575859"
+            "60616263646566676869" "70717273747576777879"
+            "80818283848586878889" "90919293949596979899";
+        char buff[24]; // enough for 64 bits.
+        char* spot = buff + sizeof(buff);
+        while (v >= 100) {
+            unsigned int idx = static_cast<unsigned int>(v % 100) * 2;
+            v /= 100;
+            *--spot = DIGITS[idx + 1];
+            *--spot = DIGITS[idx];
+        }
+        if (v >= 10) {
+            unsigned int idx = static_cast<unsigned int>(v) * 2;
+            *--spot = DIGITS[idx + 1];
+            *--spot = DIGITS[idx];
+        } else {
+            *--spot = static_cast<char>('0' + v);
+        }
+        return copy_chars(first, last, spot, buff + sizeof(buff) - spot);
+    }
+
+    /// Write the signed value @a v in decimal.
+    template < typename U, typename S > char*
+    format_signed_decimal(char* first, char* last, S v) {
+        if (v >= 0) return format_decimal(first, last, static_cast<U>(v));
+        if (first >= last) return 0;
+        *first++ = '-';
+        return format_decimal(first, last, static_cast<U>(0) - static_cast<U>(v));
+    }
+}
+/// @endcond
+
+/// @name Integer formatting.
+//@{
+inline char* to_chars(char* first, char* last, unsigned int v) { return detail::format_decimal(first, last, v); }
+inline char* to_chars(char* first, char* last, unsigned long v) { return detail::format_decimal(first, last, v); }
+inline char* to_chars(char* first, char* last, int v) { return detail::format_signed_decimal<unsigned int>(first, last, v); }
+inline char* to_chars(char* first, char* last, long v) { return detail::format_signed_decimal<unsigned long>(first, last, v); }
+//@}
+
+/** Write interval @a intv.
+    This is the same format as @c operator<<, "MIN..MAX" or "*..*" if empty.
+    @relates interval
+ */
+template < typename T > char*
+to_chars(char* first, char* last, interval<T> const& intv) {
+    if (!intv) return detail::copy_chars(first, last, "*..*", 4);
+    if (0 != (first = to_chars(first, last, intv.min()))
+        && 0 != (first = detail::copy_chars(first, last, "..", 2))
+    )
+        first = to_chars(first, last, intv.max());
+    return first;
+}
+
+/** Write a flowspace region, bottom case.
+    This is the same format as the region stream output operator.
+ */
+template < typename H > char*
+to_chars(char* first, char* last, boost::tuples::cons<H, boost::tuples::null_type> const& c) {
+    if (0 != (first = detail::copy_chars(first, last, "(", 1))
+        && 0 != (first = to_chars(first, last, c.head))
+    )
+        first = detail::copy_chars(first, last, ")", 1);
+    return first;
+}
+
+/** Write a flowspace region, upper case.
+    Write the head interval and a trailing separator, then ripple down.
+ */
+template < typename H, typename T > char*
+to_chars(char* first, char* last, boost::tuples::cons<H,T> const& c) {
+    if (0 != (first = detail::copy_chars(first, last, "(", 1))
+        && 0 != (first = to_chars(first, last, c.head))
+        && 0 != (first = detail::copy_chars(first, last, "), ", 3))
+    )
+        first = to_chars(first, last, c.tail);
+    return first;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -94,6 +94,9 @@ imp::node_base::ripple_structure_fixup()
 imp::node_base::handle
 imp::node_base::get_prev() const
 {
+# if NG_FLOWSPACE_PREV_THREAD
+    return handle(m_prev);
+# else
     handle n;
     /*  The rule is, if there is a left child, the predecessor is
         the rightmost child of that left child.
@@ -112,6 +115,7 @@ imp::node_base::get_prev() const
     }
     assert(!n || n->m_next == this);
     return n;
+# endif
 }
 
 void
@@ -148,8 +152,18 @@ imp::node_base::insert_child(handle const& n, direction d)
         // =this= is the predecessor, so splicing is easy
         n->m_next = m_next;
         m_next = n.get();
+# if NG_FLOWSPACE_PREV_THREAD
+        n->m_prev = this;
+        if (n->m_next) n->m_next->m_prev = n.get();
+# endif
     } else if (LEFT == d) {
         n->m_next = this; // =this= is the success of the child.
+# if NG_FLOWSPACE_PREV_THREAD
+        // The predecessor is directly available, splice the child in front of =this=.
+        n->m_prev = m_prev;
+        if (m_prev) m_prev->m_next = n.get();
+        m_prev = n.get();
+# else
         /*  Now we have to find the predecessor for the child.
             Because we always insert at a leaf, the predecessor node is
             always an ancestor. So we search up until we find the node that
@@ -162,6 +176,7 @@ imp::node_base::insert_child(handle const& n, direction d)
             ;
         if (p)
             p->m_next = n.get();
+# endif
     }
     return n->rebalance_after_insert();
 }
@@ -225,6 +240,9 @@ imp::node_base::remove()
     // this node, the node that is being truly removed from the tree.
     handle prev_node = this->get_prev();
     if (prev_node) prev_node->m_next = this->m_next;
+# if NG_FLOWSPACE_PREV_THREAD
+    if (m_next) m_next->m_prev = m_prev;
+# endif
 
     /** Handle two special cases first.
         - This is the only node in the tree, return a new root of NIL
@@ -425,6 +443,12 @@ imp::node_base::validate()
     }
     if (black_ht > 0 && !this->structure_validate())
         black_ht = 0;
+# if NG_FLOWSPACE_PREV_THREAD
+    if (black_ht > 0 && m_next && m_next->m_prev != this) {
+        std::cout << "Thread mismatch\n";
+        black_ht = 0;
+    }
+# endif
 
     return black_ht;
 }
@@ -448,6 +472,21 @@ imp::node_base::iterator::operator ++ (int) // postfix increment
 	return old;
 }
 
+imp::node_base::iterator&
+imp::node_base::iterator::operator -- () // prefix decrement
+{
+    m_node = m_node->get_prev();
+    return *this;
+}
+
+imp::node_base::iterator
+imp::node_base::iterator::operator -- (int) // postfix decrement
+{
+	iterator old(*this);
+	--*this;
+	return old;
+}
+
 bool
 imp::node_base::iterator::operator == (iterator const& rhs) const
 {
@@ -0,0 +1,48 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* ------------------------------------------------------------------------ */
+# include "ip_local.hpp"
+# include <ngeo/ip4_decode.hpp>
+/* ------------------------------------------------------------------------ */
+namespace {
+    // Packets ahead of the current one to prefetch.
+    std::size_t const PREFETCH_DISTANCE = 4;
+
+    inline void
+    prefetch(void const* p) {
+# if defined(__GNUC__)
+        __builtin_prefetch(p);
+# else
+        (void)p;
+# endif
+    }
+}
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+/* ------------------------------------------------------------------------ */
+std::size_t
+decode(
+    unsigned char const* const* packets,
+    std::size_t const* lengths,
+    std::size_t n,
+    ip4_flow* flows,
+    ip4_decode_status* status
+) {
+    std::size_t zret = 0;
+
+    for ( std::size_t i = 0 ; i < n && i < PREFETCH_DISTANCE ; ++i )
+        prefetch(packets[i]);
+
+    for ( std::size_t i = 0 ; i < n ; ++i ) {
+        if (i + PREFETCH_DISTANCE < n) prefetch(packets[i + PREFETCH_DISTANCE]);
+        ip4_decode_status s = decode(packets[i], lengths[i], flows[i]);
+        if (DECODE_INVALID == s) flows[i] = ip4_flow();
+        else if (DECODE_OK == s) ++zret;
+        if (status) status[i] = s;
+    }
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
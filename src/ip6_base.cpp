@@ -0,0 +1,332 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/* ------------------------------------------------------------------------ */
+# include "ip_local.hpp"
+# include "ip_parse.hpp"
+# include <ngeo/ip6_base.hpp>
+# if defined(_MSC_VER)
+#   include <intrin.h>
+# endif
+/* ------------------------------------------------------------------------ */
+// file local utilities
+namespace {
+    typedef ngeo::ip6_addr::half_type half_type;
+
+    // Number of leading zero bits in @a x, 64 if @a x is zero.
+    inline int
+    count_leading_zeros(half_type x) {
+# if defined(__GNUC__)
+        return x ? __builtin_clzll(x) : 64;
+# elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long idx;
+        return _BitScanReverse64(&idx, x) ? 63 - static_cast<int>(idx) : 64;
+# else
+        int zret = 0;
+        if (!x) return 64;
+        while (!(x >> 63)) { x <<= 1; ++zret; }
+        return zret;
+# endif
+    }
+
+    // Number of trailing zero bits in @a x, 64 if @a x is zero.
+    inline int
+    count_trailing_zeros(half_type x) {
+# if defined(__GNUC__)
+        return x ? __builtin_ctzll(x) : 64;
+# elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long idx;
+        return _BitScanForward64(&idx, x) ? static_cast<int>(idx) : 64;
+# else
+        int zret = 0;
+        if (!x) return 64;
+        while (!(x & 1)) { x >>= 1; ++zret; }
+        return zret;
+# endif
+    }
+
+    /*  Peel the largest network off the front of the non-empty range [min,max].
+        This is the same as the IPv4 logic, the network size is the smaller of
+        the alignment of @a min and the size of the range.
+        Returns @c true and updates @a min to follow the network if there are
+        addresses left in the range, @c false if the network ends at @a max.
+     */
+    bool
+    next_network(ngeo::ip6_addr& min, ngeo::ip6_addr const& max, ngeo::ip6_net& net) {
+        ngeo::ip6_addr size(max - min);
+        ++size; // zero if the range is every address.
+        int width = min.lsb_count(false);
+        int fit = size == ngeo::ip6_addr::MIN ? 128 : 127 - size.msb_count(false);
+        if (fit < width) width = fit;
+        ngeo::ip6_mask mask(ngeo::ip6_addr::WIDTH - width);
+        net = ngeo::ip6_net(min, mask);
+        ngeo::ip6_addr last(net.max_addr());
+        if (last == max) return false;
+        min = ++last;
+        return true;
+    }
+
+    // Write an address in RFC 5952 form. The buffer must have room for 39 characters.
+    char*
+    write_groups(char* spot, ngeo::ip6_addr const& a) {
+        static char const HEX[] = "0123456789abcdef";
+        unsigned int groups[8];
+        int gap = -1; // start of longest run of zero groups.
+        int gap_len = 1; // length of that run, only runs of 2 or more are compressed.
+        int run = 0;
+
+        for ( int i = 0 ; i < 8 ; ++i ) {
+            groups[i] = a.group(i);
+            if (groups[i]) {
+                run = 0;
+            } else if (++run > gap_len) {
+                gap_len = run;
+                gap = i - run + 1;
+            }
+        }
+
+        for ( int i = 0 ; i < 8 ; ++i ) {
+            if (i == gap) {
+                *spot++ = ':';
+                *spot++ = ':';
+                i += gap_len - 1;
+                continue;
+            }
+            if (i > 0 && i != gap + gap_len) *spot++ = ':';
+            unsigned int v = groups[i];
+            // Skip leading zeros, but always write the last digit.
+            if (v >= 0x1000) *spot++ = HEX[v >> 12];
+            if (v >= 0x100) *spot++ = HEX[(v >> 8) & 0xF];
+            if (v >= 0x10) *spot++ = HEX[(v >> 4) & 0xF];
+            *spot++ = HEX[v & 0xF];
+        }
+        return spot;
+    }
+
+    // Write a value through @c to_chars to a stream.
+    template < typename T, int N > std::ostream&
+    write_stream(std::ostream& s, T const& t) {
+        char buff[N];
+        char* end = to_chars(buff, buff + N, t);
+        return s.write(buff, end - buff);
+    }
+
+    // Write a single character.
+    inline char*
+    write_char(char* first, char* last, char c) {
+        if (first >= last) return 0;
+        *first++ = c;
+        return first;
+    }
+}
+/* ------------------------------------------------------------------------ */
+namespace ngeo {
+using ip_parser::read_stream;
+using ip_parser::read_text;
+using ip_parser::convert;
+/* ------------------------------------------------------------------------ */
+ip6_addr::ip6_addr(std::string const& s) {
+    convert(s, *this);
+}
+
+bool ip6_addr::is_valid(std::string const& s) {
+    ip6_addr a;
+    return read_text(s, a).is_ok();
+}
+
+int
+ip6_addr::msb_count(bool set) const {
+    half_type hi = set ? ~_hi : _hi;
+    half_type lo = set ? ~_lo : _lo;
+    return hi ? count_leading_zeros(hi) : HALF_WIDTH + count_leading_zeros(lo);
+}
+
+int
+ip6_addr::lsb_count(bool set) const {
+    half_type hi = set ? ~_hi : _hi;
+    half_type lo = set ? ~_lo : _lo;
+    return lo ? count_trailing_zeros(lo) : HALF_WIDTH + count_trailing_zeros(hi);
+}
+
+void
+ip6_addr::network_order(unsigned char* bytes) const {
+    for ( int i = 0 ; i < 8 ; ++i ) {
+        bytes[i] = static_cast<unsigned char>(_hi >> (56 - 8 * i));
+        bytes[i + 8] = static_cast<unsigned char>(_lo >> (56 - 8 * i));
+    }
+}
+
+ip6_addr&
+ip6_addr::set_network_order(unsigned char const* bytes) {
+    _hi = _lo = 0;
+    for ( int i = 0 ; i < 8 ; ++i ) {
+        _hi = (_hi << 8) | bytes[i];
+        _lo = (_lo << 8) | bytes[i + 8];
+    }
+    return *this;
+}
+
+std::ostream&
+operator << (std::ostream& s, ip6_addr const& addr) {
+    return write_stream<ip6_addr, 40>(s, addr);
+}
+
+char*
+to_chars(char* first, char* last, ip6_addr const& addr) {
+    // Format directly if there is certainly room, otherwise go through a local buffer.
+    if (last - first >= 39) return write_groups(first, addr);
+    char buff[40];
+    return detail::copy_chars(first, last, buff, write_groups(buff, addr) - buff);
+}
+
+std::istream&
+operator >> (std::istream& s, ip6_addr& addr) {
+    return read_stream(s, addr);
+}
+
+parse_result
+parse(boost::string_ref text, ip6_addr& addr) {
+    return read_text(text, addr);
+}
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+ip6_mask::ip6_mask(std::string const& s) {
+    convert(s, *this);
+}
+
+std::ostream&
+operator << (std::ostream& s, ip6_mask const& mask) {
+    return s << mask.count();
+}
+
+char*
+to_chars(char* first, char* last, ip6_mask const& mask) {
+    return to_chars(first, last, static_cast<unsigned int>(mask.count()));
+}
+
+std::istream&
+operator >> (std::istream& s, ip6_mask& m) {
+    return read_stream(s, m);
+}
+
+parse_result
+parse(boost::string_ref text, ip6_mask& m) {
+    return read_text(text, m);
+}
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+ip6_net::ip6_net(std::string const& s) {
+    convert(s, *this);
+}
+
+std::ostream& operator << (std::ostream& s, ip6_net const& net) {
+    return write_stream<ip6_net, 48>(s, net);
+}
+
+char* to_chars(char* first, char* last, ip6_net const& net) {
+    if (net.is_empty()) {
+        static char const EMPTY[] = { ip6_net::EMPTY_CHAR, ip6_net::SEPARATOR, ip6_net::EMPTY_CHAR };
+        return detail::copy_chars(first, last, EMPTY, sizeof(EMPTY));
+    }
+    if (0 != (first = to_chars(first, last, net.addr()))
+        && 0 != (first = write_char(first, last, ip6_net::SEPARATOR))
+    )
+        first = to_chars(first, last, net.mask());
+    return first;
+}
+
+std::istream& operator >> (std::istream& s, ip6_net& net) {
+    return read_stream(s, net);
+}
+
+parse_result parse(boost::string_ref text, ip6_net& net) {
+    return read_text(text, net);
+}
+/* ------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------ */
+ip6_range::ip6_range(std::string const& s) {
+    convert(s, *this);
+}
+
+ip6_range::net_iterator
+ip6_range::net_begin() const {
+    return net_iterator(*this);
+}
+
+ip6_range::net_iterator
+ip6_range::net_end() const {
+    return net_iterator();
+}
+
+bool
+ip6_range::extract_next_network(ip6_net& net) {
+    // fail somewhat gracefully for an empty range
+    if (!*this) {
+        net = ip6_net();
+        return false;
+    }
+
+    ip6_addr min(_min);
+    if (next_network(min, _max, net)) _min = min;
+    else *this = ip6_range();
+
+    return !*this;
+}
+
+// The range is a network if its cover is a single network.
+bool
+ip6_range::is_network() const {
+    ip6_addr min(_min);
+    ip6_net net;
+    return *this && !next_network(min, _max, net);
+}
+
+std::size_t
+network_cover(
+    ip6_range const* ranges,
+    std::size_t n,
+    ip6_net* nets,
+    std::size_t capacity,
+    std::size_t* converted
+) {
+    std::size_t count = 0;
+    std::size_t i;
+    for ( i = 0 ; i < n ; ++i ) {
+        ip6_range const& r = ranges[i];
+        std::size_t mark = count;
+        ip6_addr min(r.min());
+        bool more = !r.is_empty();
+        while (more && count < capacity)
+            more = next_network(min, r.max(), nets[count++]);
+        // Don't split a range across calls.
+        if (more) {
+            count = mark;
+            break;
+        }
+    }
+    if (converted) *converted = i;
+    return count;
+}
+
+std::ostream& operator << (std::ostream& s, ip6_range const& r) {
+    return write_stream<ip6_range, 80>(s, r);
+}
+
+char* to_chars(char* first, char* last, ip6_range const& r) {
+    if (0 != (first = to_chars(first, last, r.min()))
+        && 0 != (first = write_char(first, last, ip6_range::SEPARATOR))
+    )
+        first = to_chars(first, last, r.max());
+    return first;
+}
+
+std::istream& operator >> (std::istream& s, ip6_range& r) {
+    return read_stream(s, r);
+}
+
+parse_result parse(boost::string_ref text, ip6_range& r) {
+    return read_text(text, r);
+}
+/* ------------------------------------------------------------------------ */
+} // namespace ngeo
+/* ------------------------------------------------------------------------ */
@@ -4,34 +4,16 @@
 /* ------------------------------------------------------------------------ */
 # include "ip_local.hpp"
 # include "ip_static.hpp"
+# include "ip_parse.hpp"
 # include <ctype.h>
 # include <iomanip>
 # include <assert.h>
+# if defined(_MSC_VER)
+#   include <intrin.h>
+# endif
 /* ------------------------------------------------------------------------ */
 // file local utilities
 namespace {
-    // return true if we found and read the separator
-    bool get_non_numeric_separator(std::istream& s, int &c) {
-        if (s) {
-            s >> std::ws;
-            c = s.peek();
-            if (c == EOF) {
-        	s.clear(s.rdstate() & ~(std::ios::failbit | std::ios::eofbit));
-            } else if (!isdigit(c)) {
-                s.get();
-                s >> std::ws;
-                return true;
-            }
-        }
-        return false;
-    }
-
-    // return true if we found and read the separator
-    bool skip_non_numeric_separator(std::istream& s) {
-    	int c;
-    	return get_non_numeric_separator(s, c);
-    }
-
 # if 0
     // Read from a stream, presuming it to be in octet form. Return false
     // if impropertly formatted. In this case a is left with the partial
@@ -72,54 +54,117 @@ namespace {
         return false;
     }
 # endif
-    enum octet_style_t { OCTETS_INVALID = 0, OCTETS_MASK, OCTETS_CIDR };
-    octet_style_t
-    read_octets(std::istream& s, ngeo::ip4_addr::host_type& a) {
-        ngeo::ip4_addr::host_type v = 0; // current octet value
-        int count = 0; // # of octets found.
-        int digits = 0; // # of digits in this octet.
-        int c; // input character
-        octet_style_t zret = OCTETS_INVALID;
-        bool fail = false;
-
-        a = 0;
-
-        // Need to peek so we don't consume the next character
-        while (s && !fail && EOF != (c = s.peek())) {
-            if ('.' == c) {
-                s.get();
-                if (++count > 3 || v > 255) {
-                    fail = true;
-                } else {
-                    a = (a << 8) + v;
-                    digits = 0;
-                    v = 0;
-                }
-            } else if (isdigit(c)) {
-                s.get();
-                ++digits;
-                v = v * 10 + c - '0';
-                // allow a single number to represent the address.
-                if (v > 255 && count > 0) fail = true;
-            } else {
-               break;
-            }
+    // Text for each octet value, so that dotted quads can be written without division.
+    char const OCTET_TEXT[256][4] = {
+        "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15",
+        "16", "17", "18", "19", "20", "21", "22", "23", "24", "25", "26", "27", "28", "29", "30", "31",
+        "32", "33", "34", "35", "36", "37", "38", "39", "40", "41", "42", "43", "44", "45", "46", "47",
+        "48", "49", "50", "51", "52", "53", "54", "55", "56", "57", "58", "59", "60", "61", "62", "63",
+        "64", "65", "66", "67", "68", "69", "70", "71", "72", "73", "74", "75", "76", "77", "78", "79",
+        "80", "81", "82", "83", "84", "85", "86", "87", "88", "89", "90", "91", "92", "93", "94", "95",
+        "96", "97", "98", "99", "100", "101", "102", "103", "104", "105", "106", "107", "108", "109", "110", "111",
+        "112", "113", "114", "115", "116", "117", "118", "119", "120", "121", "122", "123", "124", "125", "126", "127",
+        "128", "129", "130", "131", "132", "133", "134", "135", "136", "137", "138", "139", "140", "141", "142", "143",
+        "144", "145", "146", "147", "148", "149", "150", "151", "152", "153", "154", "155", "156", "157", "158", "159",
+        "160", "161", "162", "163", "164", "165", "166", "167", "168", "169", "170", "171", "172", "173", "174", "175",
+        "176", "177", "178", "179", "180", "181", "182", "183", "184", "185", "186", "187", "188", "189", "190", "191",
+        "192", "193", "194", "195", "196", "197", "198", "199", "200", "201", "202", "203", "204", "205", "206", "207",
+        "208", "209", "210", "211", "212", "213", "214", "215", "216", "217", "218", "219", "220", "221", "222", "223",
+        "224", "225", "226", "227", "228", "229", "230", "231", "232", "233", "234", "235", "236", "237", "238", "239",
+        "240", "241", "242", "243", "244", "245", "246", "247", "248", "249", "250", "251", "252", "253", "254", "255"
+    };
+
+    // Write a single octet.
+    inline char*
+    write_octet(char* spot, unsigned int v) {
+        char const* text = OCTET_TEXT[v];
+        *spot++ = text[0];
+        if (text[1]) {
+            *spot++ = text[1];
+            if (text[2]) *spot++ = text[2];
         }
+        return spot;
+    }
 
-        a = (a << 8) + v;
-        if (!fail && ((0 == count && digits) || 3 == count)) {
-            s.clear(s.rdstate() & ~(std::ios::failbit | std::ios::eofbit));
-            zret = count ? OCTETS_MASK : OCTETS_CIDR;
-        } else {
-            s.setstate(std::ios::failbit);
-        }
+    // Write an address in octet form. The buffer must have room for 15 characters.
+    char*
+    write_octets(char* spot, ngeo::ip4_addr::host_type a) {
+        spot = write_octet(spot, (a>>24)&0xFF);
+        *spot++ = '.';
+        spot = write_octet(spot, (a>>16)&0xFF);
+        *spot++ = '.';
+        spot = write_octet(spot, (a>>8)&0xFF);
+        *spot++ = '.';
+        return write_octet(spot, a&0xFF);
+    }
+
+    typedef ngeo::ip4_addr::host_type host_type;
+
+    // Number of leading zero bits in @a x, 32 if @a x is zero.
+    inline int
+    count_leading_zeros(host_type x) {
+# if defined(__GNUC__)
+        return x ? __builtin_clz(x) : 32;
+# elif defined(_MSC_VER)
+        unsigned long idx;
+        return _BitScanReverse(&idx, x) ? 31 - static_cast<int>(idx) : 32;
+# else
+        int zret = 0;
+        if (!x) return 32;
+        while (!(x & 0x80000000)) { x <<= 1; ++zret; }
         return zret;
+# endif
     }
 
-    void
-    write_octets(std::ostream& s, ngeo::ip4_addr::host_type a) {
-        s   << ((a>>24)&0xFF) << "." << ((a>>16)&0xFF) << "."
-            << ((a>>8)&0xFF)  << "." << (a&0xFF);
+    // Number of trailing zero bits in @a x, 32 if @a x is zero.
+    inline int
+    count_trailing_zeros(host_type x) {
+# if defined(__GNUC__)
+        return x ? __builtin_ctz(x) : 32;
+# elif defined(_MSC_VER)
+        unsigned long idx;
+        return _BitScanForward(&idx, x) ? static_cast<int>(idx) : 32;
+# else
+        int zret = 0;
+        if (!x) return 32;
+        while (!(x & 1)) { x >>= 1; ++zret; }
+        return zret;
+# endif
+    }
+
+    /*  Peel the largest network off the front of the non-empty range [min,max].
+        The network size is limited by the alignment of @a min and by the size of
+        the range, both of which are single bit scans.
+        Returns @c true and updates @a min to follow the network if there are
+        addresses left in the range, @c false if the network ends at @a max.
+     */
+    inline bool
+    next_network(host_type& min, host_type max, ngeo::ip4_net& net) {
+        host_type size = max - min + 1; // zero if the range is every address.
+        int width = count_trailing_zeros(min);
+        int fit = size ? 31 - count_leading_zeros(size) : 32;
+        if (fit < width) width = fit;
+        host_type last = min + (width < 32 ? (host_type(1) << width) - 1 : ~host_type(0));
+        net = ngeo::ip4_net(ngeo::ip4_addr(min), ngeo::ip4_mask(32 - width));
+        if (last == max) return false;
+        min = last + 1;
+        return true;
+    }
+
+    // Write a single character.
+    inline char*
+    write_char(char* first, char* last, char c) {
+        if (first >= last) return 0;
+        *first++ = c;
+        return first;
+    }
+
+    // Write a value through @c to_chars to a stream.
+    template < typename T, int N > std::ostream&
+    write_stream(std::ostream& s, T const& t) {
+        char buff[N];
+        char* end = to_chars(buff, buff + N, t);
+        return s.write(buff, end - buff);
     }
 
     void
@@ -130,76 +175,13 @@ namespace {
             << std::setw(w) << std::setfill(' ') << (a&0xFF);
     }
 
-    template <typename T> std::istream&
-    read_range(std::istream& s, T& p) {
-        typedef typename T::metric_type METRIC;
-        METRIC l, h;	// temporaries
-
-        if (s >> std::ws) {
-            if (!isdigit(s.peek())) { // of the form "-###"
-                l = METRIC::MIN;
-	        s.get(); // skip separator
-	        s >> h;
-            } else if (s >> l) { // no leading separator
-                if (skip_non_numeric_separator(s)) {
-                    if (isdigit(s.peek())) {
-                        s >> h;
-                    } else { // "###-"
-                        h = METRIC::MAX;
-            		s.clear(s.rdstate() & ~(std::ios::failbit | std::ios::eofbit));
-                    }
-                } else
-                    h = l; // assume it's a singleton
-            }
-            if (s) p.set(l, h);
-        }
-	return s;
-    }
-
-    /**
-     * Pulling out of the general range reader, so we can deal with both networks and ranges
-     * as string inputs to ranges
-     */
-    std::istream&
-    read_ip4_range(std::istream& s, ngeo::ip4_range& p) {
-        typedef ngeo::ip4_range::metric_type METRIC;
-        METRIC l, h;	// temporaries
-
-        if (s >> std::ws) {
-            if (!isdigit(s.peek())) { // of the form "-###"
-                l = METRIC::MIN;
-                s.get(); // skip separator
-                s >> h;
-            } else if (s >> l) { // no leading separator
-            	int c;
-            	if (get_non_numeric_separator(s, c)) {
-            	    if (c == '/') {	// This is the network form
-	            	ngeo::ip4_mask mask;
-	            	if (s >> mask) {
-		            ngeo::ip4_net net(l, mask);
-		            l = net.addr();
-		            h = net.max_addr();
-	            	}
-	            } else { // Assume it is a dash and proceed with the straight network logic
-	                if (isdigit(s.peek())) {
-	                    s >> h;
-	                } else { // "###-"
-	                    h = METRIC::MAX;
-	                    s.clear(s.rdstate() & ~(std::ios::failbit | std::ios::eofbit));
-	                }
-	            }
-                } else {
-                    h = l; // assume it's a singleton
-                }
-	    }
-	    if (s) p.set(l, h);
-	}
-	return s;
-    }
 }
 /* ------------------------------------------------------------------------ */
 namespace ngeo {
 using boost::lexical_cast;
+using ip_parser::read_stream;
+using ip_parser::read_text;
+using ip_parser::convert;
 
 /* ------------------------------------------------------------------------ */
 
@@ -208,11 +190,19 @@ operator << (std::ostream& s, ip_port const& p) {
     return s << p.host_order();
 }
 
+char*
+to_chars(char* first, char* last, ip_port const& p) {
+    return to_chars(first, last, static_cast<unsigned int>(p.host_order()));
+}
+
 std::istream&
 operator >> (std::istream& s, ip_port& p) {
-    ip_port::host_type port;
-    if (s >> port) p.set(port);
-    return s;
+    return read_stream(s, p);
+}
+
+parse_result
+parse(boost::string_ref text, ip_port& p) {
+    return read_text(text, p);
 }
 
 ip_port::lexicon_type& ip_port::get_lexicon() { return PORT_LEXICON; }
@@ -224,144 +214,131 @@ template struct interval<ip_port>;
 # endif
 
 ip_port_range::ip_port_range(std::string const& str) {
-    *this = boost::lexical_cast<self>(str);
+    convert(str, *this);
 }
 
 std::ostream& operator << (std::ostream& s,  const ip_port_range& p) {
     return s << p.min() << ip_port_range::SEPARATOR << p.max();
 }
 
+char* to_chars(char* first, char* last, ip_port_range const& p) {
+    if (0 != (first = to_chars(first, last, p.min()))
+        && 0 != (first = write_char(first, last, ip_port_range::SEPARATOR))
+    )
+        first = to_chars(first, last, p.max());
+    return first;
+}
+
 std::istream& operator >> (std::istream& s, ip_port_range& p) {
-    return read_range<ip_port_range>(s, p);
+    return read_stream(s, p);
+}
+
+parse_result parse(boost::string_ref text, ip_port_range& p) {
+    return read_text(text, p);
 }
 /* ------------------------------------------------------------------------ */
 
 ip4_addr::ip4_addr(std::string const& s) {
-    *this = lexical_cast<self>(s);
+    convert(s, *this);
 }
 
 bool ip4_addr::is_valid(std::string const &addr_str) {
-    std::istringstream s(addr_str);
-    ip4_addr::host_type a;
-    return read_octets(s, a) != OCTETS_INVALID;
+    ip4_addr a;
+    return read_text(addr_str, a).is_ok();
 }
 
 int
 ip4_addr::msb_count(bool set) const {
-    /*  Probably a bit over the top, but I always worry about right shifts
-        and what comes in at the top. This constant lets us force the
-        MSB to be zero.
-     */
-    static const host_type ZERO_MSB = ~(host_type(1) << (WIDTH-1));
-    host_type m = ~ZERO_MSB;
-    unsigned int zret = 0;
-
-    while (zret < WIDTH && (((m & _addr) != 0) == set)) {
-        ++zret;
-        m >>= 1;
-        m &= ZERO_MSB;
-    }
-    return zret;
+    return count_leading_zeros(set ? ~_addr : _addr);
 }
 
 int
 ip4_addr::lsb_count(bool set) const {
-    host_type m(1);
-    unsigned int zret = 0;
-    while (zret < WIDTH && (((m & _addr) != 0) == set)) {
-        ++zret;
-        m <<= 1;
-    }
-    return zret;
+    return count_trailing_zeros(set ? ~_addr : _addr);
 }
 
 std::istream&
 operator >> (std::istream& s, ip4_addr& addr) {
-    ip4_addr::host_type a;
-    if (read_octets(s, a)) addr.set(a);
-    return s;
+    return read_stream(s, addr);
+}
+
+parse_result
+parse(boost::string_ref text, ip4_addr& addr) {
+    return read_text(text, addr);
 }
 
 std::ostream&
 operator << (std::ostream& s,  const ip4_addr& addr) {
-    write_octets(s, addr.host_order());
-    return s;
+    return write_stream<ip4_addr, 16>(s, addr);
+}
+
+char*
+to_chars(char* first, char* last, ip4_addr const& addr) {
+    // Format directly if there is certainly room, otherwise go through a local buffer.
+    if (last - first >= 15) return write_octets(first, addr.host_order());
+    char buff[16];
+    return detail::copy_chars(first, last, buff, write_octets(buff, addr.host_order()) - buff);
 }
 
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 ip4_mask::ip4_mask(std::string const& s) {
-    *this = lexical_cast<self>(s);
+    convert(s, *this);
 }
 
 std::istream&
 operator >> (std::istream& s, ip4_mask& m) {
-    // SKH - note that we are using ip4_addr::host_type here instead of ip4_mask::host_type
-    // because we're reading the mask in octet form, not CIDR.
-    ip4_addr::host_type u;
-    octet_style_t style = read_octets(s,u);
-    if (OCTETS_CIDR == style && u <= ip4_mask::WIDTH) {
-            m.set(u);
-    } else if (OCTETS_INVALID != style) {
-        // Either it's octet form, or it's a raw number that's more than 32.
-        m = ip4_mask(ip4_addr(u)); // force octet interpretation, not CIDR.
-    } else {	// just not right.
-        m.set(0);
-    }
-    return s;
+    return read_stream(s, m);
+}
+
+parse_result
+parse(boost::string_ref text, ip4_mask& m) {
+    return read_text(text, m);
 }
 
 std::ostream&
 operator << (std::ostream& s, ip4_mask const& mask){
     return s << mask.count();
 }
+
+char*
+to_chars(char* first, char* last, ip4_mask const& mask) {
+    return to_chars(first, last, static_cast<unsigned int>(mask.count()));
+}
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 ip4_net::ip4_net(std::string const& s) {
-    *this = lexical_cast<self>(s);
+    convert(s, *this);
 }
 
-// need to use temporaries so that we can guarantee that the address and
-// mask are compatible.
 std::istream& operator >> (std::istream& s, ip4_net& net) {
-    ip4_addr a;
-    ip4_mask m = 32;
-
-    if (!s) return s; // bad input, abort
-    s >> std::ws;
-
-    if (s.peek() == ip4_net::EMPTY_CHAR) {
-        // if the leading char is the invalid char then either it's the invalid notation
-        // or it's just wrong. So we succeed if we read invalid and fail otherwise.
-        char c;
-        s.get(); // drop leading invalid char
-        if (s >> std::ws && s >> c && ip4_net::SEPARATOR == c && s >> std::ws && s >> c && ip4_net::EMPTY_CHAR == c)
-            net = ip4_net(); // empty network
-        else // bad input
-    	    s.setstate(std::ios::failbit);
-    } else if (s >> a) {
-    	if (skip_non_numeric_separator(s)) {
-	    if (s >> m) // validate good read
-	        net.set(a,m);
-	    else
-	        s.setstate(std::ios::failbit);
-    	} else
-	    net.set(a, m);
-    }
-    return s;
+    return read_stream(s, net);
+}
+
+parse_result parse(boost::string_ref text, ip4_net& net) {
+    return read_text(text, net);
 }
 
 std::ostream& operator << (std::ostream& s, const ip4_net& net) {
-    if (net.is_empty())
-        return s << ip4_net::EMPTY_CHAR << ip4_net::SEPARATOR << ip4_net::EMPTY_CHAR;
-    else
-    	return s << net.addr() << ip4_net::SEPARATOR << net.mask();
+    return write_stream<ip4_net, 20>(s, net);
+}
+
+char* to_chars(char* first, char* last, ip4_net const& net) {
+    if (net.is_empty()) {
+        static char const EMPTY[] = { ip4_net::EMPTY_CHAR, ip4_net::SEPARATOR, ip4_net::EMPTY_CHAR };
+        return detail::copy_chars(first, last, EMPTY, sizeof(EMPTY));
+    }
+    if (0 != (first = to_chars(first, last, net.addr()))
+        && 0 != (first = write_char(first, last, ip4_net::SEPARATOR))
+    )
+        first = to_chars(first, last, net.mask());
+    return first;
 }
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 
 ip4_range::ip4_range(std::string const& s) {
-    *this = lexical_cast<self>(s);
+    convert(s, *this);
 }
 
 //! Get an iterator for the first network in the network cover of the range.
@@ -393,25 +370,41 @@ ip4_range::extract_next_network(ip4_net& net) {
         return false;
     }
 
-    int width(_min.lsb_count(false));
-    net.set(_min, ip4_mask::WIDTH - width); // largest possible network
-    // if it's too big, shrink it till it fits
-    while (net.max_addr() > _max)
-        net = ip4_net(_min, net.mask() >> 1);
-
-    /*  Need to be careful about wrapping during state update.
-        If the max address is in the net, we've done everything so reset
-        the range to empty. Otherwise, set the minimum to one past the end
-        of the network. We know that won't wrap because it's strictly less
-        than _max.
-     */
-    _min = net.max_addr();
-    if (_min == _max) *this = ip4_range();
-    else ++_min;
+    host_type min = _min.host_order();
+    if (next_network(min, _max.host_order(), net)) _min.set(min);
+    else *this = ip4_range();
 
     return !*this;
 }
 
+std::size_t
+network_cover(
+    ip4_range const* ranges,
+    std::size_t n,
+    ip4_net* nets,
+    std::size_t capacity,
+    std::size_t* converted
+) {
+    std::size_t count = 0;
+    std::size_t i;
+    for ( i = 0 ; i < n ; ++i ) {
+        ip4_range const& r = ranges[i];
+        std::size_t mark = count;
+        host_type min = r.min().host_order();
+        host_type max = r.max().host_order();
+        bool more = !r.is_empty();
+        while (more && count < capacity)
+            more = next_network(min, max, nets[count++]);
+        // Don't split a range across calls.
+        if (more) {
+            count = mark;
+            break;
+        }
+    }
+    if (converted) *converted = i;
+    return count;
+}
+
 /*  The range is a network if the size is 2^k and no more than the size of the
     maximum network based at the minimum value.
  */
@@ -429,86 +422,91 @@ ip4_range::is_network() const {
 
 std::istream&
 operator >> (std::istream& s, ip4_range& r) {
-    return read_ip4_range(s, r);
+    return read_stream(s, r);
+}
+
+parse_result
+parse(boost::string_ref text, ip4_range& r) {
+    return read_text(text, r);
 }
 
 
 std::ostream& operator << (std::ostream& s, const ip4_range& r) {
-    return s << r.min() << ip4_range::SEPARATOR << r.max();
+    return write_stream<ip4_range, 32>(s, r);
+}
+
+char* to_chars(char* first, char* last, ip4_range const& r) {
+    if (0 != (first = to_chars(first, last, r.min()))
+        && 0 != (first = write_char(first, last, ip4_range::SEPARATOR))
+    )
+        first = to_chars(first, last, r.max());
+    return first;
 }
 
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
 ip4_pepa::ip4_pepa(std::string const& s) {
-    *this = lexical_cast<self>(s);
+    convert(s, *this);
 }
 
 std::istream& operator >> (std::istream& s, ip4_pepa& pepa) {
-    ip4_addr addr;
-    ip4_mask mask;
+    return read_stream(s, pepa);
+}
 
-    if (s && s >> addr && skip_non_numeric_separator(s) && s >> mask) {
-        pepa.set(addr,mask);
-    }
-    return s;
+parse_result parse(boost::string_ref text, ip4_pepa& pepa) {
+    return read_text(text, pepa);
 }
 
 std::ostream& operator << (std::ostream& s, ip4_pepa const& pepa) {
-    return s << pepa.addr() << ip4_pepa::SEPARATOR << pepa.mask();
+    return write_stream<ip4_pepa, 20>(s, pepa);
+}
+
+char* to_chars(char* first, char* last, ip4_pepa const& pepa) {
+    if (0 != (first = to_chars(first, last, pepa.addr()))
+        && 0 != (first = write_char(first, last, ip4_pepa::SEPARATOR))
+    )
+        first = to_chars(first, last, pepa.mask());
+    return first;
 }
 /* ------------------------------------------------------------------------ */
 
 std::string icmp_type::get_name() const { return ICMP_LEXICON[_value]; }
+
+char* to_chars(char* first, char* last, icmp_type const& i) {
+    std::string name(i.get_name());
+    return detail::copy_chars(first, last, name.data(), name.size());
+}
 icmp_type::lexicon_type& icmp_type::get_lexicon() { return ICMP_LEXICON; }
 
+icmp_type::icmp_type(std::string const& str) : _value(INVALID._value) {
+    read_text(str, *this);
+}
+
 std::istream& operator >> (std::istream& s, icmp_type& i) {
-    /*  We assume that none of the names start with a digit. So check
-        the first character. If a digit, presume numeric input. Otherwise
-        if it's a letter presume a name (anything else is bogus).
-     */
-    icmp_type::host_type v(icmp_type::INVALID);
-    if (s >> std::ws) {
-        int c = s.peek();
-        if (isdigit(c)) {
-            s >> v >> std::ws;
-        } else if (isgraph(c)) {
-            std::string name;
-            if (s >> ip::stream::identifier(name) >> std::ws) {
-                std::transform(name.begin(), name.end(), name.begin(), toupper); // force upper case
-                v = ICMP_LEXICON[name];
-            }
-        }
-    }
-    // If =v= was set to a valid value, the input was good so store it.
-    // Otherwise mark the input failure.
-    if (s && icmp_type::is_valid(v))
-        i._value = v;
-    else
-        s.setstate(std::ios::failbit);
-    return s;
+    return read_stream(s, i);
+}
+
+parse_result parse(boost::string_ref text, icmp_type& i) {
+    return read_text(text, i);
 }
 /* ------------------------------------------------------------------------ */
 std::string ip4_protocol::get_name() const { return IP_PROTOCOL_LEXICON[*this]; }
 ip4_protocol::lexicon_type& ip4_protocol::get_lexicon() { return IP_PROTOCOL_LEXICON; }
 /* ------------------------------------------------------------------------ */
+char* to_chars(char* first, char* last, ip_protocol const& p) {
+    return to_chars(first, last, p.host_order());
+}
+
+ip_protocol::ip_protocol(std::string const& str) : _value(HOST_INVALID) {
+    read_text(str, *this);
+}
+
 std::istream& operator >> (std::istream& s, ip_protocol & p) {
-    if (s >> std::ws) {
-        int c = s.peek();
-        if (isdigit(c)) {
-            ip_protocol::host_type v;
-            if (s >> v >> std::ws)
-                p._value = ip_protocol::bound(v);
-        } else if (isgraph(c)) {
-            std::string name;
-            if (s >> ip::stream::identifier(name) >> std::ws) {
-                std::transform(name.begin(), name.end(), name.begin(), toupper); // force upper case
-                p._value = IP_PROTOCOL_LEXICON[name];
-            }
-        } else {
-            s.setstate(std::ios::failbit);
-        }
-    }
-    return s;
+    return read_stream(s, p);
+}
+
+parse_result parse(boost::string_ref text, ip_protocol& p) {
+    return read_text(text, p);
 }
 /* ------------------------------------------------------------------------ */
 # if defined(_DEBUG)
@@ -19,6 +19,9 @@ ip_port const ip_port::MAX(std::numeric_limits<ip_port::host_type>::max());
 ip4_addr const ip4_addr::MIN(std::numeric_limits<host_type>::min());
 ip4_addr const ip4_addr::MAX(std::numeric_limits<host_type>::max());
 /* ------------------------------------------------------------------------ */
+ip6_addr const ip6_addr::MIN(0, 0);
+ip6_addr const ip6_addr::MAX(~ip6_addr::half_type(0), ~ip6_addr::half_type(0));
+/* ------------------------------------------------------------------------ */
 icmp_type const icmp_type::INVALID(-1);
 icmp_type const icmp_type::ECHO_REPLY(0);
 icmp_type const icmp_type::UNREACHABLE(3);
@@ -88,6 +91,8 @@ ip4_protocol const ip4_protocol::INVALID(ip4_protocol::HOST_INVALID);
 // Neither of these has ancillary data
 ip4_service const ip4_service::MIN(ip_protocol::MIN);
 ip4_service const ip4_service::MAX(ip_protocol::MAX);
+packed_service const packed_service::MIN(ip4_service::MIN);
+packed_service const packed_service::MAX(ip4_service::MAX);
 
 std::string ip_protocol_default_name(ip_protocol const& p)
 {
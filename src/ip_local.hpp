@@ -12,7 +12,7 @@
 # include <boost/lexical_cast.hpp>
 # include <boost/foreach.hpp>
 
-# include <ngeo/lexicon.hpp>
+# include <ngeo/concurrent_lexicon.hpp>
 
 /* ------------------------------------------------------------------------ */
 namespace ip { namespace stream {
@@ -0,0 +1,552 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+# pragma once
+
+# include <stdio.h>
+# include <istream>
+# include <typeinfo>
+# include <boost/lexical_cast.hpp>
+# include <ngeo/ip_base.hpp>
+# include <ngeo/ip6_base.hpp>
+
+/* ------------------------------------------------------------------------ */
+/** @file
+    Parsers for the IP types.
+
+    Each parser is a state machine over a character source, which must provide
+    - @c peek to get the next character, or @c EOF if there is none.
+    - @c get to consume the next character.
+    - @c unget to put back the character just consumed, if it was followed
+      by another character.
+    - @c position for the number of characters consumed.
+
+    The same parser is instantiated for text (@c ngeo::parse) and for streams
+    (@c operator>>) so the two always accept the same grammar. Parsers do not
+    allocate except for name lookups, which are done in a lexicon keyed by
+    @c std::string.
+ */
+/* ------------------------------------------------------------------------ */
+namespace ngeo { namespace ip_parser {
+/* ------------------------------------------------------------------------ */
+/// Characters from a block of text.
+class text_source
+{
+public:
+    text_source(boost::string_ref text) : _begin(text.data()), _ptr(text.data()), _end(text.data() + text.size()) { }
+    int peek() const { return _ptr < _end ? static_cast<unsigned char>(*_ptr) : EOF; }
+    void get() { ++_ptr; }
+    void unget() { --_ptr; }
+    std::size_t position() const { return _ptr - _begin; }
+private:
+    char const* _begin;
+    char const* _ptr;
+    char const* _end;
+};
+
+/// Characters from an input stream.
+class stream_source
+{
+public:
+    stream_source(std::istream& s) : _s(s), _n(0) { }
+    int peek() { return _s.good() ? _s.peek() : EOF; }
+    void get() { _s.get(); ++_n; }
+    void unget() { _s.unget(); --_n; }
+    std::size_t position() const { return _n; }
+    /** Update the stream state for @a r.
+        Running out of input is not a failure if the value was complete.
+     */
+    void finish(parse_result const& r) {
+        if (r.is_ok()) _s.clear(_s.rdstate() & ~std::ios::failbit);
+        else _s.setstate(std::ios::failbit);
+    }
+private:
+    std::istream& _s;
+    std::size_t _n;
+};
+/* ------------------------------------------------------------------------ */
+// Character classes. These are ASCII only, independent of locale.
+inline bool is_digit(int c) { return '0' <= c && c <= '9'; }
+inline bool is_space(int c) { return ' ' == c || ('\t' <= c && c <= '\r'); }
+inline bool is_graph(int c) { return '!' <= c && c <= '~'; }
+inline bool is_hex(int c) { return is_digit(c) || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F'); }
+inline bool is_ident(int c) { return is_digit(c) || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || '_' == c; }
+
+template < typename S > void
+skip_space(S& src) {
+    while (is_space(src.peek())) src.get();
+}
+
+template < typename S > parse_result
+fail(S& src, parse_result::code_type code) {
+    return parse_result(code, src.position());
+}
+
+template < typename S > parse_result
+succeed(S& src) {
+    return parse_result(parse_result::OK, src.position());
+}
+
+/** Read an unsigned decimal number no larger than @a limit.
+    @a value is unchanged on failure.
+ */
+template < typename S, typename U > parse_result
+read_decimal(S& src, U limit, U& value) {
+    std::size_t start = src.position();
+    U v = 0;
+    bool over = false;
+    int c;
+
+    if (!is_digit(src.peek())) return fail(src, parse_result::INVALID);
+    while (is_digit(c = src.peek())) {
+        U d = static_cast<U>(c - '0');
+        if (over || v > (limit - d) / 10) over = true;
+        else v = v * 10 + d;
+        src.get();
+    }
+    if (over) return parse_result(parse_result::OUT_OF_RANGE, start);
+    value = v;
+    return succeed(src);
+}
+
+/** Read an identifier in to @a name.
+    Identifiers longer than @a n are truncated, which keeps them from
+    matching any name.
+ */
+template < typename S > std::size_t
+read_identifier(S& src, char* name, std::size_t n) {
+    std::size_t zret = 0;
+    int c;
+    while (is_ident(c = src.peek())) {
+        if (zret < n) name[zret] = static_cast<char>(c);
+        ++zret;
+        src.get();
+    }
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+enum octet_style_t { OCTETS_MASK, OCTETS_CIDR };
+
+/** Read an address in octet form, or as a single number.
+    A dot after the fourth octet is not consumed, as it can start an interval
+    separator "..". If it is followed by a digit or is the end of the input
+    the address is invalid, so that a fifth octet is not read as the start of
+    a mask or range.
+ */
+template < typename S > parse_result
+read_octets(S& src, ip4_addr::host_type& a, octet_style_t& style) {
+    ip4_addr::host_type zret = 0; // octets completed so far.
+    ip4_addr::host_type v = 0; // current octet value
+    std::size_t start = src.position(); // start of current octet
+    int count = 0; // # of dots found.
+    int digits = 0; // # of digits in this octet.
+    int c;
+
+    while (true) {
+        c = src.peek();
+        if (is_digit(c)) {
+            ip4_addr::host_type d = c - '0';
+            // A single number can be the entire address.
+            ip4_addr::host_type limit = count ? 255 : std::numeric_limits<ip4_addr::host_type>::max();
+            if (v > (limit - d) / 10) return parse_result(parse_result::OUT_OF_RANGE, start);
+            v = v * 10 + d;
+            ++digits;
+            src.get();
+        } else if ('.' == c && 3 == count) {
+            src.get();
+            c = src.peek();
+            if (EOF == c || is_digit(c)) return fail(src, parse_result::INVALID);
+            src.unget();
+            break;
+        } else if ('.' == c) {
+            if (!digits) return fail(src, parse_result::INVALID);
+            if (v > 255) return parse_result(parse_result::OUT_OF_RANGE, start);
+            zret = (zret << 8) + v;
+            v = 0;
+            digits = 0;
+            ++count;
+            src.get();
+            start = src.position();
+        } else {
+            break;
+        }
+    }
+
+    if (!digits || (count && count < 3)) return fail(src, parse_result::INVALID);
+    a = (zret << 8) + v;
+    style = count ? OCTETS_MASK : OCTETS_CIDR;
+    return succeed(src);
+}
+
+/// Read a separator, which is not a digit or a dot, with surrounding white space.
+/// @return The separator, or @c EOF if there is none.
+template < typename S > int
+read_separator(S& src) {
+    int c;
+    skip_space(src);
+    c = src.peek();
+    if (EOF == c || is_digit(c) || '.' == c) return EOF;
+    src.get();
+    skip_space(src);
+    return c;
+}
+/* ------------------------------------------------------------------------ */
+template < typename S > parse_result
+parse(S& src, ip_port& p) {
+    ip_port::host_type v;
+    parse_result zret;
+    skip_space(src);
+    zret = read_decimal(src, std::numeric_limits<ip_port::host_type>::max(), v);
+    if (zret.is_ok()) p.set(v);
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip_port_range& r) {
+    ip_port l, h;
+    parse_result zret;
+    int c;
+
+    skip_space(src);
+    c = src.peek();
+    if (EOF == c) return fail(src, parse_result::INVALID);
+    if (!is_digit(c)) { // of the form "-###"
+        l = ip_port::MIN;
+        src.get();
+        zret = parse(src, h);
+    } else if ((zret = parse(src, l)).is_ok()) {
+        if (EOF == read_separator(src)) h = l; // singleton
+        else if (is_digit(src.peek())) zret = parse(src, h);
+        else h = ip_port::MAX; // of the form "###-"
+    }
+    if (zret.is_ok()) {
+        r.set(l, h);
+        zret = succeed(src);
+    }
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip4_addr& addr) {
+    ip4_addr::host_type a;
+    octet_style_t style;
+    parse_result zret = read_octets(src, a, style);
+    if (zret.is_ok()) addr.set(a);
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip4_mask& m) {
+    ip4_addr::host_type u;
+    octet_style_t style;
+    parse_result zret = read_octets(src, u, style);
+    if (zret.is_ok()) {
+        if (OCTETS_CIDR == style && u <= ip4_mask::WIDTH) m.set(u);
+        // Either it's octet form, or it's a raw number that's more than 32.
+        else m = ip4_mask(ip4_addr(u));
+    }
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip4_net& net) {
+    ip4_addr a;
+    ip4_mask m = ip4_mask::WIDTH;
+    parse_result zret;
+
+    skip_space(src);
+    if (ip4_net::EMPTY_CHAR == src.peek()) {
+        src.get();
+        skip_space(src);
+        if (ip4_net::SEPARATOR != src.peek()) return fail(src, parse_result::INVALID);
+        src.get();
+        skip_space(src);
+        if (ip4_net::EMPTY_CHAR != src.peek()) return fail(src, parse_result::INVALID);
+        src.get();
+        net = ip4_net(); // empty network
+        return succeed(src);
+    }
+
+    if ((zret = parse(src, a)).is_ok()) {
+        if (EOF != read_separator(src)) zret = parse(src, m);
+        if (zret.is_ok()) net.set(a, m);
+    }
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip4_range& r) {
+    ip4_addr l, h;
+    parse_result zret;
+    int c;
+
+    skip_space(src);
+    c = src.peek();
+    if (EOF == c) return fail(src, parse_result::INVALID);
+    if (!is_digit(c)) { // of the form "-###"
+        l = ip4_addr::MIN;
+        src.get();
+        zret = parse(src, h);
+    } else if ((zret = parse(src, l)).is_ok()) {
+        c = read_separator(src);
+        if (EOF == c) {
+            h = l; // singleton
+        } else if ('/' == c) { // network
+            ip4_mask mask;
+            if ((zret = parse(src, mask)).is_ok()) {
+                ip4_net net(l, mask);
+                l = net.addr();
+                h = net.max_addr();
+            }
+        } else if (is_digit(src.peek())) {
+            zret = parse(src, h);
+        } else {
+            h = ip4_addr::MAX; // of the form "###-"
+        }
+    }
+    if (zret.is_ok()) {
+        r.set(l, h);
+        zret = succeed(src);
+    }
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip4_pepa& pepa) {
+    ip4_addr addr;
+    ip4_mask mask;
+    parse_result zret = parse(src, addr);
+    if (zret.is_ok()) {
+        if (EOF == read_separator(src)) return fail(src, parse_result::INVALID);
+        if ((zret = parse(src, mask)).is_ok()) pepa.set(addr, mask);
+    }
+    return zret;
+}
+
+/** Read an ICMP type.
+    We assume that none of the names start with a digit. So check the first
+    character. If a digit, presume numeric input, otherwise a name.
+ */
+template < typename S > parse_result
+parse(S& src, icmp_type& i) {
+    icmp_type::host_type v(icmp_type::INVALID);
+    parse_result zret;
+    std::size_t start;
+    int c;
+
+    skip_space(src);
+    start = src.position();
+    c = src.peek();
+    if (is_digit(c)) {
+        if (!(zret = read_decimal(src, std::numeric_limits<icmp_type::host_type>::max(), v)).is_ok()) return zret;
+        if (!icmp_type::is_valid(v)) return parse_result(parse_result::OUT_OF_RANGE, start);
+    } else if (is_graph(c)) {
+        char name[64];
+        std::size_t n = read_identifier(src, name, sizeof(name));
+        if (0 == n) return fail(src, parse_result::INVALID);
+        if (n <= sizeof(name)) v = icmp_type::get_lexicon()[std::string(name, n)];
+        if (!icmp_type::is_valid(v)) return parse_result(parse_result::UNKNOWN_NAME, start);
+    } else {
+        return fail(src, parse_result::INVALID);
+    }
+    skip_space(src);
+    i = icmp_type(v);
+    return succeed(src);
+}
+
+template < typename S > parse_result
+parse(S& src, ip_protocol& p) {
+    ip_protocol::host_type v(ip_protocol::HOST_INVALID);
+    parse_result zret;
+    std::size_t start;
+    int c;
+
+    skip_space(src);
+    start = src.position();
+    c = src.peek();
+    if (is_digit(c)) {
+        if (!(zret = read_decimal(src, std::numeric_limits<ip_protocol::host_type>::max(), v)).is_ok()) return zret;
+        v = ip_protocol(v).host_order(); // bound the value
+        if (ip_protocol::HOST_INVALID == v) return parse_result(parse_result::OUT_OF_RANGE, start);
+    } else if (is_graph(c)) {
+        char name[64];
+        std::size_t n = read_identifier(src, name, sizeof(name));
+        if (0 == n) return fail(src, parse_result::INVALID);
+        if (n <= sizeof(name)) v = ip_protocol::get_lexicon()[std::string(name, n)].host_order();
+        if (ip_protocol::HOST_INVALID == v) return parse_result(parse_result::UNKNOWN_NAME, start);
+    } else {
+        return fail(src, parse_result::INVALID);
+    }
+    skip_space(src);
+    p = v;
+    return succeed(src);
+}
+/* ------------------------------------------------------------------------ */
+inline unsigned int hex_value(int c) { return is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10; }
+
+/** Read an IPv6 address.
+    Groups are read in to a local array and the "::" gap is filled in at the end.
+ */
+template < typename S > parse_result
+parse(S& src, ip6_addr& addr) {
+    unsigned int groups[8];
+    int n = 0; // # of groups read.
+    int gap = -1; // group index of "::", if any.
+    int c;
+
+    if (':' == src.peek()) { // must be a leading "::"
+        src.get();
+        if (':' != src.peek()) return fail(src, parse_result::INVALID);
+        src.get();
+        gap = 0;
+    }
+
+    while (is_hex(src.peek())) {
+        std::size_t start = src.position();
+        unsigned int v = 0;
+        int digits = 0;
+        if (n >= 8 || (gap >= 0 && n >= 7)) return fail(src, parse_result::INVALID);
+        while (is_hex(c = src.peek())) {
+            if (++digits > 4) return parse_result(parse_result::OUT_OF_RANGE, start);
+            v = (v << 4) | hex_value(c);
+            src.get();
+        }
+        groups[n++] = v;
+        if (':' != src.peek()) break;
+        src.get();
+        if (':' == src.peek()) {
+            if (gap >= 0) return fail(src, parse_result::INVALID);
+            src.get();
+            gap = n;
+        } else if (!is_hex(src.peek())) {
+            return fail(src, parse_result::INVALID);
+        }
+    }
+
+    if (gap < 0 ? n != 8 : n > 7) return fail(src, parse_result::INVALID);
+
+    ip6_addr::half_type half[2] = { 0, 0 };
+    int tail = gap < 0 ? 0 : n - gap; // groups after the gap.
+    for ( int i = 0 ; i < n ; ++i ) {
+        int idx = (gap < 0 || i < gap) ? i : 8 - tail + (i - gap); // position in the full address.
+        half[idx / 4] |= static_cast<ip6_addr::half_type>(groups[i]) << (16 * (3 - idx % 4));
+    }
+    addr.set(half[0], half[1]);
+    return succeed(src);
+}
+
+template < typename S > parse_result
+parse(S& src, ip6_mask& m) {
+    unsigned int v;
+    parse_result zret = read_decimal(src, ip6_mask::WIDTH, v);
+    if (zret.is_ok()) m.set(v);
+    return zret;
+}
+
+/// An IPv6 address starts with a hex digit or a colon.
+inline bool is_ip6_start(int c) { return is_hex(c) || ':' == c; }
+
+/// Read a separator that can't be part of an IPv6 address, with surrounding white space.
+/// @return The separator, or @c EOF if there is none.
+template < typename S > int
+read_ip6_separator(S& src) {
+    int c;
+    skip_space(src);
+    c = src.peek();
+    if (EOF == c || is_ip6_start(c)) return EOF;
+    src.get();
+    skip_space(src);
+    return c;
+}
+
+template < typename S > parse_result
+parse(S& src, ip6_net& net) {
+    ip6_addr a;
+    ip6_mask m = ip6_mask::WIDTH;
+    parse_result zret;
+
+    skip_space(src);
+    if (ip6_net::EMPTY_CHAR == src.peek()) {
+        src.get();
+        skip_space(src);
+        if (ip6_net::SEPARATOR != src.peek()) return fail(src, parse_result::INVALID);
+        src.get();
+        skip_space(src);
+        if (ip6_net::EMPTY_CHAR != src.peek()) return fail(src, parse_result::INVALID);
+        src.get();
+        net = ip6_net(); // empty network
+        return succeed(src);
+    }
+
+    if ((zret = parse(src, a)).is_ok()) {
+        if (EOF != read_ip6_separator(src)) zret = parse(src, m);
+        if (zret.is_ok()) net.set(a, m);
+    }
+    return zret;
+}
+
+template < typename S > parse_result
+parse(S& src, ip6_range& r) {
+    ip6_addr l, h;
+    parse_result zret;
+    int c;
+
+    skip_space(src);
+    c = src.peek();
+    if (EOF == c) return fail(src, parse_result::INVALID);
+    if (!is_ip6_start(c)) { // of the form "-###"
+        l = ip6_addr::MIN;
+        src.get();
+        skip_space(src);
+        zret = parse(src, h);
+    } else if ((zret = parse(src, l)).is_ok()) {
+        c = read_ip6_separator(src);
+        if (EOF == c) {
+            h = l; // singleton
+        } else if ('/' == c) { // network
+            ip6_mask mask;
+            if ((zret = parse(src, mask)).is_ok()) {
+                ip6_net net(l, mask);
+                l = net.addr();
+                h = net.max_addr();
+            }
+        } else if (is_ip6_start(src.peek())) {
+            zret = parse(src, h);
+        } else {
+            h = ip6_addr::MAX; // of the form "###-"
+        }
+    }
+    if (zret.is_ok()) {
+        r.set(l, h);
+        zret = succeed(src);
+    }
+    return zret;
+}
+/* ------------------------------------------------------------------------ */
+/// Read @a t from stream @a s.
+template < typename T > std::istream&
+read_stream(std::istream& s, T& t) {
+    stream_source src(s);
+    src.finish(parse(src, t));
+    return s;
+}
+
+/// Read @a t from @a text.
+template < typename T > parse_result
+read_text(boost::string_ref text, T& t) {
+    text_source src(text);
+    return parse(src, t);
+}
+
+/** Convert all of @a text to @a t.
+    @throw boost::bad_lexical_cast If @a text is not exactly a value, as for @c lexical_cast.
+ */
+template < typename T > void
+convert(std::string const& text, T& t) {
+    if (!read_text(text, t).is_complete(text))
+        throw boost::bad_lexical_cast(typeid(std::string), typeid(T));
+}
+/* ------------------------------------------------------------------------ */
+}} // namespace ngeo::ip_parser
+/* ------------------------------------------------------------------------ */
@@ -4,9 +4,43 @@
 /* ------------------------------------------------------------------------ */
 # include "ip_local.hpp"
 # include "ip_static.hpp"
+# include "ip_parse.hpp"
+# include <boost/static_assert.hpp>
 /* ------------------------------------------------------------------------ */
 namespace ngeo { 
+namespace ip_parser {
+    template < typename S > parse_result
+    parse(S& src, ip4_service& svc) {
+        ip4_protocol p;
+        parse_result zret = parse(src, p);
+        if (zret.is_ok()) {
+            switch (p.get_data_type()) {
+                case ip_protocol::DATA_ICMP: {
+                    icmp_type it;
+                    if (EOF == read_separator(src)) return fail(src, parse_result::INVALID);
+                    if ((zret = parse(src, it)).is_ok()) svc = ip4_service(icmp(it));
+                    break;
+                }
+                case ip_protocol::DATA_PORT: {
+                    ip_port port;
+                    if (EOF == read_separator(src)) return fail(src, parse_result::INVALID);
+                    if ((zret = parse(src, port)).is_ok()) svc = ip4_service(p, port);
+                    break;
+                }
+                default: // no ancillary data
+                    if (':' == src.peek()) src.get(); // drop trailing colon if present
+                    svc = ip4_service(p);
+                    zret = succeed(src);
+                    break;
+            }
+        }
+        return zret;
+    }
+}
+
 using boost::lexical_cast;
+using ip_parser::read_stream;
+using ip_parser::read_text;
 /* ------------------------------------------------------------------------ */
 ip4_service::nil_type ip4_service::NIL;
 
@@ -61,8 +95,7 @@ ip4_service::~ip4_service() {
 }
 /* ------------------------------------------------------------------------ */
 ip4_service::ip4_service(std::string const &str) {
-    std::istringstream istr(str);
-    istr >> *this;
+    read_text(str, *this);
 }
 /* ------------------------------------------------------------------------ */
 bool
@@ -212,35 +245,108 @@ std::ostream& operator << (
     return s;
 }
 
+char* to_chars(char* first, char* last, ip4_service const& svc) {
+    ip_protocol::data_type type = svc.get_data_type();
+    first = to_chars(first, last, svc.get_protocol());
+    if (first && ip_protocol::DATA_NONE != type) {
+        if (first >= last) return 0;
+        *first++ = ':';
+        if (ip_protocol::DATA_ICMP == type) first = to_chars(first, last, svc.get_icmp().type());
+        else first = to_chars(first, last, svc.get_port());
+    }
+    return first;
+}
+
 std::istream& operator >> (
     std::istream& s,
     ip4_service& svc
 ) {
-    ip4_protocol p;
-    if (s >> p) {
-        if (p.get_data_type() != ip_protocol::DATA_NONE) {
-            char c;
-            s >> std::ws >> c >> std::ws; // skip trailing colon
-            switch (p.get_data_type()) {
-                case ip_protocol::DATA_ICMP: {
-                    icmp_type it;
-                    if (s >> it) svc = ip4_service(icmp(it));
-                    break;
-                }
-                case ip_protocol::DATA_PORT: {
-                    ip_port port;
-                    if (s >> port) svc = ip4_service(p, port);
-                    break;
-                }
-                default: // Should not get here.
-                    assert(false);
-                    break;
-            }
-        } else { // no ancillary data
-            if (s && !s.eof() && (':' == s.peek())) s.get(); // drop trailing colon if present
-            svc = ip4_service(p);
-        }
+    return read_stream(s, svc);
+}
+
+parse_result parse(boost::string_ref text, ip4_service& svc) {
+    return read_text(text, svc);
+}
+
+/* ------------------------------------------------------------------------ */
+packed_service::packed_service(ip4_service const& svc) {
+    raw_type data = 0;
+    switch (svc.get_data_type()) {
+        case ip_protocol::DATA_PORT:
+            data = svc.get_port().host_order();
+            break;
+        case ip_protocol::DATA_ICMP:
+            // An ICMP service built from just the protocol has no valid type, treat it as the minimum.
+            if (svc.get_icmp().type().is_valid()) data = svc.get_icmp().type().host_order();
+            break;
+        case ip_protocol::DATA_NONE:
+            break;
+    }
+    _value = encode(svc.get_protocol().host_order(), data);
+}
+
+ip4_service
+packed_service::service() const {
+    switch (this->get_data_type()) {
+        case ip_protocol::DATA_PORT: return ip4_service(this->get_protocol(), this->get_port());
+        case ip_protocol::DATA_ICMP: return ip4_service(this->get_icmp_type());
+        default: break;
+    }
+    return ip4_service(this->get_protocol());
+}
+
+std::ostream& operator << (std::ostream& s, packed_service const& svc) {
+    return s << svc.service();
+}
+
+char* to_chars(char* first, char* last, packed_service const& svc) {
+    return to_chars(first, last, svc.service());
+}
+
+std::istream& operator >> (std::istream& s, packed_service& svc) {
+    ip4_service tmp;
+    if (read_stream(s, tmp)) svc = packed_service(tmp);
+    return s;
+}
+
+parse_result parse(boost::string_ref text, packed_service& svc) {
+    ip4_service tmp;
+    parse_result zret = read_text(text, tmp);
+    if (zret.is_ok()) svc = packed_service(tmp);
+    return zret;
+}
+
+/* ------------------------------------------------------------------------ */
+BOOST_STATIC_ASSERT(sizeof(ip4_flow) == 16);
+
+ip4_service
+ip4_flow::get_src() const {
+    switch (this->protocol().get_data_type()) {
+        case ip_protocol::DATA_PORT: return ip4_service(this->protocol(), this->src_port());
+        case ip_protocol::DATA_ICMP: return ip4_service(icmp(icmp_type(m_src_port), icmp_code(static_cast<icmp_code::host_type>(m_dst_port))));
+        default: break;
+    }
+    return ip4_service(this->protocol());
+}
+
+ip4_service
+ip4_flow::get_dst() const {
+    switch (this->protocol().get_data_type()) {
+        case ip_protocol::DATA_PORT: return ip4_service(this->protocol(), this->dst_port());
+        case ip_protocol::DATA_ICMP: return this->get_src();
+        default: break;
     }
+    return ip4_service(this->protocol());
+}
+
+std::ostream& operator << (std::ostream& s, ip4_flow const& flow) {
+    bool port_p = flow.protocol().get_data_type() == ip_protocol::DATA_PORT;
+    s << flow.src_addr();
+    if (port_p) s << ':' << flow.src_port();
+    s << " -> " << flow.dst_addr();
+    if (port_p) s << ':' << flow.dst_port();
+    s << ' ' << flow.protocol();
+    if (flow.protocol().get_data_type() == ip_protocol::DATA_ICMP) s << ':' << flow.get_src().get_icmp().type();
     return s;
 }
 
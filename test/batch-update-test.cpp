@@ -0,0 +1,82 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*  Regression test for deferred fixups in a batch_update scope.
+
+    An insert in a scope can add an outer tree node and rebalance the tree
+    with a double rotation, making the new node the parent of a node that is
+    already dirty. If the new node is not marked, flush() does not reach the
+    dirty node and it stays marked after the scope. A later scope that widens
+    that node then stops marking at it, so the root is never flushed and
+    region queries miss the widened value.
+
+    Build with the library, e.g.
+        g++ -I include test/batch-update-test.cpp <library> -o batch-update-test
+ */
+
+# include <iostream>
+# include <flowspace.h>
+# include <ngeo/ip.hpp>
+
+using namespace ngeo;
+
+typedef flowspace::layer<ip4_addr, flowspace::layer<ip_port, int> > L;
+
+static L::value_type make(unsigned min, unsigned max, unsigned port) {
+    return L::value_type(L::key_type(ip4_range(ip4_addr(min), ip4_addr(max)), ip_port_range(port, port)), 0);
+}
+
+static std::size_t count(L& l, unsigned min, unsigned max) {
+    std::size_t zret = 0;
+    L::region r(ip4_range(ip4_addr(min), ip4_addr(max)), ip_port_range(0, 1000));
+    for ( L::iterator spot = l.begin(r) ; spot != l.end() ; ++spot ) ++zret;
+    return zret;
+}
+
+static int check(L& l, unsigned min, unsigned max, std::size_t expected) {
+    std::size_t n = count(l, min, max);
+    if (n == expected) return 0;
+    std::cerr << "query [" << min << "," << max << "] got " << n << " expected " << expected << std::endl;
+    return 1;
+}
+
+int main() {
+    int errors = 0;
+    L l;
+
+    // The outer tree is a node for 10 with a right child for 30. There are
+    // enough distinct intervals that the layer is not in the small form, see
+    // NG_FLOWSPACE_SMALL_LAYER.
+    unsigned const N = NG_FLOWSPACE_SMALL_LAYER + 1;
+    for ( unsigned i = 0 ; i < N ; ++i ) l.insert(make(10, 10 + i, 1));
+    l.insert(make(30, 30, 1));
+
+    {
+        L::batch_update scope(l);
+        // Marks the node for 10 dirty.
+        l.insert(make(10, 10, 2));
+        // Right then left of the nodes above, so the new node for 20 is
+        // rotated twice in to the root above the dirty node.
+        l.insert(make(20, 20, 1));
+    }
+    if (!l.validate()) {
+        std::cerr << "validate failed after the first scope" << std::endl;
+        ++errors;
+    }
+    errors += check(l, 0, 100, N + 3);
+
+    {
+        L::batch_update scope(l);
+        // Widens the node for 10 past every other node.
+        l.insert(make(10, 100, 2));
+    }
+    if (!l.validate()) {
+        std::cerr << "validate failed after the second scope" << std::endl;
+        ++errors;
+    }
+    errors += check(l, 50, 60, 1);
+    errors += check(l, 0, 100, N + 4);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*  Regression test for entry handles whose stored location is stale.
+
+    Erasing an element, or shifting elements in a small layer, can move
+    another element in to the location kept by an older handle. Finding that
+    handle must then fall back to comparing payloads from the start of the
+    elements with the same region, so that it still finds its element.
+
+    Build with the library, e.g.
+        g++ -I include test/entry-handle-test.cpp <library> -o entry-handle-test
+ */
+
+# include <iostream>
+# include <flowspace.h>
+# include <ngeo/ip.hpp>
+
+using namespace ngeo;
+
+typedef flowspace::layer<ip4_addr, flowspace::layer<ip_port, int> > L;
+
+static L::value_type make(unsigned port, int payload) {
+    return L::value_type(L::key_type(ip4_range(ip4_addr(10), ip4_addr(10)), ip_port_range(port, port)), payload);
+}
+
+/*  Run the checks with @a extra other elements in the bottom layer, so that
+    it is either in the small form or a tree.
+ */
+static int run(char const* name, unsigned extra) {
+    int errors = 0;
+    L l;
+    for ( unsigned i = 0 ; i < extra ; ++i ) l.insert(make(100 + i, 0));
+
+    // Three identical elements, then a change to the second.
+    L::entry_handle h1 = l.insert(make(10, 1));
+    L::entry_handle h2 = l.insert(make(10, 1));
+    L::entry_handle h3 = l.insert(make(10, 1));
+    if (!l.update(h2, 2)) {
+        std::cerr << name << ": update of h2 failed" << std::endl;
+        ++errors;
+    }
+    // Removing the first moves the others in a small layer.
+    l.erase(h1);
+    if (l.find(h2) == l.end()) {
+        std::cerr << name << ": find of h2 failed after erasing h1" << std::endl;
+        ++errors;
+    }
+    if (!l.update(h2, 3)) {
+        std::cerr << name << ": update of h2 failed after erasing h1" << std::endl;
+        ++errors;
+    }
+    if (l.find(h3) == l.end()) {
+        std::cerr << name << ": find of h3 failed after erasing h1" << std::endl;
+        ++errors;
+    }
+    // Adding an element in front shifts the others again.
+    l.insert(make(10, 0));
+    l.erase(h3);
+    l.erase(h2);
+    L::iterator spot = l.begin();
+    std::size_t n = 0;
+    for ( ; spot != l.end() ; ++spot ) {
+        if (spot->second != 0) {
+            std::cerr << name << ": element with payload " << spot->second << " was not erased" << std::endl;
+            ++errors;
+        }
+        ++n;
+    }
+    if (n != extra + 1) {
+        std::cerr << name << ": " << n << " elements, expected " << extra + 1 << std::endl;
+        ++errors;
+    }
+    if (!l.validate()) {
+        std::cerr << name << ": validate failed" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main() {
+    int errors = 0;
+    errors += run("small", 0);
+    errors += run("tree", NG_FLOWSPACE_SMALL_LAYER + 1);
+    return errors ? 1 : 0;
+}
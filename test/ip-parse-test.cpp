@@ -0,0 +1,70 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*  Regression tests for parsing IPv4 networks, ranges and pepas.
+
+    An address with a fifth octet, such as "1.2.3.4.5", must be rejected.
+    It must not be read as an address followed by a mask or range that
+    starts at the fifth octet, which turns a typo in a rule file in to a
+    different rule. Valid forms are checked to still parse, including an
+    interval written with the ".." separator.
+
+    Build with the library, e.g.
+        g++ -I include test/ip-parse-test.cpp <library> -o ip-parse-test
+ */
+
+# include <sstream>
+# include <typeinfo>
+# include <iostream>
+# include <ngeo/ip.hpp>
+
+using namespace ngeo;
+
+// Check that @a text is all of a @a T if @a valid, and is rejected if not.
+template < typename T > static int
+check(char const* text, bool valid) {
+    T value;
+    parse_result r = parse(boost::string_ref(text), value);
+    bool text_ok = r.is_complete(text);
+    std::istringstream s(text);
+    bool stream_ok = (s >> value) && s.peek() == std::char_traits<char>::eof();
+    if (text_ok == valid && stream_ok == valid) return 0;
+    std::cerr << '"' << text << "\" as " << typeid(T).name() << ": text " << text_ok << " stream " << stream_ok
+              << ", expected " << valid << std::endl;
+    return 1;
+}
+
+int main() {
+    int errors = 0;
+
+    errors += check<ip4_net>("1.2.3.4.5", false);
+    errors += check<ip4_net>("1.2.3.4./24", false);
+    errors += check<ip4_net>("1.2.3.4.5/24", false);
+    errors += check<ip4_net>("1.2.3.0/24", true);
+    errors += check<ip4_net>("1.2.3.0/255.255.255.0", true);
+
+    errors += check<ip4_range>("1.2.3.4.5", false);
+    errors += check<ip4_range>("1.2.3.4.5-1.2.3.9", false);
+    errors += check<ip4_range>("1.2.3.4-1.2.3.9.1", false);
+    errors += check<ip4_range>("1.2.3.4-1.2.3.9", true);
+    errors += check<ip4_range>("1.2.3.4/30", true);
+    errors += check<ip4_range>("1.2.3.4-", true);
+
+    errors += check<ip4_pepa>("1.2.3.4.5", false);
+    errors += check<ip4_pepa>("1.2.3.4.5/24", false);
+    errors += check<ip4_pepa>("1.2.3.4/5", true);
+    errors += check<ip4_pepa>("1.2.3.4/255.255.0.0", true);
+
+    errors += check<ip4_addr>("1.2.3.4.", false);
+    errors += check<ip4_addr>("1.2.3.4", true);
+
+    interval<ip4_addr> intv;
+    std::istringstream s("1.2.3.4..1.2.3.9");
+    if (!(s >> intv) || intv != interval<ip4_addr>(ip4_addr(0x01020304), ip4_addr(0x01020309))) {
+        std::cerr << "\"1.2.3.4..1.2.3.9\" as an address interval: got " << intv << std::endl;
+        ++errors;
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*  Regression tests for the flowspace journal.
+
+    A commit that fails part way must not leave a torn record in the file
+    that later commits follow, or lose the records that it was writing. The
+    failure is injected by lowering the file size limit.
+
+    A record too large to replay must be refused when it is appended.
+
+    Replay must leave identical elements in the same order as applying the
+    records to a live layer, where an erase removes the first match.
+
+    Clearing the journal while other threads append and commit must discard
+    only the records before the checkpoint it takes.
+
+    Build with the library, e.g.
+        g++ -I include test/journal-test.cpp <library> -lboost_thread -lboost_system -o journal-test
+ */
+
+# include <cstdio>
+# include <csignal>
+# include <vector>
+# include <iostream>
+# include <boost/bind.hpp>
+# include <boost/thread/thread.hpp>
+# include <sys/resource.h>
+# include <flowspace.h>
+# include <flowspace/flowspace-journal.h>
+# include <ngeo/ip.hpp>
+
+using namespace ngeo;
+
+typedef flowspace::layer<ip4_addr, flowspace::layer<ip_port, std::string> > L;
+typedef flowspace::journal<L> J;
+
+static char const* const PATH = "journal-test.jnl";
+
+static L::value_type make(unsigned addr, std::string const& payload) {
+    return L::value_type(L::key_type(ip4_range(ip4_addr(addr), ip4_addr(addr)), ip_port_range(80, 80)), payload);
+}
+
+static std::size_t count(L& l) {
+    std::size_t zret = 0;
+    for ( L::iterator spot = l.begin() ; spot != l.end() ; ++spot ) ++zret;
+    return zret;
+}
+
+static int fail(char const* what) {
+    std::cerr << what << std::endl;
+    return 1;
+}
+
+// Set the file size limit, an infinite limit if @a n is 0.
+static void limit_file_size(rlim_t n) {
+    rlimit r;
+    getrlimit(RLIMIT_FSIZE, &r);
+    r.rlim_cur = n ? n : r.rlim_max;
+    setrlimit(RLIMIT_FSIZE, &r);
+}
+
+/*  Fail a commit part way through the writes, then check that a later
+    commit makes every record durable and that they all replay.
+ */
+static int test_failed_sync() {
+    int errors = 0;
+    std::string const big(1000, 'x');
+    std::remove(PATH);
+    {
+        J j(PATH);
+        for ( unsigned i = 0 ; i < 5 ; ++i ) j.insert(make(i, "a"));
+        j.commit();
+        // Room for about one more record of this size.
+        std::FILE* f = std::fopen(PATH, "rb");
+        std::fseek(f, 0, SEEK_END);
+        long length = std::ftell(f);
+        std::fclose(f);
+        limit_file_size(length + 1500);
+        J::sequence_type seq = 0;
+        for ( unsigned i = 5 ; i < 10 ; ++i ) seq = j.insert(make(i, big));
+        bool threw = false;
+        try {
+            j.sync(seq);
+        } catch (std::exception const&) {
+            threw = true;
+        }
+        limit_file_size(0);
+        if (!threw) errors += fail("sync did not fail at the file size limit");
+        j.sync(j.insert(make(10, "b")));
+    }
+    L l;
+    flowspace::replay_result r = flowspace::replay(PATH, l);
+    if (!r.complete) errors += fail("journal is not complete after a failed sync");
+    if (r.inserted != 11 || count(l) != 11) errors += fail("records were lost after a failed sync");
+    return errors;
+}
+
+// A record larger than replay accepts is refused, and later records replay.
+static int test_large_record() {
+    int errors = 0;
+    std::remove(PATH);
+    {
+        J j(PATH);
+        j.insert(make(1, "a"));
+        bool threw = false;
+        try {
+            j.insert(make(2, std::string(flowspace::imp::JOURNAL_MAX_RECORD, 'x')));
+        } catch (std::length_error const&) {
+            threw = true;
+        }
+        if (!threw) errors += fail("a record too large to replay was appended");
+        J::sequence_type seq = j.insert(make(3, "b"));
+        if (seq != 2) errors += fail("a refused record used a sequence number");
+        j.sync(seq);
+    }
+    L l;
+    flowspace::replay_result r = flowspace::replay(PATH, l);
+    if (!r.complete || r.inserted != 2) errors += fail("records after a refused record did not replay");
+    return errors;
+}
+
+// Payloads of @a l in iteration order.
+static std::string payloads(L& l) {
+    std::string zret;
+    for ( L::iterator spot = l.begin() ; spot != l.end() ; ++spot ) zret += "[" + spot->second + "]";
+    return zret;
+}
+
+/*  Apply the same updates to a live layer and through the journal, in one
+    batch and across batches, and check the iteration order matches.
+ */
+static int test_replay_order(std::size_t extra) {
+    int errors = 0;
+    // The live result is [][][x], and erasing any other x changes the order.
+    char const* ops[] = { "+x", "+", "+x", "-x", "+", "+x", "-x" };
+    std::size_t const N = sizeof(ops) / sizeof(*ops);
+    // Number of updates replayed in a batch before the rest, so that an
+    // erase matches elements inserted in the same batch or before it.
+    std::size_t const splits[] = { N, 4 };
+    for ( std::size_t k = 0 ; k < sizeof(splits) / sizeof(*splits) ; ++k ) {
+        std::size_t split = splits[k];
+        std::remove(PATH);
+        L live;
+        {
+            J j(PATH);
+            // Other elements in the bottom layer, so that it is either in the small form or a tree.
+            for ( std::size_t i = 0 ; i < extra ; ++i ) {
+                L::value_type v(L::key_type(ip4_range(ip4_addr(1), ip4_addr(1)), ip_port_range(100 + i, 100 + i)), "z");
+                j.insert(v);
+                live.insert(v);
+            }
+            for ( std::size_t i = 0 ; i < N ; ++i ) {
+                L::value_type v = make(1, ops[i] + 1);
+                if ('+' == ops[i][0]) {
+                    j.insert(v);
+                    live.insert(v);
+                } else {
+                    j.erase(v);
+                    live.erase(live.find(v));
+                }
+            }
+        }
+        // Replay the journal split in to two, by truncating a copy of the data.
+        std::vector<unsigned char> data;
+        std::FILE* f = std::fopen(PATH, "rb");
+        for ( int c ; EOF != (c = std::fgetc(f)) ; ) data.push_back(static_cast<unsigned char>(c));
+        std::fclose(f);
+        std::size_t offset = flowspace::imp::JOURNAL_HEADER_SIZE;
+        for ( std::size_t i = 0 ; i < extra + split ; ++i )
+            offset += flowspace::imp::JOURNAL_FRAME_SIZE + static_cast<std::size_t>(flowspace::imp::load_be(&data[offset], 4));
+        L l;
+        std::vector<unsigned char> first(data.begin(), data.begin() + offset);
+        std::vector<unsigned char> rest(data.begin(), data.begin() + flowspace::imp::JOURNAL_HEADER_SIZE);
+        rest.insert(rest.end(), data.begin() + offset, data.end());
+        flowspace::replay(&first[0], first.size(), l);
+        flowspace::replay(&rest[0], rest.size(), l);
+        if (payloads(l) != payloads(live)) {
+            std::cerr << "replay order " << payloads(l) << " expected " << payloads(live) << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+// Append and commit @a n records for addresses from @a base, saving their sequence numbers.
+static void append(J* j, unsigned base, unsigned n, std::vector<J::sequence_type>* seqs) {
+    for ( unsigned i = 0 ; i < n ; ++i ) {
+        J::sequence_type seq = j->insert(make(base + i, "c"));
+        (*seqs)[i] = seq;
+        j->sync(seq);
+    }
+}
+
+/*  Clear while other threads commit, then check that the records after the
+    last checkpoint, and only those, replay.
+ */
+static int test_concurrent_clear() {
+    int errors = 0;
+    unsigned const THREADS = 4;
+    unsigned const N = 2000;
+    std::vector<std::vector<J::sequence_type> > seqs(THREADS, std::vector<J::sequence_type>(N));
+    J::sequence_type checkpoint = 0;
+    std::remove(PATH);
+    {
+        J j(PATH);
+        boost::thread_group threads;
+        for ( unsigned t = 0 ; t < THREADS ; ++t )
+            threads.create_thread(boost::bind(&append, &j, t * N, N, &seqs[t]));
+        for ( unsigned i = 0 ; i < 200 ; ++i ) {
+            checkpoint = j.clear();
+            boost::this_thread::yield();
+        }
+        threads.join_all();
+    }
+    std::size_t expected = 0;
+    for ( unsigned t = 0 ; t < THREADS ; ++t )
+        for ( unsigned i = 0 ; i < N ; ++i ) expected += seqs[t][i] > checkpoint;
+    L l;
+    flowspace::replay_result r = flowspace::replay(PATH, l);
+    if (!r.complete) errors += fail("journal is not complete after a concurrent clear");
+    if (r.inserted != expected) {
+        std::cerr << "replayed " << r.inserted << " records after a concurrent clear, expected " << expected << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main() {
+    int errors = 0;
+    std::signal(SIGXFSZ, SIG_IGN);
+    errors += test_failed_sync();
+    errors += test_large_record();
+    errors += test_replay_order(0);
+    errors += test_replay_order(NG_FLOWSPACE_SMALL_LAYER + 1);
+    errors += test_concurrent_clear();
+    std::remove(PATH);
+    return errors ? 1 : 0;
+}
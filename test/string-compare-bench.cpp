@@ -0,0 +1,112 @@
+/* Copyright 2005-2014 Network Geographics
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*  Microbenchmark for the case insensitive string compare and hash.
+
+    @c string_iless and @c ihash in the classic locale are timed against the
+    character at a time loops they replaced, for names of several lengths
+    that differ only in case, so every compare reads the whole name. The
+    results of each pair are checked to be the same, and the program fails
+    if they are not. Build it again with -DNG_NO_SIMD to time the byte loop
+    in the kernels.
+
+    Build with optimization, e.g.
+        g++ -O2 -I include test/string-compare-bench.cpp -o string-compare-bench
+ */
+
+# include <ctime>
+# include <cctype>
+# include <cstdlib>
+# include <vector>
+# include <iostream>
+# include <ngeo/string_util.hpp>
+
+using namespace ngeo::util;
+
+// Keeps the timed results live.
+static std::size_t volatile sink;
+
+// The locale based loop that string_iless used for every locale.
+static bool loop_iless(std::string const& left, std::string const& right, std::locale const& loc) {
+    std::string::const_iterator lspot(left.begin()), lx(left.end()), rspot(right.begin()), rx(right.end());
+    for ( ; lspot != lx && rspot != rx ; ++lspot , ++rspot ) {
+        char l = std::toupper<char>(*lspot, loc);
+        char r = std::toupper<char>(*rspot, loc);
+        if (l < r) return true;
+        else if (l > r) return false;
+    }
+    return lspot == lx && rspot != rx;
+}
+
+// The locale based loop that ihash used for every locale.
+static std::size_t loop_ihash(std::string const& x) {
+    std::size_t seed = 0;
+    std::locale locale;
+    for ( std::string::const_iterator spot = x.begin() ; spot != x.end() ; ++spot )
+        boost::hash_combine(seed, std::toupper(*spot, locale));
+    return seed;
+}
+
+// Nanoseconds per item for @a n items in @a ticks of the clock.
+static double ns(std::clock_t ticks, std::size_t n) {
+    return 1e9 * ticks / CLOCKS_PER_SEC / n;
+}
+
+int main() {
+    int errors = 0;
+    std::size_t const NAMES = 1000;
+    std::size_t const ROUNDS = 2000;
+    std::size_t const lengths[] = { 3, 10, 20, 40, 100 };
+    std::locale loc;
+    string_iless iless(loc);
+    ihash hash;
+
+    std::cout << "ns per call\nlength\tiless\tloop\tihash\tloop" << std::endl;
+    for ( std::size_t L = 0 ; L < sizeof(lengths) / sizeof(*lengths) ; ++L ) {
+        std::vector<std::string> lower, upper;
+        for ( std::size_t i = 0 ; i < NAMES ; ++i ) {
+            std::string s(lengths[L], 'a');
+            for ( std::size_t k = 0 ; k < s.length() ; ++k ) s[k] = 'a' + std::rand() % 26;
+            lower.push_back(s);
+            for ( std::size_t k = 0 ; k < s.length() ; ++k ) s[k] = std::toupper(s[k]);
+            upper.push_back(s);
+        }
+        // Last character differs, to make the order depend on it.
+        for ( std::size_t i = 0 ; i < NAMES ; i += 2 ) ++upper[i][lengths[L] - 1];
+
+        for ( std::size_t i = 0 ; i < NAMES ; ++i ) {
+            if (iless(lower[i], upper[i]) != loop_iless(lower[i], upper[i], loc)
+                || iless(upper[i], lower[i]) != loop_iless(upper[i], lower[i], loc)
+                || hash(lower[i]) != loop_ihash(lower[i])
+                || (i % 2 && hash(lower[i]) != hash(upper[i]))
+            ) {
+                std::cerr << "mismatch for \"" << lower[i] << "\" and \"" << upper[i] << '"' << std::endl;
+                ++errors;
+            }
+        }
+
+        std::size_t sum = 0;
+        std::clock_t t0 = std::clock();
+        for ( std::size_t r = 0 ; r < ROUNDS ; ++r )
+            for ( std::size_t i = 0 ; i < NAMES ; ++i ) sum += iless(lower[i], upper[i]);
+        std::clock_t t1 = std::clock();
+        for ( std::size_t r = 0 ; r < ROUNDS ; ++r )
+            for ( std::size_t i = 0 ; i < NAMES ; ++i ) sum += loop_iless(lower[i], upper[i], loc);
+        std::clock_t t2 = std::clock();
+        for ( std::size_t r = 0 ; r < ROUNDS ; ++r )
+            for ( std::size_t i = 0 ; i < NAMES ; ++i ) sum += hash(lower[i]);
+        std::clock_t t3 = std::clock();
+        for ( std::size_t r = 0 ; r < ROUNDS ; ++r )
+            for ( std::size_t i = 0 ; i < NAMES ; ++i ) sum += loop_ihash(lower[i]);
+        std::clock_t t4 = std::clock();
+
+        std::size_t n = NAMES * ROUNDS;
+        std::cout << lengths[L]
+                  << '\t' << ns(t1 - t0, n) << '\t' << ns(t2 - t1, n)
+                  << '\t' << ns(t3 - t2, n) << '\t' << ns(t4 - t3, n)
+                  << std::endl;
+        sink = sum;
+    }
+    return errors ? 1 : 0;
+}